@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <malloc.h>
+#include <getopt.h>
+#include "../server/parser.h"
+
+#define MAX_INPUT (64 * 1024)          /** Largest input read from a file or generated */
+#define DEFAULT_ITERATIONS 100000      /** Generated inputs per run unless `--iterations` says otherwise */
+#define MAX_MUTATIONS 8                /** Most mutations applied to one generated input */
+#define MULTI_KEY_SEEDS 3              /** Generated MSET, MGET and MDEL seeds */
+#define CRASH_FILE "crash-fuzz_parser" /** Where the input that failed a check is written */
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+/**
+ * @brief Returns the next number of a xorshift64* sequence.
+ */
+static uint64_t next_random()
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+/**
+ * @brief Returns a random number below `bound`, which must not be 0.
+ */
+static size_t random_below(size_t bound)
+{
+    return (size_t)(next_random() % bound);
+}
+
+/**
+ * @brief Reports a failed check, saves the input and aborts.
+ * @param what Description of the check.
+ * @param input The input that failed it.
+ * @param len Length of the input.
+ */
+static void fail(const char *what, const char *input, size_t len)
+{
+    fprintf(stderr, "fuzz_parser: %s (input of %zu bytes written to %s)\n", what, len, CRASH_FILE);
+
+    FILE *file = fopen(CRASH_FILE, "wb");
+    if (file)
+    {
+        fwrite(input, 1, len, file);
+        fclose(file);
+    }
+
+    abort();
+}
+
+/**
+ * @brief Checks that a slice is absent or lies within `[start, start + len)`.
+ */
+static bool slice_inside(Slice slice, const char *start, size_t len)
+{
+    if (!slice.data)
+        return slice.len == 0;
+
+    return slice.data >= start && slice.data <= start + len && slice.len <= (size_t)(start + len - slice.data);
+}
+
+/**
+ * @brief Checks a parsed command against the bytes it was parsed from.
+ *
+ * Arguments past COMMAND_MAX_ARGS must live in the overflow array, and
+ * that array must be large enough for all of them.
+ *
+ * @param cmd The command.
+ * @param start First byte the command may refer to.
+ * @param len Number of bytes it may refer to.
+ * @param input The whole input, for the report.
+ * @param input_len Length of the whole input.
+ */
+static void check_command(const Command *cmd, const char *start, size_t len, const char *input, size_t input_len)
+{
+    if (cmd->type < CMD_INVALID || cmd->type >= CMD_TYPE_COUNT)
+        fail("command type out of range", input, input_len);
+
+    if (!slice_inside(cmd->key, start, len))
+        fail("key outside of the input", input, input_len);
+
+    if (cmd->args == cmd->inline_args)
+    {
+        if (cmd->arg_count > COMMAND_MAX_ARGS)
+            fail("more inline arguments than COMMAND_MAX_ARGS", input, input_len);
+    }
+    else if (cmd->arg_count <= COMMAND_MAX_ARGS)
+    {
+        fail("overflow array used for arguments that fit inline", input, input_len);
+    }
+    else if (cmd->arg_count > malloc_usable_size(cmd->args) / sizeof(Slice))
+    {
+        fail("arguments past the end of the overflow array", input, input_len);
+    }
+
+    for (size_t i = 0; i < cmd->arg_count; i++)
+    {
+        if (!slice_inside(cmd->args[i], start, len))
+            fail("argument outside of the input", input, input_len);
+    }
+}
+
+/**
+ * @brief Runs both parsers over one input and checks their results.
+ *
+ * The input is copied to an allocation of exactly its size, so that a
+ * sanitizer catches every read past its end. The text parser sees it as
+ * one frame; the RESP parser takes as many pipelined requests from it as
+ * it can, and must report every shorter prefix of a request as incomplete.
+ *
+ * @param data The input bytes.
+ * @param size Number of bytes.
+ */
+static void fuzz_one(const uint8_t *data, size_t size)
+{
+    char *input = malloc(size ? size : 1);
+    if (!input)
+    {
+        perror("malloc input");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(input, data, size);
+
+    Command cmd;
+    parse_client_input(input, size, &cmd);
+    check_command(&cmd, input, size, input, size);
+
+    size_t offset = 0;
+    while (offset < size)
+    {
+        const char *request = input + offset;
+        size_t available = size - offset;
+        size_t consumed = SIZE_MAX;
+
+        if (parse_resp_command(request, available, &cmd, &consumed) != RESP_PARSE_OK)
+            break;
+
+        if (consumed == 0 || consumed > available)
+            fail("consumed outside of the input", input, size);
+
+        check_command(&cmd, request, consumed, input, size);
+
+        size_t cut = random_below(consumed);
+        size_t ignored;
+        if (parse_resp_command(request, cut, &cmd, &ignored) != RESP_PARSE_INCOMPLETE ||
+            parse_resp_command(request, consumed - 1, &cmd, &ignored) != RESP_PARSE_INCOMPLETE)
+            fail("prefix of a complete request not reported as incomplete", input, size);
+
+        offset += consumed;
+    }
+
+    free(input);
+}
+
+/**
+ * @brief libFuzzer entry point.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_one(data, size);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+
+/**
+ * @brief Valid requests the generated inputs are mutated from.
+ *
+ * The multi-key ones are built at startup with enough keys to push the
+ * arguments into the parser's overflow array and grow it more than once.
+ */
+static const char *const fixed_seeds[] = {
+    "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$5\r\nvalue\r\n",
+    "*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n",
+    "*5\r\n$3\r\nSET\r\n$1\r\nk\r\n$1\r\nv\r\n$4\r\nPXAT\r\n$13\r\n1700000000000\r\n",
+    "*3\r\n$6\r\nCONFIG\r\n$3\r\nGET\r\n$1\r\n*\r\n",
+    "*1\r\n$4\r\nPING\r\n*2\r\n$4\r\nINCR\r\n$1\r\nn\r\n",
+    "*0\r\n",
+    "*2\r\n$3\r\nGET\r\n$0\r\n\r\n",
+    "SET key value\r\n",
+    "GET key\n",
+    "MSET a 1 b 2 c 3 d 4 e 5 f 6 g 7\n",
+    "SCAN 0 MATCH k* COUNT 10\n",
+};
+
+static char *seeds[sizeof(fixed_seeds) / sizeof(fixed_seeds[0]) + MULTI_KEY_SEEDS];
+static size_t seed_lens[sizeof(seeds) / sizeof(seeds[0])];
+static size_t seed_count = 0;
+
+/**
+ * @brief Builds a multi-key RESP request with `keys` keys.
+ * @param name The command name.
+ * @param keys Number of keys.
+ * @param values Whether every key is followed by a value.
+ * @param len Receives the length of the request.
+ * @return The request.
+ */
+static char *multi_key_request(const char *name, size_t keys, bool values, size_t *len)
+{
+    size_t elements = 1 + keys * (values ? 2 : 1);
+    char *request = malloc(32 + elements * 32);
+    if (!request)
+    {
+        perror("malloc seed");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t used = sprintf(request, "*%zu\r\n$%zu\r\n%s\r\n", elements, strlen(name), name);
+    for (size_t i = 0; i < keys; i++)
+    {
+        char key[16];
+        int key_len = snprintf(key, sizeof(key), "k%zu", i);
+        used += sprintf(request + used, "$%d\r\n%s\r\n", key_len, key);
+        if (values)
+            used += sprintf(request + used, "$1\r\n%zu\r\n", i % 10);
+    }
+
+    *len = used;
+    return request;
+}
+
+/**
+ * @brief Fills the seed table.
+ */
+static void create_seeds()
+{
+    for (size_t i = 0; i < sizeof(fixed_seeds) / sizeof(fixed_seeds[0]); i++)
+    {
+        seeds[seed_count] = strdup(fixed_seeds[i]);
+        seed_lens[seed_count++] = strlen(fixed_seeds[i]);
+    }
+
+    seeds[seed_count] = multi_key_request("MSET", 150, true, &seed_lens[seed_count]);
+    seed_count++;
+    seeds[seed_count] = multi_key_request("MGET", COMMAND_MAX_ARGS + 1, false, &seed_lens[seed_count]);
+    seed_count++;
+    seeds[seed_count] = multi_key_request("MDEL", 600, false, &seed_lens[seed_count]);
+    seed_count++;
+}
+
+/**
+ * @brief Applies one random mutation to a buffer of `*len` bytes.
+ *
+ * Mutations flip bits, overwrite bytes with protocol characters, insert,
+ * delete or duplicate ranges, splice in another seed and truncate.
+ *
+ * @param buffer The bytes, with room for MAX_INPUT.
+ * @param len In: current length, out: new length.
+ */
+static void mutate(char *buffer, size_t *len)
+{
+    static const char interesting[] = "*$\r\n0123456789- ";
+
+    switch (random_below(7))
+    {
+    case 0:
+        if (*len > 0)
+            buffer[random_below(*len)] ^= (char)(1u << random_below(8));
+        break;
+
+    case 1:
+        if (*len > 0)
+            buffer[random_below(*len)] = interesting[random_below(sizeof(interesting) - 1)];
+        break;
+
+    case 2:
+    {
+        if (*len >= MAX_INPUT)
+            break;
+        size_t at = random_below(*len + 1);
+        memmove(buffer + at + 1, buffer + at, *len - at);
+        buffer[at] = (char)random_below(256);
+        (*len)++;
+        break;
+    }
+
+    case 3:
+    {
+        if (*len == 0)
+            break;
+        size_t at = random_below(*len);
+        size_t count = 1 + random_below(*len - at);
+        memmove(buffer + at, buffer + at + count, *len - at - count);
+        *len -= count;
+        break;
+    }
+
+    case 4:
+    {
+        if (*len == 0)
+            break;
+        size_t at = random_below(*len);
+        size_t count = 1 + random_below(*len - at);
+        if (*len + count > MAX_INPUT)
+            break;
+        memmove(buffer + at + count, buffer + at, *len - at);
+        memcpy(buffer + at + count, buffer + at, count);
+        *len += count;
+        break;
+    }
+
+    case 5:
+    {
+        size_t seed = random_below(seed_count);
+        size_t at = random_below(*len + 1);
+        size_t count = seed_lens[seed];
+        if (at + count > MAX_INPUT)
+            count = MAX_INPUT - at;
+        memcpy(buffer + at, seeds[seed], count);
+        if (at + count > *len)
+            *len = at + count;
+        break;
+    }
+
+    case 6:
+        if (*len > 0)
+            *len = random_below(*len);
+        break;
+    }
+}
+
+/**
+ * @brief Runs one input read from a file, or from stdin for `-`.
+ * @param path Path of the file.
+ * @return true if the file could be read.
+ */
+static bool run_file(const char *path)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+
+    static char buffer[MAX_INPUT];
+    size_t len = fread(buffer, 1, sizeof(buffer), file);
+    bool success = !ferror(file);
+    if (file != stdin)
+        fclose(file);
+
+    if (success)
+        fuzz_one((const uint8_t *)buffer, len);
+    else
+        perror(path);
+
+    return success;
+}
+
+/**
+ * @brief Prints command line usage.
+ */
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--iterations N] [--seed N] [FILE|-]...\n", program);
+    fprintf(stderr, "  Without files, runs N mutated requests (default %d) through both parsers.\n", DEFAULT_ITERATIONS);
+    fprintf(stderr, "  With files, runs each of them once, e.g. to reproduce a %s.\n", CRASH_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"iterations", required_argument, NULL, 'n'},
+        {"seed", required_argument, NULL, 's'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+
+    unsigned long long iterations = DEFAULT_ITERATIONS;
+    int option;
+
+    while ((option = getopt_long(argc, argv, "n:s:h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            iterations = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 10) | 1;
+            break;
+        default:
+            print_usage(argv[0]);
+            return option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (optind < argc)
+    {
+        bool success = true;
+        for (int i = optind; i < argc; i++)
+            success = run_file(argv[i]) && success;
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    create_seeds();
+
+    static char buffer[MAX_INPUT];
+    for (unsigned long long i = 0; i < iterations; i++)
+    {
+        size_t seed = random_below(seed_count);
+        size_t len = seed_lens[seed];
+        memcpy(buffer, seeds[seed], len);
+
+        size_t mutations = random_below(MAX_MUTATIONS + 1);
+        for (size_t m = 0; m < mutations; m++)
+            mutate(buffer, &len);
+
+        fuzz_one((const uint8_t *)buffer, len);
+    }
+
+    printf("fuzz_parser: %llu inputs, no failures\n", iterations);
+    return EXIT_SUCCESS;
+}
+
+#endif // LIBFUZZER
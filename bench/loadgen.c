@@ -0,0 +1,830 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MAX_REQUEST_OVERHEAD 64     /** Bytes of a request besides its value */
+#define READ_BUFFER_SIZE (64 * 1024) /** Per-connection reply buffer */
+#define MAX_EVENTS 256
+#define PRELOAD_BATCH 1000          /** SET commands pipelined per round trip while preloading */
+#define HIST_SUB_BUCKETS 16         /** Histogram buckets per power of two */
+#define HIST_MAX_EXPONENT 44        /** Latencies above 2^44 ns land in the last bucket */
+#define HIST_BUCKETS ((HIST_MAX_EXPONENT - 3) * HIST_SUB_BUCKETS)
+
+/**
+ * @brief How keys are picked from the keyspace.
+ */
+typedef enum
+{
+    DIST_UNIFORM, /**< Every key equally likely */
+    DIST_ZIPFIAN  /**< A few hot keys, YCSB-style skew */
+} KeyDistribution;
+
+/**
+ * @brief Command line settings.
+ */
+typedef struct
+{
+    const char *host;
+    const char *port;
+    int connections;           /** Total connections, spread over the threads */
+    int threads;               /** Event loop threads */
+    int pipeline;              /** Maximum requests in flight per connection */
+    double duration;           /** Measured seconds */
+    double warmup;             /** Seconds run before measuring */
+    double rate;               /** Requests per second in open-loop mode, 0 for closed loop */
+    uint64_t keys;             /** Size of the keyspace */
+    size_t value_size;         /** Bytes per SET value */
+    double get_ratio;          /** Fraction of requests that are GETs */
+    KeyDistribution distribution;
+    double zipf_theta;         /** Skew of the zipfian distribution */
+    bool preload;              /** SET every key before the run */
+    const char *output;        /** JSON output file, NULL for stdout */
+} LoadConfig;
+
+/**
+ * @brief Log-linear latency histogram in nanoseconds.
+ */
+typedef struct
+{
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    double sum;
+} Histogram;
+
+/**
+ * @brief One client connection of a load thread.
+ */
+typedef struct
+{
+    int fd;
+    char *out;          /** Requests not yet written */
+    size_t out_len;
+    size_t out_pos;
+    size_t out_cap;
+    char in[READ_BUFFER_SIZE]; /** Partial reply line */
+    size_t in_len;
+    uint64_t *inflight; /** Intended send times of outstanding requests, oldest first */
+    size_t head;
+    size_t count;
+    bool want_write;    /** EPOLLOUT is registered */
+} LoadConnection;
+
+/**
+ * @brief State of one load thread.
+ */
+typedef struct
+{
+    int id;
+    pthread_t thread;
+    LoadConnection *conns;
+    int conn_count;
+    int epoll_fd;
+    uint64_t rng;
+    uint64_t *backlog;  /** Open loop: arrivals waiting for a free pipeline slot */
+    size_t backlog_head;
+    size_t backlog_count;
+    size_t backlog_cap;
+    Histogram histogram;
+    uint64_t errors;
+    uint64_t unfinished; /** Measured requests still waiting for a reply at the end */
+} LoadThread;
+
+static LoadConfig config = {
+    .host = "127.0.0.1",
+    .port = "2318",
+    .connections = 50,
+    .threads = 1,
+    .pipeline = 1,
+    .duration = 10,
+    .warmup = 1,
+    .rate = 0,
+    .keys = 100000,
+    .value_size = 32,
+    .get_ratio = 0.9,
+    .distribution = DIST_UNIFORM,
+    .zipf_theta = 0.99,
+    .preload = true,
+    .output = NULL,
+};
+
+static char *value = NULL;
+static struct addrinfo *server_addr = NULL;
+static uint64_t start_ns, measure_ns, end_ns;
+static double zipf_zetan, zipf_eta, zipf_alpha, zipf_half_pow;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief xorshift64* generator, one state per thread.
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static inline double next_unit(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * @brief Precomputes the constants of the zipfian generator (Gray et al., as used by YCSB).
+ */
+static void initialize_zipf()
+{
+    double zeta2 = 0;
+    zipf_zetan = 0;
+
+    for (uint64_t i = 1; i <= config.keys; i++)
+    {
+        double term = 1.0 / pow((double)i, config.zipf_theta);
+        zipf_zetan += term;
+        if (i <= 2)
+            zeta2 += term;
+    }
+
+    zipf_alpha = 1.0 / (1.0 - config.zipf_theta);
+    zipf_eta = (1 - pow(2.0 / config.keys, 1 - config.zipf_theta)) / (1 - zeta2 / zipf_zetan);
+    zipf_half_pow = 1.0 + pow(0.5, config.zipf_theta);
+}
+
+/**
+ * @brief Picks the index of the next key; with zipfian keys, index 0 is the hottest.
+ */
+static uint64_t next_key(uint64_t *rng)
+{
+    if (config.distribution == DIST_UNIFORM)
+        return next_random(rng) % config.keys;
+
+    double u = next_unit(rng);
+    double uz = u * zipf_zetan;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < zipf_half_pow)
+        return 1;
+
+    uint64_t key = (uint64_t)(config.keys * pow(zipf_eta * u - zipf_eta + 1, zipf_alpha));
+    return key < config.keys ? key : config.keys - 1;
+}
+
+static inline size_t histogram_bucket(uint64_t ns)
+{
+    if (ns < HIST_SUB_BUCKETS)
+        return ns;
+
+    size_t exponent = 63 - __builtin_clzll(ns);
+    if (exponent >= HIST_MAX_EXPONENT)
+        return HIST_BUCKETS - 1;
+
+    return (exponent - 3) * HIST_SUB_BUCKETS + ((ns >> (exponent - 4)) & (HIST_SUB_BUCKETS - 1));
+}
+
+static inline uint64_t histogram_bucket_value(size_t bucket)
+{
+    if (bucket < HIST_SUB_BUCKETS)
+        return bucket;
+
+    size_t exponent = bucket / HIST_SUB_BUCKETS + 3;
+    uint64_t lower = (uint64_t)(HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS) << (exponent - 4);
+    return lower + ((uint64_t)1 << (exponent - 4)) - 1;
+}
+
+static void histogram_record(Histogram *histogram, uint64_t ns)
+{
+    histogram->counts[histogram_bucket(ns)]++;
+    histogram->total++;
+    histogram->sum += ns;
+    if (ns > histogram->max)
+        histogram->max = ns;
+}
+
+static double histogram_quantile_us(const Histogram *histogram, double quantile)
+{
+    uint64_t rank = (uint64_t)(quantile * histogram->total + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += histogram->counts[i];
+        if (seen >= rank)
+        {
+            uint64_t bound = histogram_bucket_value(i);
+            return (bound < histogram->max ? bound : histogram->max) / 1000.0;
+        }
+    }
+
+    return histogram->max / 1000.0;
+}
+
+/**
+ * @brief Opens a blocking TCP connection to the server.
+ */
+static int connect_server()
+{
+    int fd = socket(server_addr->ai_family, SOCK_STREAM, 0);
+    if (fd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    if (connect(fd, server_addr->ai_addr, server_addr->ai_addrlen) == -1)
+    {
+        perror("connect");
+        exit(EXIT_FAILURE);
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/**
+ * @brief Appends one request to the output buffer of a connection.
+ */
+static void queue_request(LoadThread *thread, LoadConnection *conn, uint64_t intended)
+{
+    uint64_t key = next_key(&thread->rng);
+    char *out = conn->out + conn->out_len;
+
+    if (next_unit(&thread->rng) < config.get_ratio)
+    {
+        conn->out_len += sprintf(out, "GET key:%llu\n", (unsigned long long)key);
+    }
+    else
+    {
+        int len = sprintf(out, "SET key:%llu ", (unsigned long long)key);
+        memcpy(out + len, value, config.value_size);
+        out[len + config.value_size] = '\n';
+        conn->out_len += len + config.value_size + 1;
+    }
+
+    conn->inflight[(conn->head + conn->count) % config.pipeline] = intended;
+    conn->count++;
+}
+
+/**
+ * @brief Writes queued requests until the socket is full, toggling EPOLLOUT as needed.
+ * @return false if the connection failed.
+ */
+static bool flush_connection(LoadThread *thread, LoadConnection *conn)
+{
+    while (conn->out_pos < conn->out_len)
+    {
+        ssize_t written = write(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos);
+        if (written > 0)
+        {
+            conn->out_pos += written;
+            continue;
+        }
+
+        if (written == -1 && errno == EINTR)
+            continue;
+
+        if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        return false;
+    }
+
+    if (conn->out_pos == conn->out_len)
+        conn->out_pos = conn->out_len = 0;
+
+    bool want_write = conn->out_len > 0;
+    if (want_write != conn->want_write)
+    {
+        struct epoll_event event = {.events = EPOLLIN | (want_write ? EPOLLOUT : 0), .data.ptr = conn};
+        epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        conn->want_write = want_write;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Fills the free pipeline slots of a connection.
+ *
+ * Closed loop: a new request is issued as soon as a slot frees up, stamped
+ * with the current time. Open loop: slots are fed from the backlog of
+ * scheduled arrivals, stamped with the time they were due, so queueing
+ * delay on the client side is counted (coordinated omission correction).
+ */
+static void dispatch(LoadThread *thread, LoadConnection *conn, uint64_t now)
+{
+    while (conn->count < (size_t)config.pipeline)
+    {
+        if (config.rate > 0)
+        {
+            if (thread->backlog_count == 0)
+                return;
+
+            uint64_t intended = thread->backlog[thread->backlog_head];
+            thread->backlog_head = (thread->backlog_head + 1) % thread->backlog_cap;
+            thread->backlog_count--;
+            queue_request(thread, conn, intended);
+        }
+        else
+        {
+            queue_request(thread, conn, now);
+        }
+    }
+}
+
+/**
+ * @brief Adds a scheduled arrival to the open-loop backlog.
+ */
+static void backlog_push(LoadThread *thread, uint64_t intended)
+{
+    if (thread->backlog_count == thread->backlog_cap)
+    {
+        size_t new_cap = thread->backlog_cap ? thread->backlog_cap * 2 : 1024;
+        uint64_t *new_backlog = malloc(new_cap * sizeof(uint64_t));
+        if (!new_backlog)
+        {
+            perror("malloc backlog");
+            exit(EXIT_FAILURE);
+        }
+
+        for (size_t i = 0; i < thread->backlog_count; i++)
+            new_backlog[i] = thread->backlog[(thread->backlog_head + i) % thread->backlog_cap];
+
+        free(thread->backlog);
+        thread->backlog = new_backlog;
+        thread->backlog_head = 0;
+        thread->backlog_cap = new_cap;
+    }
+
+    thread->backlog[(thread->backlog_head + thread->backlog_count) % thread->backlog_cap] = intended;
+    thread->backlog_count++;
+}
+
+/**
+ * @brief Returns true if a reply line is one of the server error codes.
+ */
+static bool is_error_reply(const char *line, size_t len)
+{
+    static const char *codes[] = {"FAILED", "MISSING_KEY", "MISSING_ARG", "INVALID_COMMAND", "TOO_MANY_ARGS"};
+
+    for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++)
+    {
+        if (len == strlen(codes[i]) && memcmp(line, codes[i], len) == 0)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reads replies, matching every line with the oldest outstanding request.
+ * @return false if the connection failed or was closed.
+ */
+static bool read_replies(LoadThread *thread, LoadConnection *conn)
+{
+    while (true)
+    {
+        ssize_t bytes = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+        if (bytes == 0)
+            return false;
+
+        if (bytes == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        uint64_t now = now_ns();
+        conn->in_len += bytes;
+
+        char *line = conn->in;
+        char *end = conn->in + conn->in_len;
+        char *newline;
+
+        while ((newline = memchr(line, '\n', end - line)) != NULL)
+        {
+            if (conn->count > 0)
+            {
+                uint64_t intended = conn->inflight[conn->head];
+                conn->head = (conn->head + 1) % config.pipeline;
+                conn->count--;
+
+                if (intended >= measure_ns && intended < end_ns)
+                {
+                    histogram_record(&thread->histogram, now - intended);
+                    if (is_error_reply(line, newline - line))
+                        thread->errors++;
+                }
+            }
+            line = newline + 1;
+        }
+
+        conn->in_len = end - line;
+        if (conn->in_len == sizeof(conn->in))
+            conn->in_len = 0; // A reply longer than the buffer; only its end matters
+
+        memmove(conn->in, line, conn->in_len);
+    }
+}
+
+/**
+ * @brief Records the measured requests that never got a reply, with their age at the end of the run.
+ *
+ * Dropping them would hide an overloaded server in open-loop mode, where
+ * the backlog keeps growing; their age is a lower bound of their latency.
+ */
+static void record_unfinished(LoadThread *thread)
+{
+    uint64_t now = now_ns();
+
+    for (size_t i = 0; i < thread->backlog_count; i++)
+    {
+        uint64_t intended = thread->backlog[(thread->backlog_head + i) % thread->backlog_cap];
+        if (intended >= measure_ns && intended < end_ns)
+        {
+            histogram_record(&thread->histogram, now - intended);
+            thread->unfinished++;
+        }
+    }
+
+    for (int c = 0; c < thread->conn_count; c++)
+    {
+        LoadConnection *conn = &thread->conns[c];
+
+        for (size_t i = 0; i < conn->count; i++)
+        {
+            uint64_t intended = conn->inflight[(conn->head + i) % config.pipeline];
+            if (intended >= measure_ns && intended < end_ns)
+            {
+                histogram_record(&thread->histogram, now - intended);
+                thread->unfinished++;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Runs the connections of one thread until the end of the measurement.
+ */
+static void *run_thread(void *arg)
+{
+    LoadThread *thread = arg;
+    struct epoll_event events[MAX_EVENTS];
+    uint64_t interval = config.rate > 0 ? (uint64_t)(1e9 * config.threads / config.rate) : 0;
+    uint64_t next_arrival = start_ns + (interval * thread->id) / config.threads;
+
+    while (true)
+    {
+        uint64_t now = now_ns();
+        if (now >= end_ns)
+            break;
+
+        if (interval)
+        {
+            for (; next_arrival <= now; next_arrival += interval)
+                backlog_push(thread, next_arrival);
+        }
+
+        for (int i = 0; i < thread->conn_count; i++)
+        {
+            LoadConnection *conn = &thread->conns[i];
+            dispatch(thread, conn, now);
+            if (conn->out_len > conn->out_pos && !conn->want_write && !flush_connection(thread, conn))
+            {
+                fprintf(stderr, "Connection lost\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        int timeout_ms = 100;
+        if (interval)
+        {
+            uint64_t wait = next_arrival > now ? next_arrival - now : 0;
+            timeout_ms = (int)((wait + 999999) / 1000000);
+        }
+
+        int nfds = epoll_wait(thread->epoll_fd, events, MAX_EVENTS, timeout_ms);
+        for (int i = 0; i < nfds; i++)
+        {
+            LoadConnection *conn = events[i].data.ptr;
+
+            if (((events[i].events & EPOLLOUT) && !flush_connection(thread, conn)) ||
+                ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !read_replies(thread, conn)))
+            {
+                fprintf(stderr, "Connection lost\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    record_unfinished(thread);
+    return NULL;
+}
+
+/**
+ * @brief Stores every key once so GETs hit.
+ */
+static void preload_keys()
+{
+    int fd = connect_server();
+    size_t request_size = config.value_size + MAX_REQUEST_OVERHEAD;
+    char *batch = malloc(PRELOAD_BATCH * request_size);
+    char reply[64 * 1024];
+
+    if (!batch)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (uint64_t key = 0; key < config.keys; key += PRELOAD_BATCH)
+    {
+        uint64_t count = config.keys - key < PRELOAD_BATCH ? config.keys - key : PRELOAD_BATCH;
+        size_t len = 0;
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+            len += sprintf(batch + len, "SET key:%llu ", (unsigned long long)(key + i));
+            memcpy(batch + len, value, config.value_size);
+            len += config.value_size;
+            batch[len++] = '\n';
+        }
+
+        for (size_t sent = 0; sent < len;)
+        {
+            ssize_t written = write(fd, batch + sent, len - sent);
+            if (written <= 0)
+            {
+                perror("preload write");
+                exit(EXIT_FAILURE);
+            }
+            sent += written;
+        }
+
+        for (uint64_t replies = 0; replies < count;)
+        {
+            ssize_t bytes = read(fd, reply, sizeof(reply));
+            if (bytes <= 0)
+            {
+                perror("preload read");
+                exit(EXIT_FAILURE);
+            }
+            for (ssize_t i = 0; i < bytes; i++)
+                replies += reply[i] == '\n';
+        }
+    }
+
+    free(batch);
+    close(fd);
+}
+
+/**
+ * @brief Opens the connections of a thread and registers them with its epoll instance.
+ */
+static void setup_thread(LoadThread *thread, int id)
+{
+    thread->id = id;
+    thread->rng = 0x9E3779B97F4A7C15ull * (id + 1);
+    thread->conn_count = config.connections / config.threads + (id < config.connections % config.threads);
+    thread->conns = calloc(thread->conn_count, sizeof(LoadConnection));
+    thread->epoll_fd = epoll_create1(0);
+
+    if (!thread->conns || thread->epoll_fd == -1)
+    {
+        perror("setup_thread");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < thread->conn_count; i++)
+    {
+        LoadConnection *conn = &thread->conns[i];
+        conn->fd = connect_server();
+        conn->out_cap = config.pipeline * (config.value_size + MAX_REQUEST_OVERHEAD);
+        conn->out = malloc(conn->out_cap);
+        conn->inflight = malloc(config.pipeline * sizeof(uint64_t));
+
+        if (!conn->out || !conn->inflight)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL, 0) | O_NONBLOCK);
+
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = conn};
+        if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) == -1)
+        {
+            perror("epoll_ctl");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --host HOST           Server address (default 127.0.0.1)\n"
+            "  --port PORT           Server port (default 2318)\n"
+            "  --connections N       Client connections (default 50)\n"
+            "  --threads N           Load generator threads (default 1)\n"
+            "  --pipeline N          Requests in flight per connection (default 1)\n"
+            "  --duration SECONDS    Measured run time (default 10)\n"
+            "  --warmup SECONDS      Unmeasured time before the run (default 1)\n"
+            "  --rate RPS            Open loop at a fixed arrival rate; 0 = closed loop (default 0)\n"
+            "  --keys N              Keyspace size (default 100000)\n"
+            "  --value-size BYTES    SET value size (default 32)\n"
+            "  --get-ratio R         Fraction of GETs (default 0.9)\n"
+            "  --distribution D      uniform or zipfian (default uniform)\n"
+            "  --zipf-theta T        Zipfian skew (default 0.99)\n"
+            "  --no-preload          Do not SET every key before the run\n"
+            "  --output FILE         Write the JSON result to FILE instead of stdout\n",
+            program);
+}
+
+static void parse_options(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"host", required_argument, NULL, 'H'},
+        {"port", required_argument, NULL, 'p'},
+        {"connections", required_argument, NULL, 'c'},
+        {"threads", required_argument, NULL, 't'},
+        {"pipeline", required_argument, NULL, 'P'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"rate", required_argument, NULL, 'r'},
+        {"keys", required_argument, NULL, 'k'},
+        {"value-size", required_argument, NULL, 'v'},
+        {"get-ratio", required_argument, NULL, 'g'},
+        {"distribution", required_argument, NULL, 'D'},
+        {"zipf-theta", required_argument, NULL, 'z'},
+        {"no-preload", no_argument, NULL, 'n'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    int option;
+    while ((option = getopt_long(argc, argv, "H:p:c:t:P:d:w:r:k:v:g:D:z:no:h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'H': config.host = optarg; break;
+        case 'p': config.port = optarg; break;
+        case 'c': config.connections = atoi(optarg); break;
+        case 't': config.threads = atoi(optarg); break;
+        case 'P': config.pipeline = atoi(optarg); break;
+        case 'd': config.duration = atof(optarg); break;
+        case 'w': config.warmup = atof(optarg); break;
+        case 'r': config.rate = atof(optarg); break;
+        case 'k': config.keys = strtoull(optarg, NULL, 10); break;
+        case 'v': config.value_size = strtoull(optarg, NULL, 10); break;
+        case 'g': config.get_ratio = atof(optarg); break;
+        case 'z': config.zipf_theta = atof(optarg); break;
+        case 'n': config.preload = false; break;
+        case 'o': config.output = optarg; break;
+        case 'D':
+            if (strcmp(optarg, "uniform") == 0)
+                config.distribution = DIST_UNIFORM;
+            else if (strcmp(optarg, "zipfian") == 0)
+                config.distribution = DIST_ZIPFIAN;
+            else
+            {
+                print_usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (config.connections < 1 || config.threads < 1 || config.threads > config.connections ||
+        config.pipeline < 1 || config.duration <= 0 || config.warmup < 0 || config.rate < 0 ||
+        config.keys == 0 || config.get_ratio < 0 || config.get_ratio > 1 ||
+        config.zipf_theta <= 0 || config.zipf_theta == 1)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_options(argc, argv);
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    int status = getaddrinfo(config.host, config.port, &hints, &server_addr);
+    if (status != 0)
+    {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+        exit(EXIT_FAILURE);
+    }
+
+    value = malloc(config.value_size + 1);
+    if (!value)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(value, 'x', config.value_size);
+
+    if (config.distribution == DIST_ZIPFIAN)
+        initialize_zipf();
+
+    if (config.preload)
+        preload_keys();
+
+    LoadThread *threads = calloc(config.threads, sizeof(LoadThread));
+    if (!threads)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < config.threads; i++)
+        setup_thread(&threads[i], i);
+
+    start_ns = now_ns();
+    measure_ns = start_ns + (uint64_t)(config.warmup * 1e9);
+    end_ns = measure_ns + (uint64_t)(config.duration * 1e9);
+
+    for (int i = 0; i < config.threads; i++)
+    {
+        if (pthread_create(&threads[i].thread, NULL, run_thread, &threads[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    Histogram total = {0};
+    uint64_t errors = 0, unfinished = 0;
+
+    for (int i = 0; i < config.threads; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+
+        Histogram *histogram = &threads[i].histogram;
+        for (size_t b = 0; b < HIST_BUCKETS; b++)
+            total.counts[b] += histogram->counts[b];
+        total.total += histogram->total;
+        total.sum += histogram->sum;
+        if (histogram->max > total.max)
+            total.max = histogram->max;
+        errors += threads[i].errors;
+        unfinished += threads[i].unfinished;
+    }
+
+    FILE *output = config.output ? fopen(config.output, "w") : stdout;
+    if (!output)
+    {
+        perror(config.output);
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output,
+            "{\"mode\":\"%s\",\"target_rate\":%.0f,\"connections\":%d,\"threads\":%d,\"pipeline\":%d,"
+            "\"keys\":%llu,\"distribution\":\"%s\",\"zipf_theta\":%.2f,\"value_size\":%zu,\"get_ratio\":%.2f,"
+            "\"duration_s\":%.2f,\"requests\":%llu,\"unfinished\":%llu,\"errors\":%llu,\"throughput_rps\":%.0f,"
+            "\"latency_us\":{\"mean\":%.2f,\"p50\":%.2f,\"p90\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f}}\n",
+            config.rate > 0 ? "open" : "closed", config.rate, config.connections, config.threads, config.pipeline,
+            (unsigned long long)config.keys, config.distribution == DIST_ZIPFIAN ? "zipfian" : "uniform",
+            config.zipf_theta, config.value_size, config.get_ratio, config.duration,
+            (unsigned long long)(total.total - unfinished), (unsigned long long)unfinished,
+            (unsigned long long)errors, (total.total - unfinished) / config.duration,
+            total.total ? total.sum / total.total / 1000.0 : 0.0,
+            histogram_quantile_us(&total, 0.5), histogram_quantile_us(&total, 0.9),
+            histogram_quantile_us(&total, 0.99), histogram_quantile_us(&total, 0.999), total.max / 1000.0);
+
+    if (output != stdout)
+        fclose(output);
+
+    freeaddrinfo(server_addr);
+    return 0;
+}
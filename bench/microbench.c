@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <getopt.h>
+#include "../server/hash.h"
+#include "../server/hashmap.h"
+#include "../server/parser.h"
+#include "../server/connection.h"
+#include "../server/command_handler.h"
+
+#define DEFAULT_KEYS 1000000 /** Keys used by the hashmap benchmarks */
+#define DEFAULT_RUNS 5       /** Repetitions of every benchmark; the median is reported */
+#define KEY_SIZE 16          /** Buffer size of a generated key */
+#define VALUE_SIZE 32        /** Length of the benchmark values */
+
+/**
+ * @brief Inputs shared by all benchmarks.
+ */
+typedef struct
+{
+    size_t key_count;           /** Number of distinct keys */
+    char (*keys)[KEY_SIZE];     /** Generated keys */
+    size_t *key_lens;           /** Length of each key */
+    char value[VALUE_SIZE + 1]; /** Value stored under every key */
+    HashMap *map;               /** Map the benchmarks run against */
+    Connection *conn;           /** Fake client for `execute_command` */
+} BenchContext;
+
+/**
+ * @brief A benchmark body: performs `ops` operations and returns a value the compiler cannot drop.
+ */
+typedef uint64_t (*BenchFunction)(BenchContext *ctx, size_t ops);
+
+/**
+ * @brief A named benchmark with optional per-run setup.
+ */
+typedef struct
+{
+    const char *name;                 /** Name reported in the JSON output */
+    void (*setup)(BenchContext *ctx); /** Runs untimed before every repetition, may be NULL */
+    BenchFunction run;                /** The timed body */
+} Benchmark;
+
+static volatile uint64_t sink; /** Keeps benchmark results alive */
+
+/**
+ * @brief Returns the current monotonic time in nanoseconds.
+ */
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Replaces the map of the context with an empty one.
+ */
+static void reset_map(BenchContext *ctx)
+{
+    if (ctx->map)
+        free_hash_map(ctx->map);
+
+    ctx->map = create_hash_map(1024);
+    if (!ctx->map)
+    {
+        perror("create_hash_map");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Replaces the map of the context with one holding every key.
+ */
+static void fill_map(BenchContext *ctx)
+{
+    reset_map(ctx);
+
+    for (size_t i = 0; i < ctx->key_count; i++)
+        hash_map_set(ctx->map, ctx->keys[i], ctx->key_lens[i], ctx->value, VALUE_SIZE, 0);
+}
+
+static uint64_t bench_set_insert(BenchContext *ctx, size_t ops)
+{
+    uint64_t ok = 0;
+    for (size_t i = 0; i < ops; i++)
+        ok += hash_map_set(ctx->map, ctx->keys[i % ctx->key_count], ctx->key_lens[i % ctx->key_count], ctx->value, VALUE_SIZE, 0);
+    return ok;
+}
+
+static uint64_t bench_set_overwrite(BenchContext *ctx, size_t ops)
+{
+    return bench_set_insert(ctx, ops);
+}
+
+static uint64_t bench_get_hit(BenchContext *ctx, size_t ops)
+{
+    uint64_t total = 0;
+    size_t value_len;
+
+    // Stride through the keys so consecutive lookups do not share cache lines
+    for (size_t i = 0, k = 0; i < ops; i++, k = (k + 7919) % ctx->key_count)
+        total += hash_map_get(ctx->map, ctx->keys[k], ctx->key_lens[k], &value_len) != NULL;
+    return total;
+}
+
+static uint64_t bench_get_miss(BenchContext *ctx, size_t ops)
+{
+    uint64_t total = 0;
+    size_t value_len;
+    char key[KEY_SIZE];
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        int len = snprintf(key, sizeof(key), "miss:%09zu", i);
+        total += hash_map_get(ctx->map, key, len, &value_len) != NULL;
+    }
+    return total;
+}
+
+static uint64_t bench_remove(BenchContext *ctx, size_t ops)
+{
+    uint64_t removed = 0;
+    for (size_t i = 0; i < ops; i++)
+        removed += hash_map_remove(ctx->map, ctx->keys[i % ctx->key_count], ctx->key_lens[i % ctx->key_count]);
+    return removed;
+}
+
+static uint64_t bench_parse_text(BenchContext *ctx, size_t ops)
+{
+    (void)ctx;
+    static const char frame[] = "SET user:1000042 some-value-of-moderate-size";
+    uint64_t total = 0;
+    Command cmd;
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        parse_client_input(frame, sizeof(frame) - 1, &cmd);
+        total += cmd.key.len;
+    }
+    return total;
+}
+
+static uint64_t bench_parse_resp(BenchContext *ctx, size_t ops)
+{
+    (void)ctx;
+    static const char request[] = "*3\r\n$3\r\nSET\r\n$12\r\nuser:1000042\r\n$26\r\nsome-value-of-moderate-size\r\n";
+    uint64_t total = 0;
+    size_t consumed;
+    Command cmd;
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        parse_resp_command(request, sizeof(request) - 1, &cmd, &consumed);
+        total += consumed;
+    }
+    return total;
+}
+
+/**
+ * @brief Executes a command against the shared store and discards the queued reply.
+ */
+static uint64_t run_execute(BenchContext *ctx, CommandType type, size_t ops)
+{
+    uint64_t total = 0;
+    Command cmd = {0};
+
+    cmd.type = type;
+    cmd.args = cmd.inline_args;
+    cmd.arg_count = type == CMD_SET ? 1 : 0;
+    cmd.args[0].data = ctx->value;
+    cmd.args[0].len = VALUE_SIZE;
+
+    for (size_t i = 0; i < ops; i++)
+    {
+        size_t k = i % ctx->key_count;
+        cmd.key.data = ctx->keys[k];
+        cmd.key.len = ctx->key_lens[k];
+
+        execute_command(&cmd, ctx->conn);
+        total += ctx->conn->out_bytes;
+        connection_output_rewind(ctx->conn, 0);
+    }
+    return total;
+}
+
+static uint64_t bench_execute_set(BenchContext *ctx, size_t ops)
+{
+    return run_execute(ctx, CMD_SET, ops);
+}
+
+static uint64_t bench_execute_get(BenchContext *ctx, size_t ops)
+{
+    return run_execute(ctx, CMD_GET, ops);
+}
+
+static const Benchmark benchmarks[] = {
+    {"hash_map_set_insert", reset_map, bench_set_insert},
+    {"hash_map_set_overwrite", fill_map, bench_set_overwrite},
+    {"hash_map_get_hit", fill_map, bench_get_hit},
+    {"hash_map_get_miss", fill_map, bench_get_miss},
+    {"hash_map_remove", fill_map, bench_remove},
+    {"parse_client_input", NULL, bench_parse_text},
+    {"parse_resp_command", NULL, bench_parse_resp},
+    {"execute_command_set", NULL, bench_execute_set},
+    {"execute_command_get", NULL, bench_execute_get},
+};
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--keys N] [--runs N] [--filter SUBSTRING] [--output FILE]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"keys", required_argument, NULL, 'k'},
+        {"runs", required_argument, NULL, 'r'},
+        {"filter", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    BenchContext ctx = {0};
+    size_t runs = DEFAULT_RUNS;
+    const char *filter = NULL;
+    FILE *output = stdout;
+    int option;
+
+    ctx.key_count = DEFAULT_KEYS;
+
+    while ((option = getopt_long(argc, argv, "k:r:f:o:h", long_options, NULL)) != -1)
+    {
+        switch (option)
+        {
+        case 'k':
+            ctx.key_count = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if (!output)
+            {
+                perror(optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (ctx.key_count == 0 || runs == 0)
+    {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    initialize_hash_seed();
+    initialize_command_handler(8);
+
+    ctx.keys = malloc(ctx.key_count * KEY_SIZE);
+    ctx.key_lens = malloc(ctx.key_count * sizeof(size_t));
+    ctx.conn = create_connection(-1);
+    if (!ctx.keys || !ctx.key_lens || !ctx.conn)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    ctx.conn->protocol = PROTOCOL_TEXT;
+    memset(ctx.value, 'v', VALUE_SIZE);
+    for (size_t i = 0; i < ctx.key_count; i++)
+        ctx.key_lens[i] = snprintf(ctx.keys[i], KEY_SIZE, "key:%010zu", i);
+
+    uint64_t *samples = malloc(runs * sizeof(uint64_t));
+    if (!samples)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(output, "{\"keys\":%zu,\"runs\":%zu,\"benchmarks\":[", ctx.key_count, runs);
+    bool first = true;
+
+    for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++)
+    {
+        const Benchmark *bench = &benchmarks[b];
+        if (filter && !strstr(bench->name, filter))
+            continue;
+
+        for (size_t r = 0; r < runs; r++)
+        {
+            if (bench->setup)
+                bench->setup(&ctx);
+
+            uint64_t start = now_ns();
+            sink += bench->run(&ctx, ctx.key_count);
+            samples[r] = now_ns() - start;
+        }
+
+        qsort(samples, runs, sizeof(uint64_t), compare_u64);
+        double median_ns = (double)samples[runs / 2] / ctx.key_count;
+        double min_ns = (double)samples[0] / ctx.key_count;
+
+        fprintf(output, "%s\n  {\"name\":\"%s\",\"ops\":%zu,\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,\"ops_per_sec\":%.0f}",
+                first ? "" : ",", bench->name, ctx.key_count, median_ns, min_ns, 1e9 / median_ns);
+        fflush(output);
+        first = false;
+    }
+
+    fprintf(output, "\n]}\n");
+
+    if (output != stdout)
+        fclose(output);
+
+    free(samples);
+    free_connection(ctx.conn);
+    free_hash_map(ctx.map);
+    free(ctx.keys);
+    free(ctx.key_lens);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Runs the micro-benchmarks and a closed-loop and an open-loop network load
+# against a freshly started server. Every result is written as JSON to out/bench.
+#
+# Tunables (environment):
+#   BENCH_WORKERS      server worker threads (default 1)
+#   BENCH_DURATION     seconds per network run (default 10)
+#   BENCH_CONNECTIONS  client connections (default 50)
+#   BENCH_PIPELINE     requests in flight per connection, closed loop (default 16)
+#   BENCH_RATE         arrival rate of the open-loop run, requests/s (default 50000)
+#   BENCH_DISTRIBUTION uniform or zipfian (default zipfian)
+#   BENCH_VALUE_SIZE   SET value size in bytes (default 32)
+set -eu
+
+OUT=out/bench
+WORKERS=${BENCH_WORKERS:-1}
+DURATION=${BENCH_DURATION:-10}
+CONNECTIONS=${BENCH_CONNECTIONS:-50}
+PIPELINE=${BENCH_PIPELINE:-16}
+RATE=${BENCH_RATE:-50000}
+DISTRIBUTION=${BENCH_DISTRIBUTION:-zipfian}
+VALUE_SIZE=${BENCH_VALUE_SIZE:-32}
+
+mkdir -p "$OUT"
+
+echo "Running micro-benchmarks..."
+./out/bench/microbench --output "$OUT/micro.json"
+
+./out/cepollion --workers "$WORKERS" > "$OUT/server.log" 2>&1 &
+SERVER_PID=$!
+trap 'kill "$SERVER_PID" 2>/dev/null || true' EXIT INT TERM
+sleep 1
+
+COMMON="--connections $CONNECTIONS --duration $DURATION --distribution $DISTRIBUTION --value-size $VALUE_SIZE"
+
+echo "Running closed-loop load..."
+./out/bench/loadgen $COMMON --pipeline "$PIPELINE" --output "$OUT/closed.json"
+
+echo "Running open-loop load at $RATE requests/s..."
+./out/bench/loadgen $COMMON --no-preload --rate "$RATE" --output "$OUT/open.json"
+
+cat "$OUT/micro.json" "$OUT/closed.json" "$OUT/open.json"
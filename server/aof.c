@@ -0,0 +1,915 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "parser.h"
+#include "store.h"
+#include "logger.h"
+#include "utils.h"
+#include "replication.h"
+#include "aof.h"
+
+#define AOF_REWRITE_MIN_SIZE (64ull * 1024 * 1024) /** Size below which the file is never rewritten on its own */
+#define AOF_REWRITE_GROWTH 2                       /** Factor by which the file grows before it is rewritten on its own */
+#define AOF_REWRITE_BUCKETS 256                    /** Buckets the rewrite visits per shard lock */
+#define AOF_REWRITE_CHUNK (1024 * 1024)            /** Size the rewrite buffers up to before writing */
+#define AOF_FSYNC_INTERVAL_NS 1000000000ll         /** Fsync period of the everysec policy */
+#define AOF_INITIAL_BUFFER 4096                    /** Initial size of a record buffer */
+
+/**
+ * @brief Growable buffer of encoded records.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} AofBuffer;
+
+static bool enabled = false;
+static char *aof_path = NULL;
+static AofFsyncPolicy fsync_policy = AOF_FSYNC_EVERYSEC;
+
+// Guarded by `lock`
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;                  /** Signals the writer thread that there is work */
+static AofBuffer pending;                    /** Records not handed to the writer thread yet */
+static AofBuffer rewrite_pending;            /** Records logged while a rewrite runs */
+static bool rewriting = false;
+static bool switch_pending = false;          /** A finished rewrite waits for the writer thread */
+static bool stopping = false;                /** The writer thread exits once everything pending is written */
+static int switch_fd = -1;                   /** The rewritten file */
+static AofBuffer switch_tail;                /** Records still to be appended to the rewritten file */
+static uint64_t switch_size = 0;             /** Bytes already in the rewritten file */
+static uint64_t file_size = 0;
+static uint64_t base_size = 0;
+static uint64_t write_count = 0;
+static uint64_t fsync_count = 0;
+static uint64_t rewrite_count = 0;
+static uint64_t logged_bytes = 0;            /** Bytes submitted since startup */
+static uint64_t durable_bytes = 0;           /** Submitted bytes known to be fsynced; stored by the writer thread, read atomically */
+static bool failed = false;                  /** A record was lost under appendfsync always; read atomically */
+static void (*durable_hook)(void) = NULL;    /** Called by the writer thread whenever `durable_bytes` advanced or `failed` was set */
+static __thread uint64_t thread_logged = 0;  /** Value of `logged_bytes` after the calling thread's last record */
+
+// Owned by the writer thread; `io_lock` is held while it does I/O
+static pthread_mutex_t io_lock = PTHREAD_MUTEX_INITIALIZER;
+static int aof_fd = -1;
+static AofBuffer batch;
+static bool dirty = false;                   /** Data was written but not fsynced */
+static struct timespec last_fsync;
+static pthread_t writer;                      /** Joined by `aof_flush` on shutdown */
+
+/**
+ * @brief Makes room for `extra` more bytes.
+ * @param buffer The buffer.
+ * @param extra Number of bytes about to be appended.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool buffer_reserve(AofBuffer *buffer, size_t extra)
+{
+    if (buffer->len + extra <= buffer->cap)
+        return true;
+
+    size_t cap = buffer->cap ? buffer->cap : AOF_INITIAL_BUFFER;
+    while (cap < buffer->len + extra)
+        cap *= 2;
+
+    char *data = realloc(buffer->data, cap);
+    if (!data)
+        return false;
+
+    buffer->data = data;
+    buffer->cap = cap;
+    return true;
+}
+
+/**
+ * @brief Appends a RESP bulk string.
+ * @param buffer The buffer, with enough room reserved.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ */
+static void append_bulk(AofBuffer *buffer, const char *data, size_t len)
+{
+    buffer->len += sprintf(buffer->data + buffer->len, "$%zu\r\n", len);
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    buffer->data[buffer->len++] = '\r';
+    buffer->data[buffer->len++] = '\n';
+}
+
+/**
+ * @brief Encodes a SET record, with a PXAT option if the key expires.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool encode_set(AofBuffer *buffer, const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at)
+{
+    char deadline[24];
+    int deadline_len = snprintf(deadline, sizeof(deadline), "%llu", (unsigned long long)expire_at);
+
+    // Array and bulk headers take at most 24 bytes each
+    if (!buffer_reserve(buffer, key_len + value_len + deadline_len + 5 * 24 + 16))
+        return false;
+
+    buffer->len += sprintf(buffer->data + buffer->len, "*%d\r\n", expire_at ? 5 : 3);
+    append_bulk(buffer, "SET", 3);
+    append_bulk(buffer, key, key_len);
+    append_bulk(buffer, value, value_len);
+
+    if (expire_at)
+    {
+        append_bulk(buffer, "PXAT", 4);
+        append_bulk(buffer, deadline, deadline_len);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Encodes a DEL record.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool encode_remove(AofBuffer *buffer, const char *key, size_t key_len)
+{
+    if (!buffer_reserve(buffer, key_len + 3 * 24))
+        return false;
+
+    buffer->len += sprintf(buffer->data + buffer->len, "*2\r\n");
+    append_bulk(buffer, "DEL", 3);
+    append_bulk(buffer, key, key_len);
+    return true;
+}
+
+/**
+ * @brief Returns whether the server logs to an append-only file.
+ * @return True once logging started.
+ */
+bool aof_enabled(void)
+{
+    return enabled;
+}
+
+/**
+ * @brief Returns whether mutations have to be logged.
+ * @return True if they go to the file or to replicas.
+ */
+bool aof_logging(void)
+{
+    return enabled || replication_active();
+}
+
+/**
+ * @brief Hands an encoded record to the writer thread.
+ *
+ * Copies it to the rewrite buffer as well while a rewrite runs.
+ *
+ * @param data The record.
+ * @param len Length of the record.
+ */
+static void submit(const char *data, size_t len)
+{
+    pthread_mutex_lock(&lock);
+
+    if (buffer_reserve(&pending, len))
+    {
+        memcpy(pending.data + pending.len, data, len);
+        pending.len += len;
+    }
+    else
+    {
+        log_error("AOF: out of memory, dropping a record of %zu bytes", len);
+        if (fsync_policy == AOF_FSYNC_ALWAYS)
+            __atomic_store_n(&failed, true, __ATOMIC_RELEASE);
+    }
+
+    logged_bytes += len;
+    thread_logged = logged_bytes;
+
+    if (rewriting)
+    {
+        if (buffer_reserve(&rewrite_pending, len))
+        {
+            memcpy(rewrite_pending.data + rewrite_pending.len, data, len);
+            rewrite_pending.len += len;
+        }
+        else
+        {
+            log_error("AOF: out of memory, the rewritten file misses a record");
+        }
+    }
+
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Returns whether a record was lost under the always policy.
+ * @return True after a failed write or fsync, until the server restarts.
+ */
+bool aof_failed(void)
+{
+    return __atomic_load_n(&failed, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Returns the position just past the last record the calling thread logged.
+ * @return The position, 0 if it never logged to the file.
+ */
+uint64_t aof_logged_position(void)
+{
+    return thread_logged;
+}
+
+/**
+ * @brief Returns whether everything logged up to a position was fsynced.
+ * @param position A position returned by `aof_logged_position`.
+ * @return True once the writer thread synced past it.
+ */
+bool aof_durable(uint64_t position)
+{
+    return __atomic_load_n(&durable_bytes, __ATOMIC_ACQUIRE) >= position;
+}
+
+/**
+ * @brief Sets the function the writer thread calls after each fsync.
+ * @param hook The function.
+ */
+void aof_set_durable_hook(void (*hook)(void))
+{
+    durable_hook = hook;
+}
+
+/**
+ * @brief Publishes the outcome of a batch under the always policy and wakes the event loops.
+ * @param position Value of `logged_bytes` when the writer took its batch.
+ * @param lost Whether records of the batch did not reach the disk.
+ */
+static void publish_durable(uint64_t position, bool lost)
+{
+    // Replies only ever acknowledge what is on disk, so after a loss nothing counts as durable any more
+    if (lost && !aof_failed())
+    {
+        log_error("AOF: records lost under appendfsync always, refusing writes until restart");
+        __atomic_store_n(&failed, true, __ATOMIC_RELEASE);
+    }
+
+    if (!aof_failed())
+        __atomic_store_n(&durable_bytes, position, __ATOMIC_RELEASE);
+
+    if (durable_hook)
+        durable_hook();
+}
+
+/**
+ * @brief Passes an encoded record to the file and to the replication backlog.
+ * @param data The record.
+ * @param len Length of the record.
+ */
+void aof_log_record(const char *data, size_t len)
+{
+    if (enabled)
+        submit(data, len);
+
+    replication_feed(data, len);
+}
+
+/**
+ * @brief Logs that a key was set.
+ */
+void aof_log_set(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at)
+{
+    static __thread AofBuffer record;
+
+    record.len = 0;
+    if (!encode_set(&record, key, key_len, value, value_len, expire_at))
+    {
+        log_error("AOF: out of memory, dropping a record of %zu bytes", key_len + value_len);
+        return;
+    }
+
+    aof_log_record(record.data, record.len);
+}
+
+/**
+ * @brief Logs that a key was removed.
+ */
+void aof_log_remove(const char *key, size_t key_len)
+{
+    static __thread AofBuffer record;
+
+    record.len = 0;
+    if (!encode_remove(&record, key, key_len))
+    {
+        log_error("AOF: out of memory, dropping a record of %zu bytes", key_len);
+        return;
+    }
+
+    aof_log_record(record.data, record.len);
+}
+
+/**
+ * @brief Applies one replayed or replicated record to the store.
+ * @param cmd The parsed record.
+ * @param now The current Unix time in milliseconds.
+ * @return true if the record is a SET or DEL the server could have logged.
+ */
+bool aof_apply_record(Command *cmd, uint64_t now)
+{
+    if (!cmd->key.data || cmd->too_many_args)
+        return false;
+
+    StoreShard *shard = store_shard_for_key(cmd->key.data, cmd->key.len);
+
+    if (cmd->type == CMD_REMOVE && cmd->arg_count == 0)
+    {
+        pthread_mutex_lock(&shard->lock);
+        hash_map_remove(shard->map, cmd->key.data, cmd->key.len);
+        pthread_mutex_unlock(&shard->lock);
+        return true;
+    }
+
+    if (cmd->type != CMD_SET || (cmd->arg_count != 1 && cmd->arg_count != 3))
+        return false;
+
+    uint64_t expire_at = 0;
+    if (cmd->arg_count == 3)
+    {
+        char digits[24];
+        Slice option = cmd->args[1];
+        Slice deadline = cmd->args[2];
+
+        if (option.len != 4 || strncasecmp(option.data, "PXAT", 4) != 0 ||
+            deadline.len == 0 || deadline.len >= sizeof(digits))
+            return false;
+
+        memcpy(digits, deadline.data, deadline.len);
+        digits[deadline.len] = '\0';
+
+        char *end;
+        expire_at = strtoull(digits, &end, 10);
+        if (*end != '\0' || expire_at == 0)
+            return false;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+
+    // A key whose deadline passed while the server was down is gone
+    if (expire_at && expire_at <= now)
+        hash_map_remove(shard->map, cmd->key.data, cmd->key.len);
+    else if (!hash_map_set(shard->map, cmd->key.data, cmd->key.len, cmd->args[0].data, cmd->args[0].len, expire_at))
+        log_warn("Could not apply a record of key '%.*s'", (int)cmd->key.len, cmd->key.data);
+
+    pthread_mutex_unlock(&shard->lock);
+    return true;
+}
+
+/**
+ * @brief Maps the file and applies its records to the store.
+ * @param fd The open file.
+ * @return true on success, false if the file is damaged or unreadable.
+ */
+static bool replay(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat AOF");
+        return false;
+    }
+
+    file_size = st.st_size;
+    if (file_size == 0)
+        return true;
+
+    char *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap AOF");
+        return false;
+    }
+    madvise(data, file_size, MADV_SEQUENTIAL);
+
+    uint64_t now = current_time_ms();
+    size_t offset = 0;
+    size_t records = 0;
+    bool success = true;
+
+    while (offset < file_size)
+    {
+        Command cmd;
+        size_t consumed;
+        RespParseStatus status = parse_resp_command(data + offset, file_size - offset, &cmd, &consumed);
+
+        if (status == RESP_PARSE_INCOMPLETE)
+        {
+            log_warn("AOF: dropping an incomplete record of %zu bytes at the end of %s",
+                     (size_t)(file_size - offset), aof_path);
+            if (ftruncate(fd, offset) == -1)
+            {
+                perror("ftruncate AOF");
+                success = false;
+            }
+            file_size = offset;
+            break;
+        }
+
+        if (status == RESP_PARSE_ERROR || !aof_apply_record(&cmd, now))
+        {
+            log_error("AOF: invalid record at offset %zu of %s", offset, aof_path);
+            success = false;
+            break;
+        }
+
+        offset += consumed;
+        records++;
+    }
+
+    munmap(data, st.st_size);
+
+    if (success)
+        log_info("AOF: loaded %zu records from %s", records, aof_path);
+
+    return success;
+}
+
+/**
+ * @brief Returns the path of the temporary file a rewrite writes to.
+ * @return The path, or NULL on allocation failure; the caller frees it.
+ */
+static char *rewrite_path(void)
+{
+    size_t len = strlen(aof_path) + sizeof(".rewrite");
+    char *path = malloc(len);
+    if (path)
+        snprintf(path, len, "%s.rewrite", aof_path);
+    return path;
+}
+
+/**
+ * @brief Fsyncs the current file and counts it.
+ * @return False if the fsync failed.
+ */
+static bool sync_file(int fd)
+{
+    bool success = fdatasync(fd) == 0;
+    if (!success)
+        perror("fdatasync AOF");
+
+    clock_gettime(CLOCK_MONOTONIC, &last_fsync);
+    dirty = false;
+
+    pthread_mutex_lock(&lock);
+    fsync_count++;
+    pthread_mutex_unlock(&lock);
+
+    return success;
+}
+
+/**
+ * @brief Returns whether the everysec policy is due for an fsync.
+ */
+static bool fsync_due(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long elapsed = (now.tv_sec - last_fsync.tv_sec) * 1000000000ll + (now.tv_nsec - last_fsync.tv_nsec);
+    return elapsed >= AOF_FSYNC_INTERVAL_NS;
+}
+
+/**
+ * @brief Moves the writer thread over to a rewritten file.
+ *
+ * The records logged since the rewrite took its last share go to the new
+ * file, then the new file replaces the old one. Some of them may already be
+ * in the new file; replaying a record twice is harmless because every
+ * record carries the whole state of its key.
+ *
+ * @param fd The rewritten file.
+ * @param tail Records the rewrite did not write yet.
+ * @param size Bytes already in the rewritten file.
+ * @return true if the writer switched, false if it keeps the old file.
+ */
+static bool switch_file(int fd, AofBuffer *tail, uint64_t size)
+{
+    char *path = rewrite_path();
+    bool success = path && write_all(fd, tail->data, tail->len) && write_all(fd, batch.data, batch.len) &&
+                   fdatasync(fd) == 0 && rename(path, aof_path) == 0;
+
+    if (!success)
+    {
+        log_error("AOF: could not install the rewritten file: %s", strerror(errno));
+        if (path)
+            unlink(path);
+        close(fd);
+        free(path);
+        return false;
+    }
+
+    fsync_parent_directory(aof_path);
+    close(aof_fd);
+    aof_fd = fd;
+    clock_gettime(CLOCK_MONOTONIC, &last_fsync);
+    dirty = false;
+    free(path);
+
+    size += tail->len + batch.len;
+
+    pthread_mutex_lock(&lock);
+    file_size = size;
+    base_size = size;
+    rewrite_count++;
+    write_count++;
+    pthread_mutex_unlock(&lock);
+
+    log_info("AOF: rewrite finished, %s is now %llu bytes", aof_path, (unsigned long long)size);
+    return true;
+}
+
+/**
+ * @brief Main loop of the writer thread.
+ *
+ * Every round takes all records logged since the previous one, writes them
+ * with a single write and fsyncs according to the policy, so logging
+ * threads never wait on the disk.
+ */
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "aof");
+
+    for (;;)
+    {
+        pthread_mutex_lock(&lock);
+
+        while (pending.len == 0 && !switch_pending && !stopping)
+        {
+            if (fsync_policy == AOF_FSYNC_EVERYSEC && dirty)
+            {
+                struct timespec deadline = last_fsync;
+                deadline.tv_sec++;
+                if (pthread_cond_timedwait(&wake, &lock, &deadline) == ETIMEDOUT)
+                    break;
+            }
+            else
+            {
+                pthread_cond_wait(&wake, &lock);
+            }
+        }
+
+        if (stopping && pending.len == 0 && !switch_pending)
+        {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+
+        // Take the whole pending buffer, leaving the drained one for the next round
+        AofBuffer taken = pending;
+        pending = batch;
+        pending.len = 0;
+        batch = taken;
+        uint64_t batch_end = logged_bytes;
+
+        bool switching = switch_pending;
+        int new_fd = switch_fd;
+        AofBuffer tail = switch_tail;
+        uint64_t new_size = switch_size;
+        switch_pending = false;
+        switch_tail = (AofBuffer){0};
+
+        pthread_mutex_unlock(&lock);
+
+        pthread_mutex_lock(&io_lock);
+        bool lost = false;
+
+        if (switching && switch_file(new_fd, &tail, new_size))
+        {
+            batch.len = 0;
+        }
+
+        if (batch.len > 0)
+        {
+            if (write_all(aof_fd, batch.data, batch.len))
+            {
+                dirty = true;
+
+                pthread_mutex_lock(&lock);
+                file_size += batch.len;
+                write_count++;
+                pthread_mutex_unlock(&lock);
+            }
+            else
+            {
+                log_error("AOF: write failed, %zu bytes lost: %s", batch.len, strerror(errno));
+                lost = true;
+            }
+            batch.len = 0;
+        }
+
+        if (dirty && (fsync_policy == AOF_FSYNC_ALWAYS || (fsync_policy == AOF_FSYNC_EVERYSEC && fsync_due())))
+            lost = !sync_file(aof_fd) || lost;
+
+        pthread_mutex_unlock(&io_lock);
+        free(tail.data);
+
+        if (fsync_policy == AOF_FSYNC_ALWAYS)
+            publish_durable(batch_end, lost);
+
+        pthread_mutex_lock(&lock);
+        bool grown = !rewriting && !switch_pending && !stopping && file_size > AOF_REWRITE_MIN_SIZE &&
+                     file_size > base_size * AOF_REWRITE_GROWTH;
+        pthread_mutex_unlock(&lock);
+
+        if (grown)
+            aof_rewrite_async();
+    }
+
+    pthread_mutex_lock(&io_lock);
+    if (dirty)
+        sync_file(aof_fd);
+    pthread_mutex_unlock(&io_lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Opens and replays the file, then starts the writer thread.
+ * @param path Path of the file.
+ * @param policy When to fsync.
+ * @return true on success, false otherwise.
+ */
+bool initialize_aof(const char *path, AofFsyncPolicy policy)
+{
+    aof_path = strdup(path);
+    if (!aof_path)
+        return false;
+
+    fsync_policy = policy;
+
+    aof_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (aof_fd == -1)
+    {
+        perror("open AOF");
+        return false;
+    }
+
+    if (!replay(aof_fd))
+        return false;
+
+    base_size = file_size;
+    clock_gettime(CLOCK_MONOTONIC, &last_fsync);
+
+    // The everysec policy waits for deadlines on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&writer, NULL, writer_main, NULL) != 0)
+    {
+        perror("pthread_create AOF writer");
+        return false;
+    }
+
+    enabled = true;
+    return true;
+}
+
+/**
+ * @brief State of a keyspace walk encoding records.
+ */
+typedef struct
+{
+    AofBuffer chunk; /** Records not written yet */
+    bool failed;     /** True if the buffer could not grow */
+} StoreDump;
+
+/**
+ * @brief State of the file written by a rewrite.
+ */
+typedef struct
+{
+    int fd;           /** The temporary file */
+    AofBuffer logged; /** Records logged since the rewrite started, taken with each chunk */
+    uint64_t size;    /** Bytes written to the file */
+} RewriteFile;
+
+/**
+ * @brief Appends the record of one live key to the dump buffer.
+ * @return true while the buffer could grow.
+ */
+static bool dump_pair(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx)
+{
+    StoreDump *dump = ctx;
+
+    if (!encode_set(&dump->chunk, key, key_len, value, value_len, expire_at))
+    {
+        dump->failed = true;
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Takes the records logged since the rewrite last looked.
+ * @param into Receives them, replacing its content.
+ * @param finish True to also end the rewrite window, under the same lock.
+ */
+static void take_rewrite_pending(AofBuffer *into, bool finish)
+{
+    pthread_mutex_lock(&lock);
+
+    AofBuffer taken = rewrite_pending;
+    rewrite_pending = *into;
+    rewrite_pending.len = 0;
+    *into = taken;
+
+    if (finish)
+    {
+        rewriting = false;
+        free(rewrite_pending.data);
+        rewrite_pending = (AofBuffer){0};
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Encodes the whole keyspace as SET records and passes them on in chunks.
+ * @param write_chunk Receives each chunk; the last one may be empty.
+ * @param ctx Opaque pointer passed to `write_chunk`.
+ * @return true on success, false if a buffer could not grow or `write_chunk` failed.
+ */
+bool aof_dump_store(AofChunkWriter write_chunk, void *ctx)
+{
+    StoreDump dump = {0};
+    size_t cursor = 0;
+    bool success = true;
+
+    do
+    {
+        cursor = store_scan(cursor, AOF_REWRITE_BUCKETS, dump_pair, &dump);
+        if (dump.failed)
+        {
+            success = false;
+            break;
+        }
+
+        if (dump.chunk.len >= AOF_REWRITE_CHUNK || cursor == 0)
+        {
+            success = write_chunk(dump.chunk.data, dump.chunk.len, ctx);
+            dump.chunk.len = 0;
+        }
+    } while (success && cursor != 0);
+
+    free(dump.chunk.data);
+    return success;
+}
+
+/**
+ * @brief Writes a chunk of the keyspace to the rewritten file, followed by the records logged meanwhile.
+ * @return true on success, false if a write failed.
+ */
+static bool write_rewrite_chunk(const char *data, size_t len, void *ctx)
+{
+    RewriteFile *file = ctx;
+
+    take_rewrite_pending(&file->logged, false);
+    if (!write_all(file->fd, data, len) || !write_all(file->fd, file->logged.data, file->logged.len))
+        return false;
+
+    file->size += len + file->logged.len;
+    return true;
+}
+
+/**
+ * @brief Body of the rewrite thread.
+ *
+ * Writes the keyspace to a temporary file, catching up with the records
+ * logged meanwhile every time a chunk is written, and hands the file to the
+ * writer thread once it is complete.
+ */
+static void *rewrite_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "aof-rewrite");
+
+    char *path = rewrite_path();
+    RewriteFile file = {0};
+    file.fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644) : -1;
+    bool success = file.fd != -1 && aof_dump_store(write_rewrite_chunk, &file);
+
+    if (success)
+    {
+        // What is logged from here on goes to the writer thread together with the file
+        take_rewrite_pending(&file.logged, true);
+
+        pthread_mutex_lock(&lock);
+        switch_fd = file.fd;
+        switch_tail = file.logged;
+        switch_size = file.size;
+        switch_pending = true;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+
+        file.logged = (AofBuffer){0};
+    }
+    else
+    {
+        log_error("AOF: rewrite failed: %s", strerror(errno));
+        take_rewrite_pending(&file.logged, true);
+        if (file.fd != -1)
+            close(file.fd);
+        if (path)
+            unlink(path);
+    }
+
+    free(file.logged.data);
+    free(path);
+    return NULL;
+}
+
+/**
+ * @brief Starts a rewrite on a background thread.
+ * @return true if one was started.
+ */
+bool aof_rewrite_async(void)
+{
+    if (!enabled)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    if (rewriting || switch_pending)
+    {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    rewriting = true;
+    pthread_mutex_unlock(&lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, rewrite_main, NULL) != 0)
+    {
+        perror("pthread_create AOF rewrite");
+        pthread_mutex_lock(&lock);
+        rewriting = false;
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    pthread_detach(thread);
+
+    log_info("AOF: rewrite started");
+    return true;
+}
+
+/**
+ * @brief Reports the state of the file.
+ * @param stats Receives the figures.
+ */
+void aof_stats(AofStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->enabled = enabled;
+    stats->policy = fsync_policy;
+
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stats->size = file_size;
+    stats->base_size = base_size;
+    stats->pending_bytes = pending.len;
+    stats->writes = write_count;
+    stats->fsyncs = fsync_count;
+    stats->rewrites = rewrite_count;
+    stats->rewrite_in_progress = rewriting || switch_pending;
+    stats->failed = aof_failed();
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Writes out and fsyncs the buffered records on shutdown.
+ */
+void aof_flush(void)
+{
+    if (!enabled)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+
+    pthread_join(writer, NULL);
+}
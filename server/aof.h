@@ -0,0 +1,217 @@
+#ifndef AOF_H
+#define AOF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "parser.h"
+
+/**
+ * @brief When the append-only file is flushed to stable storage.
+ */
+typedef enum
+{
+    AOF_FSYNC_ALWAYS,   /**< After every batch the writer thread writes */
+    AOF_FSYNC_EVERYSEC, /**< At most once per second */
+    AOF_FSYNC_NO        /**< Never; the kernel decides when to write back */
+} AofFsyncPolicy;
+
+/**
+ * @brief Receives a chunk of records from `aof_dump_store`.
+ *
+ * @param data The records.
+ * @param len Number of bytes.
+ * @param ctx Opaque pointer passed to `aof_dump_store`.
+ * @return True to continue, false to stop the walk.
+ */
+typedef bool (*AofChunkWriter)(const char *data, size_t len, void *ctx);
+
+/**
+ * @brief Figures reported by INFO about the append-only file.
+ */
+typedef struct
+{
+    bool enabled;               /** Whether the server logs to an append-only file */
+    AofFsyncPolicy policy;      /** Fsync policy */
+    uint64_t size;              /** Bytes written to the current file */
+    uint64_t base_size;         /** Size of the file after the last rewrite or at startup */
+    size_t pending_bytes;       /** Bytes logged but not written yet */
+    uint64_t writes;            /** Batches written by the writer thread */
+    uint64_t fsyncs;            /** Fsyncs done by the writer thread */
+    uint64_t rewrites;          /** Completed rewrites */
+    bool rewrite_in_progress;   /** Whether a rewrite is running */
+    bool failed;                /** Whether a record was lost under the always policy; writes are refused */
+} AofStats;
+
+/**
+ * @brief Replays the append-only file into the store and starts logging to it.
+ *
+ * The file is created if it does not exist. It is mapped into memory and
+ * every record is applied to the store directly, so the store must be
+ * initialized and no worker may be running yet. A record cut short at the
+ * end of the file, as left by a crash in the middle of a write, is dropped
+ * and the file truncated to the last complete record; any other damage
+ * fails the startup.
+ *
+ * Afterwards a writer thread appends the logged records to the file. Event
+ * loops only ever copy records into a memory buffer; the writer thread
+ * writes out and fsyncs everything logged since its last write at once, so
+ * concurrent writers share a single fsync.
+ *
+ * @param path Path of the file.
+ * @param policy When the writer thread fsyncs.
+ * @return True on success, false if the file could not be read or opened.
+ */
+bool initialize_aof(const char *path, AofFsyncPolicy policy);
+
+/**
+ * @brief Returns whether the server logs to an append-only file.
+ *
+ * @return True once `initialize_aof` succeeded.
+ */
+bool aof_enabled(void);
+
+/**
+ * @brief Returns whether mutations have to be logged.
+ *
+ * Records go to the append-only file if there is one and to the
+ * replication backlog once a replica connected.
+ *
+ * @return True if the `aof_log_*` functions have somewhere to send records.
+ */
+bool aof_logging(void);
+
+/**
+ * @brief Logs that a key was set.
+ *
+ * Must be called while the shard of the key is locked, so that records of
+ * the same key are logged in the order they were applied.
+ *
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @param expire_at Unix time in milliseconds at which the key expires, or 0 for never.
+ */
+void aof_log_set(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at);
+
+/**
+ * @brief Logs that a key was removed.
+ *
+ * Must be called while the shard of the key is locked.
+ *
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ */
+void aof_log_remove(const char *key, size_t key_len);
+
+/**
+ * @brief Logs a record that is already encoded.
+ *
+ * Used by replicas to pass on what they received from their primary. The
+ * same ordering rule as for the other `aof_log_*` functions applies.
+ *
+ * @param data A complete SET or DEL record.
+ * @param len Length of the record.
+ */
+void aof_log_record(const char *data, size_t len);
+
+/**
+ * @brief Returns whether a record was lost under the always policy.
+ *
+ * Set when a write or fsync fails, or a record could not be buffered. From
+ * then on nothing counts as durable any more, so replies still held for an
+ * fsync are never sent: event loops close those clients instead, and writes
+ * are refused until the server is restarted.
+ *
+ * @return True once a record was lost.
+ */
+bool aof_failed(void);
+
+/**
+ * @brief Returns the position just past the last record the calling thread
+ * logged to the file.
+ *
+ * Positions count the bytes logged since startup and only grow.
+ *
+ * @return The position, or 0 if the thread never logged a record.
+ */
+uint64_t aof_logged_position(void);
+
+/**
+ * @brief Returns whether everything logged up to a position is on stable storage.
+ *
+ * Only advances under the always policy, and stops once `aof_failed`.
+ *
+ * @param position A position returned by `aof_logged_position`.
+ * @return True once the writer thread fsynced past it.
+ */
+bool aof_durable(uint64_t position);
+
+/**
+ * @brief Sets a function the writer thread calls after each fsync under the
+ * always policy, so event loops can send the replies they held.
+ *
+ * Must be called before `initialize_aof`. The function runs on the writer
+ * thread and must not log records.
+ *
+ * @param hook The function.
+ */
+void aof_set_durable_hook(void (*hook)(void));
+
+/**
+ * @brief Applies a SET or DEL record to the store.
+ *
+ * Takes the shard lock of the key. A SET whose PXAT deadline is already
+ * past removes the key instead.
+ *
+ * @param cmd The parsed record.
+ * @param now The current Unix time in milliseconds.
+ * @return True if the record is one the server could have logged.
+ */
+bool aof_apply_record(Command *cmd, uint64_t now);
+
+/**
+ * @brief Encodes every live key as a SET record, the way a rewrite writes them.
+ *
+ * The keyspace is walked a few buckets per shard lock; records are handed
+ * over in chunks of about a megabyte, outside of any lock. Keys written
+ * during the walk may or may not be included.
+ *
+ * @param write_chunk Receives each chunk; the last one may be empty.
+ * @param ctx Opaque pointer passed to `write_chunk`.
+ * @return True on success, false if memory ran out or `write_chunk` returned false.
+ */
+bool aof_dump_store(AofChunkWriter write_chunk, void *ctx);
+
+/**
+ * @brief Starts compacting the append-only file on a background thread.
+ *
+ * The rewrite walks the store a few buckets per shard lock and writes one
+ * record per live key to a temporary file. Mutations logged meanwhile are
+ * also kept aside and appended to it; the writer thread then switches to
+ * the new file and renames it over the old one. Rewrites also start on
+ * their own whenever the file has doubled since the last one.
+ *
+ * @return True if a rewrite was started, false if logging is disabled or a
+ *         rewrite is already running.
+ */
+bool aof_rewrite_async(void);
+
+/**
+ * @brief Reports the state of the append-only file.
+ *
+ * @param stats Receives the figures.
+ */
+void aof_stats(AofStats *stats);
+
+/**
+ * @brief Writes out and fsyncs whatever is still buffered.
+ *
+ * Called once on shutdown, after the workers stopped: the writer thread
+ * writes what is pending, fsyncs and exits, and the call waits for it.
+ * Records logged afterwards are not written.
+ */
+void aof_flush(void);
+
+#endif // AOF_H
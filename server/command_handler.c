@@ -1,8 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include "hash.h"
 #include "hashmap.h"
+#include "store.h"
 #include "utils.h"
+#include "stats.h"
+#include "aof.h"
+#include "snapshot.h"
+#include "epoch.h"
+#include "replication.h"
+#include "config.h"
 #include "command_handler.h"
 
 #define SUCCESS_RESP_MSG "OK"
@@ -10,134 +20,1791 @@
 #define INVALID_KEY "MISSING_KEY"
 #define INVALID_ARGS "MISSING_ARG"
 #define INVALID_CMD_MSG "INVALID_COMMAND"
+#define TOO_MANY_ARGS_MSG "TOO_MANY_ARGS"
+#define NO_PROTO_MSG "NOPROTO"
+#define INVALID_CURSOR_MSG "INVALID_CURSOR"
+#define SYNTAX_ERROR_MSG "SYNTAX_ERROR"
+#define INVALID_EXPIRE_MSG "INVALID_EXPIRE_TIME"
+#define AOF_DISABLED_MSG "AOF_DISABLED"
+#define REWRITE_RUNNING_MSG "REWRITE_IN_PROGRESS"
+#define SNAPSHOT_DISABLED_MSG "SNAPSHOT_DISABLED"
+#define SAVE_RUNNING_MSG "SAVE_IN_PROGRESS"
+#define NOT_INTEGER_MSG "NOT_AN_INTEGER"
+#define OVERFLOW_MSG "INCREMENT_OVERFLOW"
+#define READONLY_MSG "READONLY"
+#define AOF_FAILED_MSG "AOF_WRITE_FAILED"
+#define NOT_PRIMARY_MSG "NOT_A_PRIMARY"
+#define SYNC_PIPELINED_MSG "SYNC_AFTER_PENDING_REPLIES"
+#define UNKNOWN_SETTING_MSG "UNKNOWN_SETTING"
+#define INVALID_SETTING_MSG "INVALID_SETTING_VALUE"
+#define SETTING_RESTART_MSG "SETTING_NEEDS_RESTART"
+#define PARTIAL_WRITE_MSG "PARTIAL_WRITE"
 
-#define DEFAULT_HASHMAP_SIZE 1024 /** Default size for the hash map */
-#define RESP_BUFF_SIZE 256        /** Size of the response buffer */
+#define DEFAULT_HASHMAP_SIZE 1024 /** Default size for the hash map of each shard */
+#define RESP_BUFF_SIZE 256        /** Initial size of the buffer collecting a SCAN page or CONFIG GET pairs */
+#define GET_ALL_BUFF_SIZE 1024    /** Initial size of the GETALL response buffer */
+#define STREAM_CHUNK_SIZE (16 * 1024) /** Size a streamed GETALL chunk is filled up to */
+#define STREAM_SCAN_BUCKETS 64         /** Buckets visited per shard lock while streaming */
+#define SCAN_DEFAULT_COUNT 10          /** Keys returned by SCAN without COUNT */
+#define SCAN_MAX_BUCKETS 1024          /** Buckets SCAN visits per shard lock */
+#define SCAN_EMPTY_FACTOR 10           /** SCAN visits at most COUNT times this many buckets */
+#define MAX_EXPIRE_MS (1ull << 53)     /** Longest accepted time to live, in milliseconds */
+#define BATCH_PREFETCH_DISTANCE 16     /** Keys of a multi-key command whose buckets are prefetched ahead of the probe */
+#define BATCH_MIN_CAPACITY 64          /** Keys the per-thread batch arrays are first sized for */
+#define SERVER_NAME "cepollion"
 
-HashMap *map = NULL;
+/**
+ * @brief Growable buffer used to assemble a response.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} ResponseBuffer;
+
+/**
+ * @brief Initializes the command handler.
+ *
+ * This function ensures that the sharded keyspace is created before handling commands.
+ *
+ * @param shard_count Number of keyspace shards.
+ */
+void initialize_command_handler(size_t shard_count)
+{
+    static bool initialized = false;
+
+    if (!initialized)
+    {
+        if (!initialize_store(shard_count, DEFAULT_HASHMAP_SIZE))
+        {
+            log_error("Failed to allocate keyspace with %zu shards", shard_count);
+            exit(EXIT_FAILURE);
+        }
+        initialized = true;
+    }
+}
+
+/**
+ * @brief Makes room for `extra` more bytes plus a terminator.
+ * @param buffer Pointer to the ResponseBuffer.
+ * @param extra Number of bytes about to be appended.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool buffer_reserve(ResponseBuffer *buffer, size_t extra)
+{
+    if (buffer->len + extra < buffer->cap)
+        return true;
+
+    size_t new_cap = buffer->cap;
+    while (buffer->len + extra >= new_cap)
+        new_cap *= 2;
+
+    char *new_data = realloc(buffer->data, new_cap);
+    if (!new_data)
+        return false;
+
+    buffer->data = new_data;
+    buffer->cap = new_cap;
+    return true;
+}
+
+/**
+ * @brief Appends raw bytes to a response buffer.
+ * @param buffer Pointer to the ResponseBuffer.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool buffer_append_bytes(ResponseBuffer *buffer, const char *data, size_t len)
+{
+    if (!buffer_reserve(buffer, len))
+        return false;
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Appends formatted text to a response buffer, growing it as needed.
+ * @param buffer Pointer to the ResponseBuffer.
+ * @param format printf-style format string.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool buffer_append(ResponseBuffer *buffer, const char *format, ...)
+{
+    while (true)
+    {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer->data + buffer->len, buffer->cap - buffer->len, format, args);
+        va_end(args);
+
+        if (written < 0)
+            return false;
+
+        if (buffer->len + (size_t)written < buffer->cap)
+        {
+            buffer->len += written;
+            return true;
+        }
+
+        if (!buffer_reserve(buffer, written))
+            return false;
+    }
+}
+
+/**
+ * @brief Encodes a string as a quoted JSON string.
+ * @param out Destination with room for `len * 6 + 2` bytes, the worst case
+ *            where every byte becomes a \u00XX escape.
+ * @param data The string bytes.
+ * @param len Number of bytes.
+ * @return Number of bytes written.
+ */
+static size_t encode_json_string(char *out, const char *data, size_t len)
+{
+    char *start = out;
+    *out++ = '"';
+
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)data[i];
+
+        if (c == '"' || c == '\\')
+        {
+            *out++ = '\\';
+            *out++ = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            static const char hex[] = "0123456789abcdef";
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[c >> 4];
+            out[5] = hex[c & 0xf];
+            out += 6;
+        }
+        else
+        {
+            *out++ = (char)c;
+        }
+    }
+
+    *out++ = '"';
+    return out - start;
+}
+
+/**
+ * @brief Appends a string as a quoted JSON string.
+ * @param buffer Pointer to the ResponseBuffer.
+ * @param data The string bytes.
+ * @param len Number of bytes.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool buffer_append_json_string(ResponseBuffer *buffer, const char *data, size_t len)
+{
+    if (!buffer_reserve(buffer, len * 6 + 2))
+        return false;
+
+    buffer->len += encode_json_string(buffer->data + buffer->len, data, len);
+    buffer->data[buffer->len] = '\0';
+    return true;
+}
+
+/**
+ * @brief Appends formatted text to the output queue of a connection.
+ * @param conn The client connection.
+ * @param format printf-style format string.
+ * @return true on success, false if the output queue could not grow.
+ */
+static bool output_append(Connection *conn, const char *format, ...)
+{
+    size_t needed = 1;
+
+    while (true)
+    {
+        size_t room;
+        char *out = connection_output_reserve(conn, needed, &room);
+        if (!out)
+            return false;
+
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(out, room, format, args);
+        va_end(args);
+
+        if (written < 0)
+            return false;
+
+        // vsnprintf needs room for a terminator, which is not queued
+        if ((size_t)written < room)
+        {
+            connection_output_commit(conn, written);
+            return true;
+        }
+
+        needed = written + 1;
+    }
+}
+
+/**
+ * @brief Appends a string as a quoted JSON string to the output queue of a connection.
+ * @param conn The client connection.
+ * @param data The string bytes.
+ * @param len Number of bytes.
+ * @return true on success, false if the output queue could not grow.
+ */
+static bool output_append_json_string(Connection *conn, const char *data, size_t len)
+{
+    char *out = connection_output_reserve(conn, len * 6 + 2, NULL);
+    if (!out)
+        return false;
+
+    connection_output_commit(conn, encode_json_string(out, data, len));
+    return true;
+}
+
+/**
+ * @brief Appends a status reply (`OK`, `PONG`).
+ */
+static bool reply_status(Connection *conn, const char *status)
+{
+    if (conn->protocol == PROTOCOL_TEXT)
+        return output_append(conn, "%s\n", status);
+
+    return output_append(conn, "+%s\r\n", status);
+}
+
+/**
+ * @brief Appends an error reply.
+ */
+static bool reply_error(Connection *conn, const char *code)
+{
+    if (conn->protocol == PROTOCOL_TEXT)
+        return output_append(conn, "%s\n", code);
+
+    return output_append(conn, "-ERR %s\r\n", code);
+}
+
+/**
+ * @brief Appends a binary-safe string reply.
+ *
+ * The bytes are copied into the output queue right away, so a value may be
+ * passed while its shard is locked and released as soon as this returns.
+ */
+static bool reply_bulk(Connection *conn, const char *data, size_t len)
+{
+    if (conn->protocol == PROTOCOL_TEXT)
+        return connection_output_append(conn, data, len) && connection_output_append(conn, "\n", 1);
+
+    return output_append(conn, "$%zu\r\n", len) &&
+           connection_output_append(conn, data, len) &&
+           connection_output_append(conn, "\r\n", 2);
+}
+
+/**
+ * @brief Appends the reply for a missing value.
+ */
+static bool reply_null(Connection *conn)
+{
+    switch (conn->protocol)
+    {
+    case PROTOCOL_RESP2:
+        return connection_output_append(conn, "$-1\r\n", 5);
+    case PROTOCOL_RESP3:
+        return connection_output_append(conn, "_\r\n", 3);
+    default:
+        return connection_output_append(conn, "(nil)\n", 6);
+    }
+}
+
+/**
+ * @brief Appends an integer reply.
+ */
+static bool reply_integer(Connection *conn, long long value)
+{
+    if (conn->protocol == PROTOCOL_TEXT)
+        return output_append(conn, "%lld\n", value);
+
+    return output_append(conn, ":%lld\r\n", value);
+}
+
+/**
+ * @brief Appends a JSON document as a text line or a RESP bulk string.
+ * @param conn The client connection.
+ * @param json The JSON document built by one of the report builders.
+ * @return true on success, false on allocation failure.
+ */
+static bool reply_json(Connection *conn, ResponseBuffer *json)
+{
+    bool success = reply_bulk(conn, json->data, json->len);
+    free(json->data);
+    return success;
+}
+
+/**
+ * @brief Appends the reply to HELLO: a map in RESP3, a flat array otherwise.
+ */
+static bool reply_hello(Connection *conn)
+{
+    int version = conn->protocol == PROTOCOL_RESP3 ? 3 : 2;
+    const char *header = conn->protocol == PROTOCOL_RESP3 ? "%3\r\n" : "*6\r\n";
+
+    return output_append(conn, "%s$6\r\nserver\r\n$%zu\r\n%s\r\n$5\r\nproto\r\n:%d\r\n$4\r\nmode\r\n$10\r\nstandalone\r\n",
+                         header, strlen(SERVER_NAME), SERVER_NAME, version);
+}
+
+/**
+ * @brief Appends one `"key":"value",` entry to the GETALL response.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @param ctx Pointer to the ResponseBuffer being built.
+ * @return true to continue, false if the buffer could not grow.
+ */
+static bool append_json_entry(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx)
+{
+    ResponseBuffer *buffer = ctx;
+    (void)expire_at;
+
+    return buffer_append_json_string(buffer, key, key_len) &&
+           buffer_append_bytes(buffer, ":", 1) &&
+           buffer_append_json_string(buffer, value, value_len) &&
+           buffer_append_bytes(buffer, ",", 1);
+}
+
+/**
+ * @brief Builds the JSON object of every key-value pair, one shard at a time.
+ *
+ * Only used for RESP2 clients, whose bulk strings need their length up front;
+ * everyone else gets the streamed version.
+ *
+ * @param buffer Receives the JSON document; the caller frees `buffer->data`.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_all_entries(ResponseBuffer *buffer)
+{
+    *buffer = (ResponseBuffer){malloc(GET_ALL_BUFF_SIZE), 0, GET_ALL_BUFF_SIZE};
+    if (!buffer->data)
+        return false;
+
+    buffer->data[buffer->len++] = '{';
+
+    for (size_t i = 0; i < store_shard_count(); i++)
+    {
+        StoreShard *shard = store_shard_at(i);
+        pthread_mutex_lock(&shard->lock);
+        bool complete = hash_map_for_each(shard->map, append_json_entry, buffer);
+        pthread_mutex_unlock(&shard->lock);
+
+        if (!complete)
+        {
+            free(buffer->data);
+            return false;
+        }
+    }
+
+    // Either overwrite the trailing comma or close the empty object
+    if (buffer->len > 1)
+        buffer->len--;
+
+    if (!buffer_append_bytes(buffer, "}", 1))
+    {
+        free(buffer->data);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Builds a JSON array with the slab accounting of every size class in use.
+ *
+ * `wasted_bytes` covers both rounding to the chunk size and free chunks.
+ *
+ * @param buffer Receives the JSON document; the caller frees `buffer->data`.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_slab_stats(ResponseBuffer *buffer)
+{
+    SlabClassStats stats[SLAB_CLASS_COUNT + 1];
+    size_t class_count = store_slab_stats(stats);
+
+    *buffer = (ResponseBuffer){malloc(GET_ALL_BUFF_SIZE), 0, GET_ALL_BUFF_SIZE};
+    if (!buffer->data)
+        return false;
+
+    buffer->data[buffer->len++] = '[';
+
+    for (size_t i = 0; i <= SLAB_CLASS_COUNT; i++)
+    {
+        if ((i >= class_count && i < SLAB_CLASS_COUNT) || stats[i].total_chunks == 0)
+            continue;
+
+        if (!buffer_append(buffer, "{\"chunk_size\":%zu,\"used_chunks\":%zu,\"total_chunks\":%zu,"
+                                    "\"requested_bytes\":%zu,\"allocated_bytes\":%zu,\"wasted_bytes\":%zu},",
+                           stats[i].chunk_size, stats[i].used_chunks, stats[i].total_chunks,
+                           stats[i].requested_bytes, stats[i].allocated_bytes,
+                           stats[i].allocated_bytes - stats[i].requested_bytes))
+        {
+            free(buffer->data);
+            return false;
+        }
+    }
+
+    if (buffer->len > 1)
+        buffer->len--;
+
+    if (!buffer_append_bytes(buffer, "]", 1))
+    {
+        free(buffer->data);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Builds the JSON document reported by INFO.
+ *
+ * Combines the event loop counters, the per-command latency percentiles,
+ * the occupancy of the keyspace, its memory use, the state of the
+ * append-only file and snapshots and the replication role. Measuring the keyspace
+ * walks every table slot, one shard lock at a time.
+ *
+ * @param buffer Receives the JSON document; the caller frees `buffer->data`.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_info(ResponseBuffer *buffer)
+{
+    StatsSnapshot stats;
+    HashMapStats keyspace;
+
+    EvictionPolicy policy;
+    size_t max_memory = store_memory_limit(&policy);
+
+    AofStats aof;
+    SnapshotStats snapshot;
+    ReplicationStats replication;
+
+    stats_snapshot(&stats);
+    store_keyspace_stats(&keyspace);
+    aof_stats(&aof);
+    snapshot_stats(&snapshot);
+    replication_stats(&replication);
+
+    *buffer = (ResponseBuffer){malloc(GET_ALL_BUFF_SIZE), 0, GET_ALL_BUFF_SIZE};
+    if (!buffer->data)
+        return false;
+
+    double uptime = stats.uptime_seconds > 0 ? stats.uptime_seconds : 1;
+    bool success =
+        buffer_append(buffer, "{\"server\":{\"uptime_seconds\":%.3f,\"workers\":%zu,\"log_dropped\":%llu},"
+                              "\"clients\":{\"connected\":%llu,\"total\":%llu,\"timed_out\":%llu},",
+                      stats.uptime_seconds, stats.workers, (unsigned long long)log_dropped(),
+                      (unsigned long long)stats.clients_connected, (unsigned long long)stats.clients_total,
+                      (unsigned long long)stats.clients_timed_out) &&
+        buffer_append(buffer, "\"io\":{\"commands\":%llu,\"bytes_in\":%llu,\"bytes_out\":%llu,\"syscalls\":%llu,"
+                              "\"syscalls_per_command\":%.3f,\"epoll_wakeups\":%llu,\"epoll_wakeups_per_second\":%.1f,"
+                              "\"avg_events_per_wakeup\":%.2f,\"max_events_per_wakeup\":%llu},",
+                      (unsigned long long)stats.commands, (unsigned long long)stats.bytes_in,
+                      (unsigned long long)stats.bytes_out, (unsigned long long)stats.syscalls,
+                      stats.commands ? (double)stats.syscalls / stats.commands : 0.0,
+                      (unsigned long long)stats.epoll_wakeups, stats.epoll_wakeups / uptime,
+                      stats.epoll_wakeups ? (double)stats.events / stats.epoll_wakeups : 0.0,
+                      (unsigned long long)stats.max_events_per_wakeup) &&
+        buffer_append(buffer, "\"commands\":{");
+
+    size_t commands_start = buffer->len;
+
+    for (int type = 0; success && type < CMD_TYPE_COUNT; type++)
+    {
+        CommandLatency *latency = &stats.latency[type];
+        if (latency->calls == 0)
+            continue;
+
+        success = buffer_append(buffer, "\"%s\":{\"calls\":%llu,\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"max_us\":%.2f},",
+                                command_name(type), (unsigned long long)latency->calls,
+                                latency->p50_us, latency->p99_us, latency->p999_us, latency->max_us);
+    }
+
+    // Overwrite the trailing comma, if any command was listed
+    if (success && buffer->len > commands_start)
+        buffer->len--;
+
+    success = success &&
+              buffer_append(buffer, "},\"keyspace\":{\"keys\":%zu,\"capacity\":%zu,\"load_factor\":%.3f,"
+                                    "\"tombstones\":%zu,\"longest_probe\":%zu,\"expires\":%zu,\"expired_keys\":%zu},",
+                            keyspace.keys, keyspace.capacity,
+                            keyspace.capacity ? (double)keyspace.keys / keyspace.capacity : 0.0,
+                            keyspace.tombstones, keyspace.longest_probe, keyspace.expires, keyspace.expired) &&
+              buffer_append(buffer, "\"memory\":{\"used_memory\":%zu,\"maxmemory\":%zu,\"maxmemory_policy\":\"%s\",\"evicted_keys\":%zu}",
+                            keyspace.memory, max_memory, policy == EVICTION_LFU ? "lfu" : "lru", keyspace.evicted) &&
+              buffer_append(buffer, ",\"persistence\":{\"aof_enabled\":%s,\"aof_fsync\":\"%s\",\"aof_size\":%llu,"
+                                    "\"aof_base_size\":%llu,\"aof_buffer_bytes\":%zu,\"aof_writes\":%llu,\"aof_fsyncs\":%llu,"
+                                    "\"aof_rewrites\":%llu,\"aof_rewrite_in_progress\":%s,\"aof_failed\":%s,",
+                            aof.enabled ? "true" : "false",
+                            aof.policy == AOF_FSYNC_ALWAYS ? "always" : aof.policy == AOF_FSYNC_EVERYSEC ? "everysec" : "no",
+                            (unsigned long long)aof.size, (unsigned long long)aof.base_size, aof.pending_bytes,
+                            (unsigned long long)aof.writes, (unsigned long long)aof.fsyncs,
+                            (unsigned long long)aof.rewrites, aof.rewrite_in_progress ? "true" : "false",
+                            aof.failed ? "true" : "false") &&
+              buffer_append(buffer, "\"snapshot_enabled\":%s,\"snapshot_interval\":%u,\"snapshot_in_progress\":%s,"
+                                    "\"snapshot_saves\":%llu,\"snapshot_failures\":%llu,\"snapshot_last_save_ms\":%llu,"
+                                    "\"snapshot_last_keys\":%llu,\"snapshot_last_bytes\":%llu,\"snapshot_last_duration_ms\":%llu},",
+                            snapshot.enabled ? "true" : "false", snapshot.interval, snapshot.in_progress ? "true" : "false",
+                            (unsigned long long)snapshot.saves, (unsigned long long)snapshot.failures,
+                            (unsigned long long)snapshot.last_save_ms, (unsigned long long)snapshot.last_keys,
+                            (unsigned long long)snapshot.last_bytes, (unsigned long long)snapshot.last_duration_ms) &&
+              buffer_append(buffer, "\"replication\":{\"role\":\"%s\",\"replid\":\"%s\",\"offset\":%llu,"
+                                    "\"backlog_size\":%zu,\"backlog_first_offset\":%llu,\"replicas\":%zu,"
+                                    "\"full_syncs\":%llu,\"partial_syncs\":%llu",
+                            replication.replica ? "replica" : "primary", replication.replid,
+                            (unsigned long long)replication.offset, replication.backlog_size,
+                            (unsigned long long)replication.backlog_first, replication.replicas,
+                            (unsigned long long)replication.full_syncs, (unsigned long long)replication.partial_syncs) &&
+              (!replication.replica ||
+               buffer_append(buffer, ",\"primary\":\"%s\",\"link_up\":%s,\"syncing\":%s",
+                             replication.primary, replication.link_up ? "true" : "false",
+                             replication.syncing ? "true" : "false")) &&
+              buffer_append_bytes(buffer, "}}", 2);
+
+    if (!success)
+        free(buffer->data);
+
+    return success;
+}
+
+/**
+ * @brief State of one chunk of a streamed GETALL reply.
+ */
+typedef struct
+{
+    ResponseBuffer *buffer; /** The chunk being filled */
+    bool *first;            /** True until the first entry of the reply was written */
+    bool failed;            /** True if the buffer could not grow */
+} StreamChunk;
+
+/**
+ * @brief Appends one `"key":"value"` entry to a GETALL chunk.
+ * @return true while the chunk has room for more entries.
+ */
+static bool append_stream_entry(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx)
+{
+    StreamChunk *chunk = ctx;
+    (void)expire_at;
+
+    if (!*chunk->first && !buffer_append_bytes(chunk->buffer, ",", 1))
+    {
+        chunk->failed = true;
+        return false;
+    }
+
+    if (!buffer_append_json_string(chunk->buffer, key, key_len) ||
+        !buffer_append_bytes(chunk->buffer, ":", 1) ||
+        !buffer_append_json_string(chunk->buffer, value, value_len))
+    {
+        chunk->failed = true;
+        return false;
+    }
+
+    *chunk->first = false;
+    return chunk->buffer->len < STREAM_CHUNK_SIZE;
+}
+
+/**
+ * @brief Appends the next chunk of the streamed GETALL reply of a connection.
+ *
+ * Entries are added bucket by bucket until the chunk reaches
+ * STREAM_CHUNK_SIZE, so each call holds a shard lock only briefly and the
+ * event loop gets back to other clients between chunks. Over RESP3 the
+ * chunk is framed as part of a streamed string.
+ *
+ * @param conn The client connection, with an active stream.
+ * @param buffer The buffer receiving the chunk.
+ * @return true on success, false on allocation failure.
+ */
+static bool append_stream_chunk(Connection *conn, ResponseBuffer *buffer)
+{
+    size_t start = buffer->len;
+    StreamChunk chunk = {buffer, &conn->stream.first, false};
+
+    // Nothing has been scanned yet, so this is the first chunk
+    if (conn->stream.first && conn->stream.cursor == 0 && !buffer_append_bytes(buffer, "{", 1))
+        return false;
+
+    do
+    {
+        conn->stream.cursor = store_scan(conn->stream.cursor, STREAM_SCAN_BUCKETS, append_stream_entry, &chunk);
+        if (chunk.failed)
+            return false;
+    } while (conn->stream.cursor != 0 && buffer->len - start < STREAM_CHUNK_SIZE);
+
+    bool done = conn->stream.cursor == 0;
+    conn->stream.active = !done;
+
+    if (done && !buffer_append_bytes(buffer, "}", 1))
+        return false;
+
+    if (conn->protocol != PROTOCOL_RESP3)
+        return !done || buffer_append_bytes(buffer, "\n", 1);
+
+    // Prefix the payload with its chunk header; a zero-length chunk ends the string
+    char header[32];
+    size_t payload_len = buffer->len - start;
+    size_t header_len = snprintf(header, sizeof(header), ";%zu\r\n", payload_len);
+
+    if (!buffer_reserve(buffer, header_len + 7))
+        return false;
+
+    memmove(buffer->data + start + header_len, buffer->data + start, payload_len);
+    memcpy(buffer->data + start, header, header_len);
+    buffer->len += header_len;
+
+    return buffer_append_bytes(buffer, "\r\n", 2) && (!done || buffer_append_bytes(buffer, ";0\r\n", 4));
+}
+
+/**
+ * @brief Renders the next chunk of the streamed reply of a connection and queues it.
+ *
+ * The chunk is assembled on its own first, since over RESP3 its length
+ * prefix is only known once it is complete.
+ *
+ * @param conn The client connection, with an active stream.
+ * @return true on success, false on allocation failure.
+ */
+static bool queue_stream_chunk(Connection *conn)
+{
+    ResponseBuffer buffer = {malloc(STREAM_CHUNK_SIZE * 2), 0, STREAM_CHUNK_SIZE * 2};
+    if (!buffer.data)
+        return false;
+
+    bool success = append_stream_chunk(conn, &buffer) &&
+                   connection_output_append(conn, buffer.data, buffer.len);
+
+    free(buffer.data);
+    return success;
+}
+
+/**
+ * @brief Starts a GETALL reply.
+ *
+ * The text protocol gets a JSON object split over several writes, RESP3 a
+ * streamed string (`$?`) whose chunks hold the same JSON. RESP2 has no way
+ * to send a string of unknown length, so the object is rendered whole.
+ *
+ * @param conn The client connection.
+ * @return true on success, false on allocation failure.
+ */
+static bool start_get_all(Connection *conn)
+{
+    if (conn->protocol == PROTOCOL_RESP2)
+    {
+        ResponseBuffer json;
+        if (!get_all_entries(&json))
+            return reply_error(conn, FAILURE_RESP_MSG);
+
+        return reply_json(conn, &json);
+    }
+
+    conn->stream.active = true;
+    conn->stream.first = true;
+    conn->stream.cursor = 0;
+
+    if (conn->protocol == PROTOCOL_RESP3 && !connection_output_append(conn, "$?\r\n", 4))
+        return false;
+
+    return queue_stream_chunk(conn);
+}
+
+/**
+ * @brief Queues the next chunk of the streamed reply of a connection.
+ * @param conn The client connection, with an active stream.
+ * @return true on success, false on allocation failure.
+ */
+bool continue_stream(Connection *conn)
+{
+    if (!queue_stream_chunk(conn))
+    {
+        conn->stream.active = false;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief One page of SCAN results being collected.
+ */
+typedef struct
+{
+    ResponseBuffer keys; /** Keys, already encoded for the reply protocol */
+    size_t found;        /** Number of keys in `keys` */
+    size_t count;        /** Number of keys wanted */
+    Slice pattern;       /** MATCH pattern, or a NULL slice */
+    Protocol protocol;   /** Reply protocol */
+    bool failed;         /** True if the buffer could not grow */
+} ScanPage;
+
+/**
+ * @brief Adds a key to a SCAN page if it matches the pattern.
+ * @return true while the page wants more keys.
+ */
+static bool append_scan_key(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx)
+{
+    ScanPage *page = ctx;
+    (void)value;
+    (void)value_len;
+    (void)expire_at;
+
+    if (page->pattern.data && !glob_match(page->pattern.data, page->pattern.len, key, key_len))
+        return true;
+
+    bool appended;
+    if (page->protocol == PROTOCOL_TEXT)
+    {
+        appended = (page->found == 0 || buffer_append_bytes(&page->keys, ",", 1)) &&
+                   buffer_append_json_string(&page->keys, key, key_len);
+    }
+    else
+    {
+        appended = buffer_append(&page->keys, "$%zu\r\n", key_len) &&
+                   buffer_append_bytes(&page->keys, key, key_len) &&
+                   buffer_append_bytes(&page->keys, "\r\n", 2);
+    }
+
+    if (!appended)
+    {
+        page->failed = true;
+        return false;
+    }
+
+    return ++page->found < page->count;
+}
+
+/**
+ * @brief Parses a decimal unsigned integer.
+ * @param slice The digits.
+ * @param value Receives the number.
+ * @return true if the slice is a number that fits in a size_t.
+ */
+static bool parse_size(Slice slice, size_t *value)
+{
+    if (slice.len == 0)
+        return false;
+
+    size_t result = 0;
+    for (size_t i = 0; i < slice.len; i++)
+    {
+        char c = slice.data[i];
+        if (c < '0' || c > '9' || result > (SIZE_MAX - (c - '0')) / 10)
+            return false;
+
+        result = result * 10 + (c - '0');
+    }
+
+    *value = result;
+    return true;
+}
+
+/**
+ * @brief Parses a time to live.
+ * @param amount The decimal time to live.
+ * @param unit_ms Milliseconds per unit of `amount` (1000 for seconds).
+ * @param ttl_ms Receives the time to live in milliseconds.
+ * @return true if the amount is a number no larger than MAX_EXPIRE_MS.
+ */
+static bool parse_ttl(Slice amount, uint64_t unit_ms, uint64_t *ttl_ms)
+{
+    size_t value;
+
+    if (!parse_size(amount, &value) || value > MAX_EXPIRE_MS / unit_ms)
+        return false;
+
+    *ttl_ms = value * unit_ms;
+    return true;
+}
+
+/**
+ * @brief Parses the options of `SET key value [EX seconds | PX milliseconds]`.
+ * @param cmd The SET command; the value is its first argument.
+ * @param expire_at Receives the expiry time in milliseconds, 0 if the key does not expire.
+ * @return NULL if the options are valid, otherwise the error code to reply with.
+ */
+static const char *parse_set_options(Command *cmd, uint64_t *expire_at)
+{
+    *expire_at = 0;
+
+    if (cmd->arg_count == 1)
+        return NULL;
+
+    if (cmd->arg_count != 3 || cmd->args[1].len != 2)
+        return SYNTAX_ERROR_MSG;
+
+    uint64_t unit_ms, ttl_ms;
+    if (strncasecmp(cmd->args[1].data, "EX", 2) == 0)
+        unit_ms = 1000;
+    else if (strncasecmp(cmd->args[1].data, "PX", 2) == 0)
+        unit_ms = 1;
+    else
+        return SYNTAX_ERROR_MSG;
+
+    // A time to live of zero would create a key that is already gone
+    if (!parse_ttl(cmd->args[2], unit_ms, &ttl_ms) || ttl_ms == 0)
+        return INVALID_EXPIRE_MSG;
+
+    *expire_at = current_time_ms() + ttl_ms;
+    return NULL;
+}
+
+/**
+ * @brief Logs the outcome of an EXPIRE to the append-only file.
+ *
+ * The file only holds SET and DEL records, each carrying the whole state of
+ * its key, so the key is logged with its value and deadline, or as removed
+ * if the deadline already passed.
+ *
+ * @param shard The shard of the key, locked by the caller.
+ * @param key The key.
+ * @param expire_at The new deadline.
+ */
+static void log_expire(StoreShard *shard, Slice key, uint64_t expire_at)
+{
+    size_t value_len;
+    const char *value = hash_map_get(shard->map, key.data, key.len, &value_len);
+
+    if (value)
+        aof_log_set(key.data, key.len, value, value_len, expire_at);
+    else
+        aof_log_remove(key.data, key.len);
+}
+
+/**
+ * @brief Runs `GET key`.
+ *
+ * With concurrent reads enabled the shard is not locked: the epoch keeps
+ * the value alive until it is copied into the reply.
+ *
+ * @param cmd The GET command.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_value(Command *cmd, Connection *conn)
+{
+    uint64_t hash = hash_bytes(cmd->key.data, cmd->key.len);
+    StoreShard *shard = store_shard_at(store_shard_index(hash));
+    size_t value_len;
+    bool success;
+
+    if (shard->map->concurrent && epoch_reader_attached())
+    {
+        epoch_enter();
+        const char *value = hash_map_read(shard->map, cmd->key.data, cmd->key.len, hash, &value_len);
+        success = value ? reply_bulk(conn, value, value_len) : reply_null(conn);
+        epoch_exit();
+        return success;
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    const char *value = hash_map_get_hashed(shard->map, cmd->key.data, cmd->key.len, hash, &value_len);
+
+    // The value may be freed by another worker once the shard is unlocked
+    success = value ? reply_bulk(conn, value, value_len) : reply_null(conn);
+    pthread_mutex_unlock(&shard->lock);
+    return success;
+}
+
+/**
+ * @brief Runs `TTL key`.
+ *
+ * Replies with the seconds left, rounded to the nearest second, -1 if the
+ * key does not expire and -2 if it does not exist.
+ *
+ * @param cmd The TTL command.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_ttl(Command *cmd, Connection *conn)
+{
+    StoreShard *shard = store_shard_for_key(cmd->key.data, cmd->key.len);
+    uint64_t expire_at;
+
+    pthread_mutex_lock(&shard->lock);
+    bool found = hash_map_get_expiry(shard->map, cmd->key.data, cmd->key.len, &expire_at);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (!found)
+        return reply_integer(conn, -2);
+
+    if (expire_at == 0)
+        return reply_integer(conn, -1);
+
+    uint64_t now = current_time_ms();
+    uint64_t left = expire_at > now ? expire_at - now : 0;
+    return reply_integer(conn, (long long)((left + 500) / 1000));
+}
+
+/**
+ * @brief Runs `INCR key`, `DECR key`, `INCRBY key amount` and `DECRBY key amount`.
+ *
+ * The new value is logged to the append-only file as a SET, so replaying
+ * the record does not depend on the value it was computed from.
+ *
+ * @param cmd The command.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool increment(Command *cmd, Connection *conn)
+{
+    bool takes_amount = cmd->type == CMD_INCRBY || cmd->type == CMD_DECRBY;
+    int64_t delta = 1;
+
+    if (takes_amount && cmd->arg_count == 0)
+        return reply_error(conn, INVALID_ARGS);
+
+    if (cmd->arg_count != (takes_amount ? 1 : 0))
+        return reply_error(conn, SYNTAX_ERROR_MSG);
+
+    if (takes_amount && !parse_int64(cmd->args[0].data, cmd->args[0].len, &delta))
+        return reply_error(conn, NOT_INTEGER_MSG);
+
+    if (cmd->type == CMD_DECR || cmd->type == CMD_DECRBY)
+    {
+        // The one amount whose negation does not fit
+        if (delta == INT64_MIN)
+            return reply_error(conn, OVERFLOW_MSG);
+
+        delta = -delta;
+    }
+
+    uint64_t hash = hash_bytes(cmd->key.data, cmd->key.len);
+    StoreShard *shard = store_shard_at(store_shard_index(hash));
+    int64_t result;
+    uint64_t expire_at;
+
+    pthread_mutex_lock(&shard->lock);
+    IncrementStatus status = hash_map_increment(shard->map, cmd->key.data, cmd->key.len, hash, delta, &result, &expire_at);
+
+    if (status == INCREMENT_OK && aof_logging())
+    {
+        char text[INT64_TEXT_MAX];
+        aof_log_set(cmd->key.data, cmd->key.len, text, format_int64(result, text), expire_at);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    switch (status)
+    {
+    case INCREMENT_OK:
+        return reply_integer(conn, result);
+    case INCREMENT_NOT_INTEGER:
+        return reply_error(conn, NOT_INTEGER_MSG);
+    case INCREMENT_OVERFLOW:
+        return reply_error(conn, OVERFLOW_MSG);
+    default:
+        return reply_error(conn, FAILURE_RESP_MSG);
+    }
+}
+
+/**
+ * @brief Runs `SCAN cursor [COUNT n] [MATCH pattern]`.
+ *
+ * Visits at most COUNT * SCAN_EMPTY_FACTOR buckets, so a page may hold
+ * fewer keys than asked for (or none) while the cursor is not yet 0.
+ *
+ * @param cmd The SCAN command; its key is the cursor.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool scan_keys(Command *cmd, Connection *conn)
+{
+    size_t cursor;
+    ScanPage page = {{NULL, 0, 0}, 0, SCAN_DEFAULT_COUNT, {NULL, 0}, conn->protocol, false};
+
+    if (!cmd->key.data)
+        return reply_error(conn, INVALID_ARGS);
+
+    if (!parse_size(cmd->key, &cursor))
+        return reply_error(conn, INVALID_CURSOR_MSG);
+
+    if (cmd->arg_count % 2 != 0)
+        return reply_error(conn, SYNTAX_ERROR_MSG);
+
+    for (size_t i = 0; i < cmd->arg_count; i += 2)
+    {
+        Slice option = cmd->args[i];
+
+        if (option.len == 5 && strncasecmp(option.data, "COUNT", 5) == 0)
+        {
+            if (!parse_size(cmd->args[i + 1], &page.count) || page.count == 0)
+                return reply_error(conn, SYNTAX_ERROR_MSG);
+        }
+        else if (option.len == 5 && strncasecmp(option.data, "MATCH", 5) == 0)
+        {
+            page.pattern = cmd->args[i + 1];
+        }
+        else
+        {
+            return reply_error(conn, SYNTAX_ERROR_MSG);
+        }
+    }
+
+    page.keys = (ResponseBuffer){malloc(RESP_BUFF_SIZE), 0, RESP_BUFF_SIZE};
+    if (!page.keys.data)
+        return false;
+
+    size_t buckets = page.count < SCAN_MAX_BUCKETS ? page.count : SCAN_MAX_BUCKETS;
+
+    for (size_t calls = 0; calls < SCAN_EMPTY_FACTOR && page.found < page.count; calls++)
+    {
+        cursor = store_scan(cursor, buckets, append_scan_key, &page);
+        if (page.failed || cursor == 0)
+            break;
+    }
+
+    bool success = !page.failed;
+
+    if (success && conn->protocol == PROTOCOL_TEXT)
+    {
+        success = output_append(conn, "{\"cursor\":\"%zu\",\"keys\":[", cursor) &&
+                  connection_output_append(conn, page.keys.data, page.keys.len) &&
+                  connection_output_append(conn, "]}\n", 3);
+    }
+    else if (success)
+    {
+        char digits[24];
+        int digits_len = snprintf(digits, sizeof(digits), "%zu", cursor);
+
+        success = connection_output_append(conn, "*2\r\n", 4) &&
+                  reply_bulk(conn, digits, digits_len) &&
+                  output_append(conn, "*%zu\r\n", page.found) &&
+                  connection_output_append(conn, page.keys.data, page.keys.len);
+    }
+
+    free(page.keys.data);
+    return success;
+}
+
+/**
+ * @brief Keys of the multi-key command being run, hashed once up front.
+ *
+ * The arrays belong to the worker thread and only ever grow.
+ */
+typedef struct
+{
+    uint64_t *hashes;   /** Hash of every key, in request order */
+    size_t *shards;     /** Distinct shards of the keys, ascending */
+    size_t shard_count; /** Entries used in `shards` */
+    size_t cap;         /** Entries allocated in both arrays */
+} KeyBatch;
+
+static __thread KeyBatch batch;
 
 /**
- * @brief Initializes the command handler.
+ * @brief Returns a token of a command, counting the key as token 0.
+ */
+static inline Slice command_token(const Command *cmd, size_t index)
+{
+    return index == 0 ? cmd->key : cmd->args[index - 1];
+}
+
+/**
+ * @brief Orders shard indexes for qsort.
+ */
+static int compare_shards(const void *a, const void *b)
+{
+    size_t left = *(const size_t *)a;
+    size_t right = *(const size_t *)b;
+    return (left > right) - (left < right);
+}
+
+/**
+ * @brief Hashes the keys of a multi-key command and locks their shards.
  *
- * This function ensures that the global hashmap data structure is created before handling commands.
+ * The shards are locked in ascending order and stay locked until
+ * `batch_unlock`, so the command reads or changes all of its keys
+ * atomically, and two batches can never wait on each other in a cycle.
+ *
+ * @param cmd The command.
+ * @param count Number of keys.
+ * @param stride Tokens per key: 1 for a list of keys, 2 for key-value pairs.
+ * @return true on success, false on allocation failure.
  */
-void initialize_command_handler()
+static bool batch_lock(const Command *cmd, size_t count, size_t stride)
 {
-    if (!map)
+    if (count > batch.cap)
+    {
+        size_t cap = count > BATCH_MIN_CAPACITY ? count : BATCH_MIN_CAPACITY;
+        uint64_t *hashes = realloc(batch.hashes, cap * sizeof(uint64_t));
+        if (!hashes)
+            return false;
+        batch.hashes = hashes;
+
+        size_t *shards = realloc(batch.shards, cap * sizeof(size_t));
+        if (!shards)
+            return false;
+        batch.shards = shards;
+        batch.cap = cap;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Slice key = command_token(cmd, i * stride);
+        batch.hashes[i] = hash_bytes(key.data, key.len);
+        batch.shards[i] = store_shard_index(batch.hashes[i]);
+    }
+
+    qsort(batch.shards, count, sizeof(size_t), compare_shards);
+
+    batch.shard_count = 0;
+    for (size_t i = 0; i < count; i++)
     {
-        map = create_hash_map(DEFAULT_HASHMAP_SIZE);
+        if (batch.shard_count == 0 || batch.shards[batch.shard_count - 1] != batch.shards[i])
+            batch.shards[batch.shard_count++] = batch.shards[i];
     }
+
+    for (size_t i = 0; i < batch.shard_count; i++)
+        pthread_mutex_lock(&store_shard_at(batch.shards[i])->lock);
+
+    // Start the first misses; `batch_map` keeps the window moving
+    for (size_t i = 0; i < count && i < BATCH_PREFETCH_DISTANCE; i++)
+        hash_map_prefetch(store_shard_at(store_shard_index(batch.hashes[i]))->map, batch.hashes[i]);
+
+    return true;
+}
+
+/**
+ * @brief Unlocks the shards locked by `batch_lock`.
+ */
+static void batch_unlock(void)
+{
+    for (size_t i = batch.shard_count; i-- > 0;)
+        pthread_mutex_unlock(&store_shard_at(batch.shards[i])->lock);
 }
 
 /**
- * @brief Executes a given command and returns a response.
+ * @brief Returns the hashmap holding a key of the batch.
  *
- * This function processes the command based on its type and performs actions such as
- * setting, getting, removing, or retrieving all key-value pairs from the hashmap.
+ * Also prefetches the bucket of the key BATCH_PREFETCH_DISTANCE positions
+ * later, so its cache miss overlaps with the probes in between.
  *
- * @param cmd Pointer to a Command struct containing the parsed command.
- * @return A dynamically allocated response string. Caller must free it when done.
+ * @param index Position of the key in the batch.
+ * @param count Number of keys in the batch.
+ * @return The hashmap of the key's shard.
+ */
+static HashMap *batch_map(size_t index, size_t count)
+{
+    size_t ahead = index + BATCH_PREFETCH_DISTANCE;
+    if (ahead < count)
+        hash_map_prefetch(store_shard_at(store_shard_index(batch.hashes[ahead]))->map, batch.hashes[ahead]);
+
+    return store_shard_at(store_shard_index(batch.hashes[index]))->map;
+}
+
+/**
+ * @brief Runs `MGET key [key ...]`.
+ *
+ * Replies with an array holding the value or null for every key; text
+ * clients get a JSON array on one line. Values are copied into the output
+ * queue while their shards are locked.
+ *
+ * @param cmd The MGET command.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_many(Command *cmd, Connection *conn)
+{
+    size_t count = cmd->arg_count + 1;
+    if (!batch_lock(cmd, count, 1))
+        return false;
+
+    bool success = conn->protocol == PROTOCOL_TEXT ? connection_output_append(conn, "[", 1)
+                                                   : output_append(conn, "*%zu\r\n", count);
+
+    for (size_t i = 0; success && i < count; i++)
+    {
+        Slice key = command_token(cmd, i);
+        size_t value_len;
+        const char *value = hash_map_get_hashed(batch_map(i, count), key.data, key.len, batch.hashes[i], &value_len);
+
+        if (conn->protocol == PROTOCOL_TEXT)
+        {
+            success = (i == 0 || connection_output_append(conn, ",", 1)) &&
+                      (value ? output_append_json_string(conn, value, value_len)
+                             : connection_output_append(conn, "null", 4));
+        }
+        else
+        {
+            success = value ? reply_bulk(conn, value, value_len) : reply_null(conn);
+        }
+    }
+
+    batch_unlock();
+
+    return success && (conn->protocol != PROTOCOL_TEXT || connection_output_append(conn, "]\n", 2));
+}
+
+/**
+ * @brief Runs `MSET key value [key value ...]`.
+ *
+ * Like SET, every key loses its time to live.
+ *
+ * Whether a pair fits is only known once its memory is taken, so the pairs
+ * cannot be checked up front. MSET stops at the first pair that could not
+ * be stored instead: the pairs before it stay stored and logged, and the
+ * reply is `PARTIAL_WRITE <n>` with their number, so the client knows
+ * exactly which prefix of the batch was applied.
+ *
+ * @param cmd The MSET command, with an odd number of arguments.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool set_many(Command *cmd, Connection *conn)
+{
+    size_t count = (cmd->arg_count + 1) / 2;
+    if (!batch_lock(cmd, count, 2))
+        return false;
+
+    size_t stored = 0;
+    bool logged = aof_logging();
+
+    for (; stored < count; stored++)
+    {
+        Slice key = command_token(cmd, stored * 2);
+        Slice value = command_token(cmd, stored * 2 + 1);
+
+        if (!hash_map_set_hashed(batch_map(stored, count), key.data, key.len, batch.hashes[stored], value.data, value.len, 0))
+            break;
+
+        if (logged)
+            aof_log_set(key.data, key.len, value.data, value.len, 0);
+    }
+
+    batch_unlock();
+
+    if (stored < count)
+    {
+        if (conn->protocol == PROTOCOL_TEXT)
+            return output_append(conn, "%s %zu\n", PARTIAL_WRITE_MSG, stored);
+
+        return output_append(conn, "-ERR %s %zu\r\n", PARTIAL_WRITE_MSG, stored);
+    }
+
+    return reply_status(conn, SUCCESS_RESP_MSG);
+}
+
+/**
+ * @brief Runs `MDEL key [key ...]` and replies with the number of keys removed.
+ *
+ * @param cmd The MDEL command.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool remove_many(Command *cmd, Connection *conn)
+{
+    size_t count = cmd->arg_count + 1;
+    if (!batch_lock(cmd, count, 1))
+        return false;
+
+    size_t removed = 0;
+    bool logged = aof_logging();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        Slice key = command_token(cmd, i);
+
+        if (hash_map_remove_hashed(batch_map(i, count), key.data, key.len, batch.hashes[i]))
+        {
+            removed++;
+            if (logged)
+                aof_log_remove(key.data, key.len);
+        }
+    }
+
+    batch_unlock();
+
+    return reply_integer(conn, (long long)removed);
+}
+
+/**
+ * @brief Switches the reply protocol as requested by HELLO.
+ * @param cmd The HELLO command; its key is the optional protocol version.
+ * @param protocol In: current protocol, out: selected protocol.
+ * @return true if the version is supported.
+ */
+static bool select_protocol(Command *cmd, Protocol *protocol)
+{
+    if (!cmd->key.data)
+    {
+        if (*protocol == PROTOCOL_TEXT)
+            *protocol = PROTOCOL_RESP2;
+        return true;
+    }
+
+    if (cmd->key.len == 1 && cmd->key.data[0] == '2')
+    {
+        *protocol = PROTOCOL_RESP2;
+        return true;
+    }
+
+    if (cmd->key.len == 1 && cmd->key.data[0] == '3')
+    {
+        *protocol = PROTOCOL_RESP3;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Returns whether a command changes the keyspace.
+ * @param type The command type.
+ * @return true for the commands a replica refuses.
+ */
+static bool writes_keyspace(CommandType type)
+{
+    switch (type)
+    {
+    case CMD_SET:
+    case CMD_REMOVE:
+    case CMD_EXPIRE:
+    case CMD_MSET:
+    case CMD_MDEL:
+    case CMD_INCR:
+    case CMD_DECR:
+    case CMD_INCRBY:
+    case CMD_DECRBY:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Runs `SYNC replid offset`, sent by a replica to start or resume replicating.
+ *
+ * On success the connection is handed over to a sender thread, which
+ * writes everything the replica receives from then on, so nothing is
+ * queued here and the event loop closes its side of the connection.
+ *
+ * @param cmd The SYNC command; its key is the replication id the replica knows, or `?`.
+ * @param conn The client connection.
+ * @return true on success, false on allocation failure.
+ */
+static bool start_sync(Command *cmd, Connection *conn)
+{
+    int64_t offset;
+
+    if (replication_is_replica())
+        return reply_error(conn, NOT_PRIMARY_MSG);
+
+    if (!cmd->key.data || cmd->arg_count != 1)
+        return reply_error(conn, INVALID_ARGS);
+
+    if (!parse_int64(cmd->args[0].data, cmd->args[0].len, &offset) || offset < 0)
+        return reply_error(conn, SYNTAX_ERROR_MSG);
+
+    // The sender writes to the socket directly, so queued replies would interleave with the stream
+    if (conn->out_bytes > 0)
+        return reply_error(conn, SYNC_PIPELINED_MSG);
+
+    if (!replication_attach(conn->fd, cmd->key.data, cmd->key.len, (uint64_t)offset))
+        return reply_error(conn, FAILURE_RESP_MSG);
+
+    conn->detached = true;
+    return true;
+}
+
+/**
+ * @brief Name and value pairs of a CONFIG GET reply, encoded for the client.
+ */
+typedef struct
+{
+    ResponseBuffer pairs; /** Encoded pairs, without the header */
+    Protocol protocol;    /** Protocol of the client */
+    bool failed;          /** Set if the buffer could not grow */
+} ConfigReply;
+
+/**
+ * @brief Appends one setting to a CONFIG GET reply.
+ * @param name Name of the setting.
+ * @param value Its current value.
+ * @param ctx Pointer to the ConfigReply being built.
+ */
+static void append_config_pair(const char *name, const char *value, void *ctx)
+{
+    ConfigReply *reply = ctx;
+    ResponseBuffer *pairs = &reply->pairs;
+    size_t name_len = strlen(name);
+    size_t value_len = strlen(value);
+
+    if (reply->protocol == PROTOCOL_TEXT)
+    {
+        reply->failed |= !((pairs->len == 0 || buffer_append_bytes(pairs, ",", 1)) &&
+                           buffer_append_json_string(pairs, name, name_len) &&
+                           buffer_append_bytes(pairs, ":", 1) &&
+                           buffer_append_json_string(pairs, value, value_len));
+    }
+    else
+    {
+        reply->failed |= !buffer_append(pairs, "$%zu\r\n%s\r\n$%zu\r\n%s\r\n", name_len, name, value_len, value);
+    }
+}
+
+/**
+ * @brief Runs `CONFIG GET pattern`.
+ *
+ * Replies with the matching settings as a map in RESP3, a flat array of
+ * names and values in RESP2 and a JSON object for text clients.
+ *
+ * @param pattern Glob-style pattern of setting names.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool get_config(Slice pattern, Connection *conn)
+{
+    ConfigReply reply = {{malloc(RESP_BUFF_SIZE), 0, RESP_BUFF_SIZE}, conn->protocol, false};
+    if (!reply.pairs.data)
+        return false;
+
+    size_t found = config_get(pattern.data, pattern.len, append_config_pair, &reply);
+    bool success = !reply.failed;
+
+    if (success && conn->protocol == PROTOCOL_TEXT)
+    {
+        success = connection_output_append(conn, "{", 1) &&
+                  connection_output_append(conn, reply.pairs.data, reply.pairs.len) &&
+                  connection_output_append(conn, "}\n", 2);
+    }
+    else if (success)
+    {
+        success = (conn->protocol == PROTOCOL_RESP3 ? output_append(conn, "%%%zu\r\n", found)
+                                                    : output_append(conn, "*%zu\r\n", found * 2)) &&
+                  connection_output_append(conn, reply.pairs.data, reply.pairs.len);
+    }
+
+    free(reply.pairs.data);
+    return success;
+}
+
+/**
+ * @brief Runs `CONFIG SET name value`.
+ *
+ * Only settings that can change while serving are accepted; the others
+ * are refused with an error that names the restart they need.
+ *
+ * @param name Name of the setting.
+ * @param value The new value.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool set_config(Slice name, Slice value, Connection *conn)
+{
+    char *name_text = strndup(name.data, name.len);
+    char *value_text = strndup(value.data, value.len);
+    if (!name_text || !value_text)
+    {
+        free(name_text);
+        free(value_text);
+        return false;
+    }
+
+    ConfigStatus status = config_set(name_text, value_text, true);
+    if (status == CONFIG_OK)
+        log_info("CONFIG SET %s \"%s\"", name_text, value_text);
+
+    free(name_text);
+    free(value_text);
+
+    switch (status)
+    {
+    case CONFIG_OK:
+        return reply_status(conn, SUCCESS_RESP_MSG);
+    case CONFIG_UNKNOWN:
+        return reply_error(conn, UNKNOWN_SETTING_MSG);
+    case CONFIG_NEEDS_RESTART:
+        return reply_error(conn, SETTING_RESTART_MSG);
+    default:
+        return reply_error(conn, INVALID_SETTING_MSG);
+    }
+}
+
+/**
+ * @brief Runs `CONFIG GET pattern` or `CONFIG SET name value`.
+ * @param cmd The CONFIG command; the key is the subcommand.
+ * @param conn The client connection receiving the reply.
+ * @return true on success, false on allocation failure.
+ */
+static bool run_config(Command *cmd, Connection *conn)
+{
+    if (!cmd->key.data)
+        return reply_error(conn, INVALID_ARGS);
+
+    if (cmd->key.len == 3 && strncasecmp(cmd->key.data, "GET", 3) == 0)
+    {
+        if (cmd->arg_count != 1)
+            return reply_error(conn, cmd->arg_count == 0 ? INVALID_ARGS : SYNTAX_ERROR_MSG);
+
+        return get_config(cmd->args[0], conn);
+    }
+
+    if (cmd->key.len == 3 && strncasecmp(cmd->key.data, "SET", 3) == 0)
+    {
+        if (cmd->arg_count != 2)
+            return reply_error(conn, cmd->arg_count < 2 ? INVALID_ARGS : SYNTAX_ERROR_MSG);
+
+        return set_config(cmd->args[0], cmd->args[1], conn);
+    }
+
+    return reply_error(conn, SYNTAX_ERROR_MSG);
+}
+
+/**
+ * @brief Runs a command and appends its reply.
+ * @param cmd The parsed command.
+ * @param conn The client connection; HELLO updates its protocol, GETALL starts its stream.
+ * @return true on success, false on allocation failure.
  */
-char *execute_command(Command *cmd)
+static bool run_command(Command *cmd, Connection *conn)
 {
-    char *response = malloc(RESP_BUFF_SIZE);
+    Protocol *protocol = &conn->protocol;
+
+    if (cmd->too_many_args)
+    {
+        return reply_error(conn, TOO_MANY_ARGS_MSG);
+    }
 
-    if (!response)
+    // Replicas only change through the stream from their primary
+    if (writes_keyspace(cmd->type) && replication_is_replica())
     {
-        return FAILURE_RESP_MSG;
+        return reply_error(conn, READONLY_MSG);
     }
 
-    memset(response, 0, RESP_BUFF_SIZE);
+    // After the append-only file lost a record under appendfsync always, no write could be acknowledged
+    if (writes_keyspace(cmd->type) && aof_failed())
+    {
+        return reply_error(conn, AOF_FAILED_MSG);
+    }
 
     switch (cmd->type)
     {
     case CMD_SET:
-        if (!cmd->key)
+        if (!cmd->key.data)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", INVALID_KEY);
+            return reply_error(conn, INVALID_KEY);
         }
-        else if (!cmd->args || !cmd->args[0])
+        else if (cmd->arg_count == 0)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", INVALID_ARGS);
+            return reply_error(conn, INVALID_ARGS);
         }
         else
         {
-            remove_trailing_newline(cmd->key);
-            remove_trailing_newline(cmd->args[0]);
-            bool success = hash_map_set(map, cmd->key, cmd->args[0]);
+            uint64_t expire_at;
+            const char *error = parse_set_options(cmd, &expire_at);
+            if (error)
+                return reply_error(conn, error);
+
+            StoreShard *shard = store_shard_for_key(cmd->key.data, cmd->key.len);
+            pthread_mutex_lock(&shard->lock);
+            bool success = hash_map_set(shard->map, cmd->key.data, cmd->key.len, cmd->args[0].data, cmd->args[0].len, expire_at);
+
+            // Logged under the shard lock so records of a key reach the file and the replicas in the order they were applied
+            if (success && aof_logging())
+                aof_log_set(cmd->key.data, cmd->key.len, cmd->args[0].data, cmd->args[0].len, expire_at);
+            pthread_mutex_unlock(&shard->lock);
 
             if (success)
             {
-                snprintf(response, RESP_BUFF_SIZE, "%s\n", SUCCESS_RESP_MSG);
-            }
-            else
-            {
-                snprintf(response, RESP_BUFF_SIZE, "%s\n", FAILURE_RESP_MSG);
+                return reply_status(conn, SUCCESS_RESP_MSG);
             }
+
+            return reply_error(conn, FAILURE_RESP_MSG);
         }
-        break;
 
     case CMD_GET:
-        if (!cmd->key)
+        if (!cmd->key.data)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", INVALID_KEY);
+            return reply_error(conn, INVALID_KEY);
         }
         else
         {
-            remove_trailing_newline(cmd->key);
-            char *value = hash_map_get(map, cmd->key);
-
-            if (value)
-            {
-                snprintf(response, RESP_BUFF_SIZE, "%s\n", value);
-            }
-            else
-            {
-                snprintf(response, RESP_BUFF_SIZE, "%p\n", NULL);
-            }
+            return get_value(cmd, conn);
         }
-        break;
 
     case CMD_REMOVE:
-        if (!cmd->key)
+        if (!cmd->key.data)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", INVALID_KEY);
+            return reply_error(conn, INVALID_KEY);
         }
         else
         {
-            remove_trailing_newline(cmd->key);
-            bool success = hash_map_remove(map, cmd->key);
-            snprintf(response, RESP_BUFF_SIZE, "%d\n", success);
+            StoreShard *shard = store_shard_for_key(cmd->key.data, cmd->key.len);
+            pthread_mutex_lock(&shard->lock);
+            bool success = hash_map_remove(shard->map, cmd->key.data, cmd->key.len);
+            if (success && aof_logging())
+                aof_log_remove(cmd->key.data, cmd->key.len);
+            pthread_mutex_unlock(&shard->lock);
+            return reply_integer(conn, success);
         }
-        break;
 
-    case CMD_GET_ALL:
-        char *all_entries = hash_map_get_all(map);
-        if (!all_entries)
+    case CMD_EXPIRE:
+        if (!cmd->key.data)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", FAILURE_RESP_MSG);
-            break;
+            return reply_error(conn, INVALID_KEY);
         }
-
-        size_t len = strlen(all_entries) + 2;
-        char *large_response = malloc(len);
-        if (!large_response)
+        else if (cmd->arg_count == 0)
         {
-            snprintf(response, RESP_BUFF_SIZE, "%s\n", FAILURE_RESP_MSG);
+            return reply_error(conn, INVALID_ARGS);
         }
         else
         {
-            snprintf(large_response, len, "%s\n", all_entries);
-            free(response);
-            free(all_entries);
-            return large_response;
+            uint64_t ttl_ms;
+            if (cmd->arg_count != 1)
+                return reply_error(conn, SYNTAX_ERROR_MSG);
+
+            if (!parse_ttl(cmd->args[0], 1000, &ttl_ms))
+                return reply_error(conn, INVALID_EXPIRE_MSG);
+
+            // EXPIRE key 0 removes the key right away
+            StoreShard *shard = store_shard_for_key(cmd->key.data, cmd->key.len);
+            uint64_t expire_at = current_time_ms() + ttl_ms;
+            pthread_mutex_lock(&shard->lock);
+            bool success = hash_map_expire(shard->map, cmd->key.data, cmd->key.len, expire_at);
+            if (success && aof_logging())
+                log_expire(shard, cmd->key, expire_at);
+            pthread_mutex_unlock(&shard->lock);
+            return reply_integer(conn, success);
         }
-        break;
+
+    case CMD_TTL:
+        if (!cmd->key.data)
+            return reply_error(conn, INVALID_KEY);
+
+        return get_ttl(cmd, conn);
+
+    case CMD_MGET:
+        if (!cmd->key.data)
+            return reply_error(conn, INVALID_KEY);
+
+        return get_many(cmd, conn);
+
+    case CMD_MSET:
+        if (!cmd->key.data)
+            return reply_error(conn, INVALID_KEY);
+
+        // Every key needs a value
+        if (cmd->arg_count % 2 == 0)
+            return reply_error(conn, INVALID_ARGS);
+
+        return set_many(cmd, conn);
+
+    case CMD_MDEL:
+        if (!cmd->key.data)
+            return reply_error(conn, INVALID_KEY);
+
+        return remove_many(cmd, conn);
+
+    case CMD_INCR:
+    case CMD_DECR:
+    case CMD_INCRBY:
+    case CMD_DECRBY:
+        if (!cmd->key.data)
+            return reply_error(conn, INVALID_KEY);
+
+        return increment(cmd, conn);
+
+    case CMD_GET_ALL:
+        return start_get_all(conn);
+
+    case CMD_SCAN:
+        return scan_keys(cmd, conn);
+
+    case CMD_SLABS:
+    {
+        ResponseBuffer json;
+        if (!get_slab_stats(&json))
+            return reply_error(conn, FAILURE_RESP_MSG);
+
+        return reply_json(conn, &json);
+    }
+
+    case CMD_INFO:
+    {
+        ResponseBuffer json;
+        if (!get_info(&json))
+            return reply_error(conn, FAILURE_RESP_MSG);
+
+        return reply_json(conn, &json);
+    }
+
+    case CMD_BGREWRITEAOF:
+        if (!aof_enabled())
+            return reply_error(conn, AOF_DISABLED_MSG);
+
+        if (!aof_rewrite_async())
+            return reply_error(conn, REWRITE_RUNNING_MSG);
+
+        return reply_status(conn, "Background append only file rewriting started");
+
+    case CMD_BGSAVE:
+    {
+        SnapshotStats snapshot;
+        snapshot_stats(&snapshot);
+        if (!snapshot.enabled)
+            return reply_error(conn, SNAPSHOT_DISABLED_MSG);
+
+        if (!snapshot_save_async())
+            return reply_error(conn, SAVE_RUNNING_MSG);
+
+        return reply_status(conn, "Background saving started");
+    }
+
+    case CMD_SYNC:
+        return start_sync(cmd, conn);
+
+    case CMD_CONFIG:
+        return run_config(cmd, conn);
+
+    case CMD_PING:
+        if (cmd->key.data)
+            return reply_bulk(conn, cmd->key.data, cmd->key.len);
+
+        return reply_status(conn, "PONG");
+
+    case CMD_HELLO:
+        if (!select_protocol(cmd, protocol))
+            return reply_error(conn, NO_PROTO_MSG);
+
+        return reply_hello(conn);
 
     default:
-        snprintf(response, RESP_BUFF_SIZE, "%s\n", INVALID_CMD_MSG);
-        break;
+        return reply_error(conn, INVALID_CMD_MSG);
     }
+}
+
+/**
+ * @brief Executes a given command and queues its reply.
+ *
+ * This function processes the command based on its type and performs actions such as
+ * setting, getting, removing, or retrieving all key-value pairs from the hashmap.
+ * The reply is encoded for the protocol of the connection and appended to its
+ * output queue. A reply that cannot be completed is taken back and replaced
+ * with an error.
+ *
+ * @param cmd Pointer to a Command struct containing the parsed command.
+ * @param conn The client connection.
+ * @return true if a reply was queued, false if not even the error could be.
+ */
+bool execute_command(Command *cmd, Connection *conn)
+{
+    size_t mark = conn->out_bytes;
+
+    if (run_command(cmd, conn))
+        return true;
 
-    return response;
+    connection_output_rewind(conn, mark);
+    conn->stream.active = false;
+    return reply_error(conn, FAILURE_RESP_MSG);
 }
@@ -1,26 +1,48 @@
 #ifndef COMMAND_HANDLER_H
 #define COMMAND_HANDLER_H
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "parser.h"
+#include "connection.h"
 #include "logger.h"
 
 /**
  * @brief Initializes the command handler.
  *
  * This function sets up any necessary resources for handling commands.
- * It should be called before executing any commands.
+ * It should be called once, before any worker thread executes commands.
+ *
+ * @param shard_count Number of shards to split the keyspace into.
  */
-void initialize_command_handler();
+void initialize_command_handler(size_t shard_count);
 
 /**
- * @brief Executes a given command and returns the response.
+ * @brief Executes a given command and queues its reply on the connection.
+ *
+ * This function takes a parsed command, processes it, and appends the reply,
+ * encoded for the protocol of the connection, straight to the output queue of
+ * the connection. Values are copied into the queue while their shard is
+ * locked; no intermediate response buffer is allocated.
  *
- * This function takes a parsed command, processes it, and returns a response.
- * The caller is responsible for freeing the returned string if needed.
+ * `HELLO` updates the protocol of the connection. `GETALL` only queues the
+ * start of its reply and leaves `conn->stream` active; the rest is produced
+ * by `continue_stream`.
  *
  * @param cmd Pointer to a Command struct containing the parsed command.
- * @return A dynamically allocated string containing the command response.
+ * @param conn The client connection the command came from.
+ * @return True if a reply was queued, false if allocation fails.
+ */
+bool execute_command(Command *cmd, Connection *conn);
+
+/**
+ * @brief Queues the next chunk of a streamed reply.
+ *
+ * Clears `conn->stream.active` once the final chunk has been queued.
+ *
+ * @param conn The client connection, whose stream must be active.
+ * @return True on success, false if allocation fails.
  */
-char *execute_command(Command *cmd);
+bool continue_stream(Connection *conn);
 
 #endif // COMMAND_HANDLER_H
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "config.h"
+#include "utils.h"
+
+#define CONFIG_MAX_LINE 1024 /** Longest line accepted in a configuration file */
+#define CONFIG_VALUE_MAX 64  /** Buffer size for the text form of a numeric value */
+
+static ConfigOption *config_options = NULL;
+static size_t config_count = 0;
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Registers the settings table.
+ * @param options The settings.
+ * @param count Number of settings.
+ */
+void config_register(ConfigOption *options, size_t count)
+{
+    config_options = options;
+    config_count = count;
+}
+
+/**
+ * @brief Looks a setting up by name.
+ * @param name Name of the setting.
+ * @return The setting, or NULL if none has that name.
+ */
+static ConfigOption *find_option(const char *name)
+{
+    for (size_t i = 0; i < config_count; i++)
+    {
+        if (strcmp(config_options[i].name, name) == 0)
+            return &config_options[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Parses the value of a numeric setting and checks its range.
+ * @param option The setting.
+ * @param text The value as text.
+ * @param number Receives the number.
+ * @return true if the text is a number within the range of the setting.
+ */
+static bool parse_number(const ConfigOption *option, const char *text, unsigned long long *number)
+{
+    if (option->type == CONFIG_MEMORY)
+    {
+        size_t bytes;
+        if (!parse_memory_size(text, &bytes))
+            return false;
+        *number = bytes;
+    }
+    else
+    {
+        // strtoull accepts signs and leading spaces, which would turn -1 into a huge number
+        if (text[0] < '0' || text[0] > '9')
+            return false;
+
+        char *end;
+        errno = 0;
+        *number = strtoull(text, &end, 10);
+        if (errno == ERANGE || *end != '\0')
+            return false;
+    }
+
+    return *number >= option->min && *number <= option->max;
+}
+
+/**
+ * @brief Writes the current value of a setting in the form it is given in.
+ * @param option The setting.
+ * @param buffer Receives the text if the value is a number.
+ * @return The text, either `buffer` or a string the setting owns.
+ */
+static const char *format_value(const ConfigOption *option, char buffer[CONFIG_VALUE_MAX])
+{
+    switch (option->type)
+    {
+    case CONFIG_INT:
+        snprintf(buffer, CONFIG_VALUE_MAX, "%d", *(int *)option->value);
+        return buffer;
+
+    case CONFIG_UINT:
+        snprintf(buffer, CONFIG_VALUE_MAX, "%u", *(unsigned int *)option->value);
+        return buffer;
+
+    case CONFIG_SIZE:
+    case CONFIG_MEMORY:
+        snprintf(buffer, CONFIG_VALUE_MAX, "%zu", *(size_t *)option->value);
+        return buffer;
+
+    case CONFIG_STRING:
+    {
+        const char *text = *(char **)option->value;
+        return text ? text : "";
+    }
+
+    case CONFIG_ENUM:
+        return option->names[*(int *)option->value];
+    }
+
+    return "";
+}
+
+/**
+ * @brief Parses and stores a value, then lets the setting apply it.
+ * @param option The setting.
+ * @param text The value as text.
+ * @param running Whether the server is already serving clients.
+ * @return true if the setting took the value; on false the previous value is kept.
+ */
+static bool store_value(ConfigOption *option, const char *text, bool running)
+{
+    unsigned long long number = 0;
+    char *string = NULL;
+
+    if (option->type == CONFIG_STRING)
+    {
+        if (text[0] != '\0' && !(string = strdup(text)))
+            return false;
+    }
+    else if (option->type == CONFIG_ENUM)
+    {
+        while (option->names[number] && strcmp(option->names[number], text) != 0)
+            number++;
+        if (!option->names[number])
+            return false;
+    }
+    else if (!parse_number(option, text, &number))
+    {
+        return false;
+    }
+
+    union
+    {
+        int i;
+        unsigned int u;
+        size_t z;
+        char *s;
+    } previous;
+
+    switch (option->type)
+    {
+    case CONFIG_INT:
+    case CONFIG_ENUM:
+        previous.i = *(int *)option->value;
+        __atomic_store_n((int *)option->value, (int)number, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_UINT:
+        previous.u = *(unsigned int *)option->value;
+        __atomic_store_n((unsigned int *)option->value, (unsigned int)number, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_SIZE:
+    case CONFIG_MEMORY:
+        previous.z = *(size_t *)option->value;
+        __atomic_store_n((size_t *)option->value, (size_t)number, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_STRING:
+        previous.s = *(char **)option->value;
+        *(char **)option->value = string;
+        break;
+    }
+
+    if (!option->apply || option->apply(running))
+    {
+        if (option->type == CONFIG_STRING)
+            free(previous.s);
+        return true;
+    }
+
+    switch (option->type)
+    {
+    case CONFIG_INT:
+    case CONFIG_ENUM:
+        __atomic_store_n((int *)option->value, previous.i, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_UINT:
+        __atomic_store_n((unsigned int *)option->value, previous.u, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_SIZE:
+    case CONFIG_MEMORY:
+        __atomic_store_n((size_t *)option->value, previous.z, __ATOMIC_RELAXED);
+        break;
+
+    case CONFIG_STRING:
+        *(char **)option->value = previous.s;
+        free(string);
+        break;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Changes a setting by name.
+ * @param name Name of the setting.
+ * @param value The new value as text.
+ * @param running True when changed by a client, which may only change runtime settings.
+ * @return The outcome.
+ */
+ConfigStatus config_set(const char *name, const char *value, bool running)
+{
+    ConfigOption *option = find_option(name);
+    if (!option)
+        return CONFIG_UNKNOWN;
+
+    if (running && !option->runtime)
+        return CONFIG_NEEDS_RESTART;
+
+    pthread_mutex_lock(&config_mutex);
+    bool success = store_value(option, value, running);
+    pthread_mutex_unlock(&config_mutex);
+
+    return success ? CONFIG_OK : CONFIG_INVALID;
+}
+
+/**
+ * @brief Reads `name value` lines from a configuration file.
+ * @param path Path of the file.
+ * @return true if every line was a valid setting.
+ */
+bool config_load_file(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        perror(path);
+        return false;
+    }
+
+    char line[CONFIG_MAX_LINE];
+    int number = 0;
+    bool success = true;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        number++;
+        size_t len = strlen(line);
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n' && !feof(file))
+        {
+            fprintf(stderr, "%s:%d: line too long\n", path, number);
+            fclose(file);
+            return false;
+        }
+
+        while (len > 0 && strchr(" \t\r\n", line[len - 1]))
+            line[--len] = '\0';
+
+        char *name = line + strspn(line, " \t");
+        if (*name == '\0' || *name == '#')
+            continue;
+
+        char *value = name + strcspn(name, " \t");
+        if (*value != '\0')
+        {
+            *value++ = '\0';
+            value += strspn(value, " \t");
+        }
+
+        len = strlen(value);
+        if (len >= 2 && value[0] == '"' && value[len - 1] == '"')
+        {
+            value[len - 1] = '\0';
+            value++;
+        }
+
+        ConfigStatus status = config_set(name, value, false);
+        if (status != CONFIG_OK)
+        {
+            fprintf(stderr, "%s:%d: %s: %s\n", path, number, name, config_status_message(status));
+            success = false;
+        }
+    }
+
+    if (ferror(file))
+    {
+        perror(path);
+        success = false;
+    }
+
+    fclose(file);
+    return success;
+}
+
+/**
+ * @brief Visits the settings matching a pattern.
+ * @param pattern The pattern bytes.
+ * @param pattern_len Length of the pattern.
+ * @param visitor Callback invoked with the name and value of every match.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return The number of matches.
+ */
+size_t config_get(const char *pattern, size_t pattern_len, ConfigVisitor visitor, void *ctx)
+{
+    size_t matches = 0;
+    char buffer[CONFIG_VALUE_MAX];
+
+    pthread_mutex_lock(&config_mutex);
+    for (size_t i = 0; i < config_count; i++)
+    {
+        const ConfigOption *option = &config_options[i];
+        if (!glob_match(pattern, pattern_len, option->name, strlen(option->name)))
+            continue;
+
+        visitor(option->name, format_value(option, buffer), ctx);
+        matches++;
+    }
+    pthread_mutex_unlock(&config_mutex);
+
+    return matches;
+}
+
+/**
+ * @brief Blocks changes until `config_release`.
+ */
+void config_hold(void)
+{
+    pthread_mutex_lock(&config_mutex);
+}
+
+/**
+ * @brief Lets changes blocked by `config_hold` proceed.
+ */
+void config_release(void)
+{
+    pthread_mutex_unlock(&config_mutex);
+}
+
+/**
+ * @brief Describes the outcome of a change.
+ * @param status The outcome.
+ * @return A static description.
+ */
+const char *config_status_message(ConfigStatus status)
+{
+    switch (status)
+    {
+    case CONFIG_OK:
+        return "ok";
+    case CONFIG_UNKNOWN:
+        return "unknown setting";
+    case CONFIG_INVALID:
+        return "invalid value";
+    case CONFIG_NEEDS_RESTART:
+        return "setting can only be changed at startup";
+    }
+
+    return "unknown error";
+}
@@ -0,0 +1,131 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * @brief How the text of a setting maps to the variable it controls.
+ */
+typedef enum
+{
+    CONFIG_INT,    /**< Decimal number stored in an `int` */
+    CONFIG_UINT,   /**< Decimal number stored in an `unsigned int` */
+    CONFIG_SIZE,   /**< Decimal number stored in a `size_t` */
+    CONFIG_MEMORY, /**< Byte count such as `64kb` or `2gb`, stored in a `size_t` */
+    CONFIG_STRING, /**< Text stored in a `char *` owned by the configuration, NULL while empty */
+    CONFIG_ENUM    /**< One of the `names`, stored as its index in an enum-typed variable */
+} ConfigType;
+
+/**
+ * @brief Outcome of changing a setting.
+ */
+typedef enum
+{
+    CONFIG_OK,           /**< The setting took the new value */
+    CONFIG_UNKNOWN,      /**< No setting has that name */
+    CONFIG_INVALID,      /**< The value does not parse or is out of range */
+    CONFIG_NEEDS_RESTART /**< The setting can only be given at startup */
+} ConfigStatus;
+
+/**
+ * @brief A setting that can be given in the configuration file, on the
+ * command line and, if `runtime` is set, with CONFIG SET.
+ */
+typedef struct
+{
+    const char *name;            /** Name in the file, on the command line (`--name`) and in CONFIG */
+    ConfigType type;             /** How the value is parsed and stored */
+    void *value;                 /** Variable the value is stored in */
+    unsigned long long min;      /** Smallest accepted number, for numeric types */
+    unsigned long long max;      /** Largest accepted number, for numeric types */
+    const char *const *names;    /** NULL-terminated value names, for CONFIG_ENUM */
+    bool runtime;                /** Whether CONFIG SET may change it while serving */
+    bool (*apply)(bool running); /** Called after every change, or NULL; returning false restores the previous value */
+} ConfigOption;
+
+/**
+ * @brief Called by `config_get` for every matching setting.
+ *
+ * @param name Name of the setting.
+ * @param value Current value in the form it would be given in.
+ * @param ctx Opaque pointer passed to `config_get`.
+ */
+typedef void (*ConfigVisitor)(const char *name, const char *value, void *ctx);
+
+/**
+ * @brief Registers the settings of the server.
+ *
+ * The table is used in place and must stay valid for the lifetime of the
+ * process. Must be called before any other function of this module.
+ *
+ * @param options The settings.
+ * @param count Number of settings.
+ */
+void config_register(ConfigOption *options, size_t count);
+
+/**
+ * @brief Changes a setting.
+ *
+ * The new value is stored with a relaxed atomic store, so workers may read
+ * numeric settings without locks; they see the change at their next read.
+ * Then the `apply` hook of the setting runs, which may reject the value
+ * after all, e.g. when it conflicts with another setting. Changes are
+ * serialized, so hooks never run concurrently.
+ *
+ * @param name Name of the setting.
+ * @param value The new value as text.
+ * @param running True for CONFIG SET, which may only change runtime settings.
+ * @return CONFIG_OK if the setting took the value.
+ */
+ConfigStatus config_set(const char *name, const char *value, bool running);
+
+/**
+ * @brief Loads settings from a configuration file.
+ *
+ * Each line holds a setting name and its value separated by whitespace; the
+ * value may be enclosed in double quotes. Empty lines and lines starting
+ * with `#` are ignored. Every invalid line is reported on stderr with its
+ * line number.
+ *
+ * @param path Path of the file.
+ * @return True if the file was read and every line was valid.
+ */
+bool config_load_file(const char *path);
+
+/**
+ * @brief Reports the settings whose name matches a glob-style pattern.
+ *
+ * Settings are visited in the order they were registered, while changes
+ * are blocked, so the visitor must not call `config_set`.
+ *
+ * @param pattern The pattern bytes, not null-terminated.
+ * @param pattern_len Length of the pattern.
+ * @param visitor Callback invoked for every match.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return The number of matching settings.
+ */
+size_t config_get(const char *pattern, size_t pattern_len, ConfigVisitor visitor, void *ctx);
+
+/**
+ * @brief Blocks changes, and CONFIG GET, until `config_release`.
+ *
+ * Used while the things `apply` hooks act on are being set up, e.g. while
+ * the worker threads are started.
+ */
+void config_hold(void);
+
+/**
+ * @brief Lets changes blocked by `config_hold` proceed.
+ */
+void config_release(void);
+
+/**
+ * @brief Describes the outcome of a change for error messages.
+ *
+ * @param status The outcome.
+ * @return A static description, e.g. "invalid value".
+ */
+const char *config_status_message(ConfigStatus status);
+
+#endif // CONFIG_H
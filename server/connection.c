@@ -0,0 +1,669 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include "connection.h"
+#include "stats.h"
+#include "utils.h"
+
+#define INITIAL_TABLE_SIZE 1024                /** Initial number of slots in the connection table */
+#define INITIAL_OUTPUT_SEGMENTS 16             /** Initial capacity of a connection output queue */
+#define OUTPUT_BLOCK_SIZE (16 * 1024)          /** Size of the blocks replies are appended into */
+#define OUTPUT_BLOCK_CACHE 64                  /** Written blocks each thread keeps for reuse */
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// Set once from the configuration and read by every worker
+static size_t initial_read_buffer_size = DEFAULT_READ_BUFFER_SIZE;
+static size_t max_read_buffer_size = DEFAULT_MAX_READ_BUFFER_SIZE;
+
+// Each worker thread owns the connections it accepted, so the table is per thread
+static __thread Connection **connection_table = NULL;
+static __thread size_t connection_table_size = 0;
+
+// Blocks are released by the thread that owns the connection, so the cache is per thread too
+static __thread char *block_cache[OUTPUT_BLOCK_CACHE];
+static __thread size_t block_cache_count = 0;
+
+/**
+ * @brief Sets the initial and maximum size of the input buffers.
+ * @param initial Capacity of new input buffers.
+ * @param max Upper bound for a single buffered frame.
+ */
+void connection_set_read_limits(size_t initial, size_t max)
+{
+    __atomic_store_n(&initial_read_buffer_size, initial, __ATOMIC_RELAXED);
+    __atomic_store_n(&max_read_buffer_size, max, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Creates a new connection object for a client socket.
+ * @param fd The client socket file descriptor.
+ * @return Pointer to the newly allocated Connection, or NULL on allocation failure.
+ */
+Connection *create_connection(int fd)
+{
+    Connection *conn = malloc(sizeof(Connection));
+
+    if (!conn)
+        return NULL;
+
+    conn->fd = fd;
+    conn->read_len = 0;
+    conn->read_pos = 0;
+    conn->read_scan = 0;
+    conn->read_cap = __atomic_load_n(&initial_read_buffer_size, __ATOMIC_RELAXED);
+    conn->read_buf = malloc(conn->read_cap);
+
+    if (!conn->read_buf)
+    {
+        free(conn);
+        return NULL;
+    }
+
+    conn->out_iov = NULL;
+    conn->out_blocks = NULL;
+    conn->out_head = 0;
+    conn->out_count = 0;
+    conn->out_cap = 0;
+    conn->out_bytes = 0;
+    conn->reads_paused = false;
+    conn->events = 0;
+    conn->protocol = PROTOCOL_UNKNOWN;
+    conn->stream.active = false;
+    conn->stream.first = false;
+    conn->stream.cursor = 0;
+    conn->recv_armed = false;
+    conn->send_active = false;
+    conn->send_queued = false;
+    conn->hangup = false;
+    conn->closing = false;
+    conn->detached = false;
+    conn->send_next = NULL;
+    conn->ready = false;
+    conn->ready_next = NULL;
+    conn->ready_pprev = NULL;
+    conn->durable_wait = 0;
+    conn->held = false;
+    conn->held_next = NULL;
+    conn->held_pprev = NULL;
+    conn->last_active = monotonic_time_ms();
+    conn->bytes_in = 0;
+    conn->bytes_out = 0;
+    conn->idle_timer.next = NULL;
+    conn->idle_timer.pprev = NULL;
+    conn->idle_timer.data = conn;
+
+    return conn;
+}
+
+/**
+ * @brief Returns a written output block to the per-thread cache, or frees it.
+ * @param block The block; only blocks of the standard size are cached.
+ */
+static void release_block(OutputBlock *block)
+{
+    if (block->cap == OUTPUT_BLOCK_SIZE && block_cache_count < OUTPUT_BLOCK_CACHE)
+        block_cache[block_cache_count++] = block->data;
+    else
+        free(block->data);
+}
+
+/**
+ * @brief Frees the connection and its buffers.
+ * @param conn Pointer to the Connection structure.
+ */
+void free_connection(Connection *conn)
+{
+    if (!conn)
+        return;
+
+    for (size_t i = conn->out_head; i < conn->out_count; i++)
+        release_block(&conn->out_blocks[i]);
+
+    free(conn->out_iov);
+    free(conn->out_blocks);
+    free(conn->read_buf);
+    free(conn);
+}
+
+/**
+ * @brief Makes room for at least one more byte at the end of the input buffer.
+ *
+ * Consumed bytes are moved out of the way once they outnumber the unconsumed
+ * ones; otherwise a full buffer is grown, so a large backlog is not copied
+ * again for every read.
+ *
+ * @param conn Pointer to the Connection structure.
+ * @return true if there is free space, false if the buffer cannot grow any further.
+ */
+static bool reserve_read_space(Connection *conn)
+{
+    size_t pending = conn->read_len - conn->read_pos;
+    size_t max_size = __atomic_load_n(&max_read_buffer_size, __ATOMIC_RELAXED);
+
+    // Compacting copies the unconsumed bytes, so it waits until at least as many were consumed
+    // or the buffer cannot grow anymore
+    if (conn->read_pos > 0 &&
+        (conn->read_pos >= pending || (conn->read_len == conn->read_cap && conn->read_cap >= max_size)))
+    {
+        memmove(conn->read_buf, conn->read_buf + conn->read_pos, pending);
+        conn->read_len = pending;
+        conn->read_scan = conn->read_scan > conn->read_pos ? conn->read_scan - conn->read_pos : 0;
+        conn->read_pos = 0;
+    }
+
+    if (conn->read_len < conn->read_cap)
+        return true;
+
+    if (conn->read_cap >= max_size)
+        return false;
+
+    size_t new_cap = conn->read_cap * 2;
+    char *new_buf = realloc(conn->read_buf, new_cap);
+    if (!new_buf)
+        return false;
+
+    conn->read_buf = new_buf;
+    conn->read_cap = new_cap;
+    return true;
+}
+
+/**
+ * @brief Reads once from the client socket into the free space of the input buffer.
+ * @param conn Pointer to the Connection structure.
+ * @return The status of the read.
+ */
+ConnectionReadStatus connection_read(Connection *conn)
+{
+    if (!reserve_read_space(conn))
+        return CONN_READ_OVERFLOW;
+
+    while (true)
+    {
+        ssize_t bytes_read = read(conn->fd, conn->read_buf + conn->read_len, conn->read_cap - conn->read_len);
+        stats_count_read(bytes_read);
+
+        if (bytes_read > 0)
+        {
+            conn->read_len += bytes_read;
+            conn->bytes_in += bytes_read;
+            conn->last_active = monotonic_time_ms();
+            return CONN_READ_OK;
+        }
+
+        if (bytes_read == 0)
+            return CONN_READ_EOF;
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return CONN_READ_AGAIN;
+
+        return CONN_READ_ERROR;
+    }
+}
+
+/**
+ * @brief Copies received bytes into the input buffer, growing it as needed.
+ * @param conn Pointer to the Connection structure.
+ * @param data The received bytes.
+ * @param len Number of bytes.
+ * @return true on success, false if the buffer cannot grow any further.
+ */
+bool connection_append_input(Connection *conn, const char *data, size_t len)
+{
+    stats_count_bytes_in(len);
+    conn->bytes_in += len;
+    conn->last_active = monotonic_time_ms();
+
+    while (len > 0)
+    {
+        if (!reserve_read_space(conn))
+            return false;
+
+        size_t chunk = conn->read_cap - conn->read_len;
+        if (chunk > len)
+            chunk = len;
+
+        memcpy(conn->read_buf + conn->read_len, data, chunk);
+        conn->read_len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns the next complete frame in the input buffer.
+ * @param conn Pointer to the Connection structure.
+ * @param len Receives the length of the frame.
+ * @return Pointer to the null-terminated frame, or NULL if only a partial frame is buffered.
+ */
+char *connection_next_frame(Connection *conn, size_t *len)
+{
+    char *start = conn->read_buf + conn->read_pos;
+    size_t scan_from = conn->read_scan > conn->read_pos ? conn->read_scan : conn->read_pos;
+    char *newline = memchr(conn->read_buf + scan_from, '\n', conn->read_len - scan_from);
+
+    if (!newline)
+    {
+        // Remember how far we looked so a large partial frame is not rescanned on every read
+        conn->read_scan = conn->read_len;
+        return NULL;
+    }
+
+    size_t frame_len = newline - start;
+    conn->read_pos += frame_len + 1;
+
+    if (frame_len > 0 && start[frame_len - 1] == '\r')
+        frame_len--;
+
+    start[frame_len] = '\0';
+    *len = frame_len;
+    return start;
+}
+
+/**
+ * @brief Parses the next text frame or RESP request from the input buffer.
+ * @param conn Pointer to the Connection structure.
+ * @param cmd Receives the command.
+ * @return CONN_COMMAND_READY, CONN_COMMAND_INCOMPLETE or CONN_COMMAND_INVALID.
+ */
+ConnectionCommandStatus connection_next_command(Connection *conn, Command *cmd)
+{
+    if (conn->read_pos == conn->read_len)
+        return CONN_COMMAND_INCOMPLETE;
+
+    const char *start = conn->read_buf + conn->read_pos;
+
+    if (conn->protocol == PROTOCOL_UNKNOWN)
+        conn->protocol = *start == '*' ? PROTOCOL_RESP2 : PROTOCOL_TEXT;
+
+    if (conn->protocol == PROTOCOL_TEXT || *start != '*')
+    {
+        size_t frame_len;
+        char *frame = connection_next_frame(conn, &frame_len);
+        if (!frame)
+            return CONN_COMMAND_INCOMPLETE;
+
+        parse_client_input(frame, frame_len, cmd);
+        return CONN_COMMAND_READY;
+    }
+
+    size_t consumed;
+    switch (parse_resp_command(start, conn->read_len - conn->read_pos, cmd, &consumed))
+    {
+    case RESP_PARSE_OK:
+        conn->read_pos += consumed;
+        return CONN_COMMAND_READY;
+
+    case RESP_PARSE_INCOMPLETE:
+        return CONN_COMMAND_INCOMPLETE;
+
+    default:
+        return CONN_COMMAND_INVALID;
+    }
+}
+
+/**
+ * @brief Adds an empty block of at least `len` bytes to the end of the output queue.
+ * @param conn Pointer to the Connection structure.
+ * @param len Minimum size of the block.
+ * @return The new block, or NULL if allocation fails.
+ */
+static OutputBlock *append_block(Connection *conn, size_t len)
+{
+    if (conn->out_count == conn->out_cap)
+    {
+        if (conn->out_head > 0)
+        {
+            // Reclaim the slots of blocks that were already written
+            size_t pending = conn->out_count - conn->out_head;
+            memmove(conn->out_iov, conn->out_iov + conn->out_head, pending * sizeof(struct iovec));
+            memmove(conn->out_blocks, conn->out_blocks + conn->out_head, pending * sizeof(OutputBlock));
+            conn->out_count = pending;
+            conn->out_head = 0;
+        }
+
+        if (conn->out_count == conn->out_cap)
+        {
+            size_t new_cap = conn->out_cap ? conn->out_cap * 2 : INITIAL_OUTPUT_SEGMENTS;
+            struct iovec *new_iov = realloc(conn->out_iov, new_cap * sizeof(struct iovec));
+            if (!new_iov)
+                return NULL;
+            conn->out_iov = new_iov;
+
+            OutputBlock *new_blocks = realloc(conn->out_blocks, new_cap * sizeof(OutputBlock));
+            if (!new_blocks)
+                return NULL;
+            conn->out_blocks = new_blocks;
+            conn->out_cap = new_cap;
+        }
+    }
+
+    OutputBlock *block = &conn->out_blocks[conn->out_count];
+
+    if (len <= OUTPUT_BLOCK_SIZE)
+    {
+        block->cap = OUTPUT_BLOCK_SIZE;
+        block->data = block_cache_count > 0 ? block_cache[--block_cache_count] : malloc(OUTPUT_BLOCK_SIZE);
+    }
+    else
+    {
+        // Larger replies get a block of their own size
+        block->cap = len;
+        block->data = malloc(len);
+    }
+
+    if (!block->data)
+        return NULL;
+
+    conn->out_iov[conn->out_count].iov_base = block->data;
+    conn->out_iov[conn->out_count].iov_len = 0;
+    conn->out_count++;
+    return block;
+}
+
+/**
+ * @brief Locates the free space after the last queued byte.
+ * @param conn Pointer to the Connection structure.
+ * @param end Receives the first free byte, or NULL if no block is queued.
+ * @return Number of free bytes in the last block.
+ */
+static size_t tail_room(Connection *conn, char **end)
+{
+    if (conn->out_head == conn->out_count)
+    {
+        *end = NULL;
+        return 0;
+    }
+
+    struct iovec *tail = &conn->out_iov[conn->out_count - 1];
+    OutputBlock *block = &conn->out_blocks[conn->out_count - 1];
+
+    *end = (char *)tail->iov_base + tail->iov_len;
+    return block->data + block->cap - *end;
+}
+
+/**
+ * @brief Returns contiguous free space at the end of the output queue.
+ * @param conn Pointer to the Connection structure.
+ * @param len Minimum number of bytes needed.
+ * @param room Receives the number of bytes available; may be NULL.
+ * @return The free space, or NULL if no block could be allocated.
+ */
+char *connection_output_reserve(Connection *conn, size_t len, size_t *room)
+{
+    char *end;
+    size_t available = tail_room(conn, &end);
+
+    if (!end || available < len)
+    {
+        OutputBlock *block = append_block(conn, len);
+        if (!block)
+            return NULL;
+
+        end = block->data;
+        available = block->cap;
+    }
+
+    if (room)
+        *room = available;
+
+    return end;
+}
+
+/**
+ * @brief Queues bytes written into reserved space.
+ * @param conn Pointer to the Connection structure.
+ * @param len Number of bytes written.
+ */
+void connection_output_commit(Connection *conn, size_t len)
+{
+    conn->out_iov[conn->out_count - 1].iov_len += len;
+    conn->out_bytes += len;
+}
+
+/**
+ * @brief Copies bytes to the end of the output queue, splitting them over blocks as needed.
+ * @param conn Pointer to the Connection structure.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return true if the bytes were queued, false if no block could be allocated.
+ */
+bool connection_output_append(Connection *conn, const void *data, size_t len)
+{
+    char *end;
+    size_t available = tail_room(conn, &end);
+
+    // Top up the last block before starting a new one
+    if (available > 0 && available < len)
+    {
+        memcpy(end, data, available);
+        connection_output_commit(conn, available);
+        data = (const char *)data + available;
+        len -= available;
+    }
+
+    char *space = connection_output_reserve(conn, len, NULL);
+    if (!space)
+        return false;
+
+    memcpy(space, data, len);
+    connection_output_commit(conn, len);
+    return true;
+}
+
+/**
+ * @brief Drops the bytes queued after `mark`, releasing blocks that become empty.
+ * @param conn Pointer to the Connection structure.
+ * @param mark Number of queued bytes to keep.
+ */
+void connection_output_rewind(Connection *conn, size_t mark)
+{
+    size_t excess = conn->out_bytes - mark;
+    conn->out_bytes = mark;
+
+    while (conn->out_count > conn->out_head)
+    {
+        struct iovec *tail = &conn->out_iov[conn->out_count - 1];
+
+        if (tail->iov_len > excess)
+        {
+            tail->iov_len -= excess;
+            return;
+        }
+
+        excess -= tail->iov_len;
+        release_block(&conn->out_blocks[conn->out_count - 1]);
+        conn->out_count--;
+    }
+}
+
+/**
+ * @brief Releases fully written segments and advances into a partially written one.
+ * @param conn Pointer to the Connection structure.
+ * @param written Number of bytes the socket accepted.
+ */
+static void consume_output(Connection *conn, size_t written)
+{
+    conn->out_bytes -= written;
+
+    while (written > 0)
+    {
+        struct iovec *iov = &conn->out_iov[conn->out_head];
+
+        if (written < iov->iov_len)
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+            return;
+        }
+
+        written -= iov->iov_len;
+        release_block(&conn->out_blocks[conn->out_head]);
+        conn->out_head++;
+    }
+}
+
+/**
+ * @brief Flushes queued responses to the socket with gathered writes.
+ * @param conn Pointer to the Connection structure.
+ * @return CONN_WRITE_DONE if the queue is empty, CONN_WRITE_PENDING if the socket
+ *         would block, CONN_WRITE_ERROR on failure.
+ */
+ConnectionWriteStatus connection_flush(Connection *conn)
+{
+    while (conn->out_head < conn->out_count)
+    {
+        // Skip empty segments so they never stall the queue
+        if (conn->out_iov[conn->out_head].iov_len == 0)
+        {
+            release_block(&conn->out_blocks[conn->out_head]);
+            conn->out_head++;
+            continue;
+        }
+
+        size_t segments = conn->out_count - conn->out_head;
+        if (segments > IOV_MAX)
+            segments = IOV_MAX;
+
+        ssize_t written = writev(conn->fd, conn->out_iov + conn->out_head, (int)segments);
+        stats_count_write(written);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return CONN_WRITE_PENDING;
+
+            return CONN_WRITE_ERROR;
+        }
+
+        conn->bytes_out += written;
+        conn->last_active = monotonic_time_ms();
+        consume_output(conn, (size_t)written);
+    }
+
+    conn->out_head = 0;
+    conn->out_count = 0;
+    return CONN_WRITE_DONE;
+}
+
+/**
+ * @brief Returns the unwritten part of the output queue.
+ * @param conn Pointer to the Connection structure.
+ * @param count Receives the number of segments.
+ * @return The first segment, or NULL if the queue is empty.
+ */
+struct iovec *connection_pending_output(Connection *conn, int *count)
+{
+    // Skip empty segments so they never stall the queue
+    while (conn->out_head < conn->out_count && conn->out_iov[conn->out_head].iov_len == 0)
+    {
+        release_block(&conn->out_blocks[conn->out_head]);
+        conn->out_head++;
+    }
+
+    if (conn->out_head == conn->out_count)
+    {
+        conn->out_head = 0;
+        conn->out_count = 0;
+        return NULL;
+    }
+
+    size_t segments = conn->out_count - conn->out_head;
+    *count = segments > IOV_MAX ? IOV_MAX : (int)segments;
+    return conn->out_iov + conn->out_head;
+}
+
+/**
+ * @brief Releases the segments covered by a completed gathered write.
+ * @param conn Pointer to the Connection structure.
+ * @param written Number of bytes the socket accepted.
+ */
+void connection_output_sent(Connection *conn, size_t written)
+{
+    stats_count_bytes_out(written);
+    conn->bytes_out += written;
+    conn->last_active = monotonic_time_ms();
+    consume_output(conn, written);
+
+    if (conn->out_head == conn->out_count)
+    {
+        conn->out_head = 0;
+        conn->out_count = 0;
+    }
+}
+
+/**
+ * @brief Stores a connection in the table slot matching its file descriptor.
+ * @param conn Pointer to the Connection structure.
+ * @return true on success, false if the table could not be grown.
+ */
+bool connection_table_add(Connection *conn)
+{
+    size_t fd = (size_t)conn->fd;
+
+    if (fd >= connection_table_size)
+    {
+        size_t new_size = connection_table_size ? connection_table_size : INITIAL_TABLE_SIZE;
+        while (new_size <= fd)
+            new_size *= 2;
+
+        Connection **new_table = realloc(connection_table, new_size * sizeof(Connection *));
+        if (!new_table)
+            return false;
+
+        memset(new_table + connection_table_size, 0, (new_size - connection_table_size) * sizeof(Connection *));
+        connection_table = new_table;
+        connection_table_size = new_size;
+    }
+
+    connection_table[fd] = conn;
+    return true;
+}
+
+/**
+ * @brief Returns the connection stored for a file descriptor.
+ * @param fd The client socket file descriptor.
+ * @return The Connection, or NULL if the slot is empty.
+ */
+Connection *connection_table_get(int fd)
+{
+    if (fd < 0 || (size_t)fd >= connection_table_size)
+        return NULL;
+
+    return connection_table[fd];
+}
+
+/**
+ * @brief Clears the table slot for a file descriptor.
+ * @param fd The client socket file descriptor.
+ */
+void connection_table_remove(int fd)
+{
+    if (fd >= 0 && (size_t)fd < connection_table_size)
+        connection_table[fd] = NULL;
+}
+
+/**
+ * @brief Calls a function for every connection in the table.
+ * @param visit Called with each connection; it must not add or remove any.
+ */
+void connection_table_each(void (*visit)(Connection *))
+{
+    for (size_t fd = 0; fd < connection_table_size; fd++)
+    {
+        if (connection_table[fd])
+            visit(connection_table[fd]);
+    }
+}
@@ -0,0 +1,333 @@
+#ifndef CONNECTION_H
+#define CONNECTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#include "parser.h"
+#include "timer_wheel.h"
+
+#define DEFAULT_READ_BUFFER_SIZE 4096                  /** Initial capacity of a connection input buffer */
+#define DEFAULT_MAX_READ_BUFFER_SIZE (64 * 1024 * 1024) /** Upper bound for a single buffered frame */
+
+/**
+ * @brief Result of draining a client socket into its input buffer.
+ */
+typedef enum
+{
+    CONN_READ_OK,     /**< Data was read and the socket may still have more */
+    CONN_READ_AGAIN,  /**< The socket is drained (EAGAIN), wait for the next event */
+    CONN_READ_EOF,    /**< The peer closed the connection */
+    CONN_READ_ERROR,  /**< A socket error occurred */
+    CONN_READ_OVERFLOW /**< A single frame exceeded the maximum input buffer size */
+} ConnectionReadStatus;
+
+/**
+ * @brief Result of extracting the next command from the input buffer.
+ */
+typedef enum
+{
+    CONN_COMMAND_READY,      /**< A complete command was parsed */
+    CONN_COMMAND_INCOMPLETE, /**< Only part of a command is buffered */
+    CONN_COMMAND_INVALID     /**< The input violates the protocol */
+} ConnectionCommandStatus;
+
+/**
+ * @brief Result of flushing the output queue of a client socket.
+ */
+typedef enum
+{
+    CONN_WRITE_DONE,    /**< All queued responses were written */
+    CONN_WRITE_PENDING, /**< The socket buffer is full, some responses are still queued */
+    CONN_WRITE_ERROR    /**< A socket error occurred */
+} ConnectionWriteStatus;
+
+/**
+ * @brief Progress of a reply that is produced a chunk at a time.
+ *
+ * Used by GETALL: instead of rendering the whole keyspace at once, the next
+ * chunk is generated whenever the output queue has room for it.
+ */
+typedef struct
+{
+    bool active;   /** True while chunks remain to be produced */
+    bool first;    /** True until the first entry has been written */
+    size_t cursor; /** Keyspace cursor to resume from */
+} ReplyStream;
+
+/**
+ * @brief Memory behind one segment of the output queue.
+ *
+ * The segment itself only covers the bytes still to be written; the block
+ * remembers the whole allocation so the free space after the segment can be
+ * appended to, and the allocation released once it has been written.
+ */
+typedef struct
+{
+    char *data; /** Start of the allocation */
+    size_t cap; /** Size of the allocation */
+} OutputBlock;
+
+/**
+ * @brief Per-client connection state.
+ *
+ * Each connected client owns a growable input buffer. Bytes read from the
+ * socket are appended to it and split into newline-delimited frames or RESP
+ * requests, depending on the protocol the client speaks. Any incomplete
+ * trailing request is kept in the buffer until the next wakeup.
+ *
+ * Replies are appended straight into the output queue: a list of blocks,
+ * each one an I/O vector, filled in order and flushed together with `writev`.
+ * Pipelined replies share a block, and blocks are recycled through a small
+ * per-thread cache, so queuing a reply normally allocates nothing. Whatever
+ * the socket does not accept stays queued until it becomes writable.
+ *
+ * With the io_uring backend the socket is never read or written directly:
+ * received data is appended with `connection_append_input` and the output
+ * queue is handed to the kernel with `connection_pending_output`.
+ *
+ * Every read and write that moves data refreshes `last_active` from a coarse
+ * monotonic clock, which the worker compares against the idle timeout.
+ */
+typedef struct Connection
+{
+    int fd;          /** Client socket file descriptor */
+    char *read_buf;  /** Input buffer (dynamically allocated) */
+    size_t read_len; /** Number of bytes currently buffered */
+    size_t read_cap; /** Allocated capacity of the input buffer */
+    size_t read_pos; /** Offset of the first unconsumed byte */
+    size_t read_scan; /** Offset up to which the buffer is known to hold no newline */
+
+    struct iovec *out_iov;    /** Unwritten part of each queued block */
+    OutputBlock *out_blocks;  /** Allocation behind each entry of `out_iov` */
+    size_t out_head;          /** Index of the first block not fully written */
+    size_t out_count;         /** Number of blocks in the queue, including written ones */
+    size_t out_cap;           /** Allocated capacity of the block arrays */
+    size_t out_bytes;         /** Number of bytes still waiting to be written */
+
+    bool reads_paused;     /** True while output is above the high-water mark */
+    unsigned int events;   /** Epoll events the socket is currently registered for */
+    Protocol protocol;     /** Wire protocol, detected from the first byte received */
+    ReplyStream stream;    /** Streamed reply in progress; no new command runs until it ends */
+
+    bool recv_armed;       /** A multishot receive is active (io_uring backend) */
+    bool send_active;      /** A write of the output queue is in flight (io_uring backend) */
+    bool send_queued;      /** Linked into the worker's list of pending writes (io_uring backend) */
+    bool hangup;           /** Close once the output queue is written (io_uring), or once its held replies are (epoll) */
+    bool closing;          /** Closed; freed when no io_uring request refers to it anymore */
+    bool detached;         /** The socket was handed to a replication sender; close without shutting it down */
+    struct Connection *send_next; /** Next connection in the list of pending writes */
+
+    bool ready;                      /** Linked into the worker's ready list: its budget ran out with work left */
+    struct Connection *ready_next;   /** Next connection in the ready list */
+    struct Connection **ready_pprev; /** Link that points at this connection in the ready list */
+
+    uint64_t durable_wait;          /** AOF position its queued replies wait for under appendfsync always, 0 for none */
+    bool held;                      /** Linked into the worker's list of clients waiting for that fsync */
+    struct Connection *held_next;   /** Next connection in the held list */
+    struct Connection **held_pprev; /** Link that points at this connection in the held list */
+
+    uint64_t last_active;  /** Monotonic time in milliseconds data last moved in either direction */
+    uint64_t bytes_in;     /** Bytes received from the client */
+    uint64_t bytes_out;    /** Bytes written to the client */
+    TimerNode idle_timer;  /** Idle timeout in the worker's wheel; `pprev` is NULL while unarmed */
+} Connection;
+
+/**
+ * @brief Sets the size limits of the input buffers.
+ *
+ * Buffers start at `initial` bytes and double while a frame does not fit,
+ * up to `max` bytes. Clients created before the call keep their buffers, but
+ * stop growing them at the new maximum.
+ *
+ * @param initial Capacity of the input buffer of new clients.
+ * @param max Upper bound for a single buffered frame, at least `initial`.
+ */
+void connection_set_read_limits(size_t initial, size_t max);
+
+/**
+ * @brief Creates a new connection object for a client socket.
+ *
+ * @param fd The client socket file descriptor.
+ * @return Pointer to the newly created Connection or NULL if allocation fails.
+ */
+Connection *create_connection(int fd);
+
+/**
+ * @brief Frees all memory associated with a connection.
+ *
+ * The socket itself is not closed.
+ *
+ * @param conn Pointer to the Connection to be freed.
+ */
+void free_connection(Connection *conn);
+
+/**
+ * @brief Performs a single read from the socket into the input buffer.
+ *
+ * Already consumed bytes are compacted away and the buffer grows when full.
+ * Callers are expected to call this repeatedly, processing frames in between,
+ * until it returns something other than `CONN_READ_OK`.
+ *
+ * @param conn Pointer to the Connection.
+ * @return The status of the read.
+ */
+ConnectionReadStatus connection_read(Connection *conn);
+
+/**
+ * @brief Extracts the next complete newline-delimited frame from the input buffer.
+ *
+ * The terminating newline (and an optional preceding carriage return) is replaced
+ * with a null terminator, so the returned frame can be used as a C string. The frame
+ * stays valid until the next call to `connection_read`.
+ *
+ * @param conn Pointer to the Connection.
+ * @param len Output parameter receiving the frame length (excluding the terminator).
+ * @return Pointer to the frame, or NULL if no complete frame is buffered.
+ */
+char *connection_next_frame(Connection *conn, size_t *len);
+
+/**
+ * @brief Parses the next complete command from the input buffer.
+ *
+ * On the first call with buffered data the protocol of the connection is
+ * detected: RESP if the first byte is `*`, the text protocol otherwise. RESP
+ * connections may still send inline (newline-terminated) commands.
+ * The command points into the input buffer and stays valid until the next
+ * call to `connection_read`.
+ *
+ * @param conn Pointer to the Connection.
+ * @param cmd Receives the command.
+ * @return The status of the parse.
+ */
+ConnectionCommandStatus connection_next_command(Connection *conn, Command *cmd);
+
+/**
+ * @brief Returns free space at the end of the output queue.
+ *
+ * The space is contiguous and lies right after the last queued byte, in the
+ * last block if it has room and in a fresh block otherwise. Nothing is
+ * queued until `connection_output_commit` is called, so a reply may be
+ * rendered in place and given up halfway. The space stays valid until the
+ * next call that appends to or flushes the queue.
+ *
+ * @param conn Pointer to the Connection.
+ * @param len Minimum number of bytes needed.
+ * @param room Receives the number of bytes available, at least `len`; may be NULL.
+ * @return The free space, or NULL if allocation fails.
+ */
+char *connection_output_reserve(Connection *conn, size_t len, size_t *room);
+
+/**
+ * @brief Queues bytes written into space returned by `connection_output_reserve`.
+ *
+ * @param conn Pointer to the Connection.
+ * @param len Number of bytes written, at most the reserved room.
+ */
+void connection_output_commit(Connection *conn, size_t len);
+
+/**
+ * @brief Copies bytes to the end of the output queue.
+ *
+ * Data larger than the free space of the last block is split, the rest
+ * going to a block of its own size, so values of any size are sent whole.
+ *
+ * @param conn Pointer to the Connection.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return True if the bytes were queued, false if allocation fails.
+ */
+bool connection_output_append(Connection *conn, const void *data, size_t len);
+
+/**
+ * @brief Discards everything queued after a given point.
+ *
+ * Used to take back a reply that could not be completed. `mark` is the
+ * value `out_bytes` had when the reply was started, and nothing may have
+ * been written to the socket since.
+ *
+ * @param conn Pointer to the Connection.
+ * @param mark Number of queued bytes to keep.
+ */
+void connection_output_rewind(Connection *conn, size_t mark);
+
+/**
+ * @brief Writes as much of the output queue as the socket accepts.
+ *
+ * Queued responses are gathered into `writev` calls, so a whole batch of
+ * pipelined responses normally costs a single system call.
+ *
+ * @param conn Pointer to the Connection.
+ * @return The status of the flush.
+ */
+ConnectionWriteStatus connection_flush(Connection *conn);
+
+/**
+ * @brief Appends received bytes to the input buffer.
+ *
+ * Used when the data was read by someone else, such as an io_uring receive
+ * into a provided buffer. The buffer grows as `connection_read` would.
+ *
+ * @param conn Pointer to the Connection.
+ * @param data The received bytes.
+ * @param len Number of bytes.
+ * @return True on success, false if the input buffer limit would be exceeded.
+ */
+bool connection_append_input(Connection *conn, const char *data, size_t len);
+
+/**
+ * @brief Returns the queued responses as a gathered write.
+ *
+ * Nothing is consumed: the caller writes the segments itself and then reports
+ * the result with `connection_output_sent`. Until then the segments must not
+ * be freed, so the queue must not be flushed in between. Replies may still be
+ * appended: that never moves or changes bytes that are already queued.
+ *
+ * @param conn Pointer to the Connection.
+ * @param count Receives the number of segments, at most `IOV_MAX`.
+ * @return The first segment, or NULL if nothing is queued.
+ */
+struct iovec *connection_pending_output(Connection *conn, int *count);
+
+/**
+ * @brief Releases the part of the output queue written by a gathered write.
+ *
+ * @param conn Pointer to the Connection.
+ * @param written Number of bytes the socket accepted.
+ */
+void connection_output_sent(Connection *conn, size_t written);
+
+/**
+ * @brief Registers a connection in the fd-indexed connection table.
+ *
+ * The table is private to the calling worker thread.
+ *
+ * @param conn Pointer to the Connection to register.
+ * @return True if the connection was registered, false if allocation fails.
+ */
+bool connection_table_add(Connection *conn);
+
+/**
+ * @brief Looks up the connection registered for a file descriptor.
+ *
+ * @param fd The client socket file descriptor.
+ * @return Pointer to the Connection, or NULL if none is registered.
+ */
+Connection *connection_table_get(int fd);
+
+/**
+ * @brief Removes the connection registered for a file descriptor.
+ *
+ * @param fd The client socket file descriptor.
+ */
+void connection_table_remove(int fd);
+
+/**
+ * @brief Calls a function for every connection registered by the calling worker.
+ *
+ * @param visit Called with each connection; it must not register or remove any.
+ */
+void connection_table_each(void (*visit)(Connection *));
+
+#endif // CONNECTION_H
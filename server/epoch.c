@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include "epoch.h"
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * @brief Epoch announced by one reader, alone on its cache line.
+ */
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t epoch; /** Epoch the current read started in, 0 outside of reads */
+} ReaderSlot;
+
+static ReaderSlot *readers = NULL;
+static size_t reader_count = 0;
+static _Atomic uint64_t global_epoch = 1;
+
+static __thread ReaderSlot *local_reader = NULL; /** Slot of the reader running on the calling thread */
+
+/**
+ * @brief Allocates the reader slots.
+ * @param count Number of readers.
+ * @return true on success, false on allocation failure.
+ */
+bool initialize_epoch(size_t count)
+{
+    readers = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(ReaderSlot));
+    if (!readers)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+        atomic_init(&readers[i].epoch, 0);
+
+    reader_count = count;
+    return true;
+}
+
+/**
+ * @brief Binds the calling thread to a reader slot.
+ * @param reader_id Index of the slot.
+ */
+void epoch_attach_reader(size_t reader_id)
+{
+    local_reader = reader_id < reader_count ? &readers[reader_id] : NULL;
+}
+
+/**
+ * @brief Reports whether the calling thread owns a reader slot.
+ * @return true if it does.
+ */
+bool epoch_reader_attached(void)
+{
+    return local_reader != NULL;
+}
+
+/**
+ * @brief Announces the current epoch in the reader slot.
+ */
+void epoch_enter(void)
+{
+    atomic_store_explicit(&local_reader->epoch, atomic_load_explicit(&global_epoch, memory_order_acquire),
+                          memory_order_relaxed);
+
+    // Pairs with the fence in `epoch_safe`: either the writer sees this slot or this reader sees the unlink
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * @brief Clears the reader slot.
+ */
+void epoch_exit(void)
+{
+    atomic_store_explicit(&local_reader->epoch, 0, memory_order_release);
+}
+
+/**
+ * @brief Advances the global epoch.
+ * @return The epoch before the advance, which retired memory is tagged with.
+ */
+uint64_t epoch_retire(void)
+{
+    return atomic_fetch_add_explicit(&global_epoch, 1, memory_order_seq_cst);
+}
+
+/**
+ * @brief Finds the oldest epoch among the active readers.
+ * @return The oldest active epoch, UINT64_MAX if none is active.
+ */
+uint64_t epoch_safe(void)
+{
+    uint64_t oldest = UINT64_MAX;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for (size_t i = 0; i < reader_count; i++)
+    {
+        uint64_t epoch = atomic_load_explicit(&readers[i].epoch, memory_order_acquire);
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    return oldest;
+}
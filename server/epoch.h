@@ -0,0 +1,74 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Allocates the reader slots of the epoch-based reclamation.
+ *
+ * Every worker thread owns a reader slot. While it reads shared memory
+ * without a lock it announces the global epoch it started in; outside of
+ * such a read the slot holds 0.
+ *
+ * A writer that unlinks memory readers may still be looking at tags it with
+ * `epoch_retire`, which also advances the global epoch, and keeps it until
+ * `epoch_safe` reports that every reader active at that point has finished.
+ * Readers that started after the tag was taken can no longer reach the
+ * memory, since the unlink happened before the epoch advanced.
+ *
+ * @param reader_count Number of threads that will read without locks.
+ * @return True on success, false if allocation fails.
+ */
+bool initialize_epoch(size_t reader_count);
+
+/**
+ * @brief Binds the calling thread to a reader slot.
+ *
+ * @param reader_id Index of the slot, less than the count passed to `initialize_epoch`.
+ */
+void epoch_attach_reader(size_t reader_id);
+
+/**
+ * @brief Returns whether the calling thread owns a reader slot.
+ *
+ * Threads without one must read under the locks instead.
+ *
+ * @return True if `epoch_enter` may be called.
+ */
+bool epoch_reader_attached(void);
+
+/**
+ * @brief Starts a read without locks.
+ *
+ * Memory reached from here until `epoch_exit` is not freed, even if a
+ * writer unlinks it in the meantime. Reads must not nest.
+ */
+void epoch_enter(void);
+
+/**
+ * @brief Ends a read started with `epoch_enter`.
+ */
+void epoch_exit(void);
+
+/**
+ * @brief Tags memory that was just unlinked and advances the global epoch.
+ *
+ * Must be called after the memory became unreachable for new readers.
+ *
+ * @return The tag to pass to `epoch_safe`.
+ */
+uint64_t epoch_retire(void);
+
+/**
+ * @brief Returns the oldest epoch a reader is still active in.
+ *
+ * Memory whose tag is lower than this value may be freed. Costs one load
+ * per reader slot, so writers call it for batches of retired memory.
+ *
+ * @return The oldest active epoch, or UINT64_MAX if no reader is active.
+ */
+uint64_t epoch_safe(void);
+
+#endif // EPOCH_H
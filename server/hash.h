@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Picks the process-wide hash seed.
+ *
+ * The seed is read from the kernel's random source so that bucket placement
+ * cannot be predicted by clients. Must be called before any key is hashed
+ * and before worker threads start.
+ */
+void initialize_hash_seed();
+
+/**
+ * @brief Hashes a byte string with the process-wide seed.
+ *
+ * A wyhash-style function: short keys are read with a couple of unaligned
+ * loads and mixed with 64x64->128 bit multiplications.
+ *
+ * @param data Pointer to the bytes to hash.
+ * @param len Number of bytes.
+ * @return 64-bit hash value.
+ */
+uint64_t hash_bytes(const void *data, size_t len);
+
+#endif // HASH_H
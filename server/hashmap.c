@@ -1,234 +1,1824 @@
-#ifdef __STDC_ALLOC_LIB__
-#define __STDC_WANT_LIB_EXT2__ 1
-#else
-#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sched.h>
+#include <endian.h>
+#include "hash.h"
+#include "utils.h"
+#include "epoch.h"
+#include "hashmap.h"
+
+#define GROUP_WIDTH 8              /** Control bytes examined per probe step */
+#define CTRL_EMPTY 0x80            /** Control byte of a slot that was never used */
+#define CTRL_DELETED 0xFE          /** Control byte of a slot whose pair was removed */
+#define MIN_CAPACITY 16            /** Smallest table size */
+#define MIGRATE_SLOTS_PER_OP 64    /** Old table slots moved by every write during a resize */
+#define NOT_FOUND ((size_t)-1)
+#define EVICTION_SAMPLES 5         /** Pairs sampled per eviction */
+#define LRU_CLOCK_MS 1000          /** Resolution of the LRU access clock */
+#define LFU_DECAY_MS 60000         /** Period after which an idle LFU counter drops by one */
+#define LFU_INIT_COUNT 5           /** LFU counter of a new pair, so it is not evicted right away */
+#define LFU_LOG_FACTOR 10          /** Higher values make the LFU counter saturate more slowly */
+#define LFU_MAX_COUNT 255
+#define RECLAIM_BATCH 64           /** Retired blocks a write collects before it tries to free them */
+
+#define LSB_MASK 0x0101010101010101ull
+#define MSB_MASK 0x8080808080808080ull
+
+/**
+ * @brief Expiry timer of a pair, allocated from the map's slabs on first use.
+ */
+typedef struct
+{
+    TimerNode timer;   /** Node linked into the expiry wheel; `data` points at the pair */
+    size_t block_size; /** Usable size of the slab block holding the timer */
+} PairExpiry;
+
+/**
+ * @brief The single allocation behind the arrays of a table.
+ */
+typedef struct
+{
+    size_t capacity; /** Number of slots */
+    KVPair **slots;  /** Slot array, placed after the control bytes */
+    uint8_t ctrl[];  /** Control bytes, `capacity` plus a mirrored group */
+} TableBlock;
+
+/**
+ * @brief Memory unlinked from the map, waiting for lookups without the lock to move on.
+ */
+typedef struct RetiredBlock
+{
+    void *block;       /** The memory */
+    size_t block_size; /** Slab block size, 0 for memory from `malloc` */
+    size_t requested;  /** Bytes requested from the slab allocator */
+    uint64_t epoch;    /** Tag from `epoch_retire`, 0 until the next reclaim takes one */
+} RetiredBlock;
+
+static __thread uint64_t reader_rng = 0;              /** Generator behind the LFU counters of lookups without the lock */
+static __thread char value_text[INT64_TEXT_MAX]; /** Decimal form of the last integer value looked up */
+
+/**
+ * @brief Returns the allocation a table's control bytes belong to.
+ */
+static inline TableBlock *table_block(const uint8_t *ctrl)
+{
+    return (TableBlock *)(ctrl - offsetof(TableBlock, ctrl));
+}
+
+/**
+ * @brief Returns the 7-bit tag stored in the control byte of a full slot.
+ *
+ * Taken from the 32 bits of the hash that pairs keep, as far as possible
+ * from the low bits that pick the slot.
+ *
+ * @param hash Hash of the key.
+ * @return Bits 25 to 31 of the hash.
+ */
+static inline uint8_t hash_tag(uint64_t hash)
+{
+    return (uint8_t)((uint32_t)hash >> 25);
+}
+
+/**
+ * @brief Loads a group of control bytes so that byte `i` of the group ends up in bits `8i..8i+7`.
+ * @param ctrl Pointer to the first control byte of the group.
+ * @return The packed group.
+ */
+static inline uint64_t load_group(const uint8_t *ctrl)
+{
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group);
 #endif
+    return group;
+}
+
+/**
+ * @brief Marks the bytes of a group equal to a tag.
+ *
+ * May report a false positive right after a real match; callers verify
+ * every candidate against the key anyway.
+ */
+static inline uint64_t match_tag(uint64_t group, uint8_t tag)
+{
+    uint64_t x = group ^ (LSB_MASK * tag);
+    return (x - LSB_MASK) & ~x & MSB_MASK;
+}
+
+/**
+ * @brief Marks the empty bytes of a group.
+ */
+static inline uint64_t match_empty(uint64_t group)
+{
+    return group & (~group << 6) & MSB_MASK;
+}
+
+/**
+ * @brief Marks the empty or deleted bytes of a group.
+ */
+static inline uint64_t match_free(uint64_t group)
+{
+    return group & ~(group << 7) & MSB_MASK;
+}
+
+/**
+ * @brief Converts a match mask into the offset of its first marked byte.
+ */
+static inline size_t first_match(uint64_t mask)
+{
+    return (size_t)__builtin_ctzll(mask) >> 3;
+}
+
+/**
+ * @brief Writes a control byte, keeping the mirrored group after the table in sync.
+ * @param table Pointer to the HashTable.
+ * @param index Slot index.
+ * @param ctrl New control byte.
+ */
+static inline void set_ctrl(HashTable *table, size_t index, uint8_t ctrl)
+{
+    // Released so that lookups without the lock seeing a tag also see the slot it was stored with
+    __atomic_store_n(&table->ctrl[index], ctrl, __ATOMIC_RELEASE);
+    if (index < GROUP_WIDTH)
+        __atomic_store_n(&table->ctrl[table->capacity + index], ctrl, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Allocates an empty table.
+ * @param table Pointer to the HashTable to initialize.
+ * @param capacity Number of slots, a power of two no smaller than MIN_CAPACITY.
+ * @return true on success, false on allocation failure.
+ */
+static bool table_init(HashTable *table, size_t capacity)
+{
+    size_t ctrl_size = (capacity + GROUP_WIDTH + sizeof(KVPair *) - 1) & ~(sizeof(KVPair *) - 1);
+    TableBlock *block = malloc(sizeof(TableBlock) + ctrl_size + capacity * sizeof(KVPair *));
+
+    if (!block)
+        return false;
+
+    block->capacity = capacity;
+    block->slots = (KVPair **)(block->ctrl + ctrl_size);
+    memset(block->ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+
+    table->ctrl = block->ctrl;
+    table->slots = block->slots;
+    table->capacity = capacity;
+    table->size = 0;
+    table->used = 0;
+    return true;
+}
+
+/**
+ * @brief Copies a table descriptor into the map.
+ *
+ * The control byte pointer is stored last and released, since lookups
+ * without the lock reach the table through it alone.
+ *
+ * @param dst The table of the map to overwrite.
+ * @param src The new descriptor.
+ */
+static void publish_table(HashTable *dst, const HashTable *src)
+{
+    dst->slots = src->slots;
+    dst->capacity = src->capacity;
+    dst->size = src->size;
+    dst->used = src->used;
+    __atomic_store_n(&dst->ctrl, src->ctrl, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Marks the start of a change that moves pairs between tables.
+ *
+ * Lookups without the lock that miss while `moves` is odd or has changed
+ * retry, since the key may have been in transit.
+ *
+ * @param map Pointer to the HashMap structure.
+ */
+static inline void begin_moves(HashMap *map)
+{
+    __atomic_store_n(&map->moves, map->moves + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Marks the end of a change started with `begin_moves`.
+ * @param map Pointer to the HashMap structure.
+ */
+static inline void end_moves(HashMap *map)
+{
+    __atomic_store_n(&map->moves, map->moves + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns memory to where it was allocated from.
+ * @param map Pointer to the HashMap structure.
+ * @param block The memory.
+ * @param block_size Slab block size, 0 for memory from `malloc`.
+ * @param requested Bytes requested from the slab allocator.
+ */
+static void release_block(HashMap *map, void *block, size_t block_size, size_t requested)
+{
+    if (block_size == 0)
+        free(block);
+    else
+        slab_free(&map->slabs, block, block_size, requested);
+}
+
+/**
+ * @brief Frees the retired blocks no lookup without the lock can see anymore.
+ *
+ * Blocks retired since the last call are tagged with a single advance of
+ * the global epoch, which all of them were unlinked before.
+ *
+ * @param map Pointer to the HashMap structure.
+ */
+void hash_map_reclaim(HashMap *map)
+{
+    if (map->retired_count == 0)
+        return;
+
+    uint64_t epoch = 0;
+    for (size_t i = map->retired_count; i-- > 0 && map->retired[i].epoch == 0;)
+    {
+        if (epoch == 0)
+            epoch = epoch_retire();
+        map->retired[i].epoch = epoch;
+    }
+
+    uint64_t safe = epoch_safe();
+    size_t kept = 0;
+
+    for (size_t i = 0; i < map->retired_count; i++)
+    {
+        RetiredBlock *retired = &map->retired[i];
+
+        if (retired->epoch < safe)
+            release_block(map, retired->block, retired->block_size, retired->requested);
+        else
+            map->retired[kept++] = *retired;
+    }
+
+    map->retired_count = kept;
+    map->reclaim_at = kept + RECLAIM_BATCH;
+}
+
+/**
+ * @brief Frees memory that was just unlinked from the map, once no lookup can see it.
+ *
+ * Without concurrent reads it is freed right away.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param block The memory.
+ * @param block_size Slab block size, 0 for memory from `malloc`.
+ * @param requested Bytes requested from the slab allocator.
+ */
+static void retire_block(HashMap *map, void *block, size_t block_size, size_t requested)
+{
+    if (!map->concurrent)
+    {
+        release_block(map, block, block_size, requested);
+        return;
+    }
+
+    if (map->retired_count == map->retired_cap)
+    {
+        size_t cap = map->retired_cap ? map->retired_cap * 2 : RECLAIM_BATCH * 2;
+        RetiredBlock *retired = realloc(map->retired, cap * sizeof(RetiredBlock));
+
+        if (!retired)
+        {
+            // Nowhere to keep it, so wait until the lookups that may see it are done
+            uint64_t epoch = epoch_retire();
+            while (epoch_safe() <= epoch)
+                sched_yield();
+
+            release_block(map, block, block_size, requested);
+            return;
+        }
+
+        map->retired = retired;
+        map->retired_cap = cap;
+    }
+
+    map->retired[map->retired_count++] = (RetiredBlock){block, block_size, requested, 0};
+
+    if (map->retired_count >= map->reclaim_at)
+        hash_map_reclaim(map);
+}
+
+/**
+ * @brief Retires the arrays of a table (not the pairs it references) and clears it.
+ * @param map Pointer to the HashMap owning the table.
+ * @param table Pointer to the HashTable.
+ */
+static void table_release(HashMap *map, HashTable *table)
+{
+    TableBlock *block = table_block(table->ctrl);
+
+    __atomic_store_n(&table->ctrl, NULL, __ATOMIC_RELEASE);
+    memset(table, 0, sizeof(*table));
+    retire_block(map, block, 0, 0);
+}
+
+/**
+ * @brief Finds the slot holding a key.
+ * @param table Pointer to the HashTable.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @return The slot index, or NOT_FOUND.
+ */
+static size_t table_find(const HashTable *table, const char *key, size_t key_len, uint64_t hash)
+{
+    if (!table->ctrl)
+        return NOT_FOUND;
+
+    size_t mask = table->capacity - 1;
+    size_t pos = hash & mask;
+    uint8_t tag = hash_tag(hash);
+
+    while (true)
+    {
+        uint64_t group = load_group(table->ctrl + pos);
+
+        for (uint64_t match = match_tag(group, tag); match; match &= match - 1)
+        {
+            size_t index = (pos + first_match(match)) & mask;
+            KVPair *pair = table->slots[index];
+
+            if (pair->hash == (uint32_t)hash && pair->key_len == key_len && memcmp(kv_key(pair), key, key_len) == 0)
+                return index;
+        }
+
+        // An empty slot ends every probe sequence that could contain the key
+        if (match_empty(group))
+            return NOT_FOUND;
+
+        pos = (pos + GROUP_WIDTH) & mask;
+    }
+}
+
+/**
+ * @brief Places a pair that is known not to be in the table.
+ * @param table Pointer to the HashTable, which must have a free slot.
+ * @param pair The pair to store.
+ */
+static void table_insert(HashTable *table, KVPair *pair)
+{
+    size_t mask = table->capacity - 1;
+    size_t pos = pair->hash & mask;
+
+    while (true)
+    {
+        uint64_t match = match_free(load_group(table->ctrl + pos));
+
+        if (match)
+        {
+            size_t index = (pos + first_match(match)) & mask;
+
+            if (table->ctrl[index] == CTRL_EMPTY)
+                table->used++;
+
+            __atomic_store_n(&table->slots[index], pair, __ATOMIC_RELAXED);
+            set_ctrl(table, index, hash_tag(pair->hash));
+            table->size++;
+            return;
+        }
+
+        pos = (pos + GROUP_WIDTH) & mask;
+    }
+}
+
+/**
+ * @brief Marks a slot as deleted.
+ *
+ * The slot keeps counting towards the load until the next resize, since
+ * probe sequences of other keys may run through it.
+ *
+ * @param table Pointer to the HashTable.
+ * @param index The slot to clear.
+ */
+static void table_erase(HashTable *table, size_t index)
+{
+    set_ctrl(table, index, CTRL_DELETED);
+    table->size--;
+}
+
+/**
+ * @brief Moves pairs from the old table into the current one.
+ * @param map Pointer to the HashMap structure.
+ * @param budget Maximum number of old slots to visit.
+ */
+static void migrate(HashMap *map, size_t budget)
+{
+    HashTable *old = &map->old;
+
+    if (!old->ctrl)
+        return;
+
+    begin_moves(map);
+
+    // Each pair is in the new table before it leaves the old one
+    while (budget-- > 0 && old->size > 0 && map->migrate_pos < old->capacity)
+    {
+        size_t index = map->migrate_pos++;
+
+        if (old->ctrl[index] < CTRL_EMPTY)
+        {
+            table_insert(&map->table, old->slots[index]);
+            table_erase(old, index);
+        }
+    }
+
+    if (old->size == 0 || map->migrate_pos >= old->capacity)
+    {
+        table_release(map, old);
+        map->migrate_pos = 0;
+    }
+
+    end_moves(map);
+}
+
+/**
+ * @brief Makes sure the current table can take one more pair.
+ *
+ * When the table is too full, a new one replaces it and the previous one is
+ * drained incrementally. The new table doubles in size unless most of the
+ * load is deleted slots, in which case it keeps the same size.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @return true on success, false on allocation failure.
+ */
+static bool reserve_slot(HashMap *map)
+{
+    HashTable *table = &map->table;
+
+    if ((table->used + 1) * 8 <= table->capacity * 7)
+        return true;
+
+    // A resize is already in progress; complete it before starting another
+    migrate(map, SIZE_MAX);
+
+    size_t capacity = table->capacity;
+    if ((table->size + 1) * 2 > capacity)
+        capacity *= 2;
+
+    HashTable next;
+    if (!table_init(&next, capacity))
+        return false;
+
+    begin_moves(map);
+
+    // Lookups without the lock check the old table first, so it is published first
+    publish_table(&map->old, table);
+    publish_table(&map->table, &next);
+    map->migrate_pos = 0;
+
+    if (map->old.size == 0)
+        table_release(map, &map->old);
+
+    end_moves(map);
+    return true;
+}
+
+/**
+ * @brief Looks a key up in both tables.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @return The slot holding the pair, or NULL if the key is not stored.
+ */
+static KVPair **lookup(HashMap *map, const char *key, size_t key_len, uint64_t hash)
+{
+    size_t index = table_find(&map->table, key, key_len, hash);
+    if (index != NOT_FOUND)
+        return &map->table.slots[index];
+
+    index = table_find(&map->old, key, key_len, hash);
+    if (index != NOT_FOUND)
+        return &map->old.slots[index];
+
+    return NULL;
+}
+
+/**
+ * @brief Advances an xorshift generator.
+ * @param state State of the generator, never 0.
+ * @return The next pseudo-random number.
+ */
+static inline uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief Returns the clock pairs are aged by for eviction, in milliseconds.
+ *
+ * Uses the tick of the expiry wheel, which the active expiry sweep keeps
+ * within one sweep period of the wall clock, so accesses never read the
+ * clock themselves.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @return The clock.
+ */
+static inline uint64_t access_clock(const HashMap *map)
+{
+    return __atomic_load_n(&map->expiry.current, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns an LFU counter, decayed by the minutes its pair sat idle.
+ *
+ * The upper 24 bits of `access` hold the minute of the last decay, the low
+ * 8 bits the counter.
+ *
+ * @param access The eviction metadata of the pair.
+ * @param minute The current minute.
+ * @return The decayed counter.
+ */
+static inline uint32_t lfu_count(uint32_t access, uint32_t minute)
+{
+    uint32_t count = access & 0xFF;
+    uint32_t idle = (minute - (access >> 8)) & 0xFFFFFF;
+
+    return idle < count ? count - idle : 0;
+}
+
+/**
+ * @brief Computes the eviction metadata of a pair after an access.
+ *
+ * LFU counters grow logarithmically: the higher the counter, the less
+ * likely an access increments it, so 8 bits cover millions of hits.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param access The current metadata.
+ * @param created Whether the pair was just created.
+ * @param rng Generator deciding LFU increments.
+ * @return The new metadata.
+ */
+static uint32_t accessed(const HashMap *map, uint32_t access, bool created, uint64_t *rng)
+{
+    if (map->policy == EVICTION_LRU)
+        return (uint32_t)(access_clock(map) / LRU_CLOCK_MS);
+
+    uint32_t minute = (uint32_t)(access_clock(map) / LFU_DECAY_MS) & 0xFFFFFF;
+    uint32_t count = created ? LFU_INIT_COUNT : lfu_count(access, minute);
+
+    if (!created && count < LFU_MAX_COUNT)
+    {
+        uint32_t base = count > LFU_INIT_COUNT ? count - LFU_INIT_COUNT : 0;
+        if (next_random(rng) % ((uint64_t)base * LFU_LOG_FACTOR + 1) == 0)
+            count++;
+    }
+
+    return (minute << 8) | count;
+}
+
+/**
+ * @brief Records an access to a pair in its eviction metadata.
+ *
+ * Lookups without the lock update it too, so it is stored atomically.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param pair The pair.
+ * @param created Whether the pair was just created.
+ */
+static void touch_pair(HashMap *map, KVPair *pair, bool created)
+{
+    uint32_t access = accessed(map, __atomic_load_n(&pair->access, __ATOMIC_RELAXED), created, &map->rng);
+    __atomic_store_n(&pair->access, access, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief The form a value is stored in, worked out before the pair is written.
+ */
+typedef struct
+{
+    const char *text; /** The value as given */
+    size_t len;       /** Bytes stored: the text length, or the integer width */
+    KVEncoding encoding;
+    int64_t integer; /** The value, for `KV_ENCODING_INT` */
+} StoredValue;
+
+/**
+ * @brief Returns the number of bytes that hold an integer value.
+ * @param value The integer.
+ * @return 1, 2, 4 or 8.
+ */
+static inline size_t integer_width(int64_t value)
+{
+    if (value >= INT8_MIN && value <= INT8_MAX)
+        return 1;
+    if (value >= INT16_MIN && value <= INT16_MAX)
+        return 2;
+    if (value >= INT32_MIN && value <= INT32_MAX)
+        return 4;
+    return 8;
+}
+
+/**
+ * @brief Picks the encoding of a value.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @return The stored form.
+ */
+static StoredValue encode_value(const char *value, size_t value_len)
+{
+    StoredValue stored = {value, value_len, KV_ENCODING_RAW, 0};
+
+    if (value_len <= INT64_TEXT_MAX && parse_int64(value, value_len, &stored.integer))
+    {
+        stored.encoding = KV_ENCODING_INT;
+        stored.len = integer_width(stored.integer);
+    }
+
+    return stored;
+}
+
+/**
+ * @brief Writes the value of a pair whose key and length fields are set.
+ * @param pair The pair.
+ * @param stored The value, as returned by `encode_value`.
+ */
+static void write_value(KVPair *pair, const StoredValue *stored)
+{
+    pair->encoding = stored->encoding;
+    pair->value_len = (uint32_t)stored->len;
+
+    if (stored->encoding == KV_ENCODING_RAW)
+    {
+        memcpy(kv_value(pair), stored->text, stored->len);
+        return;
+    }
+
+    // Little-endian on every host, so the low bytes of the integer are the narrower integer
+    char *bytes = kv_value(pair);
+    switch (stored->len)
+    {
+    case 1:
+    {
+        int8_t value = (int8_t)stored->integer;
+        memcpy(bytes, &value, sizeof(value));
+        break;
+    }
+    case 2:
+    {
+        uint16_t value = htole16((uint16_t)stored->integer);
+        memcpy(bytes, &value, sizeof(value));
+        break;
+    }
+    case 4:
+    {
+        uint32_t value = htole32((uint32_t)stored->integer);
+        memcpy(bytes, &value, sizeof(value));
+        break;
+    }
+    default:
+    {
+        uint64_t value = htole64((uint64_t)stored->integer);
+        memcpy(bytes, &value, sizeof(value));
+        break;
+    }
+    }
+}
+
+/**
+ * @brief Reads the value of a pair stored as an integer.
+ * @param pair The pair.
+ * @return The integer.
+ */
+static int64_t pair_integer(KVPair *pair)
+{
+    const char *bytes = kv_value(pair);
+
+    switch (pair->value_len)
+    {
+    case 1:
+    {
+        int8_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return value;
+    }
+    case 2:
+    {
+        uint16_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return (int16_t)le16toh(value);
+    }
+    case 4:
+    {
+        uint32_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return (int32_t)le32toh(value);
+    }
+    default:
+    {
+        uint64_t value;
+        memcpy(&value, bytes, sizeof(value));
+        return (int64_t)le64toh(value);
+    }
+    }
+}
+
+/**
+ * @brief Returns the value of a pair as clients see it.
+ * @param pair The pair.
+ * @param text Buffer of `INT64_TEXT_MAX` bytes for the decimal form of an integer.
+ * @param value_len Receives the length of the value.
+ * @return The value bytes, either in the pair or in `text`.
+ */
+static const char *pair_value(KVPair *pair, char *text, size_t *value_len)
+{
+    if (pair->encoding == KV_ENCODING_RAW)
+    {
+        *value_len = pair->value_len;
+        return kv_value(pair);
+    }
+
+    *value_len = format_int64(pair_integer(pair), text);
+    return text;
+}
+
+/**
+ * @brief Returns the number of bytes a pair needs in its slab block.
+ * @param key_len Length of the key.
+ * @param stored_len Bytes stored for the value.
+ * @return Header size plus the key and value bytes.
+ */
+static inline size_t pair_size(size_t key_len, size_t stored_len)
+{
+    return sizeof(KVPair) + key_len + stored_len;
+}
+
+/**
+ * @brief Returns the size of the slab block holding a pair.
+ *
+ * Pairs are only rewritten in place within the same block size, so it
+ * always follows from their current lengths.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param pair The pair.
+ * @return The usable size of the block.
+ */
+static inline size_t pair_block_size(HashMap *map, const KVPair *pair)
+{
+    return slab_block_size(&map->slabs, pair_size(pair->key_len, pair->value_len));
+}
+
+/**
+ * @brief Allocates a pair with its key and value in a single slab block.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param stored The value, as returned by `encode_value`.
+ * @param hash Hash of the key.
+ * @return The new pair, or NULL on allocation failure.
+ */
+static KVPair *create_pair(HashMap *map, const char *key, size_t key_len, const StoredValue *stored, uint64_t hash)
+{
+    if (key_len > KV_MAX_KEY_LEN || stored->len > UINT32_MAX)
+        return NULL;
+
+    size_t block_size;
+    KVPair *pair = slab_alloc(&map->slabs, pair_size(key_len, stored->len), &block_size);
+    if (!pair)
+        return NULL;
+
+    map->memory += block_size;
+
+    pair->hash = (uint32_t)hash;
+    pair->expiry = NULL;
+    pair->key_len = (uint32_t)key_len;
+    memcpy(kv_key(pair), key, key_len);
+    write_value(pair, stored);
+    touch_pair(map, pair, true);
+    return pair;
+}
+
+/**
+ * @brief Returns the block of a pair, already unlinked from the tables, to the slab allocator.
+ *
+ * The memory limit counts it as freed right away, even if lookups without
+ * the lock keep it alive a little longer.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param pair The pair to free.
+ */
+static void free_pair(HashMap *map, KVPair *pair)
+{
+    if (pair->expiry)
+    {
+        PairExpiry *expiry = (PairExpiry *)pair->expiry;
+        timer_wheel_remove(&map->expiry, &expiry->timer);
+        map->memory -= expiry->block_size;
+        retire_block(map, expiry, expiry->block_size, sizeof(PairExpiry));
+    }
+
+    size_t block_size = pair_block_size(map, pair);
+    map->memory -= block_size;
+    retire_block(map, pair, block_size, pair_size(pair->key_len, pair->value_len));
+}
+
+/**
+ * @brief Replaces the time to live of a pair.
+ * @param map Pointer to the HashMap structure.
+ * @param pair The pair.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
+ * @return true on success, false if the timer could not be allocated.
+ */
+static bool set_pair_expiry(HashMap *map, KVPair *pair, uint64_t expire_at)
+{
+    PairExpiry *expiry = (PairExpiry *)pair->expiry;
+
+    if (expiry)
+    {
+        timer_wheel_remove(&map->expiry, &expiry->timer);
+
+        if (expire_at == 0)
+        {
+            __atomic_store_n(&pair->expiry, NULL, __ATOMIC_RELEASE);
+            map->memory -= expiry->block_size;
+            retire_block(map, expiry, expiry->block_size, sizeof(PairExpiry));
+            return true;
+        }
+
+        __atomic_store_n(&expiry->timer.expires, expire_at, __ATOMIC_RELAXED);
+    }
+    else if (expire_at != 0)
+    {
+        size_t block_size;
+        expiry = slab_alloc(&map->slabs, sizeof(PairExpiry), &block_size);
+        if (!expiry)
+            return false;
+
+        map->memory += block_size;
+        expiry->block_size = block_size;
+        expiry->timer.data = pair;
+        expiry->timer.expires = expire_at;
+        __atomic_store_n(&pair->expiry, &expiry->timer, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        return true;
+    }
+
+    timer_wheel_add(&map->expiry, &expiry->timer);
+    return true;
+}
+
+/**
+ * @brief Returns when a pair expires.
+ * @param pair The pair.
+ * @return Unix time in milliseconds, or 0 if the pair never expires.
+ */
+static inline uint64_t pair_expire_at(const KVPair *pair)
+{
+    return pair->expiry ? pair->expiry->expires : 0;
+}
+
+/**
+ * @brief Checks whether the time to live of a pair ran out.
+ * @param pair The pair.
+ * @param now The current time in milliseconds, or 0 to treat every pair as live.
+ * @return true if the pair is expired.
+ */
+static inline bool pair_expired(const KVPair *pair, uint64_t now)
+{
+    return pair->expiry && pair->expiry->expires <= now;
+}
+
+/**
+ * @brief Returns the time expiry checks of a walk compare against.
+ *
+ * Skips reading the clock when no pair of the map has a time to live.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @return The current time in milliseconds, or 0.
+ */
+static inline uint64_t expiry_clock(const HashMap *map)
+{
+    return map->expiry.count > 0 ? current_time_ms() : 0;
+}
+
+/**
+ * @brief Removes a key from whichever table holds it.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @return true if the key was removed, false if it was not found.
+ */
+static bool erase_key(HashMap *map, const char *key, size_t key_len, uint64_t hash)
+{
+    HashTable *table = &map->table;
+    size_t index = table_find(table, key, key_len, hash);
+
+    if (index == NOT_FOUND)
+    {
+        table = &map->old;
+        index = table_find(table, key, key_len, hash);
+
+        if (index == NOT_FOUND)
+            return false;
+    }
+
+    KVPair *pair = table->slots[index];
+    table_erase(table, index);
+    map->size--;
+
+    free_pair(map, pair);
+    return true;
+}
+
+/**
+ * @brief Returns the bytes held by the arrays of a table.
+ * @param table Pointer to the HashTable.
+ * @return The size of the control bytes and slot array, 0 for a released table.
+ */
+static inline size_t table_memory(const HashTable *table)
+{
+    return table->ctrl ? table->capacity + GROUP_WIDTH + table->capacity * sizeof(KVPair *) : 0;
+}
+
+/**
+ * @brief Returns the memory held by the map.
+ * @param map Pointer to the HashMap structure.
+ * @return Slab blocks of pairs and timers plus the table arrays, in bytes.
+ */
+size_t hash_map_memory(const HashMap *map)
+{
+    return map->memory + table_memory(&map->table) + table_memory(&map->old);
+}
+
+/**
+ * @brief Picks a pseudo-random pair.
+ *
+ * Starts at a random slot of one of the tables, chosen in proportion to the
+ * pairs they hold, and takes the first full slot from there.
+ *
+ * @param map Pointer to the HashMap structure, which must not be empty.
+ * @return The pair.
+ */
+static KVPair *sample_pair(HashMap *map)
+{
+    HashTable *table = &map->table;
+    if (map->old.size > 0 && next_random(&map->rng) % map->size < map->old.size)
+        table = &map->old;
+
+    size_t mask = table->capacity - 1;
+    size_t index = next_random(&map->rng) & mask;
+
+    while (table->ctrl[index] >= CTRL_EMPTY)
+        index = (index + 1) & mask;
+
+    return table->slots[index];
+}
+
+/**
+ * @brief Ranks a pair as an eviction victim.
+ * @param map Pointer to the HashMap structure.
+ * @param pair The pair.
+ * @return Higher for pairs that should go first.
+ */
+static uint64_t eviction_rank(const HashMap *map, const KVPair *pair)
+{
+    if (map->policy == EVICTION_LRU)
+        return ((uint32_t)(access_clock(map) / LRU_CLOCK_MS) - pair->access) & UINT32_MAX;
+
+    uint32_t minute = (uint32_t)(access_clock(map) / LFU_DECAY_MS) & 0xFFFFFF;
+    return LFU_MAX_COUNT - lfu_count(pair->access, minute);
+}
+
+/**
+ * @brief Evicts the worst of a few sampled pairs.
+ *
+ * An expired pair among the samples is taken right away.
+ *
+ * @param map Pointer to the HashMap structure, which must not be empty.
+ */
+static void evict_one(HashMap *map)
+{
+    KVPair *victim = NULL;
+    uint64_t victim_rank = 0;
+    size_t samples = map->size < EVICTION_SAMPLES ? map->size : EVICTION_SAMPLES;
+
+    for (size_t i = 0; i < samples; i++)
+    {
+        KVPair *pair = sample_pair(map);
+
+        if (pair_expired(pair, access_clock(map)))
+        {
+            erase_key(map, kv_key(pair), pair->key_len, pair->hash);
+            map->expired++;
+            return;
+        }
+
+        uint64_t rank = eviction_rank(map, pair);
+        if (!victim || rank > victim_rank)
+        {
+            victim = pair;
+            victim_rank = rank;
+        }
+    }
+
+    erase_key(map, kv_key(victim), victim->key_len, victim->hash);
+    map->evicted++;
+}
 
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <stdbool.h>
-#include "hashmap.h"
+/**
+ * @brief Evicts pairs until `needed` more bytes fit under the memory limit.
+ * @param map Pointer to the HashMap structure.
+ * @param needed Bytes about to be allocated.
+ * @return true if they fit, false if the map is empty and they still do not.
+ */
+static bool make_room(HashMap *map, size_t needed)
+{
+    if (map->memory_limit == 0)
+        return true;
+
+    while (hash_map_memory(map) + needed > map->memory_limit)
+    {
+        if (map->size == 0)
+            return false;
 
-#define BUFFER_SIZE 1024
+        evict_one(map);
+    }
+
+    return true;
+}
 
 /**
- * @brief A very basic hash function that sums ASCII values of characters.
- * @param key The input key (string).
- * @param capacity The total number of buckets in the hash map.
- * @return Hash index (0 to capacity-1).
+ * @brief Looks a key up, removing it instead if its time to live ran out.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @return The live pair, or NULL if the key is not stored.
  */
-unsigned int hash(const char *key, size_t capacity)
+static KVPair *lookup_live(HashMap *map, const char *key, size_t key_len, uint64_t hash)
 {
-    unsigned int hash_value = 0;
-    while (*key)
+    KVPair **slot = lookup(map, key, key_len, hash);
+    if (!slot)
+        return NULL;
+
+    if ((*slot)->expiry && pair_expired(*slot, current_time_ms()))
     {
-        hash_value += (unsigned char)(*key);
-        key++;
+        erase_key(map, key, key_len, hash);
+        map->expired++;
+        return NULL;
     }
-    return hash_value % capacity;
+
+    touch_pair(map, *slot, false);
+    return *slot;
 }
 
 /**
  * @brief Creates and initializes a new hash map.
- * @param capacity The total number of buckets in the hash map.
+ * @param capacity The number of pairs the map should hold before it first grows.
  * @return Pointer to the newly allocated HashMap structure.
  */
 HashMap *create_hash_map(size_t capacity)
 {
-    HashMap *map = malloc(sizeof(HashMap));
+    HashMap *map = calloc(1, sizeof(HashMap));
 
     if (!map)
         return NULL;
 
-    map->capacity = capacity;
-    map->size = 0;
-    map->buckets = calloc(capacity, sizeof(KVPair *));
+    size_t slots = MIN_CAPACITY;
+    while (slots * 7 < capacity * 8)
+        slots *= 2;
 
-    if (!map->buckets)
+    if (!table_init(&map->table, slots))
     {
         free(map);
         return NULL;
     }
 
+    slab_init(&map->slabs);
+    timer_wheel_init(&map->expiry, current_time_ms());
+    map->rng = hash_bytes((const char *)&map, sizeof(map)) | 1;
+
     return map;
 }
 
+/**
+ * @brief Grows the table up front so that a number of pairs fits without resizing.
+ * @param map Pointer to the HashMap structure.
+ * @param count Number of pairs the map should hold.
+ * @return true on success, false on allocation failure.
+ */
+bool hash_map_reserve(HashMap *map, size_t count)
+{
+    size_t slots = map->table.capacity;
+    while (slots * 7 < count * 8)
+        slots *= 2;
+
+    if (slots == map->table.capacity)
+        return true;
+
+    HashTable next;
+    if (!table_init(&next, slots))
+        return false;
+
+    // Every pair moves right away; the stored hashes spare rehashing the keys
+    migrate(map, SIZE_MAX);
+    for (size_t index = 0; index < map->table.capacity; index++)
+    {
+        if (map->table.ctrl[index] < CTRL_EMPTY)
+            table_insert(&next, map->table.slots[index]);
+    }
+
+    begin_moves(map);
+    TableBlock *block = table_block(map->table.ctrl);
+    publish_table(&map->table, &next);
+    retire_block(map, block, 0, 0);
+    end_moves(map);
+    return true;
+}
+
 /**
  * @brief Inserts or updates a key-value pair in the hash map.
  * @param map Pointer to the HashMap structure.
- * @param key The key (string).
- * @param value The value (string).
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
+ * @return true on success, false on allocation failure.
+ */
+bool hash_map_set(HashMap *map, const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at)
+{
+    return hash_map_set_hashed(map, key, key_len, hash_bytes(key, key_len), value, value_len, expire_at);
+}
+
+/**
+ * @brief Inserts or updates a key-value pair whose hash is already known.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
+ * @return true on success, false on allocation failure.
  */
-bool hash_map_set(HashMap *map, const char *key, const char *value)
+bool hash_map_set_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash, const char *value, size_t value_len, uint64_t expire_at)
 {
-    unsigned int index = hash(key, map->capacity);
-    KVPair *entry = map->buckets[index];
+    migrate(map, MIGRATE_SLOTS_PER_OP);
+
+    StoredValue stored = encode_value(value, value_len);
+
+    // Evict before the lookup, since the victim may be the very pair being updated
+    if (!make_room(map, pair_size(key_len, stored.len)))
+        return false;
 
     // Check if key already exists and update its value
-    while (entry)
+    KVPair **slot = lookup(map, key, key_len, hash);
+    if (slot)
     {
-        if (strcmp(entry->key, key) == 0)
+        KVPair *pair = *slot;
+        touch_pair(map, pair, false);
+        size_t old_size = pair_size(pair->key_len, pair->value_len);
+        size_t new_size = pair_size(key_len, stored.len);
+        size_t block_size = pair_block_size(map, pair);
+
+        // Overwrite in place whenever the new value keeps the block size, unless
+        // lookups without the lock could read it halfway
+        if (slab_block_size(&map->slabs, new_size) == block_size && !map->concurrent)
         {
-            free(entry->value);
-            entry->value = strdup(value);
-            return true;
+            write_value(pair, &stored);
+            slab_resize_in_place(&map->slabs, block_size, old_size, new_size);
+            return set_pair_expiry(map, pair, expire_at);
+        }
+
+        KVPair *new_pair = create_pair(map, key, key_len, &stored, hash);
+        if (!new_pair)
+            return false;
+
+        new_pair->access = pair->access;
+
+        // Hand the timer over so the wheel keeps pointing at a live pair. The old
+        // pair stays visible to lookups without the lock until the slot swap, so
+        // its expiry is cleared atomically; the new pair is published by that swap
+        if (pair->expiry)
+        {
+            TimerNode *timer = pair->expiry;
+            new_pair->expiry = timer;
+            __atomic_store_n(&timer->data, new_pair, __ATOMIC_RELEASE);
+            __atomic_store_n(&pair->expiry, NULL, __ATOMIC_RELEASE);
         }
-        entry = entry->next;
+
+        __atomic_store_n(slot, new_pair, __ATOMIC_RELEASE);
+        free_pair(map, pair);
+        return set_pair_expiry(map, new_pair, expire_at);
     }
 
-    // Insert new key-value pair at head of the linked list
-    KVPair *new_pair = malloc(sizeof(KVPair));
-    new_pair->key = strdup(key);
-    new_pair->value = strdup(value);
-    new_pair->next = map->buckets[index];
-    map->buckets[index] = new_pair;
+    if (!reserve_slot(map))
+        return false;
+
+    KVPair *new_pair = create_pair(map, key, key_len, &stored, hash);
+    if (!new_pair)
+        return false;
+
+    table_insert(&map->table, new_pair);
     map->size++;
 
-    return true;
+    return set_pair_expiry(map, new_pair, expire_at);
 }
 
 /**
  * @brief Retrieves the value associated with a given key.
  * @param map Pointer to the HashMap structure.
- * @param key The key (string).
- * @return The corresponding value (string), or NULL if key not found.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param value_len Receives the value length when found.
+ * @return The corresponding value, or NULL if key not found.
+ */
+const char *hash_map_get(HashMap *map, const char *key, size_t key_len, size_t *value_len)
+{
+    return hash_map_get_hashed(map, key, key_len, hash_bytes(key, key_len), value_len);
+}
+
+/**
+ * @brief Retrieves the value of a key whose hash is already known.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @param value_len Receives the value length when found.
+ * @return The corresponding value, or NULL if key not found.
  */
-char *hash_map_get(HashMap *map, const char *key)
+const char *hash_map_get_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash, size_t *value_len)
 {
     if (map->size == 0)
     {
         return NULL;
     }
 
-    unsigned int index = hash(key, map->capacity);
-    KVPair *entry = map->buckets[index];
+    KVPair *pair = lookup_live(map, key, key_len, hash);
+    if (!pair)
+        return NULL;
+
+    return pair_value(pair, value_text, value_len);
+}
+
+/**
+ * @brief Finds a key in a table while writers may be changing it.
+ * @param ctrl Control bytes of the table, as published; NULL for no table.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @return The pair, or NULL if the key was not found.
+ */
+static KVPair *table_read(const uint8_t *ctrl, const char *key, size_t key_len, uint64_t hash)
+{
+    if (!ctrl)
+        return NULL;
+
+    const TableBlock *block = table_block(ctrl);
+    size_t mask = block->capacity - 1;
+    size_t pos = hash & mask;
+    uint8_t tag = hash_tag(hash);
 
-    while (entry)
+    while (true)
     {
-        if (strcmp(entry->key, key) == 0)
+        uint64_t group = load_group(ctrl + pos);
+
+        // Pairs with the release in `set_ctrl`, so a matching tag comes with its slot
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        for (uint64_t match = match_tag(group, tag); match; match &= match - 1)
         {
-            return entry->value;
+            size_t index = (pos + first_match(match)) & mask;
+            KVPair *pair = __atomic_load_n(&block->slots[index], __ATOMIC_ACQUIRE);
+
+            // The slot may have been reused since the tag was read, which the comparison catches
+            if (pair->hash == (uint32_t)hash && pair->key_len == key_len && memcmp(kv_key(pair), key, key_len) == 0)
+                return pair;
         }
-        entry = entry->next;
+
+        if (match_empty(group))
+            return NULL;
+
+        pos = (pos + GROUP_WIDTH) & mask;
     }
+}
 
-    return NULL;
+/**
+ * @brief Looks a key up without the lock.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @param value_len Receives the value length when found.
+ * @return The corresponding value, or NULL if key not found.
+ */
+const char *hash_map_read(HashMap *map, const char *key, size_t key_len, uint64_t hash, size_t *value_len)
+{
+    KVPair *pair;
+
+    while (true)
+    {
+        uint64_t moves = __atomic_load_n(&map->moves, __ATOMIC_ACQUIRE);
+
+        // A pair in transit is inserted into the new table before it leaves the old one
+        pair = table_read(__atomic_load_n(&map->old.ctrl, __ATOMIC_ACQUIRE), key, key_len, hash);
+        if (!pair)
+            pair = table_read(__atomic_load_n(&map->table.ctrl, __ATOMIC_ACQUIRE), key, key_len, hash);
+
+        if (pair)
+            break;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (!(moves & 1) && __atomic_load_n(&map->moves, __ATOMIC_RELAXED) == moves)
+            return NULL;
+    }
+
+    TimerNode *expiry = __atomic_load_n(&pair->expiry, __ATOMIC_ACQUIRE);
+    if (expiry && __atomic_load_n(&expiry->expires, __ATOMIC_RELAXED) <= current_time_ms())
+        return NULL;
+
+    if (reader_rng == 0)
+        reader_rng = hash_bytes((const char *)&pair, sizeof(pair)) | 1;
+
+    uint32_t access = accessed(map, __atomic_load_n(&pair->access, __ATOMIC_RELAXED), false, &reader_rng);
+    __atomic_store_n(&pair->access, access, __ATOMIC_RELAXED);
+
+    return pair_value(pair, value_text, value_len);
+}
+
+/**
+ * @brief Enables lookups without the lock.
+ * @param map Pointer to the HashMap structure.
+ */
+void hash_map_enable_concurrent_reads(HashMap *map)
+{
+    map->concurrent = true;
+    map->reclaim_at = RECLAIM_BATCH;
 }
 
 /**
  * @brief Removes a key-value pair from the hash map.
  * @param map Pointer to the HashMap structure.
- * @param key The key to remove.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @return true if key was removed, false if key was not found.
+ */
+bool hash_map_remove(HashMap *map, const char *key, size_t key_len)
+{
+    return hash_map_remove_hashed(map, key, key_len, hash_bytes(key, key_len));
+}
+
+/**
+ * @brief Removes a key whose hash is already known.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
  * @return true if key was removed, false if key was not found.
  */
-bool hash_map_remove(HashMap *map, const char *key)
+bool hash_map_remove_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash)
+{
+    migrate(map, MIGRATE_SLOTS_PER_OP);
+
+    return erase_key(map, key, key_len, hash);
+}
+
+/**
+ * @brief Sets or clears the time to live of a key.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
+ * @return true if the key exists, false if not or on allocation failure.
+ */
+bool hash_map_expire(HashMap *map, const char *key, size_t key_len, uint64_t expire_at)
 {
-    unsigned int index = hash(key, map->capacity);
-    KVPair *entry = map->buckets[index];
-    KVPair *prev = NULL;
+    uint64_t hash = hash_bytes(key, key_len);
+    KVPair *pair = lookup_live(map, key, key_len, hash);
 
-    while (entry)
+    if (!pair)
+        return false;
+
+    if (expire_at != 0 && expire_at <= current_time_ms())
     {
-        if (strcmp(entry->key, key) == 0)
-        {
-            if (prev)
-            {
-                prev->next = entry->next;
-            }
-            else
-            {
-                map->buckets[index] = entry->next;
-            }
+        erase_key(map, key, key_len, hash);
+        map->expired++;
+        return true;
+    }
 
-            free(entry->key);
-            free(entry->value);
-            free(entry);
-            map->size--;
-            return true;
+    return set_pair_expiry(map, pair, expire_at);
+}
+
+/**
+ * @brief Reads the expiry time of a key.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param expire_at Receives the expiry time in milliseconds, 0 for never.
+ * @return true if the key exists.
+ */
+bool hash_map_get_expiry(HashMap *map, const char *key, size_t key_len, uint64_t *expire_at)
+{
+    KVPair *pair = lookup_live(map, key, key_len, hash_bytes(key, key_len));
+    if (!pair)
+        return false;
+
+    *expire_at = pair_expire_at(pair);
+    return true;
+}
+
+/**
+ * @brief Adds to the integer value of a key.
+ * @param map Pointer to the HashMap structure.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key.
+ * @param delta The amount to add.
+ * @param result Receives the new value.
+ * @param expire_at Receives the expiry time of the key.
+ * @return The outcome.
+ */
+IncrementStatus hash_map_increment(HashMap *map, const char *key, size_t key_len, uint64_t hash, int64_t delta,
+                                   int64_t *result, uint64_t *expire_at)
+{
+    migrate(map, MIGRATE_SLOTS_PER_OP);
+
+    int64_t current = 0;
+    KVPair *pair = lookup_live(map, key, key_len, hash);
+    *expire_at = 0;
+
+    if (pair)
+    {
+        if (pair->encoding == KV_ENCODING_INT)
+            current = pair_integer(pair);
+        else if (!parse_int64(kv_value(pair), pair->value_len, &current))
+            return INCREMENT_NOT_INTEGER;
+
+        *expire_at = pair_expire_at(pair);
+    }
+
+    if (__builtin_add_overflow(current, delta, result))
+        return INCREMENT_OVERFLOW;
+
+    StoredValue stored = {NULL, integer_width(*result), KV_ENCODING_INT, *result};
+
+    if (pair && !map->concurrent)
+    {
+        size_t old_size = pair_size(pair->key_len, pair->value_len);
+        size_t new_size = pair_size(key_len, stored.len);
+        size_t block_size = pair_block_size(map, pair);
+
+        if (slab_block_size(&map->slabs, new_size) == block_size)
+        {
+            write_value(pair, &stored);
+            slab_resize_in_place(&map->slabs, block_size, old_size, new_size);
+            return INCREMENT_OK;
         }
+    }
+
+    // Readers without the lock only ever see whole pairs, so the value is replaced
+    char text[INT64_TEXT_MAX];
+    size_t text_len = format_int64(*result, text);
+
+    if (!hash_map_set_hashed(map, key, key_len, hash, text, text_len, *expire_at))
+        return INCREMENT_FAILED;
+
+    return INCREMENT_OK;
+}
+
+/**
+ * @brief Removes up to `max` pairs whose timers are due.
+ * @param map Pointer to the HashMap structure.
+ * @param now The current time in milliseconds.
+ * @param max Maximum number of pairs to remove.
+ * @return The number of pairs removed.
+ */
+size_t hash_map_expire_due(HashMap *map, uint64_t now, size_t max)
+{
+    size_t removed = 0;
+
+    while (removed < max)
+    {
+        TimerNode *timer = timer_wheel_expire(&map->expiry, now);
+        if (!timer)
+            break;
+
+        // The wheel already dropped the timer, so release it before the pair
+        PairExpiry *expiry = (PairExpiry *)timer;
+        KVPair *pair = __atomic_load_n(&timer->data, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&pair->expiry, NULL, __ATOMIC_RELEASE);
+        map->memory -= expiry->block_size;
+        retire_block(map, expiry, expiry->block_size, sizeof(PairExpiry));
 
-        prev = entry;
-        entry = entry->next;
+        erase_key(map, kv_key(pair), pair->key_len, pair->hash);
+        removed++;
     }
 
-    return false;
+    map->expired += removed;
+    return removed;
 }
 
 /**
- * @brief Retrieves all key-value pairs as a JSON-formatted string.
+ * @brief Sets the memory limit and eviction policy.
  * @param map Pointer to the HashMap structure.
- * @return Dynamically allocated JSON string. The caller must free() it.
+ * @param limit Maximum bytes, 0 for no limit.
+ * @param policy How victims are chosen.
  */
-char *hash_map_get_all(HashMap *map)
+void hash_map_set_memory_limit(HashMap *map, size_t limit, EvictionPolicy policy)
 {
-    size_t buffer_size = BUFFER_SIZE;
-    char *result = malloc(buffer_size);
-    if (!result)
-        return NULL;
+    map->memory_limit = limit;
+    map->policy = policy;
+}
 
-    size_t pos = 0;
-    result[pos++] = '{';
+/**
+ * @brief Passes a pair to a visitor, with integer values in decimal form.
+ * @param pair The pair.
+ * @param visitor The callback.
+ * @param ctx Opaque pointer passed through to the visitor.
+ * @return What the visitor returned.
+ */
+static bool visit_pair(KVPair *pair, HashMapVisitor visitor, void *ctx)
+{
+    char text[INT64_TEXT_MAX];
+    size_t value_len;
+    const char *value = pair_value(pair, text, &value_len);
+
+    return visitor(kv_key(pair), pair->key_len, value, value_len, pair_expire_at(pair), ctx);
+}
+
+/**
+ * @brief Calls a visitor for every pair of one table.
+ * @param table Pointer to the HashTable.
+ * @param visitor Callback invoked with each key and value.
+ * @param ctx Opaque pointer passed through to the visitor.
+ * @param now Current time for the expiry check, see `expiry_clock`.
+ * @return true if every pair was visited, false if the visitor stopped early.
+ */
+static bool table_for_each(const HashTable *table, HashMapVisitor visitor, void *ctx, uint64_t now)
+{
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->ctrl[i] < CTRL_EMPTY)
+        {
+            KVPair *pair = table->slots[i];
+            if (pair_expired(pair, now))
+                continue;
+
+            if (!visit_pair(pair, visitor, ctx))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Calls a visitor for every key-value pair in the hash map.
+ * @param map Pointer to the HashMap structure.
+ * @param visitor Callback invoked with each key and value.
+ * @param ctx Opaque pointer passed through to the visitor.
+ * @return true if every pair was visited, false if the visitor stopped early.
+ */
+bool hash_map_for_each(HashMap *map, HashMapVisitor visitor, void *ctx)
+{
+    uint64_t now = expiry_clock(map);
+
+    return table_for_each(&map->table, visitor, ctx, now) && table_for_each(&map->old, visitor, ctx, now);
+}
 
-    bool has_entries = false;
+/**
+ * @brief Calls a visitor for every pair of one table whose home slot is `bucket`.
+ *
+ * A pair always sits in the probe sequence starting at its home slot, no
+ * further than the first group holding an empty slot.
+ *
+ * @param table Pointer to the HashTable.
+ * @param bucket The home slot, less than the capacity of the table.
+ * @param visitor Callback invoked with each key and value.
+ * @param ctx Opaque pointer passed through to the visitor.
+ * @param now Current time for the expiry check, see `expiry_clock`.
+ * @return false if the visitor asked to stop; the bucket is still visited in full.
+ */
+static bool table_scan_bucket(const HashTable *table, size_t bucket, HashMapVisitor visitor, void *ctx, uint64_t now)
+{
+    if (!table->ctrl)
+        return true;
+
+    size_t mask = table->capacity - 1;
+    size_t pos = bucket;
+    bool more = true;
 
-    for (size_t i = 0; i < map->capacity; i++)
+    while (true)
     {
-        KVPair *entry = map->buckets[i];
+        uint64_t group = load_group(table->ctrl + pos);
 
-        while (entry)
+        for (size_t i = 0; i < GROUP_WIDTH; i++)
         {
-            size_t required_size = pos + strlen(entry->key) + strlen(entry->value) + 6;
+            size_t index = (pos + i) & mask;
 
-            if (required_size >= buffer_size)
+            if (table->ctrl[index] < CTRL_EMPTY && (table->slots[index]->hash & mask) == bucket)
             {
-                buffer_size *= 2;
-                char *new_result = realloc(result, buffer_size);
-                if (!new_result)
-                {
-                    free(result);
-                    return NULL;
-                }
-                result = new_result;
-            }
+                KVPair *pair = table->slots[index];
+                if (pair_expired(pair, now))
+                    continue;
 
-            pos += snprintf(result + pos, buffer_size - pos, "\"%s\":\"%s\",", entry->key, entry->value);
-            entry = entry->next;
-            has_entries = true;
+                more &= visit_pair(pair, visitor, ctx);
+            }
         }
+
+        if (match_empty(group))
+            return more;
+
+        pos = (pos + GROUP_WIDTH) & mask;
     }
+}
+
+/**
+ * @brief Reverses the bit order of a 64-bit word.
+ */
+static inline uint64_t reverse_bits(uint64_t v)
+{
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return __builtin_bswap64(v);
+}
+
+/**
+ * @brief Advances a reverse-binary scan cursor.
+ *
+ * The high bits of the cursor are incremented first, so buckets already
+ * visited in a smaller table map to buckets already visited after it grows.
+ *
+ * @param cursor The current cursor.
+ * @param mask Slot mask of the table the cursor walks.
+ * @return The next cursor, 0 once every bucket was visited.
+ */
+static inline size_t next_cursor(size_t cursor, size_t mask)
+{
+    return reverse_bits(reverse_bits(cursor | ~mask) + 1);
+}
+
+/**
+ * @brief Visits the pairs of the bucket a scan cursor points at.
+ *
+ * While a resize is in progress, the bucket of the smaller table and every
+ * bucket of the larger one that it expands to are visited together.
+ *
+ * @param map Pointer to the HashMap structure.
+ * @param cursor In: the cursor, out: the next cursor, 0 when the walk is complete.
+ * @param visitor Callback invoked with each key and value.
+ * @param ctx Opaque pointer passed through to the visitor.
+ * @return false if the visitor asked to stop.
+ */
+bool hash_map_scan(HashMap *map, size_t *cursor, HashMapVisitor visitor, void *ctx)
+{
+    const HashTable *small = &map->table;
+    const HashTable *large = &map->old;
+    uint64_t now = expiry_clock(map);
 
-    if (has_entries)
+    if (!large->ctrl)
     {
-        result[pos - 1] = '}';
+        size_t mask = small->capacity - 1;
+        bool more = table_scan_bucket(small, *cursor & mask, visitor, ctx, now);
+        *cursor = next_cursor(*cursor, mask);
+        return more;
     }
-    else
+
+    if (small->capacity > large->capacity)
     {
-        result[pos++] = '}';
+        small = &map->old;
+        large = &map->table;
     }
-    result[pos] = '\0';
 
-    return result;
+    size_t small_mask = small->capacity - 1;
+    size_t large_mask = large->capacity - 1;
+    size_t v = *cursor;
+    bool more = table_scan_bucket(small, v & small_mask, visitor, ctx, now);
+
+    do
+    {
+        more &= table_scan_bucket(large, v & large_mask, visitor, ctx, now);
+        v = next_cursor(v, large_mask);
+    } while (v & (small_mask ^ large_mask));
+
+    *cursor = v;
+    return more;
 }
 
 /**
- * @brief Frees all memory allocated for the hash map.
- * @param map Pointer to the HashMap structure.
+ * @brief Adds the occupancy of one table to a running total.
+ * @param table Pointer to the HashTable.
+ * @param stats The total to update.
  */
-void free_hash_map(HashMap *map)
+static void table_stats(const HashTable *table, HashMapStats *stats)
 {
-    for (size_t i = 0; i < map->capacity; i++)
+    size_t mask = table->capacity - 1;
+
+    stats->capacity += table->capacity;
+
+    for (size_t i = 0; i < table->capacity; i++)
     {
-        KVPair *entry = map->buckets[i];
-        while (entry)
+        if (table->ctrl[i] == CTRL_DELETED)
+        {
+            stats->tombstones++;
+        }
+        else if (table->ctrl[i] < CTRL_EMPTY)
         {
-            KVPair *temp = entry;
-            entry = entry->next;
-            free(temp->key);
-            free(temp->value);
-            free(temp);
+            size_t distance = (i - (table->slots[i]->hash & mask)) & mask;
+            if (distance > stats->longest_probe)
+                stats->longest_probe = distance;
         }
     }
-    free(map->buckets);
+}
+
+/**
+ * @brief Measures the occupancy of both tables.
+ * @param map Pointer to the HashMap structure.
+ * @param stats Receives the figures.
+ */
+void hash_map_stats(HashMap *map, HashMapStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->keys = map->size;
+    stats->expires = map->expiry.count;
+    stats->expired = map->expired;
+    stats->memory = hash_map_memory(map);
+    stats->evicted = map->evicted;
+
+    table_stats(&map->table, stats);
+    table_stats(&map->old, stats);
+}
+
+/**
+ * @brief Frees the pairs referenced by a table and the table itself.
+ * @param map Pointer to the HashMap owning the pairs.
+ * @param table Pointer to the HashTable.
+ */
+static void table_free(HashMap *map, HashTable *table)
+{
+    if (!table->ctrl)
+        return;
+
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->ctrl[i] < CTRL_EMPTY)
+            free_pair(map, table->slots[i]);
+    }
+
+    table_release(map, table);
+}
+
+/**
+ * @brief Removes every pair, leaving an empty table of the smallest size.
+ * @param map Pointer to the HashMap structure.
+ * @return true on success, false on allocation failure.
+ */
+bool hash_map_clear(HashMap *map)
+{
+    HashTable fresh;
+    if (!table_init(&fresh, MIN_CAPACITY))
+        return false;
+
+    HashTable previous = map->table;
+
+    // Lookups without the lock that still reach the previous tables find live pairs, as both are retired
+    begin_moves(map);
+    publish_table(&map->table, &fresh);
+    table_free(map, &map->old);
+    table_free(map, &previous);
+    memset(&map->old, 0, sizeof(map->old));
+    map->migrate_pos = 0;
+    map->size = 0;
+    end_moves(map);
+    return true;
+}
+
+/**
+ * @brief Frees all memory allocated for the hash map.
+ * @param map Pointer to the HashMap structure.
+ */
+void free_hash_map(HashMap *map)
+{
+    // No lookup may run anymore, so retired memory goes right away
+    map->concurrent = false;
+    table_free(map, &map->table);
+    table_free(map, &map->old);
+
+    for (size_t i = 0; i < map->retired_count; i++)
+        release_block(map, map->retired[i].block, map->retired[i].block_size, map->retired[i].requested);
+
+    free(map->retired);
+    slab_destroy(&map->slabs);
     free(map);
 }
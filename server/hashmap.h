@@ -2,92 +2,445 @@
 #define HASHMAP_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include "slab.h"
+#include "timer_wheel.h"
+
+/**
+ * @brief Which pairs a hashmap over its memory limit evicts first.
+ *
+ * Both policies are approximate: a handful of random pairs is sampled and
+ * the worst of them is evicted, so no list or heap has to be maintained.
+ */
+typedef enum
+{
+    EVICTION_LRU, /**< Least recently used, by an access clock in seconds */
+    EVICTION_LFU  /**< Least frequently used, by a logarithmic counter that decays every minute */
+} EvictionPolicy;
+
+/**
+ * @brief How the value of a pair is stored.
+ */
+typedef enum
+{
+    KV_ENCODING_RAW, /**< The value bytes as given */
+    KV_ENCODING_INT  /**< A canonical decimal integer, stored as a little-endian integer of 1, 2, 4 or 8 bytes */
+} KVEncoding;
+
+/**
+ * @brief Outcome of `hash_map_increment`.
+ */
+typedef enum
+{
+    INCREMENT_OK,          /**< The key holds the new value */
+    INCREMENT_NOT_INTEGER, /**< The value is not a canonical 64-bit integer */
+    INCREMENT_OVERFLOW,    /**< The new value would not fit in 64 bits */
+    INCREMENT_FAILED       /**< Allocation failed or the memory limit was hit */
+} IncrementStatus;
+
+#define KV_MAX_KEY_LEN 0x7FFFFFFF /** Longest key a pair can hold */
 
 /**
  * @brief Structure representing a key-value pair in the hashmap.
  *
- * This structure stores a key and its associated value. It also supports
- * chaining via a linked list to handle collisions.
+ * The pair, its key and its value live in one slab block: the 24-byte
+ * header is followed by the key bytes and then the value bytes, both
+ * delimited by their lengths alone, so a small pair is a single chunk of
+ * at most a cache line. Values that are the canonical decimal form of a
+ * 64-bit integer are stored as a binary integer of the smallest width that
+ * holds them and are only formatted again when read.
+ *
+ * Only the low 32 bits of the key hash are kept: they place the pair in
+ * any table of up to 2^32 slots and give its tag, so growing the table
+ * never has to rehash key bytes. The size of the slab block is not stored
+ * either, since it follows from the lengths. Pairs with a time to live
+ * point at a timer of the map's expiry wheel; all others pay only for the
+ * NULL pointer.
  */
 typedef struct KVPair
 {
-    char *key;           /** The key string (dynamically allocated) */
-    char *value;         /** The value string (dynamically allocated) */
-    struct KVPair *next; /** Pointer to the next key-value pair (for collision handling) */
+    TimerNode *expiry;     /** Expiry timer, expiring at a Unix time in milliseconds; NULL if the pair never expires */
+    uint32_t hash;         /** Low 32 bits of the hash of the key */
+    uint32_t access;       /** Eviction metadata: access clock (LRU) or decay minute and counter (LFU) */
+    uint32_t key_len : 31; /** Length of the key */
+    uint32_t encoding : 1; /** A `KVEncoding` */
+    uint32_t value_len;    /** Bytes stored for the value: its length, or the width of the integer */
+    char data[];           /** Key bytes, then value bytes */
 } KVPair;
 
+/**
+ * @brief Returns the key bytes of a pair.
+ */
+static inline char *kv_key(KVPair *pair)
+{
+    return pair->data;
+}
+
+/**
+ * @brief Returns the stored value bytes of a pair.
+ */
+static inline char *kv_value(KVPair *pair)
+{
+    return pair->data + pair->key_len;
+}
+
+/**
+ * @brief One open-addressing table of the hashmap.
+ *
+ * Every slot has a one byte control word: the slot is empty, deleted, or
+ * holds the top 7 bits of the hash of its key. Lookups scan the control
+ * bytes a group at a time and only touch a KVPair when those bits match.
+ *
+ * Both arrays live in one allocation that also records the capacity, so a
+ * lookup without the lock reaches the whole table through `ctrl` alone.
+ */
+typedef struct
+{
+    uint8_t *ctrl;   /** Control bytes, `capacity` plus a mirrored group for wrap-around */
+    KVPair **slots;  /** Slot array */
+    size_t capacity; /** Number of slots (a power of two) */
+    size_t size;     /** Number of live pairs */
+    size_t used;     /** Number of live pairs plus deleted markers */
+} HashTable;
+
 /**
  * @brief Structure representing the HashMap.
  *
- * The hashmap uses an array of buckets where each bucket is a linked list
- * of key-value pairs. The `capacity` defines the total number of buckets,
- * while `size` tracks the number of key-value pairs stored.
+ * When the table fills up a table twice the size is allocated and the pairs
+ * of the old one are moved over a few slots at a time by later writes, so no
+ * single request pays for a full rehash. While that happens lookups check
+ * both tables.
+ *
+ * Expired pairs are removed lazily when a lookup finds them, and actively by
+ * `hash_map_expire_due`, which pops due timers off a wheel ticking in
+ * milliseconds instead of scanning the table.
+ *
+ * With a memory limit, writes that would take the map over it first evict
+ * pairs chosen by sampling, see EvictionPolicy.
+ *
+ * With concurrent reads enabled, `hash_map_read` looks keys up without the
+ * lock while writers keep serializing on it. Writers then never change a
+ * pair in place: an update stores a new pair, and every pair, timer or
+ * table they unlink is retired, to be freed once `epoch_safe` shows no
+ * reader can still see it.
  */
 typedef struct
 {
-    size_t capacity;  /** Number of buckets in the hashmap */
-    size_t size;      /** Current number of key-value pairs stored */
-    KVPair **buckets; /** Array of bucket pointers */
+    HashTable table;       /** Table receiving new pairs */
+    HashTable old;         /** Table being drained by an incremental resize, if any */
+    size_t migrate_pos;    /** Next slot of `old` to move */
+    size_t size;           /** Current number of key-value pairs stored */
+    SlabAllocator slabs;   /** Allocator of the pairs and their expiry timers */
+    TimerWheel expiry;     /** Timers of the pairs with a time to live */
+    size_t expired;        /** Pairs removed because their time to live ran out */
+    size_t memory;         /** Bytes of the slab blocks held by pairs and timers */
+    size_t memory_limit;   /** Bytes the map may hold before writes evict, 0 for no limit */
+    EvictionPolicy policy; /** How eviction victims are chosen */
+    size_t evicted;        /** Pairs removed to stay under the memory limit */
+    uint64_t rng;          /** State of the generator behind eviction sampling and LFU counters */
+    bool concurrent;       /** Whether `hash_map_read` may run without the lock */
+    uint64_t moves;        /** Odd while pairs move between tables; lookups without the lock retry misses that overlap */
+    struct RetiredBlock *retired; /** Memory unlinked while lookups without the lock may still see it */
+    size_t retired_count;  /** Entries of `retired` in use */
+    size_t retired_cap;    /** Allocated entries of `retired` */
+    size_t reclaim_at;     /** Number of retired entries at which a write tries to free them */
 } HashMap;
 
+/**
+ * @brief Occupancy figures of a hashmap.
+ */
+typedef struct
+{
+    size_t keys;          /** Number of pairs stored */
+    size_t capacity;      /** Slots of the current table plus the table being drained */
+    size_t tombstones;    /** Slots holding a deletion marker */
+    size_t longest_probe; /** Longest distance in slots between a pair and its home slot */
+    size_t expires;       /** Pairs with a time to live */
+    size_t expired;       /** Pairs removed so far because their time to live ran out */
+    size_t memory;        /** Bytes held by pairs, timers and tables, see `hash_map_memory` */
+    size_t evicted;       /** Pairs removed so far to stay under the memory limit */
+} HashMapStats;
+
+/**
+ * @brief Callback used to walk the pairs of a hashmap.
+ *
+ * `expire_at` is the Unix time in milliseconds at which the pair expires,
+ * or 0 if it never does. Integer values are passed in decimal form from a
+ * buffer that only lives for the call.
+ *
+ * @return True to continue the walk, false to stop it.
+ */
+typedef bool (*HashMapVisitor)(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx);
+
 /**
  * @brief Creates a new hashmap with the specified capacity.
  *
  * Allocates memory for a hashmap and initializes its internal structures.
  *
- * @param capacity The initial number of buckets.
+ * @param capacity The expected number of pairs; the table grows beyond it as needed.
  * @return Pointer to the newly created HashMap or NULL if allocation fails.
  */
 HashMap *create_hash_map(size_t capacity);
 
+/**
+ * @brief Grows the table so that a number of pairs fits without further resizing.
+ *
+ * Used before bulk loads. Unlike the growth triggered by writes, the pairs
+ * already stored are moved to the new table at once, so the cost is
+ * proportional to the size of the map; a table already large enough is kept.
+ *
+ * @param map Pointer to the HashMap.
+ * @param count Number of pairs the map should hold.
+ * @return True on success, false if the table could not be allocated.
+ */
+bool hash_map_reserve(HashMap *map, size_t count);
+
 /**
  * @brief Inserts or updates a key-value pair in the hashmap.
  *
  * If the key already exists, its value is updated. Otherwise, a new key-value
- * pair is inserted.
+ * pair is inserted. Either way the pair's time to live is replaced by
+ * `expire_at`, so a plain set makes the key persistent again.
+ *
+ * When the map has a memory limit and the pair would not fit under it,
+ * other pairs are evicted first; the set fails if evicting everything still
+ * leaves no room.
  *
  * @param map Pointer to the HashMap.
- * @param key The key string (must be null-terminated).
- * @param value The value string (must be null-terminated).
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param value The value bytes.
+ * @param value_len Length of the value.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
  * @return True if insertion/update is successful, false otherwise.
  */
-bool hash_map_set(HashMap *map, const char *key, const char *value);
+bool hash_map_set(HashMap *map, const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at);
 
 /**
  * @brief Retrieves the value associated with a key in the hashmap.
  *
  * @param map Pointer to the HashMap.
- * @param key The key string to search for.
- * @return Pointer to the value string if found, or NULL if the key does not exist.
- *         The returned string should NOT be freed by the caller.
+ * @param key The key bytes to search for.
+ * @param key_len Length of the key.
+ * @param value_len Receives the length of the value if it is found.
+ * @return Pointer to the value if found, or NULL if the key does not exist. The
+ *         value is not null-terminated, should NOT be freed by the caller and is only
+ *         valid until the next modification of the hashmap. Integer values are
+ *         formatted into a buffer of the calling thread, which the next lookup reuses.
  */
-char *hash_map_get(HashMap *map, const char *key);
+const char *hash_map_get(HashMap *map, const char *key, size_t key_len, size_t *value_len);
 
 /**
  * @brief Removes a key-value pair from the hashmap.
  *
  * @param map Pointer to the HashMap.
- * @param key The key string to remove.
+ * @param key The key bytes to remove.
+ * @param key_len Length of the key.
  * @return True if the key was successfully removed, false if the key was not found.
  */
-bool hash_map_remove(HashMap *map, const char *key);
+bool hash_map_remove(HashMap *map, const char *key, size_t key_len);
+
+/**
+ * @brief Variants of `hash_map_set`, `hash_map_get` and `hash_map_remove`
+ *        for callers that already hashed the key with `hash_bytes`.
+ *
+ * Multi-key commands hash every key once to pick its shard, prefetch its
+ * bucket and probe the table.
+ */
+bool hash_map_set_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash, const char *value, size_t value_len, uint64_t expire_at);
+const char *hash_map_get_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash, size_t *value_len);
+bool hash_map_remove_hashed(HashMap *map, const char *key, size_t key_len, uint64_t hash);
+
+/**
+ * @brief Looks a key up without holding the lock of the map.
+ *
+ * Only valid with concurrent reads enabled and inside an `epoch_enter` /
+ * `epoch_exit` section, which the returned value stays valid for. Misses
+ * that overlap a resize are retried, so a key that is stored throughout
+ * the call is always found. Expired pairs read as missing and are left to
+ * the writers to remove.
+ *
+ * @param map Pointer to the HashMap.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key, as computed by `hash_bytes`.
+ * @param value_len Receives the length of the value if it is found.
+ * @return Pointer to the value, not null-terminated, or NULL if the key does not exist.
+ */
+const char *hash_map_read(HashMap *map, const char *key, size_t key_len, uint64_t hash, size_t *value_len);
+
+/**
+ * @brief Allows lookups with `hash_map_read` to run alongside writes.
+ *
+ * Must be called before any such lookup.
+ *
+ * @param map Pointer to the HashMap.
+ */
+void hash_map_enable_concurrent_reads(HashMap *map);
+
+/**
+ * @brief Frees the retired memory that no lookup without the lock can see anymore.
+ *
+ * Writes do this every few retired blocks on their own; calling it
+ * periodically frees what the last writes left behind.
+ *
+ * @param map Pointer to the HashMap.
+ */
+void hash_map_reclaim(HashMap *map);
+
+/**
+ * @brief Starts loading the first bucket a lookup of a hash probes.
+ *
+ * Issuing this for a batch of keys before probing them lets their cache
+ * misses overlap instead of being taken one after another.
+ *
+ * @param map Pointer to the HashMap.
+ * @param hash Hash of the key.
+ */
+static inline void hash_map_prefetch(const HashMap *map, uint64_t hash)
+{
+    size_t pos = hash & (map->table.capacity - 1);
+    __builtin_prefetch(map->table.ctrl + pos);
+    __builtin_prefetch(map->table.slots + pos);
+}
+
+/**
+ * @brief Sets or clears the time to live of an existing key.
+ *
+ * A time in the past removes the key right away.
+ *
+ * @param map Pointer to the HashMap.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param expire_at Unix time in milliseconds at which the pair expires, or 0 for never.
+ * @return True if the key exists, false if it was not found or the timer could not be allocated.
+ */
+bool hash_map_expire(HashMap *map, const char *key, size_t key_len, uint64_t expire_at);
+
+/**
+ * @brief Reads the expiry time of a key.
+ *
+ * @param map Pointer to the HashMap.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param expire_at Receives the Unix time in milliseconds at which the pair expires, 0 for never.
+ * @return True if the key exists, false otherwise.
+ */
+bool hash_map_get_expiry(HashMap *map, const char *key, size_t key_len, uint64_t *expire_at);
+
+/**
+ * @brief Adds to the integer value of a key, as a single operation.
+ *
+ * A missing key counts as 0 and is created without a time to live; an
+ * existing key keeps its time to live. A value stored as an integer is
+ * updated in place when the result fits in the same block and no lookup
+ * without the lock can be reading it, so a counter costs no allocation.
+ *
+ * @param map Pointer to the HashMap.
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @param hash Hash of the key, as computed by `hash_bytes`.
+ * @param delta The amount to add, negative to subtract.
+ * @param result Receives the new value on success.
+ * @param expire_at Receives the expiry time of the key on success, 0 for never.
+ * @return INCREMENT_OK, or why the value was left unchanged.
+ */
+IncrementStatus hash_map_increment(HashMap *map, const char *key, size_t key_len, uint64_t hash, int64_t delta,
+                                   int64_t *result, uint64_t *expire_at);
+
+/**
+ * @brief Removes pairs whose time to live ran out.
+ *
+ * Pops due timers off the expiry wheel, so the cost is proportional to the
+ * number of pairs removed and the ticks skipped, never to the size of the map.
+ *
+ * @param map Pointer to the HashMap.
+ * @param now The current Unix time in milliseconds.
+ * @param max Maximum number of pairs to remove.
+ * @return The number of pairs removed; `max` means more may be due.
+ */
+size_t hash_map_expire_due(HashMap *map, uint64_t now, size_t max);
+
+/**
+ * @brief Sets the memory limit of the hashmap.
+ *
+ * A lower limit takes effect with the next write, which evicts until the
+ * map fits again.
+ *
+ * @param map Pointer to the HashMap.
+ * @param limit Bytes the map may hold, see `hash_map_memory`; 0 removes the limit.
+ * @param policy How eviction victims are chosen.
+ */
+void hash_map_set_memory_limit(HashMap *map, size_t limit, EvictionPolicy policy);
+
+/**
+ * @brief Returns the memory the memory limit is checked against.
+ *
+ * Counts the slab blocks of the pairs and their timers, so keys, values and
+ * per-pair headers including slab rounding, plus the slot arrays of the
+ * tables.
+ *
+ * @param map Pointer to the HashMap.
+ * @return The number of bytes.
+ */
+size_t hash_map_memory(const HashMap *map);
+
+/**
+ * @brief Visits every key-value pair stored in the hashmap.
+ *
+ * The visitor must not modify the hashmap. Iteration order is unspecified.
+ * Expired pairs that were not removed yet are skipped.
+ *
+ * @param map Pointer to the HashMap.
+ * @param visitor Callback invoked for each pair; returning false stops the walk.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return True if all pairs were visited, false if the visitor stopped early.
+ */
+bool hash_map_for_each(HashMap *map, HashMapVisitor visitor, void *ctx);
+
+/**
+ * @brief Visits one bucket of the hashmap and advances a scan cursor.
+ *
+ * Starting from a cursor of 0 and calling this until the cursor is 0 again
+ * visits every pair that stays in the map for the whole walk at least once,
+ * even if the table grows in between calls; pairs may be reported twice.
+ * Expired pairs are skipped. The visitor must not modify the hashmap.
+ *
+ * @param map Pointer to the HashMap.
+ * @param cursor In: the scan cursor, out: the next cursor, 0 when the walk is complete.
+ * @param visitor Callback invoked for each pair of the bucket. Returning false
+ *                stops the walk after the current bucket.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return True if the visitor wants more pairs.
+ */
+bool hash_map_scan(HashMap *map, size_t *cursor, HashMapVisitor visitor, void *ctx);
+
+/**
+ * @brief Measures the occupancy of the hashmap.
+ *
+ * Walks every slot, so it costs time proportional to the capacity.
+ *
+ * @param map Pointer to the HashMap.
+ * @param stats Receives the figures.
+ */
+void hash_map_stats(HashMap *map, HashMapStats *stats);
 
 /**
- * @brief Retrieves all key-value pairs as a formatted string.
+ * @brief Removes every key-value pair.
  *
- * The returned string contains all key-value pairs in a human-readable format.
- * The caller is responsible for freeing the returned string.
+ * The tables shrink back to their smallest size. Lookups without the lock
+ * that run meanwhile see either the old or the empty map.
  *
  * @param map Pointer to the HashMap.
- * @return A dynamically allocated string containing all key-value pairs, or NULL if empty.
+ * @return True on success, false if the empty table could not be allocated.
  */
-char *hash_map_get_all(HashMap *map);
+bool hash_map_clear(HashMap *map);
 
 /**
  * @brief Frees all memory associated with the hashmap.
  *
- * This function deallocates all key-value pairs, buckets, and the hashmap itself.
+ * This function deallocates all key-value pairs, tables, and the hashmap itself.
  *
  * @param map Pointer to the HashMap to be freed.
  */
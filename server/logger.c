@@ -1,52 +1,913 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include "utils.h"
 #include "logger.h"
 
-static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOG_RING_SIZE (64 * 1024)        /** Bytes of records each thread can have pending, a power of two */
+#define LOG_MAX_RECORD 2048              /** Largest encoded record, arguments included */
+#define LOG_MAX_STRING 256               /** Bytes of a string argument that are kept */
+#define LOG_OUTPUT_SIZE (64 * 1024)      /** Formatted text gathered before it is written */
+#define LOG_LINE_MAX 4096                /** Longest formatted line, longer ones are cut */
+#define LOG_FLUSH_MIN_INTERVAL_MS 10     /** Flusher sleep while messages keep coming */
+#define LOG_FLUSH_MAX_INTERVAL_MS 200    /** Flusher sleep once the logs went quiet */
+#define LOG_RECORD_PADDING 0xffffffffu   /** Level of the filler skipping the end of a ring */
 
 /**
- * @brief Logs a formatted message with a timestamp, log level, and thread information.
+ * @brief Header of a binary log record.
  *
- * This function generates a log message with the current timestamp (with milliseconds),
- * the specified log level, and the thread name (or ID if unavailable). The message
- * supports printf-style formatting.
+ * Followed by the arguments in 8-byte slots, in the order the format
+ * consumes them. A string takes a slot with its length, then its bytes
+ * and a terminator, padded to a slot boundary.
+ */
+typedef struct
+{
+    uint32_t size;         /** Bytes taken in the ring, header included, a multiple of 8 */
+    uint32_t level;        /** LogLevel, or LOG_RECORD_PADDING */
+    uint64_t timestamp_ms; /** Coarse wall clock time the message was logged at */
+    const char *format;    /** The format string literal */
+} LogRecord;
+
+/**
+ * @brief State of a ring buffer.
+ */
+enum
+{
+    RING_ACTIVE, /** Owned by a running thread */
+    RING_RETIRED /** Its thread exited; another one may take it over once it is drained */
+};
+
+/**
+ * @brief Single-producer, single-consumer ring of log records.
+ *
+ * The owning thread appends records and publishes them by advancing `tail`;
+ * the flusher formats them and hands the space back by advancing `head`.
+ * Both positions only grow and are reduced modulo LOG_RING_SIZE. A record
+ * never wraps: if it does not fit before the end, the end is skipped with a
+ * padding record.
+ */
+typedef struct LogRing
+{
+    _Atomic size_t head;                /** Position of the next record to format (flusher) */
+    _Alignas(64) _Atomic size_t tail;   /** Position after the last published record (owner) */
+    _Atomic uint64_t dropped;           /** Messages dropped because the ring was full (owner) */
+    uint64_t reported;                  /** Drops already reported (flusher) */
+    size_t drain_pos;                   /** Next record of the current pass (flusher) */
+    size_t drain_end;                   /** End of the records taken in the current pass (flusher) */
+    _Atomic int state;                  /** RING_ACTIVE or RING_RETIRED */
+    char thread_name[16];               /** Name of the owning thread */
+    struct LogRing *next;               /** Next ring in the list of every ring */
+    _Alignas(64) char data[LOG_RING_SIZE];
+} LogRing;
+
+/**
+ * @brief Kind of argument a conversion consumes.
+ */
+typedef enum
+{
+    ARG_NONE,     /** `%%` or an unknown conversion */
+    ARG_SIGNED,   /** d, i */
+    ARG_UNSIGNED, /** u, o, x, X */
+    ARG_CHAR,     /** c */
+    ARG_DOUBLE,   /** e, f, g, a and their upper case forms */
+    ARG_STRING,   /** s */
+    ARG_POINTER,  /** p */
+    ARG_COUNT     /** n, consumed but ignored */
+} ArgKind;
+
+/**
+ * @brief Length modifier of a conversion.
+ */
+typedef enum
+{
+    LEN_NONE,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_Z,
+    LEN_J,
+    LEN_T,
+    LEN_LONG_DOUBLE
+} ArgLength;
+
+/**
+ * @brief One conversion specification of a format string.
+ */
+typedef struct
+{
+    const char *start;     /** The `%` */
+    const char *width;     /** Start of the width, right after the flags */
+    const char *precision; /** Start of the precision (its `.`), right after the width */
+    const char *length;    /** Start of the length modifier */
+    const char *end;       /** One past the conversion character */
+    bool star_width;       /** Width is given as an argument */
+    bool star_precision;   /** Precision is given as an argument */
+    int precision_value;   /** Literal precision, -1 if absent or given as an argument */
+    ArgLength length_kind; /** Parsed length modifier */
+    ArgKind kind;          /** Argument consumed by the conversion */
+} FormatSpec;
+
+/**
+ * @brief Cursor over the argument area of a record.
+ */
+typedef struct
+{
+    char *pos;
+    char *end;
+} ArgCursor;
+
+static _Atomic(LogRing *) ring_list = NULL;
+static _Atomic uint64_t unrecorded = 0; /** Messages lost because no ring could be allocated */
+static __thread LogRing *local_ring = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+// Only one thread formats at a time: the flusher, or whoever calls flush_logs on shutdown
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static char output[LOG_OUTPUT_SIZE];
+static size_t output_len = 0;
+static time_t cached_second = -1;
+static char cached_date[24];
+
+static const char *const level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+/**
+ * @brief Parses the next conversion specification of a format string.
+ * @param format Where to start looking.
+ * @param spec Receives the specification.
+ * @return true if one was found.
+ */
+static bool next_spec(const char *format, FormatSpec *spec)
+{
+    const char *p = strchr(format, '%');
+    if (!p)
+        return false;
+
+    spec->start = p++;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+
+    spec->width = p;
+    spec->star_width = *p == '*';
+    if (spec->star_width)
+        p++;
+    while (*p >= '0' && *p <= '9')
+        p++;
+
+    spec->precision = p;
+    spec->star_precision = false;
+    spec->precision_value = -1;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            spec->star_precision = true;
+            p++;
+        }
+        else
+        {
+            spec->precision_value = 0;
+            while (*p >= '0' && *p <= '9')
+                spec->precision_value = spec->precision_value * 10 + (*p++ - '0');
+        }
+    }
+
+    spec->length = p;
+    switch (*p)
+    {
+    case 'h':
+        spec->length_kind = p[1] == 'h' ? LEN_HH : LEN_H;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        spec->length_kind = p[1] == 'l' ? LEN_LL : LEN_L;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'z':
+        spec->length_kind = LEN_Z;
+        p++;
+        break;
+    case 'j':
+        spec->length_kind = LEN_J;
+        p++;
+        break;
+    case 't':
+        spec->length_kind = LEN_T;
+        p++;
+        break;
+    case 'L':
+        spec->length_kind = LEN_LONG_DOUBLE;
+        p++;
+        break;
+    default:
+        spec->length_kind = LEN_NONE;
+        break;
+    }
+
+    switch (*p)
+    {
+    case 'd':
+    case 'i':
+        spec->kind = ARG_SIGNED;
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        spec->kind = ARG_UNSIGNED;
+        break;
+    case 'c':
+        spec->kind = ARG_CHAR;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        spec->kind = ARG_DOUBLE;
+        break;
+    case 's':
+        spec->kind = ARG_STRING;
+        break;
+    case 'p':
+        spec->kind = ARG_POINTER;
+        break;
+    case 'n':
+        spec->kind = ARG_COUNT;
+        break;
+    default:
+        spec->kind = ARG_NONE;
+        break;
+    }
+
+    spec->end = *p ? p + 1 : p;
+    return true;
+}
+
+/**
+ * @brief Appends one 8-byte slot to a record.
+ * @return false if the record is full.
+ */
+static bool put_slot(ArgCursor *cursor, uint64_t value)
+{
+    if (cursor->end - cursor->pos < 8)
+        return false;
+
+    memcpy(cursor->pos, &value, 8);
+    cursor->pos += 8;
+    return true;
+}
+
+/**
+ * @brief Reads the next 8-byte slot of a record.
+ */
+static uint64_t get_slot(ArgCursor *cursor)
+{
+    uint64_t value = 0;
+
+    if (cursor->end - cursor->pos >= 8)
+    {
+        memcpy(&value, cursor->pos, 8);
+        cursor->pos += 8;
+    }
+
+    return value;
+}
+
+/**
+ * @brief Copies a string argument into a record.
+ * @param cursor The argument area.
+ * @param text The string, or NULL.
+ * @param precision Most bytes to read, -1 to read up to the terminator.
+ * @return false if the record is full.
+ */
+static bool put_string(ArgCursor *cursor, const char *text, int precision)
+{
+    if (!text)
+        text = "(null)";
+
+    size_t limit = precision >= 0 && precision < LOG_MAX_STRING ? (size_t)precision : LOG_MAX_STRING;
+    size_t len = strnlen(text, limit);
+    size_t padded = (len + 1 + 7) & ~(size_t)7;
+
+    if (!put_slot(cursor, len) || (size_t)(cursor->end - cursor->pos) < padded)
+        return false;
+
+    memcpy(cursor->pos, text, len);
+    memset(cursor->pos + len, 0, padded - len);
+    cursor->pos += padded;
+    return true;
+}
+
+/**
+ * @brief Reads a string argument of a record.
+ */
+static const char *get_string(ArgCursor *cursor)
+{
+    size_t len = get_slot(cursor);
+    size_t padded = (len + 1 + 7) & ~(size_t)7;
+
+    if ((size_t)(cursor->end - cursor->pos) < padded)
+        return "";
+
+    const char *text = cursor->pos;
+    cursor->pos += padded;
+    return text;
+}
+
+/**
+ * @brief Captures the arguments of a message in the order its format consumes them.
+ * @param cursor The argument area of the record being built.
+ * @param format The format string.
+ * @param args The arguments.
+ * @return false if they do not fit in a record.
+ */
+static bool encode_arguments(ArgCursor *cursor, const char *format, va_list args)
+{
+    FormatSpec spec;
+
+    while (next_spec(format, &spec))
+    {
+        format = spec.end;
+        int precision = spec.precision_value;
+
+        if (spec.star_width && !put_slot(cursor, (uint64_t)(int64_t)va_arg(args, int)))
+            return false;
+
+        if (spec.star_precision)
+        {
+            precision = va_arg(args, int);
+            if (!put_slot(cursor, (uint64_t)(int64_t)precision))
+                return false;
+        }
+
+        uint64_t value = 0;
+
+        switch (spec.kind)
+        {
+        case ARG_SIGNED:
+            switch (spec.length_kind)
+            {
+            case LEN_HH:
+                value = (int64_t)(signed char)va_arg(args, int);
+                break;
+            case LEN_H:
+                value = (int64_t)(short)va_arg(args, int);
+                break;
+            case LEN_L:
+                value = (int64_t)va_arg(args, long);
+                break;
+            case LEN_LL:
+                value = (int64_t)va_arg(args, long long);
+                break;
+            case LEN_Z:
+                value = (int64_t)va_arg(args, ssize_t);
+                break;
+            case LEN_J:
+                value = (int64_t)va_arg(args, intmax_t);
+                break;
+            case LEN_T:
+                value = (int64_t)va_arg(args, ptrdiff_t);
+                break;
+            default:
+                value = (int64_t)va_arg(args, int);
+                break;
+            }
+            break;
+
+        case ARG_UNSIGNED:
+            switch (spec.length_kind)
+            {
+            case LEN_HH:
+                value = (unsigned char)va_arg(args, unsigned int);
+                break;
+            case LEN_H:
+                value = (unsigned short)va_arg(args, unsigned int);
+                break;
+            case LEN_L:
+                value = va_arg(args, unsigned long);
+                break;
+            case LEN_LL:
+                value = va_arg(args, unsigned long long);
+                break;
+            case LEN_Z:
+                value = va_arg(args, size_t);
+                break;
+            case LEN_J:
+                value = va_arg(args, uintmax_t);
+                break;
+            case LEN_T:
+                value = (uint64_t)va_arg(args, ptrdiff_t);
+                break;
+            default:
+                value = va_arg(args, unsigned int);
+                break;
+            }
+            break;
+
+        case ARG_CHAR:
+            value = (uint64_t)(int64_t)va_arg(args, int);
+            break;
+
+        case ARG_DOUBLE:
+        {
+            double number = spec.length_kind == LEN_LONG_DOUBLE ? (double)va_arg(args, long double) : va_arg(args, double);
+            memcpy(&value, &number, sizeof(value));
+            break;
+        }
+
+        case ARG_STRING:
+            if (!put_string(cursor, va_arg(args, const char *), precision))
+                return false;
+            continue;
+
+        case ARG_POINTER:
+            value = (uint64_t)(uintptr_t)va_arg(args, void *);
+            break;
+
+        case ARG_COUNT:
+            (void)va_arg(args, void *);
+            continue;
+
+        default:
+            continue;
+        }
+
+        if (!put_slot(cursor, value))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Marks the ring of an exiting thread as free for another thread.
+ * @param ring The ring.
+ */
+static void retire_ring(void *ring)
+{
+    atomic_store_explicit(&((LogRing *)ring)->state, RING_RETIRED, memory_order_release);
+}
+
+/**
+ * @brief Creates the key whose destructor retires the ring of an exiting thread.
+ */
+static void create_ring_key(void)
+{
+    pthread_key_create(&ring_key, retire_ring);
+}
+
+/**
+ * @brief Returns the ring of the calling thread, taking one on its first message.
+ *
+ * A drained ring left by an exited thread is reused before a new one is
+ * allocated, so short-lived threads do not make the list grow.
  *
- * @param level The log level (e.g., "INFO", "ERROR", "DEBUG").
- * @param format The printf-style format string.
- * @param ... Variable arguments for formatting.
+ * @return The ring, or NULL if none could be allocated.
  */
-void log_message(const char *level, const char *format, ...)
+static LogRing *acquire_ring(void)
 {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
+    if (local_ring)
+        return local_ring;
 
-    struct tm t;
-    localtime_r(&tv.tv_sec, &t);
+    pthread_once(&ring_key_once, create_ring_key);
 
-    char timestamp[24];
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &t);
+    LogRing *ring = atomic_load_explicit(&ring_list, memory_order_acquire);
+    for (; ring; ring = ring->next)
+    {
+        int retired = RING_RETIRED;
+        if (atomic_load_explicit(&ring->head, memory_order_acquire) == atomic_load_explicit(&ring->tail, memory_order_relaxed) &&
+            atomic_compare_exchange_strong(&ring->state, &retired, RING_ACTIVE))
+            break;
+    }
+
+    if (!ring)
+    {
+        ring = aligned_alloc(_Alignof(LogRing), sizeof(LogRing));
+        if (!ring)
+            return NULL;
 
-    char timestamp_ms[30];
-    snprintf(timestamp_ms, sizeof(timestamp_ms), "%s.%03d", timestamp, (int)(tv.tv_usec / 1000));
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->dropped, 0);
+        atomic_init(&ring->state, RING_ACTIVE);
+        ring->reported = 0;
+        ring->next = atomic_load_explicit(&ring_list, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(&ring_list, &ring->next, ring, memory_order_release, memory_order_relaxed))
+            ;
+    }
+
+    if (pthread_getname_np(pthread_self(), ring->thread_name, sizeof(ring->thread_name)) != 0)
+        snprintf(ring->thread_name, sizeof(ring->thread_name), "%lu", (unsigned long)pthread_self());
 
-    pthread_t tid = pthread_self();
-    char thread_name[16] = "(unknown)";
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    return ring;
+}
 
-    if (pthread_getname_np(tid, thread_name, sizeof(thread_name)) != 0)
+/**
+ * @brief Records a log message in the ring of the calling thread.
+ *
+ * Takes a coarse timestamp, which the kernel keeps updated without a
+ * system call, and copies the arguments; nothing is formatted here.
+ *
+ * @param level The log level.
+ * @param format The printf-style format string literal.
+ * @param ... Arguments for the format.
+ */
+void log_message(LogLevel level, const char *format, ...)
+{
+    LogRing *ring = acquire_ring();
+    if (!ring)
     {
-        snprintf(thread_name, sizeof(thread_name), "%lu", (unsigned long)tid);
+        atomic_fetch_add_explicit(&unrecorded, 1, memory_order_relaxed);
+        return;
     }
 
-    char log_msg[256];
+    _Alignas(8) char staging[LOG_MAX_RECORD];
+    LogRecord *record = (LogRecord *)staging;
+    ArgCursor cursor = {staging + sizeof(LogRecord), staging + sizeof(staging)};
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
     va_list args;
     va_start(args, format);
-    int needed_size = vsnprintf(log_msg, sizeof(log_msg), format, args);
+    bool encoded = encode_arguments(&cursor, format, args);
     va_end(args);
 
-    if (needed_size < 0)
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t size = cursor.pos - staging;
+    size_t offset = tail & (LOG_RING_SIZE - 1);
+    size_t contiguous = LOG_RING_SIZE - offset;
+    size_t needed = size + (contiguous < size ? contiguous : 0);
+
+    if (!encoded || LOG_RING_SIZE - (tail - head) < needed)
     {
-        snprintf(log_msg, sizeof(log_msg), "LOG ERROR: Formatting failed");
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1, memory_order_relaxed);
+        return;
     }
 
-    pthread_mutex_lock(&log_mutex);
-    printf("[%s] [%s] [Thread: %s] %s\n", timestamp_ms, level, thread_name, log_msg);
-    pthread_mutex_unlock(&log_mutex);
+    record->size = (uint32_t)size;
+    record->level = level;
+    record->timestamp_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    record->format = format;
+
+    if (contiguous < size)
+    {
+        // Skip the end of the ring, the record goes to the start
+        LogRecord *padding = (LogRecord *)(ring->data + offset);
+        padding->size = (uint32_t)contiguous;
+        padding->level = LOG_RECORD_PADDING;
+        tail += contiguous;
+        offset = 0;
+    }
+
+    memcpy(ring->data + offset, staging, size);
+    atomic_store_explicit(&ring->tail, tail + size, memory_order_release);
+}
+
+/**
+ * @brief Writes the gathered text out.
+ */
+static void write_output(void)
+{
+    if (output_len == 0)
+        return;
+
+    // Straight to the descriptor: flushing stdout here would race with exit() flushing it
+    write_all(STDOUT_FILENO, output, output_len);
+    output_len = 0;
+}
+
+/**
+ * @brief Appends text to a line, cutting it at the end of the line buffer.
+ */
+static void line_append(char *line, size_t *len, const char *text, size_t text_len)
+{
+    size_t room = LOG_LINE_MAX - 1 - *len;
+    if (text_len > room)
+        text_len = room;
+
+    memcpy(line + *len, text, text_len);
+    *len += text_len;
+}
+
+/**
+ * @brief Formats one conversion with its captured argument.
+ *
+ * The specification is rebuilt with any `*` replaced by its value and the
+ * length modifier of integers widened to `ll`, matching how they were stored.
+ */
+static void line_format(char *line, size_t *len, const FormatSpec *spec, ArgCursor *args)
+{
+    char text[64];
+    size_t text_len = 0;
+    int width = spec->star_width ? (int)(int64_t)get_slot(args) : 0;
+    int precision = spec->star_precision ? (int)(int64_t)get_slot(args) : -1;
+    size_t flags_len = spec->width - spec->start;
+    size_t width_len = spec->precision - spec->width;
+    size_t precision_len = spec->length - spec->precision;
+
+    if (flags_len + width_len + precision_len + 32 > sizeof(text))
+        return;
+
+    memcpy(text, spec->start, flags_len);
+    text_len = flags_len;
+
+    if (spec->star_width)
+        text_len += snprintf(text + text_len, sizeof(text) - text_len, "%s%d", width < 0 ? "-" : "", width < 0 ? -width : width);
+    else
+    {
+        memcpy(text + text_len, spec->width, width_len);
+        text_len += width_len;
+    }
+
+    if (spec->star_precision)
+    {
+        if (precision >= 0)
+            text_len += snprintf(text + text_len, sizeof(text) - text_len, ".%d", precision);
+    }
+    else
+    {
+        memcpy(text + text_len, spec->precision, precision_len);
+        text_len += precision_len;
+    }
+
+    if (spec->kind == ARG_SIGNED || spec->kind == ARG_UNSIGNED)
+    {
+        memcpy(text + text_len, "ll", 2);
+        text_len += 2;
+    }
+
+    text[text_len++] = spec->end[-1];
+    text[text_len] = '\0';
+
+    size_t room = LOG_LINE_MAX - *len;
+    int written = 0;
+    uint64_t value;
+    double number;
+
+    switch (spec->kind)
+    {
+    case ARG_SIGNED:
+        written = snprintf(line + *len, room, text, (long long)(int64_t)get_slot(args));
+        break;
+    case ARG_UNSIGNED:
+        written = snprintf(line + *len, room, text, (unsigned long long)get_slot(args));
+        break;
+    case ARG_CHAR:
+        written = snprintf(line + *len, room, text, (int)(int64_t)get_slot(args));
+        break;
+    case ARG_DOUBLE:
+        value = get_slot(args);
+        memcpy(&number, &value, sizeof(number));
+        written = snprintf(line + *len, room, text, number);
+        break;
+    case ARG_STRING:
+        written = snprintf(line + *len, room, text, get_string(args));
+        break;
+    case ARG_POINTER:
+        written = snprintf(line + *len, room, text, (void *)(uintptr_t)get_slot(args));
+        break;
+    default:
+        break;
+    }
+
+    if (written > 0)
+        *len += (size_t)written < room ? (size_t)written : room - 1;
+}
+
+/**
+ * @brief Formats a log line into the output, writing the output out first if it is too full.
+ * @param timestamp_ms Time of the message.
+ * @param level Level name.
+ * @param thread Name of the thread that logged it.
+ * @param format The format string.
+ * @param args The captured arguments, or NULL if the format takes none.
+ */
+static void format_line(uint64_t timestamp_ms, const char *level, const char *thread, const char *format, ArgCursor *args)
+{
+    if (LOG_OUTPUT_SIZE - output_len < LOG_LINE_MAX)
+        write_output();
+
+    // Dates only change once a second, so the broken-down time is cached
+    time_t second = (time_t)(timestamp_ms / 1000);
+    if (second != cached_second)
+    {
+        struct tm t;
+        localtime_r(&second, &t);
+        strftime(cached_date, sizeof(cached_date), "%Y-%m-%d %H:%M:%S", &t);
+        cached_second = second;
+    }
+
+    char *line = output + output_len;
+    size_t len = snprintf(line, LOG_LINE_MAX, "[%s.%03d] [%s] [Thread: %s] ",
+                          cached_date, (int)(timestamp_ms % 1000), level, thread);
+    FormatSpec spec;
+
+    while (args && next_spec(format, &spec))
+    {
+        line_append(line, &len, format, spec.start - format);
+        format = spec.end;
+
+        if (spec.kind == ARG_NONE)
+        {
+            // `%%` prints a percent sign, anything unknown is printed as is
+            if (spec.end[-1] == '%')
+                line_append(line, &len, "%", 1);
+            else
+                line_append(line, &len, spec.start, spec.end - spec.start);
+        }
+        else if (spec.kind == ARG_COUNT)
+        {
+            continue;
+        }
+        else
+        {
+            line_format(line, &len, &spec, args);
+        }
+    }
+
+    line_append(line, &len, format, strlen(format));
+    line[len++] = '\n';
+    output_len += len;
+}
+
+/**
+ * @brief Returns the next record of the current pass over a ring, skipping padding.
+ * @param ring The ring.
+ * @return The record, or NULL once the pass reached the end of what was taken.
+ */
+static LogRecord *peek_record(LogRing *ring)
+{
+    while (ring->drain_pos != ring->drain_end)
+    {
+        LogRecord *record = (LogRecord *)(ring->data + (ring->drain_pos & (LOG_RING_SIZE - 1)));
+        if (record->level != LOG_RECORD_PADDING)
+            return record;
+
+        ring->drain_pos += record->size;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Reports the messages a ring dropped since the last report.
+ * @param ring The ring.
+ */
+static void report_drops(LogRing *ring)
+{
+    uint64_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped == ring->reported)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+    char message[64];
+    snprintf(message, sizeof(message), "%llu log messages dropped, the ring was full",
+             (unsigned long long)(dropped - ring->reported));
+    format_line((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000, "WARN", ring->thread_name, message, NULL);
+    ring->reported = dropped;
+}
+
+/**
+ * @brief Formats every record published so far and writes the result out.
+ *
+ * Each ring is in order on its own, so the rings are merged by timestamp
+ * to keep lines from different threads in order too.
+ *
+ * @return true if there was anything to write.
+ */
+static bool drain_rings(void)
+{
+    pthread_mutex_lock(&drain_lock);
+
+    LogRing *rings = atomic_load_explicit(&ring_list, memory_order_acquire);
+    for (LogRing *ring = rings; ring; ring = ring->next)
+    {
+        ring->drain_pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        ring->drain_end = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    }
+
+    while (true)
+    {
+        LogRing *oldest = NULL;
+        LogRecord *oldest_record = NULL;
+
+        for (LogRing *ring = rings; ring; ring = ring->next)
+        {
+            LogRecord *record = peek_record(ring);
+            if (record && (!oldest_record || record->timestamp_ms < oldest_record->timestamp_ms))
+            {
+                oldest = ring;
+                oldest_record = record;
+            }
+        }
+
+        if (!oldest)
+            break;
+
+        ArgCursor args = {(char *)(oldest_record + 1), (char *)oldest_record + oldest_record->size};
+        const char *level = oldest_record->level < sizeof(level_names) / sizeof(level_names[0]) ? level_names[oldest_record->level] : "?";
+        format_line(oldest_record->timestamp_ms, level, oldest->thread_name, oldest_record->format, &args);
+        oldest->drain_pos += oldest_record->size;
+    }
+
+    for (LogRing *ring = rings; ring; ring = ring->next)
+    {
+        report_drops(ring);
+
+        // Published last: once head reaches tail a retired ring may be taken over
+        atomic_store_explicit(&ring->head, ring->drain_pos, memory_order_release);
+    }
+
+    bool wrote = output_len > 0;
+    write_output();
+
+    pthread_mutex_unlock(&drain_lock);
+    return wrote;
+}
+
+/**
+ * @brief Writes every pending log message.
+ */
+void flush_logs(void)
+{
+    drain_rings();
+}
+
+/**
+ * @brief Main loop of the flusher thread.
+ *
+ * Drains the rings every LOG_FLUSH_MIN_INTERVAL_MS while messages keep
+ * coming, backing off to LOG_FLUSH_MAX_INTERVAL_MS when the logs are quiet.
+ */
+static void *flusher_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "logger");
+
+    long interval_ms = LOG_FLUSH_MIN_INTERVAL_MS;
+
+    while (true)
+    {
+        if (drain_rings())
+            interval_ms = LOG_FLUSH_MIN_INTERVAL_MS;
+        else if (interval_ms < LOG_FLUSH_MAX_INTERVAL_MS)
+            interval_ms = interval_ms * 2 < LOG_FLUSH_MAX_INTERVAL_MS ? interval_ms * 2 : LOG_FLUSH_MAX_INTERVAL_MS;
+
+        struct timespec delay = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+        nanosleep(&delay, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Starts the flusher thread and flushes pending messages at exit.
+ * @return true on success, false if the thread could not be started.
+ */
+bool initialize_logger(void)
+{
+    pthread_t flusher;
+
+    if (pthread_create(&flusher, NULL, flusher_main, NULL) != 0)
+    {
+        perror("pthread_create logger");
+        return false;
+    }
+
+    pthread_detach(flusher);
+    atexit(flush_logs);
+    return true;
+}
+
+/**
+ * @brief Returns the number of messages dropped so far.
+ * @return Messages dropped because a ring was full or could not be allocated.
+ */
+uint64_t log_dropped(void)
+{
+    uint64_t dropped = atomic_load_explicit(&unrecorded, memory_order_relaxed);
+
+    for (LogRing *ring = atomic_load_explicit(&ring_list, memory_order_acquire); ring; ring = ring->next)
+        dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+
+    return dropped;
 }
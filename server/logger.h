@@ -1,22 +1,87 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-#include <stdio.h>
-#include <stdarg.h>
-#include <pthread.h>
-#include <time.h>
-#include <sys/time.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 /**
- * @brief Logs a formatted message with a specified log level.
+ * @brief Severity of a log message.
+ */
+typedef enum
+{
+    LOG_LEVEL_DEBUG, /**< Detail only useful while debugging */
+    LOG_LEVEL_INFO,  /**< Normal operation */
+    LOG_LEVEL_WARN,  /**< Something unexpected the server recovered from */
+    LOG_LEVEL_ERROR  /**< A failed operation */
+} LogLevel;
+
+/**
+ * @brief Lowest level that is compiled in.
+ *
+ * Messages below it are removed by the compiler, arguments included. Debug
+ * messages are left out of builds with `NDEBUG`; `make LOG_LEVEL=WARN`
+ * raises the threshold further.
+ */
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#define LOG_AT(level, ...)                       \
+    do                                           \
+    {                                            \
+        if ((level) >= LOG_MIN_LEVEL)            \
+            log_message((level), __VA_ARGS__);   \
+    } while (0)
+
+#define log_debug(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define log_warn(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_error(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+/**
+ * @brief Starts the background thread that writes log messages.
  *
- * This function prints a timestamped log message with the given severity level.
- * The message format follows printf-style formatting.
+ * Messages logged before are kept and written once it runs. Pending
+ * messages are also written when the process exits.
  *
- * @param level The log level (e.g., "INFO", "ERROR", "DEBUG").
+ * @return True on success, false if the thread could not be started.
+ */
+bool initialize_logger(void);
+
+/**
+ * @brief Records a log message; use the `log_*` macros instead.
+ *
+ * Nothing is formatted on the calling thread: the message is stored as a
+ * binary record in a ring owned by the thread, holding a coarse timestamp,
+ * the format pointer and the raw arguments, with strings copied. The
+ * background thread formats and writes records in batches. When the ring is
+ * full the message is dropped and counted.
+ *
+ * The format must be a string literal, since only its address is recorded.
+ * `%n` is not supported and long string arguments are truncated.
+ *
+ * @param level The log level.
  * @param format The printf-style format string.
- * @param ... Variable arguments corresponding to the format specifiers.
+ * @param ... Arguments corresponding to the format specifiers.
+ */
+void log_message(LogLevel level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Writes every pending log message right away.
+ *
+ * Used on shutdown, from any thread.
+ */
+void flush_logs(void);
+
+/**
+ * @brief Returns how many messages were dropped because a ring was full.
+ *
+ * @return Number of messages dropped since startup.
  */
-void log_message(const char *level, const char *format, ...);
+uint64_t log_dropped(void);
 
 #endif // LOGGER_H
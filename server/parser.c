@@ -1,94 +1,399 @@
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include "parser.h"
 
-#define COMMAND_MAX_SIZE 16 /**Maximum possible length of a command string */
+#define RESP_MAX_ARRAY_LEN (1024 * 1024)       /** Largest accepted number of request elements */
+#define RESP_MAX_BULK_LEN (512 * 1024 * 1024)  /** Largest accepted bulk string */
 
 /**
- * @brief Converts a command string to its corresponding CommandType.
+ * @brief Compares a token with an upper-case keyword, ignoring case.
  *
- * This function converts the given command string to uppercase,
- * then matches it against known commands (`SET`, `GET`, `DEL`, `GETALL`).
+ * Folding with `| 0x20` is only exact for letters, which is all keywords contain.
+ *
+ * @param token The token bytes.
+ * @param keyword The upper-case keyword, of the same length as the token.
+ * @param len Length of both.
+ * @return true if they match.
+ */
+static inline bool keyword_equals(const char *token, const char *keyword, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if ((token[i] | 0x20) != (keyword[i] | 0x20))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Converts a command token to its corresponding CommandType.
+ *
+ * Dispatches on the token length first, so at most one keyword comparison
+ * is made against known commands (`SET`, `GET`, `DEL`, `GETALL`, `SLABS`,
+ * `PING`, `HELLO`, `SCAN`, `INFO`, `STATS`, `EXPIRE`, `TTL`, `INCR`, `DECR`,
+ * `INCRBY`, `DECRBY`, `CONFIG`).
  * If the command is not recognized, it returns `CMD_INVALID`.
  *
- * @param str The command string to convert.
+ * @param str The command token.
+ * @param len Length of the token.
  * @return The corresponding CommandType, or CMD_INVALID if unrecognized.
  */
-CommandType string_to_command(const char *str)
+CommandType string_to_command(const char *str, size_t len)
 {
-    char command_str[COMMAND_MAX_SIZE] = {0};
+    switch (len)
+    {
+    case 3:
+        switch (str[0] | 0x20)
+        {
+        case 's':
+            return keyword_equals(str, "SET", 3) ? CMD_SET : CMD_INVALID;
+        case 'g':
+            return keyword_equals(str, "GET", 3) ? CMD_GET : CMD_INVALID;
+        case 'd':
+            return keyword_equals(str, "DEL", 3) ? CMD_REMOVE : CMD_INVALID;
+        case 't':
+            return keyword_equals(str, "TTL", 3) ? CMD_TTL : CMD_INVALID;
+        }
+        break;
 
-    for (int i = 0; i < COMMAND_MAX_SIZE - 1 && str[i]; i++)
+    case 4:
+        switch (str[0] | 0x20)
+        {
+        case 'p':
+            return keyword_equals(str, "PING", 4) ? CMD_PING : CMD_INVALID;
+        case 's':
+            if (keyword_equals(str, "SCAN", 4))
+                return CMD_SCAN;
+            return keyword_equals(str, "SYNC", 4) ? CMD_SYNC : CMD_INVALID;
+        case 'i':
+            if (keyword_equals(str, "INFO", 4))
+                return CMD_INFO;
+            return keyword_equals(str, "INCR", 4) ? CMD_INCR : CMD_INVALID;
+        case 'd':
+            return keyword_equals(str, "DECR", 4) ? CMD_DECR : CMD_INVALID;
+        case 'm':
+            if (keyword_equals(str, "MGET", 4))
+                return CMD_MGET;
+            if (keyword_equals(str, "MSET", 4))
+                return CMD_MSET;
+            return keyword_equals(str, "MDEL", 4) ? CMD_MDEL : CMD_INVALID;
+        }
+        break;
+
+    case 5:
+        switch (str[0] | 0x20)
+        {
+        case 's':
+            if (keyword_equals(str, "SLABS", 5))
+                return CMD_SLABS;
+            return keyword_equals(str, "STATS", 5) ? CMD_INFO : CMD_INVALID;
+        case 'h':
+            return keyword_equals(str, "HELLO", 5) ? CMD_HELLO : CMD_INVALID;
+        }
+        break;
+
+    case 6:
+        switch (str[0] | 0x20)
+        {
+        case 'g':
+            return keyword_equals(str, "GETALL", 6) ? CMD_GET_ALL : CMD_INVALID;
+        case 'e':
+            return keyword_equals(str, "EXPIRE", 6) ? CMD_EXPIRE : CMD_INVALID;
+        case 'b':
+            return keyword_equals(str, "BGSAVE", 6) ? CMD_BGSAVE : CMD_INVALID;
+        case 'i':
+            return keyword_equals(str, "INCRBY", 6) ? CMD_INCRBY : CMD_INVALID;
+        case 'd':
+            return keyword_equals(str, "DECRBY", 6) ? CMD_DECRBY : CMD_INVALID;
+        case 'c':
+            return keyword_equals(str, "CONFIG", 6) ? CMD_CONFIG : CMD_INVALID;
+        }
+        break;
+
+    case 12:
+        return keyword_equals(str, "BGREWRITEAOF", 12) ? CMD_BGREWRITEAOF : CMD_INVALID;
+    }
+
+    return CMD_INVALID;
+}
+
+/**
+ * @brief Returns the upper-case name of a command type.
+ * @param type The command type.
+ * @return The name, or "INVALID" for unrecognized commands.
+ */
+const char *command_name(CommandType type)
+{
+    static const char *names[CMD_TYPE_COUNT] = {
+        [CMD_SET] = "SET",
+        [CMD_GET] = "GET",
+        [CMD_REMOVE] = "DEL",
+        [CMD_GET_ALL] = "GETALL",
+        [CMD_SLABS] = "SLABS",
+        [CMD_PING] = "PING",
+        [CMD_HELLO] = "HELLO",
+        [CMD_SCAN] = "SCAN",
+        [CMD_INFO] = "INFO",
+        [CMD_EXPIRE] = "EXPIRE",
+        [CMD_TTL] = "TTL",
+        [CMD_BGREWRITEAOF] = "BGREWRITEAOF",
+        [CMD_BGSAVE] = "BGSAVE",
+        [CMD_MGET] = "MGET",
+        [CMD_MSET] = "MSET",
+        [CMD_MDEL] = "MDEL",
+        [CMD_INCR] = "INCR",
+        [CMD_DECR] = "DECR",
+        [CMD_INCRBY] = "INCRBY",
+        [CMD_DECRBY] = "DECRBY",
+        [CMD_SYNC] = "SYNC",
+        [CMD_CONFIG] = "CONFIG",
+    };
+
+    if (type < 0 || type >= CMD_TYPE_COUNT || !names[type])
+        return "INVALID";
+
+    return names[type];
+}
+
+/**
+ * @brief Returns true for the bytes that separate tokens.
+ */
+static inline bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * @brief Cuts the next whitespace-delimited token off the input.
+ * @param cursor In: start of the remaining input, out: first byte after the token.
+ * @param end One past the last input byte.
+ * @param token Receives the token.
+ * @return true if a token was found, false at the end of the input.
+ */
+static inline bool next_token(const char **cursor, const char *end, Slice *token)
+{
+    const char *p = *cursor;
+
+    while (p < end && is_separator(*p))
+        p++;
+
+    if (p == end)
+        return false;
+
+    const char *start = p;
+    while (p < end && !is_separator(*p))
+        p++;
+
+    token->data = start;
+    token->len = p - start;
+    *cursor = p;
+    return true;
+}
+
+/**
+ * @brief Resets a command before tokens are added to it.
+ * @param cmd Pointer to the Command struct.
+ */
+static void command_init(Command *cmd)
+{
+    cmd->type = CMD_INVALID;
+    cmd->args = cmd->inline_args;
+    cmd->key.data = NULL;
+    cmd->key.len = 0;
+    cmd->arg_count = 0;
+    cmd->too_many_args = false;
+}
+
+/**
+ * @brief Returns whether a command takes any number of arguments.
+ */
+static inline bool is_variadic(CommandType type)
+{
+    return type == CMD_MGET || type == CMD_MSET || type == CMD_MDEL;
+}
+
+/**
+ * @brief Makes room for one more argument of a multi-key command.
+ *
+ * Moves the arguments to the calling thread's overflow array, which only
+ * ever grows, so steady traffic of large batches does not allocate.
+ *
+ * @param cmd Pointer to the Command struct, whose `args` are full.
+ * @return true on success, false if the array could not grow.
+ */
+static bool command_grow_args(Command *cmd)
+{
+    static __thread Slice *overflow = NULL;
+    static __thread size_t overflow_cap = 0;
+
+    if (cmd->args == cmd->inline_args || cmd->arg_count == overflow_cap)
     {
-        if (str[i] == '\n')
-            break;
-        command_str[i] = toupper((unsigned char)str[i]);
+        size_t cap = overflow_cap;
+        if (cap <= cmd->arg_count)
+            cap = cap ? cap * 2 : COMMAND_MAX_ARGS * 8;
+
+        if (cap != overflow_cap)
+        {
+            Slice *grown = realloc(overflow, cap * sizeof(Slice));
+            if (!grown)
+                return false;
+
+            overflow = grown;
+            overflow_cap = cap;
+        }
+
+        if (cmd->args == cmd->inline_args)
+            memcpy(overflow, cmd->inline_args, sizeof(cmd->inline_args));
+        cmd->args = overflow;
     }
 
-    if (strcmp(command_str, "SET") == 0)
+    return true;
+}
+
+/**
+ * @brief Adds the next token of a request to a command.
+ *
+ * The first token selects the command type, the second is the key and the
+ * rest are arguments. Tokens after an unknown command name are ignored.
+ *
+ * @param cmd Pointer to the Command struct.
+ * @param index Position of the token in the request.
+ * @param token The token.
+ */
+static void command_add_token(Command *cmd, size_t index, Slice token)
+{
+    if (index == 0)
     {
-        return CMD_SET;
+        cmd->type = string_to_command(token.data, token.len);
     }
-    else if (strcmp(command_str, "GET") == 0)
+    else if (cmd->type == CMD_INVALID)
     {
-        return CMD_GET;
+        return;
     }
-    else if (strcmp(command_str, "DEL") == 0)
+    else if (index == 1)
     {
-        return CMD_REMOVE;
+        cmd->key = token;
     }
-    else if (strcmp(command_str, "GETALL") == 0)
+    else if (cmd->arg_count >= COMMAND_MAX_ARGS && (!is_variadic(cmd->type) || !command_grow_args(cmd)))
     {
-        return CMD_GET_ALL;
+        cmd->too_many_args = true;
     }
     else
     {
-        return CMD_INVALID;
+        cmd->args[cmd->arg_count++] = token;
     }
 }
 
 /**
- * @brief Parses the client input string and populates a Command struct.
+ * @brief Parses the client input and populates a Command struct.
  *
  * This function extracts the command type, key, and optional arguments
- * from the given input string. It tokenizes the input, determines the
- * command type, and stores arguments in a dynamically allocated array.
+ * from the given input as slices into it. Arguments past COMMAND_MAX_ARGS
+ * are not stored and flag the command instead, unless it is a multi-key
+ * command.
  *
- * @param input The raw input string from the client.
+ * @param input The raw input bytes from the client.
+ * @param len Number of input bytes.
  * @param cmd Pointer to a Command struct to store the parsed command.
  */
-void parse_client_input(const char *input, Command *cmd)
+void parse_client_input(const char *input, size_t len, Command *cmd)
 {
-    while (isspace((unsigned char)*input))
-    {
-        input++;
-    }
+    const char *cursor = input;
+    const char *end = input + len;
+    Slice token;
+
+    command_init(cmd);
 
-    char *command_str = strtok((char *)input, " ");
-    if (!command_str)
+    for (size_t index = 0; next_token(&cursor, end, &token); index++)
     {
-        cmd->type = CMD_INVALID;
-        return;
+        command_add_token(cmd, index, token);
+
+        if (cmd->type == CMD_INVALID || cmd->too_many_args)
+            return;
     }
+}
+
+/**
+ * @brief Reads a RESP length line such as `*3\r\n` or `$5\r\n`.
+ * @param cursor In: points at the type byte, out: first byte after the line.
+ * @param end One past the last buffered byte.
+ * @param type Expected type byte.
+ * @param max Largest accepted value.
+ * @param value Receives the length.
+ * @return The status of the parse.
+ */
+static RespParseStatus read_length(const char **cursor, const char *end, char type, long long max, long long *value)
+{
+    const char *p = *cursor;
+
+    if (p == end)
+        return RESP_PARSE_INCOMPLETE;
 
-    cmd->type = string_to_command(command_str);
-    if (cmd->type == CMD_INVALID)
+    if (*p++ != type)
+        return RESP_PARSE_ERROR;
+
+    long long result = 0;
+    const char *digits = p;
+
+    while (p < end && *p >= '0' && *p <= '9')
     {
-        return;
+        result = result * 10 + (*p - '0');
+        if (result > max)
+            return RESP_PARSE_ERROR;
+        p++;
     }
 
-    cmd->key = strtok(NULL, " ");
-    if (cmd->key)
+    if (end - p < 2)
+        return RESP_PARSE_INCOMPLETE;
+
+    if (p == digits || p[0] != '\r' || p[1] != '\n')
+        return RESP_PARSE_ERROR;
+
+    *value = result;
+    *cursor = p + 2;
+    return RESP_PARSE_OK;
+}
+
+/**
+ * @brief Parses a RESP array of bulk strings into a Command.
+ * @param input The buffered bytes.
+ * @param len Number of buffered bytes.
+ * @param cmd Receives the command.
+ * @param consumed Receives the request size.
+ * @return The status of the parse.
+ */
+RespParseStatus parse_resp_command(const char *input, size_t len, Command *cmd, size_t *consumed)
+{
+    const char *cursor = input;
+    const char *end = input + len;
+    long long count;
+
+    command_init(cmd);
+
+    RespParseStatus status = read_length(&cursor, end, '*', RESP_MAX_ARRAY_LEN, &count);
+    if (status != RESP_PARSE_OK)
+        return status;
+
+    for (long long index = 0; index < count; index++)
     {
-        cmd->args = malloc(sizeof(char *) * 10);
-        int i = 0;
+        long long bulk_len;
 
-        while (cmd->key && (cmd->args[i] = strtok(NULL, " ")) != NULL)
-        {
-            i++;
-        }
-        cmd->args[i] = NULL;
+        status = read_length(&cursor, end, '$', RESP_MAX_BULK_LEN, &bulk_len);
+        if (status != RESP_PARSE_OK)
+            return status;
+
+        // The payload is skipped by its length, never scanned
+        if (end - cursor < bulk_len + 2)
+            return RESP_PARSE_INCOMPLETE;
+
+        if (cursor[bulk_len] != '\r' || cursor[bulk_len + 1] != '\n')
+            return RESP_PARSE_ERROR;
+
+        Slice token = {cursor, (size_t)bulk_len};
+        command_add_token(cmd, (size_t)index, token);
+        cursor += bulk_len + 2;
     }
+
+    *consumed = cursor - input;
+    return RESP_PARSE_OK;
 }
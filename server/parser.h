@@ -1,8 +1,12 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <stddef.h>
+#include <stdbool.h>
 #include "hashmap.h"
 
+#define COMMAND_MAX_ARGS 8 /** Maximum number of arguments after the key, except for multi-key commands */
+
 /**
  * @brief Represents different types of client commands.
  */
@@ -12,25 +16,117 @@ typedef enum
     CMD_SET,          /**< Set a key-value pair */
     CMD_GET,          /**< Retrieve a value by key */
     CMD_REMOVE,       /**< Remove a key-value pair */
-    CMD_GET_ALL       /**< Retrieve all stored key-value pairs */
+    CMD_GET_ALL,      /**< Retrieve all stored key-value pairs */
+    CMD_SLABS,        /**< Report slab allocator statistics */
+    CMD_PING,         /**< Check that the server is alive */
+    CMD_HELLO,        /**< Select the RESP version of the replies */
+    CMD_SCAN,         /**< Iterate over the keys a page at a time */
+    CMD_INFO,         /**< Report server statistics (also `STATS`) */
+    CMD_EXPIRE,       /**< Set the time to live of a key */
+    CMD_TTL,          /**< Report the time to live of a key */
+    CMD_BGREWRITEAOF, /**< Compact the append-only file in the background */
+    CMD_BGSAVE,       /**< Write a snapshot in the background */
+    CMD_MGET,         /**< Retrieve the values of several keys */
+    CMD_MSET,         /**< Set several key-value pairs at once */
+    CMD_MDEL,         /**< Remove several keys */
+    CMD_INCR,         /**< Add one to the integer value of a key */
+    CMD_DECR,         /**< Subtract one from the integer value of a key */
+    CMD_INCRBY,       /**< Add an amount to the integer value of a key */
+    CMD_DECRBY,       /**< Subtract an amount from the integer value of a key */
+    CMD_SYNC,         /**< Start replicating from this server (sent by replicas) */
+    CMD_CONFIG,       /**< Read or change server settings */
+    CMD_TYPE_COUNT    /**< Number of command types, not a command */
 } CommandType;
 
+/**
+ * @brief Wire protocol spoken by a connection.
+ *
+ * The request framing is detected from the first byte a client sends: a
+ * RESP array starts with `*`, anything else is the newline-delimited text
+ * protocol. `HELLO` switches the replies between RESP2 and RESP3.
+ */
+typedef enum
+{
+    PROTOCOL_UNKNOWN, /**< Nothing received yet */
+    PROTOCOL_TEXT,    /**< Space-delimited commands, plain text replies */
+    PROTOCOL_RESP2,   /**< RESP requests, RESP2 replies */
+    PROTOCOL_RESP3    /**< RESP requests, RESP3 replies */
+} Protocol;
+
+/**
+ * @brief Result of parsing a RESP request.
+ */
+typedef enum
+{
+    RESP_PARSE_OK,         /**< A complete command was parsed */
+    RESP_PARSE_INCOMPLETE, /**< More bytes are needed */
+    RESP_PARSE_ERROR       /**< The input is not valid RESP */
+} RespParseStatus;
+
+/**
+ * @brief A view of bytes owned by someone else (usually the connection input buffer).
+ *
+ * Slices are not null-terminated.
+ */
+typedef struct
+{
+    const char *data; /**< First byte, or NULL if the slice is absent */
+    size_t len;       /**< Number of bytes */
+} Slice;
+
 /**
  * @brief Structure representing a parsed command.
+ *
+ * The key and arguments point into the parsed input, so the command is only
+ * valid as long as that input is.
+ *
+ * Multi-key commands take any number of arguments. Up to COMMAND_MAX_ARGS
+ * live in the command itself; longer lists are kept in an array owned by
+ * the parsing thread, which is reused by the next command it parses.
  */
 typedef struct
 {
-    CommandType type; /**< Type of command */
-    char *key;        /**< Key associated with the command (if applicable) */
-    char **args;      /**< Additional arguments (if any) */
+    CommandType type;                    /**< Type of command */
+    Slice key;                           /**< Key associated with the command (if applicable) */
+    Slice *args;                         /**< Additional arguments (if any): `inline_args` or the thread's overflow array */
+    size_t arg_count;                    /**< Number of entries used in `args` */
+    bool too_many_args;                  /**< True if arguments beyond the limit of the command were dropped */
+    Slice inline_args[COMMAND_MAX_ARGS]; /**< Storage for the arguments of most commands */
 } Command;
 
+/**
+ * @brief Returns the upper-case name of a command type.
+ *
+ * @param type The command type.
+ * @return The name, or "INVALID" for unrecognized commands.
+ */
+const char *command_name(CommandType type);
+
 /**
  * @brief Parses client input and populates a Command struct.
  *
- * @param input The raw input string from the client.
+ * Does not modify the input and performs no allocation, apart from growing
+ * the thread's array for the arguments of a large multi-key command.
+ *
+ * @param input The raw input bytes from the client (one frame).
+ * @param len Number of bytes in the input.
+ * @param cmd Pointer to a Command struct to store the parsed command.
+ */
+void parse_client_input(const char *input, size_t len, Command *cmd);
+
+/**
+ * @brief Parses one RESP request (an array of bulk strings).
+ *
+ * The command name, key and arguments become slices into the input, so
+ * bulk payloads are never scanned or copied. Allocates only like
+ * `parse_client_input`.
+ *
+ * @param input The buffered input bytes, starting with `*`.
+ * @param len Number of buffered bytes.
  * @param cmd Pointer to a Command struct to store the parsed command.
+ * @param consumed Receives the size of the request when it is complete.
+ * @return The status of the parse.
  */
-void parse_client_input(const char *input, Command *cmd);
+RespParseStatus parse_resp_command(const char *input, size_t len, Command *cmd, size_t *consumed);
 
 #endif // PARSER_H
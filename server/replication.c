@@ -0,0 +1,736 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include "parser.h"
+#include "store.h"
+#include "aof.h"
+#include "logger.h"
+#include "utils.h"
+#include "replication.h"
+
+#define REPLICATION_BATCH (64 * 1024)       /** Bytes of backlog a sender writes at once */
+#define REPLICATION_PING_MS 1000            /** Silence after which a sender writes a ping */
+#define REPLICATION_TIMEOUT_S 10            /** Seconds a write to a replica or a read from the primary may block */
+#define REPLICATION_RETRY_MS 1000           /** Pause before a replica reconnects */
+#define REPLICATION_READ_SIZE (64 * 1024)   /** Bytes a replica reads from the primary at once */
+#define REPLICATION_MAX_LINE 128            /** Longest status line a primary sends */
+
+static const char ping_line[] = "+PING\r\n";
+static const char synced_line[] = "+SYNCED\r\n";
+
+/**
+ * @brief A replica being served by a sender thread.
+ */
+typedef struct
+{
+    int fd;           /** The replica socket, owned by the sender */
+    bool same_id;     /** The replica knows the replication id of this server */
+    uint64_t offset;  /** Offset the replica asked to continue from */
+} ReplicaLink;
+
+/**
+ * @brief Input buffer of the link to the primary.
+ */
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} ReplicaInput;
+
+static bool replica_mode = false;
+static char *primary_host = NULL;
+static int primary_port = 0;
+static atomic_bool active = false;           /** Logged records are fed to the backlog */
+
+// Guarded by `lock`
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fed;                   /** Signals the senders that the backlog grew */
+static char replid[REPLICATION_ID_LEN + 1];  /** Own id on a primary, id of the primary's history on a replica */
+static char *backlog = NULL;
+static size_t backlog_size = 0;              /** Capacity of the backlog */
+static uint64_t backlog_end = 0;             /** Offset of the next byte fed, on a replica the offset applied */
+static size_t replica_count = 0;
+static uint64_t full_syncs = 0;
+static uint64_t partial_syncs = 0;
+static bool link_up = false;
+static bool syncing = false;
+
+/**
+ * @brief Returns the oldest offset the backlog still holds.
+ */
+static inline uint64_t backlog_first(void)
+{
+    return backlog_end > backlog_size ? backlog_end - backlog_size : 0;
+}
+
+/**
+ * @brief Copies bytes into the backlog at an offset, wrapping around its end.
+ */
+static void ring_write(uint64_t offset, const char *data, size_t len)
+{
+    size_t start = offset % backlog_size;
+    size_t first = len < backlog_size - start ? len : backlog_size - start;
+
+    memcpy(backlog + start, data, first);
+    memcpy(backlog, data + first, len - first);
+}
+
+/**
+ * @brief Copies bytes out of the backlog from an offset, wrapping around its end.
+ */
+static void ring_read(uint64_t offset, char *data, size_t len)
+{
+    size_t start = offset % backlog_size;
+    size_t first = len < backlog_size - start ? len : backlog_size - start;
+
+    memcpy(data, backlog + start, first);
+    memcpy(data + first, backlog, len - first);
+}
+
+/**
+ * @brief Fills `replid` with random hex digits.
+ */
+static void generate_replid(void)
+{
+    unsigned char bytes[REPLICATION_ID_LEN / 2];
+
+    if (getrandom(bytes, sizeof(bytes), 0) != (ssize_t)sizeof(bytes))
+    {
+        // Only has to differ from the ids of earlier runs
+        uint64_t seed = current_time_ms() ^ ((uint64_t)getpid() << 32);
+        for (size_t i = 0; i < sizeof(bytes); i++)
+        {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            bytes[i] = (unsigned char)(seed >> 56);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        snprintf(replid + 2 * i, 3, "%02x", bytes[i]);
+}
+
+/**
+ * @brief Returns whether this server replicates a primary.
+ */
+bool replication_is_replica(void)
+{
+    return replica_mode;
+}
+
+/**
+ * @brief Returns whether logged records go to the backlog.
+ */
+bool replication_active(void)
+{
+    return atomic_load_explicit(&active, memory_order_acquire);
+}
+
+/**
+ * @brief Appends a record to the backlog.
+ * @param data The record.
+ * @param len Length of the record.
+ */
+void replication_feed(const char *data, size_t len)
+{
+    if (!replication_active())
+        return;
+
+    pthread_mutex_lock(&lock);
+
+    // Only the last `backlog_size` bytes fit; the others would be overwritten right away
+    size_t skip = len > backlog_size ? len - backlog_size : 0;
+    ring_write(backlog_end + skip, data + skip, len - skip);
+    backlog_end += len;
+
+    pthread_cond_broadcast(&fed);
+    pthread_mutex_unlock(&lock);
+}
+
+/**
+ * @brief Writes a chunk of the keyspace dump to a replica.
+ * @return true on success, false if the replica is gone or stopped reading.
+ */
+static bool send_chunk(const char *data, size_t len, void *ctx)
+{
+    return write_all(*(int *)ctx, data, len);
+}
+
+/**
+ * @brief Streams the backlog to a replica until it disconnects or falls behind.
+ *
+ * Every round writes everything fed since the previous one, up to
+ * REPLICATION_BATCH bytes, with a single write, so records logged while a
+ * write was blocked go out together.
+ *
+ * @param fd The replica socket.
+ * @param position Offset of the first byte to send.
+ */
+static void stream_backlog(int fd, uint64_t position)
+{
+    char *batch = malloc(REPLICATION_BATCH);
+    if (!batch)
+    {
+        log_error("Replication: out of memory, dropping replica fd %d", fd);
+        return;
+    }
+
+    for (;;)
+    {
+        bool idle = false;
+
+        pthread_mutex_lock(&lock);
+
+        if (position == backlog_end)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_sec += REPLICATION_PING_MS / 1000;
+            idle = pthread_cond_timedwait(&fed, &lock, &deadline) == ETIMEDOUT;
+        }
+
+        bool lost = position < backlog_first();
+        size_t len = 0;
+        if (!lost)
+        {
+            len = backlog_end - position < REPLICATION_BATCH ? backlog_end - position : REPLICATION_BATCH;
+            ring_read(position, batch, len);
+        }
+
+        pthread_mutex_unlock(&lock);
+
+        if (lost)
+        {
+            log_warn("Replication: replica fd %d fell behind the backlog at offset %llu, disconnecting",
+                     fd, (unsigned long long)position);
+            break;
+        }
+
+        if (len == 0 && !idle)
+            continue;
+
+        if (len == 0 ? !write_all(fd, ping_line, sizeof(ping_line) - 1) : !write_all(fd, batch, len))
+        {
+            log_info("Replication: replica fd %d disconnected at offset %llu", fd, (unsigned long long)position);
+            break;
+        }
+
+        position += len;
+    }
+
+    free(batch);
+}
+
+/**
+ * @brief Body of a sender thread: syncs one replica, then streams the backlog to it.
+ *
+ * Feeding the backlog is switched on and the starting offset taken under
+ * the same lock. Writers check whether to feed under their shard lock, and
+ * the keyspace dump takes every shard lock afterwards, so each write is
+ * either seen by the dump or fed at or after the starting offset. Records
+ * carry the whole state of their key, so a replica that gets a write both
+ * ways ends up with the same result.
+ */
+static void *sender_main(void *arg)
+{
+    ReplicaLink *link = arg;
+    pthread_setname_np(pthread_self(), "repl-sender");
+
+    // The event loop used the socket non-blocking; the sender blocks, bounded by a timeout
+    struct timeval timeout = {REPLICATION_TIMEOUT_S, 0};
+    fcntl(link->fd, F_SETFL, fcntl(link->fd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(link->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    pthread_mutex_lock(&lock);
+
+    if (!backlog)
+        backlog = malloc(backlog_size);
+
+    bool ready = backlog != NULL;
+    bool partial = false;
+    uint64_t position = 0;
+
+    if (ready)
+    {
+        atomic_store_explicit(&active, true, memory_order_release);
+        partial = link->same_id && link->offset >= backlog_first() && link->offset <= backlog_end;
+        position = partial ? link->offset : backlog_end;
+        replica_count++;
+        if (partial)
+            partial_syncs++;
+        else
+            full_syncs++;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    if (!ready)
+    {
+        log_error("Replication: could not allocate a backlog of %zu bytes", backlog_size);
+        close(link->fd);
+        free(link);
+        return NULL;
+    }
+
+    char header[REPLICATION_MAX_LINE];
+    int header_len = partial ? snprintf(header, sizeof(header), "+CONTINUE\r\n")
+                             : snprintf(header, sizeof(header), "+FULLRESYNC %s %llu\r\n", replid, (unsigned long long)position);
+    bool success = write_all(link->fd, header, header_len);
+
+    log_info("Replication: %s sync of replica fd %d from offset %llu", partial ? "partial" : "full",
+             link->fd, (unsigned long long)position);
+
+    if (success && !partial)
+    {
+        success = aof_dump_store(send_chunk, &link->fd) && write_all(link->fd, synced_line, sizeof(synced_line) - 1);
+        if (!success)
+            log_warn("Replication: full sync of replica fd %d failed: %s", link->fd, strerror(errno));
+    }
+
+    if (success)
+        stream_backlog(link->fd, position);
+
+    close(link->fd);
+
+    pthread_mutex_lock(&lock);
+    replica_count--;
+    pthread_mutex_unlock(&lock);
+
+    free(link);
+    return NULL;
+}
+
+/**
+ * @brief Hands a replica connection to a new sender thread.
+ * @return true if the thread was started.
+ */
+bool replication_attach(int fd, const char *id, size_t id_len, uint64_t offset)
+{
+    if (replica_mode)
+        return false;
+
+    ReplicaLink *link = malloc(sizeof(ReplicaLink));
+    if (!link)
+        return false;
+
+    link->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    link->same_id = id_len == REPLICATION_ID_LEN && memcmp(id, replid, REPLICATION_ID_LEN) == 0;
+    link->offset = offset;
+
+    if (link->fd == -1)
+    {
+        perror("fcntl F_DUPFD_CLOEXEC");
+        free(link);
+        return false;
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, sender_main, link) != 0)
+    {
+        perror("pthread_create replication sender");
+        close(link->fd);
+        free(link);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+/**
+ * @brief Opens a connection to the primary.
+ * @return The socket, or -1 if the primary could not be reached.
+ */
+static int connect_primary(void)
+{
+    char port[16];
+    snprintf(port, sizeof(port), "%d", primary_port);
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addresses;
+    if (getaddrinfo(primary_host, port, &hints, &addresses) != 0)
+        return -1;
+
+    int fd = -1;
+    for (struct addrinfo *address = addresses; address && fd == -1; address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd != -1 && connect(fd, address->ai_addr, address->ai_addrlen) == -1)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+
+    if (fd == -1)
+        return -1;
+
+    // The primary pings every second, so a silent link is a dead one
+    int opt = 1;
+    struct timeval timeout = {REPLICATION_TIMEOUT_S, 0};
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+/**
+ * @brief Sends SYNC with the history and offset the replica reached.
+ * @return true on success, false if the write failed.
+ */
+static bool request_sync(int fd)
+{
+    char id[REPLICATION_ID_LEN + 1];
+    uint64_t offset;
+
+    pthread_mutex_lock(&lock);
+    memcpy(id, replid[0] ? replid : "?", sizeof(id));
+    offset = backlog_end;
+    pthread_mutex_unlock(&lock);
+
+    char offset_text[24];
+    int offset_len = snprintf(offset_text, sizeof(offset_text), "%llu", (unsigned long long)offset);
+
+    char request[REPLICATION_MAX_LINE];
+    int len = snprintf(request, sizeof(request), "*3\r\n$4\r\nSYNC\r\n$%zu\r\n%s\r\n$%d\r\n%s\r\n",
+                       strlen(id), id, offset_len, offset_text);
+    return write_all(fd, request, len);
+}
+
+/**
+ * @brief State of the link to the primary while it is being read.
+ */
+typedef struct
+{
+    bool loading;                               /** A full sync is in progress */
+    char loading_id[REPLICATION_ID_LEN + 1];    /** History the full sync belongs to */
+    uint64_t loading_offset;                    /** Offset the stream continues from after the full sync */
+    uint64_t applied;                           /** Stream bytes applied since the last report */
+} ReplicaLinkState;
+
+/**
+ * @brief Handles a status line from the primary.
+ * @param line The line, without its CRLF.
+ * @param len Length of the line.
+ * @param state The link state.
+ * @return true to keep reading, false to drop the link.
+ */
+static bool handle_status(const char *line, size_t len, ReplicaLinkState *state)
+{
+    char text[REPLICATION_MAX_LINE];
+    memcpy(text, line, len);
+    text[len] = '\0';
+
+    if (strcmp(text, "+PING") == 0)
+        return true;
+
+    if (strcmp(text, "+CONTINUE") == 0)
+    {
+        pthread_mutex_lock(&lock);
+        link_up = true;
+        partial_syncs++;
+        uint64_t offset = backlog_end;
+        pthread_mutex_unlock(&lock);
+
+        log_info("Replication: continuing from offset %llu of %s:%d", (unsigned long long)offset, primary_host, primary_port);
+        return true;
+    }
+
+    char id[REPLICATION_ID_LEN + 1];
+    unsigned long long offset;
+    int consumed = 0;
+    if (sscanf(text, "+FULLRESYNC %40[0-9a-f] %llu%n", id, &offset, &consumed) == 2 && (size_t)consumed == len &&
+        strlen(id) == REPLICATION_ID_LEN)
+    {
+        // Until the full sync is complete a reconnect has to start over
+        pthread_mutex_lock(&lock);
+        replid[0] = '\0';
+        backlog_end = 0;
+        link_up = true;
+        syncing = true;
+        full_syncs++;
+        pthread_mutex_unlock(&lock);
+
+        if (!store_clear())
+        {
+            log_error("Replication: could not clear the keyspace for a full sync");
+            return false;
+        }
+
+        state->loading = true;
+        memcpy(state->loading_id, id, sizeof(id));
+        state->loading_offset = offset;
+        log_info("Replication: full sync from %s:%d started", primary_host, primary_port);
+        return true;
+    }
+
+    if (strcmp(text, "+SYNCED") == 0 && state->loading)
+    {
+        state->loading = false;
+
+        pthread_mutex_lock(&lock);
+        memcpy(replid, state->loading_id, sizeof(replid));
+        backlog_end = state->loading_offset;
+        syncing = false;
+        pthread_mutex_unlock(&lock);
+
+        log_info("Replication: full sync from %s:%d finished at offset %llu", primary_host, primary_port,
+                 (unsigned long long)state->loading_offset);
+
+        // The file still holds the keyspace from before the sync
+        if (aof_enabled())
+            aof_rewrite_async();
+        return true;
+    }
+
+    log_error("Replication: unexpected reply from %s:%d: %s", primary_host, primary_port, text);
+    return false;
+}
+
+/**
+ * @brief Applies the status lines and records buffered from the primary.
+ * @param input The input buffer; applied bytes are removed from it.
+ * @param state The link state.
+ * @return true to keep reading, false to drop the link.
+ */
+static bool apply_input(ReplicaInput *input, ReplicaLinkState *state)
+{
+    uint64_t now = current_time_ms();
+    size_t pos = 0;
+    bool success = true;
+
+    while (success && pos < input->len)
+    {
+        char *start = input->data + pos;
+        size_t available = input->len - pos;
+
+        if (start[0] == '+' || start[0] == '-')
+        {
+            char *end = memmem(start, available < REPLICATION_MAX_LINE ? available : REPLICATION_MAX_LINE, "\r\n", 2);
+            if (!end)
+            {
+                success = available < REPLICATION_MAX_LINE;
+                if (!success)
+                    log_error("Replication: overlong status line from %s:%d", primary_host, primary_port);
+                break;
+            }
+
+            size_t len = end - start;
+            if (start[0] == '-')
+            {
+                log_error("Replication: %s:%d refused to sync: %.*s", primary_host, primary_port, (int)len, start);
+                success = false;
+                break;
+            }
+
+            success = handle_status(start, len, state);
+            pos += len + 2;
+            continue;
+        }
+
+        Command cmd;
+        size_t consumed;
+        RespParseStatus status = parse_resp_command(start, available, &cmd, &consumed);
+
+        if (status == RESP_PARSE_INCOMPLETE)
+            break;
+
+        if (status == RESP_PARSE_ERROR || !aof_apply_record(&cmd, now))
+        {
+            log_error("Replication: invalid record from %s:%d", primary_host, primary_port);
+            success = false;
+            break;
+        }
+
+        // Records of a full sync are not part of the stream; the rewrite after it covers them
+        if (!state->loading)
+        {
+            aof_log_record(start, consumed);
+            state->applied += consumed;
+        }
+
+        pos += consumed;
+    }
+
+    if (state->applied > 0)
+    {
+        pthread_mutex_lock(&lock);
+        backlog_end += state->applied;
+        pthread_mutex_unlock(&lock);
+        state->applied = 0;
+    }
+
+    memmove(input->data, input->data + pos, input->len - pos);
+    input->len -= pos;
+    return success;
+}
+
+/**
+ * @brief Syncs with the primary over a fresh connection and applies its stream until the link drops.
+ * @param fd The connected socket.
+ * @param input The input buffer, reused across connections.
+ */
+static void follow_primary(int fd, ReplicaInput *input)
+{
+    ReplicaLinkState state = {0};
+    input->len = 0;
+
+    if (!request_sync(fd))
+    {
+        log_warn("Replication: could not send SYNC to %s:%d: %s", primary_host, primary_port, strerror(errno));
+        return;
+    }
+
+    for (;;)
+    {
+        if (input->cap - input->len < REPLICATION_READ_SIZE)
+        {
+            size_t cap = input->cap ? input->cap * 2 : REPLICATION_READ_SIZE * 2;
+            char *data = realloc(input->data, cap);
+            if (!data)
+            {
+                log_error("Replication: out of memory reading from %s:%d", primary_host, primary_port);
+                return;
+            }
+            input->data = data;
+            input->cap = cap;
+        }
+
+        ssize_t received = read(fd, input->data + input->len, input->cap - input->len);
+        if (received <= 0)
+        {
+            if (received == -1 && errno == EINTR)
+                continue;
+
+            log_warn("Replication: lost the link to %s:%d: %s", primary_host, primary_port,
+                     received == 0 ? "closed by the primary" : strerror(errno));
+            return;
+        }
+
+        input->len += received;
+        if (!apply_input(input, &state))
+            return;
+
+        // Only a small remainder is left after applying, so the buffer is shrunk back after a large record
+        if (input->len < REPLICATION_READ_SIZE && input->cap > REPLICATION_READ_SIZE * 2)
+        {
+            char *data = realloc(input->data, REPLICATION_READ_SIZE * 2);
+            if (data)
+            {
+                input->data = data;
+                input->cap = REPLICATION_READ_SIZE * 2;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Body of the replica thread: keeps a link to the primary up.
+ */
+static void *replica_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "replica");
+
+    ReplicaInput input = {0};
+    bool reported = false;
+
+    for (;;)
+    {
+        int fd = connect_primary();
+
+        if (fd != -1)
+        {
+            log_info("Replication: connected to %s:%d", primary_host, primary_port);
+            follow_primary(fd, &input);
+            close(fd);
+            reported = false;
+        }
+        else if (!reported)
+        {
+            log_warn("Replication: could not connect to %s:%d, retrying", primary_host, primary_port);
+            reported = true;
+        }
+
+        pthread_mutex_lock(&lock);
+        link_up = false;
+        syncing = false;
+        pthread_mutex_unlock(&lock);
+
+        usleep(REPLICATION_RETRY_MS * 1000);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Sets up the backlog, and the replica thread if there is a primary.
+ * @return true on success.
+ */
+bool initialize_replication(size_t size, const char *host, int port)
+{
+    backlog_size = size;
+
+    // Senders wait for records with deadlines on the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&fed, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (!host)
+    {
+        generate_replid();
+        return true;
+    }
+
+    primary_host = strdup(host);
+    primary_port = port;
+    replica_mode = true;
+    if (!primary_host)
+        return false;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replica_main, NULL) != 0)
+    {
+        perror("pthread_create replica");
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+/**
+ * @brief Reports the state of replication.
+ * @param stats Receives the figures.
+ */
+void replication_stats(ReplicationStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->replica = replica_mode;
+
+    if (replica_mode)
+        snprintf(stats->primary, sizeof(stats->primary), "%s:%d", primary_host, primary_port);
+
+    pthread_mutex_lock(&lock);
+    memcpy(stats->replid, replid, sizeof(stats->replid));
+    stats->offset = backlog_end;
+    stats->backlog_first = backlog ? backlog_first() : 0;
+    stats->backlog_size = backlog ? backlog_size : 0;
+    stats->replicas = replica_count;
+    stats->full_syncs = full_syncs;
+    stats->partial_syncs = partial_syncs;
+    stats->link_up = link_up;
+    stats->syncing = syncing;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,108 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define REPLICATION_ID_LEN 40 /** Hex characters of a replication id */
+
+/**
+ * @brief Figures reported by INFO about replication.
+ */
+typedef struct
+{
+    bool replica;                        /** Whether this server replicates a primary */
+    char replid[REPLICATION_ID_LEN + 1]; /** Id of the history the offsets count in */
+    uint64_t offset;                     /** Primary: bytes fed to the backlog; replica: stream bytes applied */
+    uint64_t backlog_first;              /** Oldest offset still in the backlog (primary) */
+    size_t backlog_size;                 /** Capacity of the backlog, 0 until the first replica connected */
+    size_t replicas;                     /** Replicas currently attached (primary) */
+    uint64_t full_syncs;                 /** Primary: full syncs served; replica: full syncs taken */
+    uint64_t partial_syncs;              /** Primary: partial syncs served; replica: partial syncs taken */
+    bool link_up;                        /** Whether the stream from the primary is being applied (replica) */
+    bool syncing;                        /** Whether a full sync is being loaded (replica) */
+    char primary[64];                    /** Address of the primary as host:port (replica) */
+} ReplicationStats;
+
+/**
+ * @brief Sets up replication.
+ *
+ * Every server can act as a primary. It draws a random replication id and
+ * counts the bytes of every record it logs from then on; that count is the
+ * replication offset. The backlog, a ring buffer holding the most recent
+ * `backlog_size` bytes of records, is only allocated when the first replica
+ * connects, so servers without replicas never copy their writes into it.
+ *
+ * With a primary address the server becomes a replica instead: a thread
+ * connects to the primary, loads a full copy of its keyspace and then
+ * applies the records it streams. After a lost connection it reconnects
+ * and asks to continue from the offset it reached, which the primary grants
+ * as long as its backlog still holds that offset. Replicas refuse writes
+ * from clients and cannot serve replicas of their own.
+ *
+ * Must be called after the store is loaded and before any worker starts.
+ *
+ * @param backlog_size Capacity of the backlog in bytes.
+ * @param primary_host Host of the primary, or NULL to only act as a primary.
+ * @param primary_port Port of the primary.
+ * @return True on success, false if the replica thread could not be started.
+ */
+bool initialize_replication(size_t backlog_size, const char *primary_host, int primary_port);
+
+/**
+ * @brief Returns whether this server replicates a primary.
+ *
+ * @return True for replicas, which refuse writes from clients.
+ */
+bool replication_is_replica(void);
+
+/**
+ * @brief Returns whether logged records have to be fed to the backlog.
+ *
+ * @return True once a replica connected.
+ */
+bool replication_active(void);
+
+/**
+ * @brief Appends a record to the backlog and wakes the replica senders.
+ *
+ * Called by the `aof_log_*` functions, under the shard lock of the key, so
+ * the backlog holds the records of a key in the order they were applied.
+ * Does nothing until a replica connected.
+ *
+ * @param data A complete SET or DEL record.
+ * @param len Length of the record.
+ */
+void replication_feed(const char *data, size_t len);
+
+/**
+ * @brief Takes over a client connection that sent SYNC.
+ *
+ * The socket is duplicated and handed to a sender thread, which answers
+ * either `+CONTINUE` and streams the backlog from `offset` on, if `replid`
+ * is the id of this server and the backlog still reaches back to `offset`,
+ * or `+FULLRESYNC <replid> <offset>` followed by the whole keyspace, a
+ * `+SYNCED` line and the backlog from that offset. While nothing is logged
+ * it sends a `+PING` line every second. A replica that falls so far behind
+ * that the backlog wraps past it is disconnected.
+ *
+ * The caller closes its own descriptor of the socket without shutting it
+ * down and without writing to it anymore.
+ *
+ * @param fd The client socket.
+ * @param replid The replication id the replica knows, not null-terminated.
+ * @param replid_len Length of `replid`.
+ * @param offset The offset the replica reached in that history.
+ * @return True if the sender thread was started.
+ */
+bool replication_attach(int fd, const char *replid, size_t replid_len, uint64_t offset);
+
+/**
+ * @brief Reports the state of replication.
+ *
+ * @param stats Receives the figures.
+ */
+void replication_stats(ReplicationStats *stats);
+
+#endif // REPLICATION_H
@@ -4,6 +4,10 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <arpa/inet.h>
@@ -11,32 +15,153 @@
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sched.h>
+#include <limits.h>
 #include "parser.h"
 #include "logger.h"
 #include "utils.h"
 #include "command_handler.h"
+#include "connection.h"
+#include "store.h"
+#include "stats.h"
+#include "uring.h"
+#include "aof.h"
+#include "snapshot.h"
+#include "epoch.h"
+#include "replication.h"
+#include "config.h"
 
-#define PORT 2318
-#define BACKLOG 100
-#define READ_BUFFER_SIZE 1024
-#define MAX_EVENTS 10000
-#define MAX_CLIENTS 10000
+#define DEFAULT_PORT 2318                       /** Port listened on unless `--port` says otherwise */
+#define DEFAULT_BACKLOG 4096                    /** Pending connections per listener; the kernel caps it at `somaxconn` */
+#define DEFAULT_MAX_EVENTS 10000                /** Events fetched per `epoll_wait` unless `--max-events` says otherwise */
+#define DEFAULT_MAX_CLIENTS 10000               /** Open connections allowed unless `--maxclients` says otherwise */
+#define RESERVED_FDS 32                         /** Descriptors kept for stdio, the AOF, snapshots and the like */
+#define FDS_PER_WORKER 4                        /** Listener, timer and epoll or io_uring instance of a worker, plus one spare */
+#define ACCEPT_BATCH 64                         /** Clients accepted per listener wakeup before other events get a turn */
+#define IDLE_REAP_LIMIT 1024                    /** Idle clients closed per expiry tick, so a mass timeout never stalls the loop */
+#define MAX_WORKERS 256                         /** Upper bound for the `--workers` option */
+#define SHARDS_PER_WORKER 8                     /** Keyspace shards created per worker thread */
+#define DEFAULT_OUTPUT_HIGH_WATER (1024 * 1024) /** Queued output size at which reads from a client are paused */
+#define DEFAULT_OUTPUT_LOW_WATER (256 * 1024)   /** Queued output size below which paused reads resume */
+#define CLIENT_COMMAND_BUDGET 64                /** Commands or stream chunks run for one client before the others get a turn */
+#define CLIENT_READ_BUDGET (256 * 1024)         /** Bytes read from one client before the others get a turn */
+#define URING_ENTRIES 4096                      /** Submission queue size of an io_uring worker */
+#define URING_BUFFER_COUNT 1024                 /** Provided receive buffers per io_uring worker */
+#define URING_BUFFER_SIZE (16 * 1024)           /** Size of each provided receive buffer */
+#define URING_BUFFER_GROUP 0                    /** Buffer group id of the receive buffers */
+#define EXPIRE_INTERVAL_MS 100                  /** Period of the active expiry sweep of every worker */
+#define EXPIRE_TIME_LIMIT_US 1000               /** Time one expiry sweep may run for */
+#define DEFAULT_SNAPSHOT_INTERVAL 300           /** Seconds between snapshots unless `--snapshot-interval` says otherwise */
+#define DEFAULT_REPL_BACKLOG (1024 * 1024)      /** Bytes of recent writes kept for replicas that reconnect */
+#define MAX_TABLE_PRESIZE (1ull << 40)          /** Upper bound for the `--table-presize` option */
 
-int total_clients_connected = 0;
-int total_queries_processed = 0;
-int active_clients = 0;
-int server_fd;
-int epoll_fd;
+/** Reads a setting that CONFIG SET may change while the workers run */
+#define SETTING(name) __atomic_load_n(&(name), __ATOMIC_RELAXED)
+
+/**
+ * @brief Event loop implementation used by the workers.
+ */
+typedef enum
+{
+    IO_BACKEND_EPOLL,   /**< Readiness notifications with edge-triggered epoll */
+    IO_BACKEND_IO_URING /**< Completion-based I/O with multishot accept and receive */
+} IoBackend;
+
+/**
+ * @brief Kind of io_uring request, stored in the low bits of its `user_data`.
+ *
+ * The rest of `user_data` is the Connection the request belongs to, which is
+ * kept alive until all of its requests have completed.
+ */
+typedef enum
+{
+    URING_OP_CANCEL, /**< Cancellation of a client's receive, needs no handling */
+    URING_OP_ACCEPT, /**< Multishot accept on the listening socket */
+    URING_OP_RECV,   /**< Multishot receive on a client */
+    URING_OP_SEND,   /**< Gathered write of a client's output queue */
+    URING_OP_TIMER,  /**< Read of the worker's expiry timer */
+    URING_OP_WAKE,   /**< Read of the worker's fsync wakeup */
+    URING_OP_STOP    /**< Poll of the shutdown eventfd */
+} UringOp;
+
+#define URING_OP_MASK 7ull
+
+/**
+ * @brief State of one event loop thread.
+ *
+ * Every worker owns a listening socket bound to the shared port with
+ * `SO_REUSEPORT`, so the kernel spreads incoming connections over the
+ * workers. A connection is served by the worker that accepted it for its
+ * whole lifetime.
+ */
+typedef struct
+{
+    int id;                /** Index of the worker */
+    pthread_t thread;      /** Thread running the event loop */
+    int server_fd;         /** Listening socket of this worker */
+    int epoll_fd;          /** Epoll instance of this worker */
+    int timer_fd;          /** Timer driving the active expiry sweep of this worker */
+    int wake_fd;           /** Eventfd the AOF writer signals after each fsync under appendfsync always, or -1 */
+} Worker;
+
+Worker *workers = NULL;
+int worker_count = 1;
+IoBackend io_backend = IO_BACKEND_EPOLL;
+int max_clients = DEFAULT_MAX_CLIENTS;
+unsigned int idle_timeout = 0; /** Seconds a client may stay silent before it is closed, 0 to never close it */
+
+// Settings, filled in from the configuration file and the command line; see `settings` for their names.
+// CONFIG SET stores the runtime ones atomically, so workers read them with SETTING.
+static int port = DEFAULT_PORT;
+static int listen_backlog = DEFAULT_BACKLOG;
+static int max_events = DEFAULT_MAX_EVENTS;
+static size_t output_high_water = DEFAULT_OUTPUT_HIGH_WATER;
+static size_t output_low_water = DEFAULT_OUTPUT_LOW_WATER;
+static size_t read_buffer_size = DEFAULT_READ_BUFFER_SIZE;
+static size_t max_request_size = DEFAULT_MAX_READ_BUFFER_SIZE;
+static size_t table_presize = 0;
+static size_t max_memory = 0;
+static EvictionPolicy eviction_policy = EVICTION_LRU;
+static char *aof_path = NULL;
+static AofFsyncPolicy fsync_policy = AOF_FSYNC_EVERYSEC;
+static char *snapshot_path = NULL;
+static unsigned int snapshot_interval = DEFAULT_SNAPSHOT_INTERVAL;
+static char *replicaof = NULL;
+static char *primary_host = NULL; /** Host part of `replicaof` */
+static int primary_port = 0;      /** Port part of `replicaof` */
+static size_t repl_backlog = DEFAULT_REPL_BACKLOG;
+static char *cpu_affinity = NULL;
+static int affinity_cpus[CPU_SETSIZE]; /** CPUs of `cpu_affinity` in the order listed, worker i runs on entry i modulo the count */
+static int affinity_count = 0;         /** Entries used in `affinity_cpus`, 0 to leave the workers unpinned */
+static cpu_set_t startup_cpus;         /** CPUs the process may run on, restored when the affinity is cleared */
+static bool sync_replies = false;      /** Replies wait for the fsync of what their commands logged (appendfsync always) */
+
+static int shutdown_fd = -1;          /** Eventfd the termination signal handler writes to; it wakes every worker */
+static int shutdown_signal = 0;       /** Signal that asked the server to stop, 0 while it runs; accessed atomically */
+static unsigned int idle_changes = 0; /** Bumped by each CONFIG SET of `timeout`; accessed atomically */
+
+static __thread Worker *worker = NULL;              /** Worker running on the calling thread */
+static __thread TimerWheel idle_wheel;              /** Idle timeouts of the worker's clients, in monotonic milliseconds */
+static __thread Connection *ready_head = NULL;      /** Clients resumed on the next loop iteration, oldest first */
+static __thread Connection **ready_tail = NULL;     /** Link the next ready client is stored in */
+static __thread size_t ready_count = 0;             /** Number of clients in the ready list */
+static __thread Connection *held_head = NULL;       /** Clients whose replies wait for an AOF fsync */
+static __thread unsigned int idle_changes_seen = 0; /** Value of `idle_changes` the worker's idle timers were armed for */
 
 /**
  * @brief Prints server statistics before shutdown.
  */
 void print_statistics()
 {
+    StatsSnapshot stats;
+    stats_snapshot(&stats);
+
     printf("\n+------------------------+------------------------+\n");
     printf("| Total Clients Connected | Total Queries Processed |\n");
     printf("+------------------------+------------------------+\n");
-    printf("| %22d | %22d |\n", total_clients_connected, total_queries_processed);
+    printf("| %22llu | %22llu |\n", (unsigned long long)stats.clients_total, (unsigned long long)stats.commands);
     printf("+------------------------+------------------------+\n");
 }
 
@@ -45,6 +170,8 @@ void print_statistics()
  *
  * In non-blocking mode, system calls like `read()` and `write()`
  * will return immediately if no data is available, instead of blocking.
+ * Only used for listening sockets: clients are accepted non-blocking by
+ * `accept4`.
  *
  * @param fd The socket file descriptor to modify.
  *
@@ -68,190 +195,2155 @@ void set_socket_nonblocking(int fd)
 }
 
 /**
- * @brief Handles termination signals (e.g., SIGINT, SIGTERM)
- *        and gracefully shuts down the server cleaning up server resources.
+ * @brief Handles termination signals (e.g., SIGINT, SIGTERM) by asking the
+ *        workers to stop.
+ *
+ * Only async-signal-safe work happens here: the signal is recorded and the
+ * shutdown eventfd written, which wakes every event loop. `main` cleans up
+ * once they have returned.
  *
  * @param signal The signal number received (e.g., SIGINT = 2, SIGTERM = 15).
  */
-void cleanup_and_close_server(int signal)
+void request_shutdown(int signal)
+{
+    uint64_t one = 1;
+
+    __atomic_store_n(&shutdown_signal, signal, __ATOMIC_RELEASE);
+
+    // Nothing can be reported from a signal handler; the eventfd is non-blocking and never read
+    ssize_t written = write(shutdown_fd, &one, sizeof(one));
+    (void)written;
+}
+
+/**
+ * @brief Returns whether a termination signal asked the workers to stop.
+ */
+bool shutdown_requested()
+{
+    return __atomic_load_n(&shutdown_signal, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * @brief Gracefully shuts down the server once the workers stopped, cleaning
+ *        up server resources and writing out the append-only file.
+ *
+ * @param status The exit status, the number of the signal that stopped the server.
+ */
+void cleanup_and_close_server(int status)
 {
-    if (server_fd != -1)
+    for (int i = 0; workers && i < worker_count; i++)
     {
-        close(server_fd);
+        if (workers[i].server_fd != -1)
+        {
+            close(workers[i].server_fd);
+        }
+
+        if (workers[i].epoll_fd != -1)
+        {
+            close(workers[i].epoll_fd);
+        }
+
+        if (workers[i].timer_fd != -1)
+        {
+            close(workers[i].timer_fd);
+        }
+
+        if (workers[i].wake_fd != -1)
+        {
+            close(workers[i].wake_fd);
+        }
     }
 
-    if (epoll_fd != -1)
+    aof_flush();
+    print_statistics();
+    exit(status);
+}
+
+/**
+ * @brief Queues a client whose budget ran out with work left.
+ *
+ * Clients in the ready list are resumed round-robin on the next loop
+ * iteration, after the events that arrived in the meantime.
+ *
+ * @param conn The client connection.
+ */
+void schedule_ready(Connection *conn)
+{
+    if (conn->ready)
+        return;
+
+    conn->ready = true;
+    conn->ready_next = NULL;
+    conn->ready_pprev = ready_tail;
+    *ready_tail = conn;
+    ready_tail = &conn->ready_next;
+    ready_count++;
+}
+
+/**
+ * @brief Removes a client from the ready list, if it is in it.
+ *
+ * @param conn The client connection.
+ */
+void unschedule_ready(Connection *conn)
+{
+    if (!conn->ready)
+        return;
+
+    *conn->ready_pprev = conn->ready_next;
+    if (conn->ready_next)
+        conn->ready_next->ready_pprev = conn->ready_pprev;
+    else
+        ready_tail = conn->ready_pprev;
+
+    conn->ready = false;
+    conn->ready_next = NULL;
+    conn->ready_pprev = NULL;
+    ready_count--;
+}
+
+/**
+ * @brief Gives every client that was in the ready list one more turn.
+ *
+ * Clients queued again during the pass wait for the next one, so a client
+ * with an endless backlog gets one budget per loop iteration, like everyone
+ * else.
+ *
+ * @param resume Serves a client with the worker's backend.
+ */
+void run_ready_clients(void (*resume)(Connection *))
+{
+    for (size_t turns = ready_count; turns > 0 && ready_head; turns--)
     {
-        close(epoll_fd);
+        Connection *conn = ready_head;
+        unschedule_ready(conn);
+        resume(conn);
     }
+}
 
-    print_statistics();
-    exit(signal);
+/**
+ * @brief Removes a client from the held list, if it is in it.
+ *
+ * @param conn The client connection.
+ */
+void unhold_client(Connection *conn)
+{
+    if (!conn->held)
+        return;
+
+    *conn->held_pprev = conn->held_next;
+    if (conn->held_next)
+        conn->held_next->held_pprev = conn->held_pprev;
+
+    conn->held = false;
+    conn->held_next = NULL;
+    conn->held_pprev = NULL;
 }
 
-int main()
+/**
+ * @brief Returns whether the replies of a client still wait for an AOF fsync.
+ *
+ * Under appendfsync always a reply may only be written once the records its
+ * command logged are on disk. A client that has to wait is put in the held
+ * list, which is revisited whenever the AOF writer wakes the worker.
+ *
+ * @param conn The client connection.
+ * @return true if its output must stay queued for now.
+ */
+bool replies_held(Connection *conn)
 {
-    signal(SIGINT, cleanup_and_close_server);  // Handle Ctrl+C
-    signal(SIGTERM, cleanup_and_close_server); // Handle termination using kill
-    pthread_setname_np(pthread_self(), "main");
+    if (conn->durable_wait == 0)
+        return false;
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (aof_durable(conn->durable_wait))
+    {
+        conn->durable_wait = 0;
+        unhold_client(conn);
+        return false;
+    }
 
-    if (server_fd == -1)
+    if (!conn->held)
     {
-        perror("socket");
-        exit(EXIT_FAILURE);
+        conn->held = true;
+        conn->held_next = held_head;
+        conn->held_pprev = &held_head;
+        if (held_head)
+            held_head->held_pprev = &conn->held_next;
+        held_head = conn;
     }
 
-    int enable = 1;
-    if (setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1)
+    return true;
+}
+
+/**
+ * @brief Returns whether the held replies of a client can never be sent.
+ *
+ * Once the AOF lost a record nothing becomes durable any more, and the held
+ * replies would acknowledge writes that are not on disk, so the client has
+ * to be closed without them.
+ *
+ * @param conn A client whose replies are held.
+ * @return true if it must be closed.
+ */
+bool replies_lost(Connection *conn)
+{
+    if (!aof_failed())
+        return false;
+
+    log_error("Replies held for fd %d can no longer be made durable. Closing connection...", conn->fd);
+    return true;
+}
+
+/**
+ * @brief Writes the replies of the held clients whose records were fsynced,
+ * and closes those whose replies were lost.
+ *
+ * @param release Writes the output of a client with the worker's backend.
+ * @param drop Closes a client with the worker's backend.
+ */
+void release_held_clients(void (*release)(Connection *), void (*drop)(Connection *))
+{
+    Connection *conn = held_head;
+
+    while (conn)
     {
-        perror("setsockopt TCP_NODELAY");
-        exit(EXIT_FAILURE);
+        Connection *next = conn->held_next;
+        if (!replies_held(conn))
+            release(conn);
+        else if (replies_lost(conn))
+            drop(conn);
+        conn = next;
     }
+}
 
-    // Enable SO_REUSEADDR to allow immediate reuse of the port
-    int opt = 1;
+/**
+ * @brief Wakes every worker after an AOF fsync, so they write the replies they held.
+ *
+ * Runs on the AOF writer thread.
+ */
+void wake_workers(void)
+{
+    uint64_t one = 1;
 
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    for (int i = 0; i < worker_count; i++)
     {
-        perror("setsockopt");
-        exit(EXIT_FAILURE);
+        if (workers[i].wake_fd != -1 && write(workers[i].wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+            perror("write wake_fd");
     }
+}
+
+/**
+ * @brief Arms the idle timeout of a new client.
+ *
+ * @param conn The client connection.
+ */
+void watch_idle(Connection *conn)
+{
+    unsigned int timeout = SETTING(idle_timeout);
+    if (timeout == 0)
+        return;
 
-    set_socket_nonblocking(server_fd);
+    conn->idle_timer.expires = conn->last_active + (uint64_t)timeout * 1000;
+    timer_wheel_add(&idle_wheel, &conn->idle_timer);
+}
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(PORT);
+/**
+ * @brief Cancels the idle timeout of a client that is being closed.
+ *
+ * @param conn The client connection.
+ */
+void unwatch_idle(Connection *conn)
+{
+    if (conn->idle_timer.pprev)
+        timer_wheel_remove(&idle_wheel, &conn->idle_timer);
+}
+
+/**
+ * @brief Re-arms the idle timeout of a client for the current `timeout`.
+ *
+ * @param conn The client connection.
+ */
+static void rearm_idle(Connection *conn)
+{
+    unwatch_idle(conn);
+    watch_idle(conn);
+}
 
-    if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
+/**
+ * @brief Closes the clients of the calling worker that exceeded the idle timeout.
+ *
+ * Timers are not moved on every read or write, only when they fire: a client
+ * that was active since its timer was armed is re-armed at `last_active`
+ * plus the timeout, so the common path costs a clock read and a store.
+ * After CONFIG SET changed the timeout, every client is re-armed for the new
+ * value first, which also covers clients that connected while it was 0.
+ *
+ * @param close_idle Closes a client with the worker's backend.
+ */
+void reap_idle_clients(void (*close_idle)(Connection *))
+{
+    unsigned int changes = __atomic_load_n(&idle_changes, __ATOMIC_ACQUIRE);
+    if (changes != idle_changes_seen)
     {
-        perror("bind");
-        exit(EXIT_FAILURE);
+        idle_changes_seen = changes;
+        connection_table_each(rearm_idle);
     }
 
-    if (listen(server_fd, BACKLOG) == -1)
+    uint64_t timeout_ms = (uint64_t)SETTING(idle_timeout) * 1000;
+    if (timeout_ms == 0)
+        return;
+
+    uint64_t now = monotonic_time_ms();
+
+    for (int reaped = 0; reaped < IDLE_REAP_LIMIT;)
     {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        TimerNode *timer = timer_wheel_expire(&idle_wheel, now);
+        if (!timer)
+            break;
+
+        Connection *conn = timer->data;
+        if (now - conn->last_active < timeout_ms)
+        {
+            timer->expires = conn->last_active + timeout_ms;
+            timer_wheel_add(&idle_wheel, timer);
+            continue;
+        }
+
+        log_debug("Closing idle client fd %d (%llu bytes in, %llu bytes out)", conn->fd,
+                  (unsigned long long)conn->bytes_in, (unsigned long long)conn->bytes_out);
+        stats_client_timed_out();
+        close_idle(conn);
+        reaped++;
     }
+}
+
+/**
+ * @brief Unregisters a client from epoll, closes its socket and frees its connection state.
+ *
+ * @param conn The client connection to close.
+ */
+void close_client(Connection *conn)
+{
+    unwatch_idle(conn);
+    unschedule_ready(conn);
+    unhold_client(conn);
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    stats_count_syscall();
+    close(conn->fd);
+    stats_count_syscall();
+    connection_table_remove(conn->fd);
+    free_connection(conn);
+    stats_client_disconnected();
+}
 
-    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-    if (epoll_fd == -1)
+/**
+ * @brief Updates the epoll interest set of a client to match its output state.
+ *
+ * `EPOLLOUT` is only requested while responses are queued, so idle clients
+ * never generate writable wakeups.
+ *
+ * @param conn The client connection.
+ * @return true on success, false if `epoll_ctl` fails.
+ */
+bool update_client_events(Connection *conn)
+{
+    unsigned int events = EPOLLIN | EPOLLET;
+    if (conn->out_bytes > 0)
+        events |= EPOLLOUT;
+
+    if (events == conn->events)
+        return true;
+
+    struct epoll_event client_event;
+    client_event.events = events;
+    client_event.data.fd = conn->fd;
+
+    stats_count_syscall();
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, conn->fd, &client_event) == -1)
     {
-        perror("epoll_create1");
-        exit(EXIT_FAILURE);
+        perror("epoll_ctl EPOLL_CTL_MOD");
+        return false;
     }
 
-    struct epoll_event server_event;
-    server_event.events = EPOLLIN;
-    server_event.data.fd = server_fd;
+    conn->events = events;
+    return true;
+}
+
+/**
+ * @brief Writes queued responses and adjusts the epoll interest set.
+ *
+ * @param conn The client connection.
+ * @return true if the connection is still usable, false if it must be closed.
+ */
+bool flush_client(Connection *conn)
+{
+    // Held replies are written when the AOF writer wakes the worker
+    if (replies_held(conn))
+        return !replies_lost(conn);
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &server_event) == -1)
+    if (conn->out_bytes > 0 && connection_flush(conn) == CONN_WRITE_ERROR)
     {
-        perror("epoll_ctl: server_fd");
-        exit(EXIT_FAILURE);
+        perror("sock_write_err");
+        return false;
     }
 
-    log_message("INFO", "CEpollion Server started:\n"
-                        "{\n"
-                        "  \"server_socket_fd\": %d,\n"
-                        "  \"port\": %d,\n"
-                        "  \"max_clients\": %d\n"
-                        "}",
-                server_fd, ntohs(server_addr.sin_port), MAX_CLIENTS);
+    return update_client_events(conn);
+}
 
-    struct epoll_event events[MAX_EVENTS];
-    initialize_command_handler();
+/**
+ * @brief Executes every complete command currently buffered for a client.
+ *
+ * Each text frame or RESP request is parsed and executed in order and its
+ * reply is appended to the output queue of the connection. A trailing partial command is left in
+ * the buffer for the next read. Processing stops early once the queued output
+ * crosses the high-water mark, pausing reads until the client catches up on
+ * its replies. A streamed reply (GETALL) is continued the same way, one
+ * chunk at a time, as the client drains its output.
+ *
+ * Every command and stream chunk takes one unit of `budget`; processing
+ * also stops when it is used up, so a deep pipeline cannot hold up the
+ * other clients of the worker.
+ *
+ * @param conn The client connection.
+ * @param budget Commands that may still run; decremented for each one.
+ * @return false if the client sent malformed RESP, a reply could not be
+ *         queued or the connection was handed over, in which case it must
+ *         be disconnected.
+ */
+bool process_frames(Connection *conn, size_t *budget)
+{
+    Command cmd;
+    ConnectionCommandStatus status = CONN_COMMAND_INCOMPLETE;
+    size_t high_water = SETTING(output_high_water);
+    uint64_t logged = sync_replies ? aof_logged_position() : 0;
 
-    while (true)
+    for (; *budget > 0 && conn->out_bytes < high_water; (*budget)--)
     {
-        int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
-        if (nfds == -1)
+        if (conn->stream.active)
         {
-            if (errno == EINTR)
-                continue;
-            perror("epoll_wait");
-            exit(EXIT_FAILURE);
+            // Finish the streamed reply before running anything pipelined behind it
+            if (!continue_stream(conn))
+            {
+                log_error("Failed to stream reply to fd %d. Closing connection...", conn->fd);
+                return false;
+            }
         }
-
-        for (int i = 0; i < nfds; i++)
+        else if ((status = connection_next_command(conn, &cmd)) == CONN_COMMAND_READY)
         {
-            int fd = events[i].data.fd;
+            uint64_t start = stats_now();
+            bool queued = execute_command(&cmd, conn);
+            stats_record_command(cmd.type, start);
 
-            // New client trying to connect
-            if (fd == server_fd)
+            // Replies queued from here on wait until what this command logged is fsynced
+            if (sync_replies && aof_logged_position() != logged)
+                conn->durable_wait = logged = aof_logged_position();
+
+            // SYNC handed the socket to a replication sender, which takes it from here
+            if (conn->detached)
+                return false;
+
+            // Without its reply the client could no longer match replies to requests
+            if (!queued)
             {
-                if (active_clients >= MAX_CLIENTS)
-                {
-                    log_message("ERROR", "Max clients reached (%d). Rejecting connection...", MAX_CLIENTS);
-                    int tmp_fd = accept(server_fd, NULL, NULL);
-                    if (tmp_fd != -1)
-                        close(tmp_fd);
-                    continue;
-                }
+                log_error("Failed to queue reply to fd %d. Closing connection...", conn->fd);
+                return false;
+            }
+        }
+        else
+        {
+            break;
+        }
+    }
 
-                struct sockaddr_in client_addr;
-                socklen_t client_len = sizeof(client_addr);
-                int client_fd = accept(server_fd, (struct sockaddr *)&client_addr, &client_len);
+    conn->reads_paused = conn->out_bytes >= high_water;
 
-                if (client_fd == -1)
-                {
-                    perror("accept");
-                    continue;
-                }
+    if (!conn->reads_paused && status == CONN_COMMAND_INVALID)
+    {
+        // The stream cannot be resynchronized, so report the error and hang up
+        static const char protocol_error[] = "-ERR Protocol error\r\n";
+        connection_output_append(conn, protocol_error, sizeof(protocol_error) - 1);
 
-                set_socket_nonblocking(client_fd);
+        log_error("Malformed RESP request from fd %d. Closing connection...", conn->fd);
+        return false;
+    }
 
-                struct epoll_event client_event;
-                client_event.events = EPOLLIN | EPOLLET;
-                client_event.data.fd = client_fd;
+    return true;
+}
 
-                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1)
-                {
-                    perror("epoll_ctl EPOLL_CTL_ADD");
-                    close(client_fd);
-                    continue;
-                }
+/**
+ * @brief Writes what is queued for a client that is done and closes it.
+ *
+ * Replies still held for an AOF fsync are not waited for, as that would
+ * stall the event loop: the client is marked as hung up and stays in the
+ * held list, and `release_held_client` writes them and closes it once the
+ * fsync completes.
+ *
+ * @param conn The client connection.
+ */
+void close_after_replies(Connection *conn)
+{
+    if (conn->out_bytes > 0 && replies_held(conn))
+    {
+        if (replies_lost(conn))
+            close_client(conn);
+        else
+            conn->hangup = true;
+        return;
+    }
 
-                active_clients++;
-                total_clients_connected++;
-            }
-            else
-            {
-                // Existing client has sent some data
-                char buffer[READ_BUFFER_SIZE];
-                memset(buffer, 0, READ_BUFFER_SIZE);
-                ssize_t bytes_read = read(fd, buffer, READ_BUFFER_SIZE);
+    connection_flush(conn);
+    close_client(conn);
+}
 
-                if (bytes_read <= 0)
-                {
-                    if (bytes_read < 0)
-                    {
-                        perror("sock_read_err");
-                    }
-                    close(fd);
-                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
-                    active_clients--;
-                }
-                else
-                {
-                    remove_trailing_newline(buffer);
-                    Command *cmd = malloc(sizeof(Command));
-                    parse_client_input(buffer, cmd);
-                    char *resp = execute_command(cmd);
-                    write(fd, resp, strlen(resp));
-                    free(resp);
-                    free(cmd);
-                    total_queries_processed++;
-                }
-            }
+/**
+ * @brief Handles a readable event on a client socket.
+ *
+ * Since clients are registered edge-triggered, the socket is drained until
+ * `EAGAIN`. Frames are processed after every read and the responses of that
+ * batch are flushed together, so pipelined commands spanning several reads
+ * are served without unbounded buffering. While reads are paused by the
+ * high-water mark the socket is left untouched until the queued output
+ * drops below the low-water mark.
+ *
+ * Each call runs at most `CLIENT_COMMAND_BUDGET` commands and reads at most
+ * `CLIENT_READ_BUDGET` bytes. A client with work left after that goes to the
+ * ready list and continues on the next loop iteration, since edge-triggered
+ * epoll will not report the data still waiting in its socket.
+ *
+ * @param conn The client connection.
+ */
+void handle_client_data(Connection *conn)
+{
+    size_t budget = CLIENT_COMMAND_BUDGET;
+    uint64_t read_limit = conn->bytes_in + CLIENT_READ_BUDGET;
+
+    while (true)
+    {
+        if (conn->reads_paused)
+        {
+            if (conn->out_bytes >= SETTING(output_low_water))
+                return;
+
+            conn->reads_paused = false;
         }
-    }
 
-    cleanup_and_close_server(EXIT_SUCCESS);
+        if (!process_frames(conn, &budget))
+        {
+            close_after_replies(conn);
+            return;
+        }
+
+        if (!flush_client(conn))
+        {
+            close_client(conn);
+            return;
+        }
+
+        if (conn->reads_paused)
+            continue;
+
+        if (budget == 0 || conn->bytes_in >= read_limit)
+        {
+            schedule_ready(conn);
+            return;
+        }
+
+        ConnectionReadStatus status = connection_read(conn);
+
+        switch (status)
+        {
+        case CONN_READ_OK:
+            continue;
+
+        case CONN_READ_AGAIN:
+            return;
+
+        case CONN_READ_ERROR:
+            perror("sock_read_err");
+            break;
+
+        case CONN_READ_OVERFLOW:
+            log_error("Input buffer limit exceeded by fd %d. Closing connection...", conn->fd);
+            break;
+
+        case CONN_READ_EOF:
+            // Best effort delivery of replies to clients that half-closed after sending
+            budget = SIZE_MAX;
+            process_frames(conn, &budget);
+            close_after_replies(conn);
+            return;
+        }
+
+        close_client(conn);
+        return;
+    }
+}
+
+/**
+ * @brief Handles a writable event on a client socket.
+ *
+ * Flushes queued responses. If reads were paused, the client is handed back
+ * to `handle_client_data`, which resumes them once the backlog is below the
+ * low-water mark; edge-triggered epoll will not report data that arrived while
+ * the client was paused, so the socket has to be drained explicitly.
+ *
+ * @param conn The client connection.
+ */
+void handle_client_writable(Connection *conn)
+{
+    if (!flush_client(conn))
+    {
+        close_client(conn);
+        return;
+    }
+
+    if (conn->reads_paused)
+        handle_client_data(conn);
+}
+
+/**
+ * @brief Writes the replies of a client that the AOF writer released.
+ *
+ * A client that hung up while they were held is closed after them.
+ *
+ * @param conn The client connection.
+ */
+void release_held_client(Connection *conn)
+{
+    if (conn->hangup)
+    {
+        connection_flush(conn);
+        close_client(conn);
+        return;
+    }
+
+    handle_client_writable(conn);
+}
+
+/**
+ * @brief Creates a non-blocking listening socket bound to the server port.
+ *
+ * `SO_REUSEPORT` lets every worker bind its own socket to the same port.
+ *
+ * @param server_addr The address to bind to.
+ * @return The listening socket file descriptor.
+ *
+ * @note Exits the program with `EXIT_FAILURE` if any step fails.
+ */
+int create_listener(struct sockaddr_in *server_addr)
+{
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (server_fd == -1)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    int enable = 1;
+    if (setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1)
+    {
+        perror("setsockopt TCP_NODELAY");
+        exit(EXIT_FAILURE);
+    }
+
+    // Enable SO_REUSEADDR to allow immediate reuse of the port
+    int opt = 1;
+
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1)
+    {
+        perror("setsockopt");
+        exit(EXIT_FAILURE);
+    }
+
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        perror("setsockopt SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
+
+    if (bind(server_fd, (struct sockaddr *)server_addr, sizeof(*server_addr)) == -1)
+    {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(server_fd, listen_backlog) == -1)
+    {
+        perror("listen");
+        exit(EXIT_FAILURE);
+    }
+
+    return server_fd;
+}
+
+/**
+ * @brief Creates the periodic timer that drives the expiry sweep of a worker.
+ *
+ * @param nonblocking Whether reads of the timer should fail with `EAGAIN` instead of waiting.
+ * @return The timer file descriptor.
+ *
+ * @note Exits the program with `EXIT_FAILURE` if the timer cannot be created.
+ */
+int create_expire_timer(bool nonblocking)
+{
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | (nonblocking ? TFD_NONBLOCK : 0));
+    if (timer_fd == -1)
+    {
+        perror("timerfd_create");
+        exit(EXIT_FAILURE);
+    }
+
+    struct itimerspec interval;
+    interval.it_interval.tv_sec = EXPIRE_INTERVAL_MS / 1000;
+    interval.it_interval.tv_nsec = (EXPIRE_INTERVAL_MS % 1000) * 1000000L;
+    interval.it_value = interval.it_interval;
+
+    if (timerfd_settime(timer_fd, 0, &interval, NULL) == -1)
+    {
+        perror("timerfd_settime");
+        exit(EXIT_FAILURE);
+    }
+
+    return timer_fd;
+}
+
+/**
+ * @brief Creates the eventfd the AOF writer signals after each fsync.
+ *
+ * @param nonblocking Whether reads of the eventfd should fail with `EAGAIN` instead of waiting.
+ * @return The eventfd.
+ *
+ * @note Exits the program with `EXIT_FAILURE` if the eventfd cannot be created.
+ */
+int create_wake_fd(bool nonblocking)
+{
+    int wake_fd = eventfd(0, EFD_CLOEXEC | (nonblocking ? EFD_NONBLOCK : 0));
+    if (wake_fd == -1)
+    {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    return wake_fd;
+}
+
+/**
+ * @brief Runs one active expiry sweep over the shards of the calling worker.
+ *
+ * Lazy expiry only catches keys that are accessed again; the sweep removes
+ * the rest a bounded slice of time per tick, so it never stalls the loop.
+ */
+void run_expire_cycle()
+{
+    store_expire_cycle(worker->id, worker_count, EXPIRE_TIME_LIMIT_US);
+}
+
+/**
+ * @brief Creates the listening socket, expiry timer and epoll instance of a worker.
+ *
+ * io_uring workers create their ring on their own thread instead, and keep
+ * their sockets blocking so that requests wait for readiness in the kernel
+ * rather than failing with `EAGAIN`.
+ *
+ * @param w The worker to set up.
+ * @param id Index of the worker.
+ * @param server_addr The address to listen on.
+ *
+ * @note Exits the program with `EXIT_FAILURE` if any step fails.
+ */
+void setup_worker(Worker *w, int id, struct sockaddr_in *server_addr)
+{
+    w->id = id;
+    w->server_fd = create_listener(server_addr);
+    w->timer_fd = create_expire_timer(io_backend == IO_BACKEND_EPOLL);
+
+    // Only workers holding replies for the fsync need to hear about it
+    if (sync_replies)
+        w->wake_fd = create_wake_fd(io_backend == IO_BACKEND_EPOLL);
+
+    if (io_backend != IO_BACKEND_EPOLL)
+        return;
+
+    set_socket_nonblocking(w->server_fd);
+
+    w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (w->epoll_fd == -1)
+    {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event server_event;
+    server_event.events = EPOLLIN;
+    server_event.data.fd = w->server_fd;
+
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->server_fd, &server_event) == -1)
+    {
+        perror("epoll_ctl: server_fd");
+        exit(EXIT_FAILURE);
+    }
+
+    struct epoll_event timer_event;
+    timer_event.events = EPOLLIN;
+    timer_event.data.fd = w->timer_fd;
+
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->timer_fd, &timer_event) == -1)
+    {
+        perror("epoll_ctl: timer_fd");
+        exit(EXIT_FAILURE);
+    }
+
+    // Level-triggered and never read, so every worker sees it
+    struct epoll_event shutdown_event;
+    shutdown_event.events = EPOLLIN;
+    shutdown_event.data.fd = shutdown_fd;
+
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, shutdown_fd, &shutdown_event) == -1)
+    {
+        perror("epoll_ctl: shutdown_fd");
+        exit(EXIT_FAILURE);
+    }
+
+    if (w->wake_fd == -1)
+        return;
+
+    struct epoll_event wake_event;
+    wake_event.events = EPOLLIN;
+    wake_event.data.fd = w->wake_fd;
+
+    if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->wake_fd, &wake_event) == -1)
+    {
+        perror("epoll_ctl: wake_fd");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Accepts the clients waiting on the worker's listening socket.
+ *
+ * `accept4` hands out sockets that are already non-blocking, so a new client
+ * costs no `fcntl` calls. The listener is level-triggered: clients left over
+ * after a batch wake the loop again once other events had their turn.
+ */
+void accept_clients()
+{
+    for (int i = 0; i < ACCEPT_BATCH; i++)
+    {
+        int client_fd = accept4(worker->server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        stats_count_syscall();
+
+        if (client_fd == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // Drained, or another worker took the connection first
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept4");
+            return;
+        }
+
+        int limit = SETTING(max_clients);
+        if (stats_active_clients() >= (uint64_t)limit)
+        {
+            log_error("Max clients reached (%d). Rejecting connection...", limit);
+            close(client_fd);
+            continue;
+        }
+
+        Connection *conn = create_connection(client_fd);
+        if (!conn || !connection_table_add(conn))
+        {
+            log_error("Failed to allocate connection for fd %d", client_fd);
+            free_connection(conn);
+            close(client_fd);
+            continue;
+        }
+
+        struct epoll_event client_event;
+        client_event.events = EPOLLIN | EPOLLET;
+        client_event.data.fd = client_fd;
+
+        stats_count_syscall();
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, client_fd, &client_event) == -1)
+        {
+            perror("epoll_ctl EPOLL_CTL_ADD");
+            connection_table_remove(client_fd);
+            free_connection(conn);
+            close(client_fd);
+            continue;
+        }
+
+        conn->events = client_event.events;
+        watch_idle(conn);
+
+        stats_client_connected();
+    }
+}
+
+/**
+ * @brief Runs the epoll event loop of a worker until the process exits.
+ *
+ * @param w The worker to run on the calling thread.
+ */
+void run_event_loop(Worker *w)
+{
+    worker = w;
+    stats_attach_worker(w->id);
+    epoch_attach_reader(w->id);
+    timer_wheel_init(&idle_wheel, monotonic_time_ms());
+    ready_tail = &ready_head;
+
+    struct epoll_event *events = malloc(max_events * sizeof(struct epoll_event));
+    if (!events)
+    {
+        perror("malloc events");
+        exit(EXIT_FAILURE);
+    }
+
+    while (!shutdown_requested())
+    {
+        // Clients with work left must not wait for an event that may never come
+        int nfds = epoll_wait(worker->epoll_fd, events, max_events, ready_head ? 0 : -1);
+        stats_count_wakeup(nfds);
+        if (nfds == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < nfds; i++)
+        {
+            int fd = events[i].data.fd;
+
+            // New client trying to connect
+            if (fd == worker->server_fd)
+            {
+                accept_clients();
+            }
+            else if (fd == worker->timer_fd)
+            {
+                uint64_t expirations;
+                if (read(worker->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                {
+                    run_expire_cycle();
+                    reap_idle_clients(close_client);
+                }
+            }
+            else if (fd == worker->wake_fd)
+            {
+                uint64_t fsyncs;
+                if (read(worker->wake_fd, &fsyncs, sizeof(fsyncs)) == sizeof(fsyncs))
+                    release_held_clients(release_held_client, close_client);
+            }
+            else if (fd == shutdown_fd)
+            {
+                // The loop ends after this round of events
+            }
+            else
+            {
+                // Existing client is writable and/or has sent some data
+                Connection *conn = connection_table_get(fd);
+                if (conn && (events[i].events & EPOLLOUT))
+                {
+                    handle_client_writable(conn);
+                    conn = connection_table_get(fd);
+                }
+
+                // A client in the ready list reads the new data when its turn comes; one that hung up is done reading
+                if (conn && !conn->ready && !conn->hangup && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                {
+                    handle_client_data(conn);
+                }
+            }
+        }
+
+        run_ready_clients(handle_client_data);
+    }
+
+    free(events);
+}
+
+#ifdef HAVE_IO_URING
+
+static __thread Uring *ring = NULL;               /** io_uring instance of the worker running on the calling thread */
+static __thread Connection *pending_sends = NULL; /** Clients whose output is written at the end of the loop iteration */
+static __thread uint64_t timer_expirations;       /** Buffer of the pending read of the expiry timer */
+static __thread uint64_t wake_count;              /** Buffer of the pending read of the fsync wakeup */
+
+/**
+ * @brief Packs a connection and a request kind into an io_uring `user_data` value.
+ *
+ * @param conn The client connection, or NULL for the listening socket.
+ * @param op The request kind.
+ * @return The `user_data` value.
+ */
+static inline uint64_t uring_user_data(Connection *conn, UringOp op)
+{
+    return (uint64_t)(uintptr_t)conn | op;
+}
+
+/**
+ * @brief Frees a closed client once none of its io_uring requests is outstanding.
+ *
+ * @param conn The client connection.
+ */
+void uring_release_client(Connection *conn)
+{
+    if (conn->closing && !conn->recv_armed && !conn->send_active && !conn->send_queued)
+        free_connection(conn);
+}
+
+/**
+ * @brief Stops the multishot receive of a client.
+ *
+ * Its final completion arrives with `-ECANCELED`.
+ *
+ * @param conn The client connection.
+ */
+void uring_cancel_recv(Connection *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe)
+        uring_prep_cancel(sqe, uring_user_data(conn, URING_OP_RECV), uring_user_data(NULL, URING_OP_CANCEL));
+}
+
+/**
+ * @brief Closes the socket of a client served by the io_uring backend.
+ *
+ * Its receive and write may still hold a reference to the socket, so it is
+ * shut down first, which makes both of them complete. A socket handed to a
+ * replication sender only has its receive cancelled instead. The connection
+ * state stays allocated until they have; callers release it with
+ * `uring_release_client` once they are done with it.
+ *
+ * @param conn The client connection to close.
+ */
+void uring_close_client(Connection *conn)
+{
+    if (conn->closing)
+        return;
+
+    conn->closing = true;
+    unwatch_idle(conn);
+    unschedule_ready(conn);
+    unhold_client(conn);
+
+    // A shutdown would also end the replication stream that now owns the socket
+    if (conn->detached && conn->recv_armed)
+    {
+        uring_cancel_recv(conn);
+    }
+    else if (conn->recv_armed || conn->send_active)
+    {
+        shutdown(conn->fd, SHUT_RDWR);
+        stats_count_syscall();
+    }
+
+    close(conn->fd);
+    stats_count_syscall();
+    connection_table_remove(conn->fd);
+    stats_client_disconnected();
+}
+
+/**
+ * @brief Closes a client outside of its own completions on the io_uring
+ * backend, e.g. one that exceeded the idle timeout.
+ *
+ * @param conn The client connection.
+ */
+void uring_drop_client(Connection *conn)
+{
+    uring_close_client(conn);
+    uring_release_client(conn);
+}
+
+/**
+ * @brief Starts a multishot receive on a client.
+ *
+ * @param conn The client connection.
+ * @return true on success, false if the submission queue is full.
+ */
+bool uring_arm_recv(Connection *conn)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+        return false;
+
+    uring_prep_recv_multishot(sqe, conn->fd, URING_BUFFER_GROUP, uring_user_data(conn, URING_OP_RECV));
+    conn->recv_armed = true;
+    return true;
+}
+
+/**
+ * @brief Schedules the output queue of a client to be written at the end of the loop iteration.
+ *
+ * @param conn The client connection.
+ */
+void uring_queue_send(Connection *conn)
+{
+    if (conn->send_queued || conn->send_active || conn->out_bytes == 0)
+        return;
+
+    conn->send_queued = true;
+    conn->send_next = pending_sends;
+    pending_sends = conn;
+}
+
+/**
+ * @brief Prepares one write for every client scheduled during this loop iteration.
+ *
+ * Deferring the writes to just before the submission sends every response a
+ * client produced in this iteration with a single request, and guarantees
+ * the output queue is not reallocated before the kernel has taken its copy
+ * of the I/O vectors.
+ */
+void uring_prepare_sends()
+{
+    while (pending_sends)
+    {
+        Connection *conn = pending_sends;
+        pending_sends = conn->send_next;
+        conn->send_next = NULL;
+        conn->send_queued = false;
+
+        int count;
+        // Held replies are queued again when the AOF writer wakes the worker
+        bool held = !conn->closing && replies_held(conn);
+        if (held && replies_lost(conn))
+            uring_close_client(conn);
+
+        struct iovec *iov = conn->closing || held ? NULL : connection_pending_output(conn, &count);
+        if (iov)
+        {
+            struct io_uring_sqe *sqe = uring_get_sqe(ring);
+            if (sqe)
+            {
+                uring_prep_writev(sqe, conn->fd, iov, (unsigned int)count, uring_user_data(conn, URING_OP_SEND));
+                conn->send_active = true;
+            }
+            else
+            {
+                log_error("Submission queue full, closing fd %d", conn->fd);
+                uring_close_client(conn);
+            }
+        }
+
+        uring_release_client(conn);
+    }
+}
+
+/**
+ * @brief Executes the buffered commands of a client and schedules the replies.
+ *
+ * Mirrors `handle_client_data`: a client that has to be disconnected gets
+ * its queued replies written first, a client above the high-water mark
+ * stops receiving until its output drains, and a client that used up its
+ * budget continues from the ready list. Clients that half-closed get all of
+ * their buffered commands run, as they will not send anything else.
+ *
+ * @param conn The client connection.
+ */
+void uring_serve_client(Connection *conn)
+{
+    size_t budget = conn->hangup ? SIZE_MAX : CLIENT_COMMAND_BUDGET;
+
+    if (!process_frames(conn, &budget))
+        conn->hangup = true;
+    else if (budget == 0 && !conn->reads_paused)
+        schedule_ready(conn);
+
+    if (conn->out_bytes > 0)
+        uring_queue_send(conn);
+    else if (conn->hangup)
+    {
+        uring_close_client(conn);
+        return;
+    }
+
+    if ((conn->reads_paused || conn->hangup) && conn->recv_armed)
+        uring_cancel_recv(conn);
+}
+
+/**
+ * @brief Handles a completion of the multishot accept.
+ *
+ * @param cqe The completion.
+ */
+void uring_handle_accept(struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+    {
+        struct io_uring_sqe *sqe = uring_get_sqe(ring);
+        if (!sqe)
+        {
+            log_error("Failed to re-arm accept on worker %d", worker->id);
+            exit(EXIT_FAILURE);
+        }
+
+        uring_prep_accept_multishot(sqe, worker->server_fd, uring_user_data(NULL, URING_OP_ACCEPT));
+    }
+
+    if (cqe->res < 0)
+    {
+        errno = -cqe->res;
+        perror("accept");
+        return;
+    }
+
+    int client_fd = cqe->res;
+
+    int limit = SETTING(max_clients);
+    if (stats_active_clients() >= (uint64_t)limit)
+    {
+        log_error("Max clients reached (%d). Rejecting connection...", limit);
+        close(client_fd);
+        return;
+    }
+
+    Connection *conn = create_connection(client_fd);
+    if (!conn || !connection_table_add(conn))
+    {
+        log_error("Failed to allocate connection for fd %d", client_fd);
+        free_connection(conn);
+        close(client_fd);
+        return;
+    }
+
+    if (!uring_arm_recv(conn))
+    {
+        log_error("Submission queue full, rejecting fd %d", client_fd);
+        connection_table_remove(client_fd);
+        free_connection(conn);
+        close(client_fd);
+        return;
+    }
+
+    watch_idle(conn);
+    stats_client_connected();
+}
+
+/**
+ * @brief Handles a completion of a client's multishot receive.
+ *
+ * Received data is copied into the input buffer and the provided buffer is
+ * recycled right away. The receive is re-armed whenever the kernel ended it
+ * while the client is still being read from.
+ *
+ * @param conn The client connection.
+ * @param cqe The completion.
+ */
+void uring_handle_recv(Connection *conn, struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        conn->recv_armed = false;
+
+    if (cqe->res > 0)
+    {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        bool discard = conn->closing || conn->hangup;
+        bool stored = discard || connection_append_input(conn, uring_buffer(ring, bid), (size_t)cqe->res);
+
+        uring_recycle_buffer(ring, bid);
+
+        if (!stored)
+        {
+            log_error("Input buffer limit exceeded by fd %d. Closing connection...", conn->fd);
+            uring_close_client(conn);
+            return;
+        }
+
+        // A client in the ready list runs the new commands when its turn comes
+        if (!discard && !conn->ready)
+            uring_serve_client(conn);
+    }
+    else if (cqe->res == 0)
+    {
+        // Best effort delivery of replies to clients that half-closed after sending
+        if (!conn->closing && !conn->hangup)
+        {
+            conn->hangup = true;
+            uring_serve_client(conn);
+        }
+        return;
+    }
+    else if (cqe->res != -ENOBUFS && cqe->res != -ECANCELED)
+    {
+        if (!conn->closing)
+        {
+            errno = -cqe->res;
+            perror("sock_read_err");
+            uring_close_client(conn);
+        }
+        return;
+    }
+
+    if (!conn->recv_armed && !conn->closing && !conn->hangup && !conn->reads_paused && !uring_arm_recv(conn))
+    {
+        log_error("Submission queue full, closing fd %d", conn->fd);
+        uring_close_client(conn);
+    }
+}
+
+/**
+ * @brief Handles the completion of a write of a client's output queue.
+ *
+ * Mirrors `handle_client_writable`: once a paused client has drained below
+ * the low-water mark its buffered commands are resumed and it is read from
+ * again.
+ *
+ * @param conn The client connection.
+ * @param cqe The completion.
+ */
+void uring_handle_send(Connection *conn, struct io_uring_cqe *cqe)
+{
+    conn->send_active = false;
+
+    if (conn->closing)
+        return;
+
+    if (cqe->res < 0)
+    {
+        if (cqe->res == -EINTR || cqe->res == -EAGAIN)
+        {
+            uring_queue_send(conn);
+            return;
+        }
+
+        errno = -cqe->res;
+        perror("sock_write_err");
+        uring_close_client(conn);
+        return;
+    }
+
+    connection_output_sent(conn, (size_t)cqe->res);
+
+    if (conn->reads_paused && conn->out_bytes < SETTING(output_low_water))
+    {
+        conn->reads_paused = false;
+        uring_serve_client(conn);
+
+        if (conn->closing)
+            return;
+    }
+
+    if (conn->out_bytes > 0)
+        uring_queue_send(conn);
+    else if (conn->hangup)
+    {
+        uring_close_client(conn);
+        return;
+    }
+
+    if (!conn->recv_armed && !conn->reads_paused && !conn->hangup && !uring_arm_recv(conn))
+    {
+        log_error("Submission queue full, closing fd %d", conn->fd);
+        uring_close_client(conn);
+    }
+}
+
+/**
+ * @brief Queues a read of the expiry timer, which completes at its next tick.
+ */
+void uring_arm_timer()
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+    {
+        log_error("Failed to arm expiry timer on worker %d", worker->id);
+        exit(EXIT_FAILURE);
+    }
+
+    uring_prep_read(sqe, worker->timer_fd, &timer_expirations, sizeof(timer_expirations),
+                    uring_user_data(NULL, URING_OP_TIMER));
+}
+
+/**
+ * @brief Handles a tick of the expiry timer.
+ *
+ * @param cqe The completion of the timer read.
+ */
+void uring_handle_timer(struct io_uring_cqe *cqe)
+{
+    uring_arm_timer();
+
+    if (cqe->res == sizeof(timer_expirations))
+    {
+        run_expire_cycle();
+        reap_idle_clients(uring_drop_client);
+    }
+}
+
+/**
+ * @brief Queues a read of the fsync wakeup, which completes at the next AOF fsync.
+ */
+void uring_arm_wake()
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (!sqe)
+    {
+        log_error("Failed to arm fsync wakeup on worker %d", worker->id);
+        exit(EXIT_FAILURE);
+    }
+
+    uring_prep_read(sqe, worker->wake_fd, &wake_count, sizeof(wake_count), uring_user_data(NULL, URING_OP_WAKE));
+}
+
+/**
+ * @brief Handles an AOF fsync by writing the replies that were held for it.
+ *
+ * @param cqe The completion of the wakeup read.
+ */
+void uring_handle_wake(struct io_uring_cqe *cqe)
+{
+    uring_arm_wake();
+
+    if (cqe->res == sizeof(wake_count))
+        release_held_clients(uring_queue_send, uring_drop_client);
+}
+
+/**
+ * @brief Dispatches a completion to the handler of its request kind.
+ *
+ * @param cqe The completion.
+ */
+void uring_handle_completion(struct io_uring_cqe *cqe)
+{
+    Connection *conn = (Connection *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+
+    switch ((UringOp)(cqe->user_data & URING_OP_MASK))
+    {
+    case URING_OP_ACCEPT:
+        uring_handle_accept(cqe);
+        return;
+
+    case URING_OP_RECV:
+        uring_handle_recv(conn, cqe);
+        break;
+
+    case URING_OP_SEND:
+        uring_handle_send(conn, cqe);
+        break;
+
+    case URING_OP_TIMER:
+        uring_handle_timer(cqe);
+        return;
+
+    case URING_OP_WAKE:
+        uring_handle_wake(cqe);
+        return;
+
+    case URING_OP_STOP:
+        // The loop ends after this round of completions
+        return;
+
+    case URING_OP_CANCEL:
+        return;
+    }
+
+    uring_release_client(conn);
+}
+
+/**
+ * @brief Runs the io_uring event loop of a worker until the process exits.
+ *
+ * Connections are accepted with a multishot accept and read with multishot
+ * receives into a ring of provided buffers, so neither needs to be re-armed
+ * per request. Replies are written with one gathered write per client, and
+ * all new requests of an iteration are submitted together with the wait for
+ * the next completions: a loop iteration costs a single `io_uring_enter`
+ * however many clients it serves.
+ *
+ * @param w The worker to run on the calling thread.
+ */
+void run_uring_event_loop(Worker *w)
+{
+    Uring worker_ring;
+
+    worker = w;
+    stats_attach_worker(w->id);
+    epoch_attach_reader(w->id);
+    timer_wheel_init(&idle_wheel, monotonic_time_ms());
+    ready_tail = &ready_head;
+
+    if (!uring_init(&worker_ring, URING_ENTRIES) ||
+        !uring_setup_buffers(&worker_ring, URING_BUFFER_COUNT, URING_BUFFER_SIZE, URING_BUFFER_GROUP))
+    {
+        perror("io_uring setup");
+        exit(EXIT_FAILURE);
+    }
+
+    ring = &worker_ring;
+
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    uring_prep_accept_multishot(sqe, worker->server_fd, uring_user_data(NULL, URING_OP_ACCEPT));
+    uring_arm_timer();
+    if (worker->wake_fd != -1)
+        uring_arm_wake();
+
+    sqe = uring_get_sqe(ring);
+    uring_prep_poll(sqe, shutdown_fd, POLLIN, uring_user_data(NULL, URING_OP_STOP));
+
+    while (!shutdown_requested())
+    {
+        uring_prepare_sends();
+
+        // EBUSY and EAGAIN mean completions have to be reaped before more can be submitted;
+        // clients with work left must not wait for a completion that may never come
+        if (uring_submit_and_wait(ring, ready_head ? 0 : 1) == -1 && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            perror("io_uring_enter");
+            exit(EXIT_FAILURE);
+        }
+
+        int completions = 0;
+        struct io_uring_cqe *cqe;
+
+        while ((cqe = uring_peek_cqe(ring)))
+        {
+            uring_handle_completion(cqe);
+            uring_cqe_seen(ring);
+            completions++;
+        }
+
+        stats_count_wakeup(completions);
+        run_ready_clients(uring_serve_client);
+    }
+}
+
+#endif // HAVE_IO_URING
+
+/**
+ * @brief Runs the event loop of the configured backend on the calling thread.
+ *
+ * @param w The worker to run.
+ */
+void run_worker(Worker *w)
+{
+#ifdef HAVE_IO_URING
+    if (io_backend == IO_BACKEND_IO_URING)
+    {
+        run_uring_event_loop(w);
+        return;
+    }
+#endif
+
+    run_event_loop(w);
+}
+
+/**
+ * @brief Entry point of the additional worker threads.
+ *
+ * @param arg Pointer to the Worker to run.
+ * @return NULL once the server shuts down.
+ */
+void *worker_thread(void *arg)
+{
+    Worker *w = arg;
+
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "worker-%d", w->id);
+    pthread_setname_np(pthread_self(), thread_name);
+
+    run_worker(w);
+    return NULL;
+}
+
+/**
+ * @brief Raises the open file limit so that `max_clients` connections fit.
+ *
+ * The soft limit is raised as far as the hard limit allows. If that is still
+ * too low, `max_clients` is lowered to what fits, so surplus clients are
+ * rejected cleanly instead of `accept` failing with `EMFILE`.
+ */
+void raise_file_limit()
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        perror("getrlimit");
+        return;
+    }
+
+    rlim_t reserved = RESERVED_FDS + (rlim_t)worker_count * FDS_PER_WORKER;
+    rlim_t needed = (rlim_t)max_clients + reserved;
+    if (limit.rlim_cur >= needed)
+        return;
+
+    rlim_t previous = limit.rlim_cur;
+    limit.rlim_cur = limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed ? limit.rlim_max : needed;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == -1)
+    {
+        perror("setrlimit");
+        limit.rlim_cur = previous;
+    }
+
+    if (limit.rlim_cur < needed)
+    {
+        int fitting = limit.rlim_cur > reserved ? (int)(limit.rlim_cur - reserved) : 1;
+        log_warn("Open file limit is %llu, lowering max clients from %d to %d",
+                 (unsigned long long)limit.rlim_cur, max_clients, fitting);
+        __atomic_store_n(&max_clients, fitting, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Parses a CPU list such as `0-3,8`, keeping the order CPUs are listed in.
+ *
+ * @param text The list, empty or `none` for no CPUs.
+ * @param cpus Receives the CPUs, room for CPU_SETSIZE entries.
+ * @param count Receives the number of CPUs.
+ * @return True if every CPU is one the process may run on.
+ */
+static bool parse_cpu_list(const char *text, int *cpus, int *count)
+{
+    *count = 0;
+    if (strcmp(text, "none") == 0)
+        return true;
+
+    for (const char *p = text; *p != '\0';)
+    {
+        char *end;
+        if (*p < '0' || *p > '9')
+            return false;
+
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (*end == '-')
+        {
+            p = end + 1;
+            if (*p < '0' || *p > '9')
+                return false;
+            last = strtol(p, &end, 10);
+        }
+
+        if (first > last || last >= CPU_SETSIZE || (*end != ',' && *end != '\0') || (*end == ',' && end[1] == '\0'))
+            return false;
+
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            if (!CPU_ISSET(cpu, &startup_cpus) || *count == CPU_SETSIZE)
+                return false;
+            cpus[(*count)++] = (int)cpu;
+        }
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Pins every worker to its CPU of `cpu_affinity`, or lets all of
+ * them run on the CPUs the process started with if the list is empty.
+ *
+ * @return True on success, false if a thread could not be moved.
+ */
+static bool pin_workers(void)
+{
+    for (int i = 0; i < worker_count; i++)
+    {
+        cpu_set_t set = startup_cpus;
+        if (affinity_count > 0)
+        {
+            CPU_ZERO(&set);
+            CPU_SET(affinity_cpus[i % affinity_count], &set);
+        }
+
+        int error = pthread_setaffinity_np(workers[i].thread, sizeof(set), &set);
+        if (error != 0)
+        {
+            log_error("Failed to pin worker %d: %s", i, strerror(error));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Applies a new `cpu-affinity` list.
+ * @param running Whether the workers are already running.
+ * @return True if the list is valid and could be applied.
+ */
+static bool apply_cpu_affinity(bool running)
+{
+    static int cpus[CPU_SETSIZE];
+    int count;
+
+    if (!parse_cpu_list(cpu_affinity ? cpu_affinity : "", cpus, &count))
+        return false;
+
+    memcpy(affinity_cpus, cpus, count * sizeof(int));
+    affinity_count = count;
+    return !running || pin_workers();
+}
+
+/**
+ * @brief Splits `replicaof` into the host and port of the primary.
+ * @param running Unused, the setting is only read at startup.
+ * @return True if the address is empty or of the form HOST:PORT.
+ */
+static bool apply_replicaof(bool running)
+{
+    (void)running;
+    char *host = NULL;
+    long value = 0;
+
+    if (replicaof)
+    {
+        // The port follows the last colon, so the host may be an IPv6 address
+        char *colon = strrchr(replicaof, ':');
+        char *end;
+        value = colon ? strtol(colon + 1, &end, 10) : 0;
+        if (!colon || colon == replicaof || colon[1] == '\0' || *end != '\0' || value < 1 || value > 65535)
+            return false;
+
+        host = strndup(replicaof, colon - replicaof);
+        if (!host)
+            return false;
+    }
+
+    free(primary_host);
+    primary_host = host;
+    primary_port = (int)value;
+    return true;
+}
+
+/**
+ * @brief Applies a new listen backlog to the listening sockets.
+ * @param running Whether the listeners exist yet.
+ * @return True on success.
+ */
+static bool apply_backlog(bool running)
+{
+    // Calling listen again on a listening socket only updates its backlog
+    for (int i = 0; running && i < worker_count; i++)
+    {
+        if (listen(workers[i].server_fd, listen_backlog) == -1)
+        {
+            log_error("Failed to update the listen backlog: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Raises the open file limit for a new `maxclients`.
+ * @param running Whether the server is already serving; at startup `main` raises it.
+ * @return Always true; `max_clients` is lowered to what the limit allows.
+ */
+static bool apply_max_clients(bool running)
+{
+    if (running)
+        raise_file_limit();
+    return true;
+}
+
+/**
+ * @brief Applies a new `maxmemory` or `maxmemory-policy` to the store.
+ * @param running Whether the store exists yet.
+ * @return Always true.
+ */
+static bool apply_memory_limit(bool running)
+{
+    if (running)
+        store_set_memory_limit(max_memory, eviction_policy);
+    return true;
+}
+
+/**
+ * @brief Grows the shards for a new `table-presize`.
+ * @param running Whether the store exists yet.
+ * @return True on success, false if a table could not be allocated.
+ */
+static bool apply_table_presize(bool running)
+{
+    return !running || store_reserve(table_presize);
+}
+
+/**
+ * @brief Applies new input buffer sizes to the connections.
+ *
+ * At startup the sizes are checked against each other once all options
+ * are read, so they can be given in any order.
+ *
+ * @param running Whether the server is already serving.
+ * @return True unless the initial size exceeds the maximum.
+ */
+static bool apply_read_limits(bool running)
+{
+    if (!running)
+        return true;
+
+    if (read_buffer_size > max_request_size)
+        return false;
+
+    connection_set_read_limits(read_buffer_size, max_request_size);
+    return true;
+}
+
+/**
+ * @brief Has the workers re-arm their idle timers for a new `timeout`.
+ * @param running Whether the server is already serving.
+ * @return Always true.
+ */
+static bool apply_idle_timeout(bool running)
+{
+    if (running)
+        __atomic_add_fetch(&idle_changes, 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * @brief Checks new output water marks against each other.
+ * @param running Whether the server is already serving; at startup `main` checks them.
+ * @return True unless the low mark exceeds the high one.
+ */
+static bool apply_output_water(bool running)
+{
+    return !running || output_low_water <= output_high_water;
+}
+
+static const char *const backend_names[] = {"epoll", "io_uring", NULL};
+static const char *const eviction_names[] = {"lru", "lfu", NULL};
+static const char *const fsync_names[] = {"always", "everysec", "no", NULL};
+
+/**
+ * @brief Every setting, with its name in the configuration file, on the
+ * command line and in CONFIG GET/SET.
+ *
+ * Settings that shape the layout of the server (worker threads, shards,
+ * listeners, persistence and replication) are only read at startup.
+ */
+static ConfigOption settings[] = {
+    {"workers", CONFIG_INT, &worker_count, 1, MAX_WORKERS, NULL, false, NULL},
+    {"backend", CONFIG_ENUM, &io_backend, 0, 0, backend_names, false, NULL},
+    {"port", CONFIG_INT, &port, 1, 65535, NULL, false, NULL},
+    {"max-events", CONFIG_INT, &max_events, 1, INT_MAX / sizeof(struct epoll_event), NULL, false, NULL},
+    {"aof", CONFIG_STRING, &aof_path, 0, 0, NULL, false, NULL},
+    {"appendfsync", CONFIG_ENUM, &fsync_policy, 0, 0, fsync_names, false, NULL},
+    {"snapshot", CONFIG_STRING, &snapshot_path, 0, 0, NULL, false, NULL},
+    {"snapshot-interval", CONFIG_UINT, &snapshot_interval, 0, UINT32_MAX, NULL, false, NULL},
+    {"replicaof", CONFIG_STRING, &replicaof, 0, 0, NULL, false, apply_replicaof},
+    {"repl-backlog", CONFIG_MEMORY, &repl_backlog, 1, SIZE_MAX, NULL, false, NULL},
+    {"backlog", CONFIG_INT, &listen_backlog, 1, INT_MAX, NULL, true, apply_backlog},
+    {"maxclients", CONFIG_INT, &max_clients, 1, INT32_MAX, NULL, true, apply_max_clients},
+    {"timeout", CONFIG_UINT, &idle_timeout, 0, UINT32_MAX, NULL, true, apply_idle_timeout},
+    {"maxmemory", CONFIG_MEMORY, &max_memory, 0, SIZE_MAX, NULL, true, apply_memory_limit},
+    {"maxmemory-policy", CONFIG_ENUM, &eviction_policy, 0, 0, eviction_names, true, apply_memory_limit},
+    {"table-presize", CONFIG_SIZE, &table_presize, 0, MAX_TABLE_PRESIZE, NULL, true, apply_table_presize},
+    {"read-buffer", CONFIG_MEMORY, &read_buffer_size, 64, SIZE_MAX / 2, NULL, true, apply_read_limits},
+    {"max-request", CONFIG_MEMORY, &max_request_size, 64, SIZE_MAX / 2, NULL, true, apply_read_limits},
+    {"output-high-water", CONFIG_MEMORY, &output_high_water, 1, SIZE_MAX, NULL, true, apply_output_water},
+    {"output-low-water", CONFIG_MEMORY, &output_low_water, 0, SIZE_MAX, NULL, true, apply_output_water},
+    {"cpu-affinity", CONFIG_STRING, &cpu_affinity, 0, 0, NULL, true, apply_cpu_affinity},
+};
+
+/**
+ * @brief Prints command line usage.
+ *
+ * @param program Name the server was invoked with.
+ */
+void print_usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--config FILE] [OPTION VALUE]...\n", program);
+    fprintf(stderr, "  -C, --config FILE         Read settings from a file of `name value` lines; later options override it\n");
+    fprintf(stderr, "  -w, --workers N           Number of event loop threads (1-%d, default 1)\n", MAX_WORKERS);
+    fprintf(stderr, "  -b, --backend B           Event loop implementation: epoll (default) or io_uring\n");
+    fprintf(stderr, "  -m, --maxmemory BYTES     Memory limit of the keyspace, e.g. 512mb (default 0, no limit)\n");
+    fprintf(stderr, "  -e, --maxmemory-policy P  Keys evicted at the limit: lru (default) or lfu, both sampled\n");
+    fprintf(stderr, "  -a, --aof FILE            Log writes to an append-only file and replay it on startup (default off)\n");
+    fprintf(stderr, "  -f, --appendfsync P       When to fsync the append-only file: always (replies wait for it), everysec (default) or no\n");
+    fprintf(stderr, "  -s, --snapshot FILE       Load a snapshot on startup and write snapshots to it (default off)\n");
+    fprintf(stderr, "  -i, --snapshot-interval S Seconds between snapshots, 0 for BGSAVE only (default %d)\n", DEFAULT_SNAPSHOT_INTERVAL);
+    fprintf(stderr, "  -c, --maxclients N        Open connections allowed across all workers (default %d)\n", DEFAULT_MAX_CLIENTS);
+    fprintf(stderr, "  -t, --timeout SECONDS     Close clients idle for this long, 0 to never close them (default 0)\n");
+    fprintf(stderr, "  -p, --port N              TCP port to listen on (default %d)\n", DEFAULT_PORT);
+    fprintf(stderr, "  -r, --replicaof HOST:PORT Replicate the primary at this address and refuse writes (default off)\n");
+    fprintf(stderr, "  -B, --repl-backlog BYTES  Recent writes kept for replicas to resume from, e.g. 16mb (default 1mb)\n");
+    fprintf(stderr, "      --backlog N           Pending connections per listener (default %d)\n", DEFAULT_BACKLOG);
+    fprintf(stderr, "      --max-events N        Events fetched per epoll_wait call (default %d)\n", DEFAULT_MAX_EVENTS);
+    fprintf(stderr, "      --table-presize KEYS  Size the keyspace tables for this many keys up front (default 0)\n");
+    fprintf(stderr, "      --read-buffer BYTES   Initial input buffer of a client (default 4kb)\n");
+    fprintf(stderr, "      --max-request BYTES   Largest request a client may send (default 64mb)\n");
+    fprintf(stderr, "      --output-high-water B Queued output at which reads from a client pause (default 1mb)\n");
+    fprintf(stderr, "      --output-low-water B  Queued output below which paused reads resume (default 256kb)\n");
+    fprintf(stderr, "      --cpu-affinity LIST   Pin worker i to the i-th CPU of a list such as 0-3,8 (default off)\n");
+    fprintf(stderr, "Settings that CONFIG SET can change while running:");
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++)
+    {
+        if (settings[i].runtime)
+            fprintf(stderr, " %s", settings[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+/**
+ * @brief Returns the setting a command line option stands for.
+ * @param options The long options.
+ * @param option The value returned by `getopt_long`.
+ * @param long_index Index of the long option, valid when `option` is 0.
+ * @return The name of the setting.
+ */
+static const char *option_setting(const struct option *options, int option, int long_index)
+{
+    if (option == 0)
+        return options[long_index].name;
+
+    for (; options->name; options++)
+    {
+        if (options->val == option)
+            return options->name;
+    }
+
+    return "";
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option long_options[] = {
+        {"config", required_argument, NULL, 'C'},
+        {"workers", required_argument, NULL, 'w'},
+        {"backend", required_argument, NULL, 'b'},
+        {"maxmemory", required_argument, NULL, 'm'},
+        {"maxmemory-policy", required_argument, NULL, 'e'},
+        {"aof", required_argument, NULL, 'a'},
+        {"appendfsync", required_argument, NULL, 'f'},
+        {"snapshot", required_argument, NULL, 's'},
+        {"snapshot-interval", required_argument, NULL, 'i'},
+        {"maxclients", required_argument, NULL, 'c'},
+        {"timeout", required_argument, NULL, 't'},
+        {"port", required_argument, NULL, 'p'},
+        {"replicaof", required_argument, NULL, 'r'},
+        {"repl-backlog", required_argument, NULL, 'B'},
+        {"backlog", required_argument, NULL, 0},
+        {"max-events", required_argument, NULL, 0},
+        {"table-presize", required_argument, NULL, 0},
+        {"read-buffer", required_argument, NULL, 0},
+        {"max-request", required_argument, NULL, 0},
+        {"output-high-water", required_argument, NULL, 0},
+        {"output-low-water", required_argument, NULL, 0},
+        {"cpu-affinity", required_argument, NULL, 0},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    config_register(settings, sizeof(settings) / sizeof(settings[0]));
+
+    if (sched_getaffinity(0, sizeof(startup_cpus), &startup_cpus) == -1)
+    {
+        perror("sched_getaffinity");
+        exit(EXIT_FAILURE);
+    }
+
+    // Settings apply in the order given, so options after --config override the file
+    int option;
+    int long_index = 0;
+    while ((option = getopt_long(argc, argv, "C:w:b:m:e:a:f:s:i:c:t:p:r:B:h", long_options, &long_index)) != -1)
+    {
+        if (option == 'h' || option == '?')
+        {
+            print_usage(argv[0]);
+            exit(option == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+
+        if (option == 'C')
+        {
+            if (!config_load_file(optarg))
+                exit(EXIT_FAILURE);
+            continue;
+        }
+
+        const char *name = option_setting(long_options, option, long_index);
+        ConfigStatus status = config_set(name, optarg, false);
+        if (status != CONFIG_OK)
+        {
+            fprintf(stderr, "%s: --%s %s: %s\n", argv[0], name, optarg, config_status_message(status));
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (read_buffer_size > max_request_size)
+    {
+        fprintf(stderr, "%s: read-buffer must not exceed max-request\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (output_low_water > output_high_water)
+    {
+        fprintf(stderr, "%s: output-low-water must not exceed output-high-water\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    connection_set_read_limits(read_buffer_size, max_request_size);
+
+    shutdown_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (shutdown_fd == -1)
+    {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    signal(SIGINT, request_shutdown);  // Handle Ctrl+C
+    signal(SIGTERM, request_shutdown); // Handle termination using kill
+    signal(SIGPIPE, SIG_IGN);                  // Report writes to closed sockets as EPIPE instead
+    pthread_setname_np(pthread_self(), "main");
+
+    if (!initialize_logger())
+    {
+        exit(EXIT_FAILURE);
+    }
+
+    raise_file_limit();
+
+#ifdef HAVE_IO_URING
+    if (io_backend == IO_BACKEND_IO_URING && !uring_available())
+#else
+    if (io_backend == IO_BACKEND_IO_URING)
+#endif
+    {
+        log_error("io_uring backend is not available on this system. Falling back to epoll...");
+        io_backend = IO_BACKEND_EPOLL;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    workers = calloc(worker_count, sizeof(Worker));
+    if (!workers)
+    {
+        perror("calloc workers");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        workers[i].server_fd = -1;
+        workers[i].epoll_fd = -1;
+        workers[i].timer_fd = -1;
+        workers[i].wake_fd = -1;
+    }
+
+    // Decided before the workers are set up, since only then do they need a wakeup for the fsync
+    sync_replies = aof_path && fsync_policy == AOF_FSYNC_ALWAYS;
+
+    for (int i = 0; i < worker_count; i++)
+    {
+        setup_worker(&workers[i], i, &server_addr);
+    }
+
+    if (!initialize_stats(worker_count))
+    {
+        perror("initialize_stats");
+        exit(EXIT_FAILURE);
+    }
+
+    if (!initialize_epoch(worker_count))
+    {
+        perror("initialize_epoch");
+        exit(EXIT_FAILURE);
+    }
+
+    initialize_command_handler((size_t)worker_count * SHARDS_PER_WORKER);
+    store_set_memory_limit(max_memory, eviction_policy);
+
+    if (table_presize > 0 && !store_reserve(table_presize))
+    {
+        log_error("Failed to presize the keyspace for %zu keys", table_presize);
+        exit(EXIT_FAILURE);
+    }
+
+    // The append-only file is always at least as recent as a snapshot, so a snapshot is only loaded without one
+    if (snapshot_path && !aof_path && !snapshot_load(snapshot_path))
+    {
+        log_error("Failed to load the snapshot %s", snapshot_path);
+        exit(EXIT_FAILURE);
+    }
+
+    aof_set_durable_hook(wake_workers);
+    if (aof_path && !initialize_aof(aof_path, fsync_policy))
+    {
+        log_error("Failed to load the append-only file %s", aof_path);
+        exit(EXIT_FAILURE);
+    }
+
+    if (snapshot_path && !initialize_snapshot(snapshot_path, snapshot_interval))
+    {
+        log_error("Failed to set up snapshots to %s", snapshot_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // Loading is done, so GET may now skip the shard locks the other workers contend on
+    if (worker_count > 1)
+        store_enable_concurrent_reads();
+
+    if (!initialize_replication(repl_backlog, primary_host, primary_port))
+    {
+        log_error("Failed to set up replication");
+        exit(EXIT_FAILURE);
+    }
+
+    log_info("CEpollion Server started:\n"
+             "{\n"
+             "  \"port\": %d,\n"
+             "  \"workers\": %d,\n"
+             "  \"shards\": %zu,\n"
+             "  \"backend\": \"%s\",\n"
+             "  \"maxmemory\": %zu,\n"
+             "  \"maxmemory_policy\": \"%s\",\n"
+             "  \"aof\": \"%s\",\n"
+             "  \"snapshot\": \"%s\",\n"
+             "  \"max_clients\": %d,\n"
+             "  \"timeout\": %u,\n"
+             "  \"replicaof\": \"%s%s%.0d\"\n"
+             "}",
+             ntohs(server_addr.sin_port), worker_count, store_shard_count(),
+             io_backend == IO_BACKEND_IO_URING ? "io_uring" : "epoll",
+             max_memory, eviction_policy == EVICTION_LFU ? "lfu" : "lru", aof_path ? aof_path : "off",
+             snapshot_path ? snapshot_path : "off", max_clients, idle_timeout,
+             primary_host ? primary_host : "off", primary_host ? ":" : "", primary_port);
+
+    // Termination signals are handled by the main thread only
+    sigset_t signals, previous_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous_signals);
+
+    // CONFIG SET cpu-affinity moves every worker thread, so changes wait until all of them exist
+    config_hold();
+    workers[0].thread = pthread_self();
+
+    for (int i = 1; i < worker_count; i++)
+    {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous_signals, NULL);
+
+    bool pinned = affinity_count == 0 || pin_workers();
+    config_release();
+    if (!pinned)
+        exit(EXIT_FAILURE);
+
+    run_worker(&workers[0]);
+
+    for (int i = 1; i < worker_count; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    cleanup_and_close_server(__atomic_load_n(&shutdown_signal, __ATOMIC_ACQUIRE));
     return EXIT_SUCCESS;
 }
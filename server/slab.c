@@ -0,0 +1,230 @@
+#include <stdlib.h>
+#include <string.h>
+#include "slab.h"
+
+#define SLAB_MIN_CHUNK 32             /** Smallest chunk size */
+#define SLAB_MAX_CHUNK (64 * 1024)    /** Largest chunk size; bigger blocks use malloc */
+#define SLAB_GROWTH_FACTOR 1.25       /** Ratio between neighbouring chunk sizes */
+#define SLAB_FINE_MAX 128             /** Classes up to this size are one alignment step apart */
+#define SLAB_PAGE_SIZE (64 * 1024)    /** Minimum page size */
+#define SLAB_MIN_CHUNKS_PER_PAGE 8    /** Pages of large classes hold at least this many chunks */
+#define SLAB_ALIGNMENT 8
+
+/**
+ * @brief Sets up the size classes.
+ * @param slabs Pointer to the SlabAllocator.
+ */
+void slab_init(SlabAllocator *slabs)
+{
+    memset(slabs, 0, sizeof(*slabs));
+
+    size_t size = SLAB_MIN_CHUNK;
+    while (slabs->class_count < SLAB_CLASS_COUNT)
+    {
+        if (size > SLAB_MAX_CHUNK || slabs->class_count == SLAB_CLASS_COUNT - 1)
+            size = SLAB_MAX_CHUNK;
+
+        SlabClass *class = &slabs->classes[slabs->class_count++];
+        class->chunk_size = size;
+        class->chunks_per_page = SLAB_PAGE_SIZE / size;
+        if (class->chunks_per_page < SLAB_MIN_CHUNKS_PER_PAGE)
+            class->chunks_per_page = SLAB_MIN_CHUNKS_PER_PAGE;
+
+        if (size == SLAB_MAX_CHUNK)
+            break;
+
+        // Small pairs are the most common, so they get classes that waste at most a few bytes
+        if (size < SLAB_FINE_MAX)
+            size += SLAB_ALIGNMENT;
+        else
+            size = (size_t)(size * SLAB_GROWTH_FACTOR + SLAB_ALIGNMENT - 1) & ~(size_t)(SLAB_ALIGNMENT - 1);
+    }
+}
+
+/**
+ * @brief Finds the smallest class whose chunks fit a request.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param size Requested size, at most SLAB_MAX_CHUNK.
+ * @return The class.
+ */
+static SlabClass *class_for_size(SlabAllocator *slabs, size_t size)
+{
+    size_t low = 0, high = slabs->class_count - 1;
+
+    while (low < high)
+    {
+        size_t mid = (low + high) / 2;
+        if (slabs->classes[mid].chunk_size < size)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &slabs->classes[low];
+}
+
+/**
+ * @brief Adds a page to a class.
+ * @param class Pointer to the SlabClass.
+ * @return true on success, false on allocation failure.
+ */
+static bool add_page(SlabClass *class)
+{
+    if (class->page_count == class->page_cap)
+    {
+        size_t new_cap = class->page_cap ? class->page_cap * 2 : 4;
+        void **new_pages = realloc(class->pages, new_cap * sizeof(void *));
+        if (!new_pages)
+            return false;
+
+        class->pages = new_pages;
+        class->page_cap = new_cap;
+    }
+
+    char *page = malloc(class->chunk_size * class->chunks_per_page);
+    if (!page)
+        return false;
+
+    class->pages[class->page_count++] = page;
+    class->page_cursor = page;
+    class->page_left = class->chunks_per_page;
+    return true;
+}
+
+/**
+ * @brief Allocates a chunk from the matching class, or a large block from malloc.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param size Requested size.
+ * @param block_size Receives the usable size.
+ * @return The block, or NULL on allocation failure.
+ */
+void *slab_alloc(SlabAllocator *slabs, size_t size, size_t *block_size)
+{
+    if (size > SLAB_MAX_CHUNK)
+    {
+        void *block = malloc(size);
+        if (!block)
+            return NULL;
+
+        slabs->large_count++;
+        slabs->large_bytes += size;
+        *block_size = size;
+        return block;
+    }
+
+    SlabClass *class = class_for_size(slabs, size);
+    void *chunk = class->free_list;
+
+    if (chunk)
+    {
+        memcpy(&class->free_list, chunk, sizeof(void *));
+    }
+    else
+    {
+        if (class->page_left == 0 && !add_page(class))
+            return NULL;
+
+        chunk = class->page_cursor;
+        class->page_cursor += class->chunk_size;
+        class->page_left--;
+    }
+
+    class->used_chunks++;
+    class->requested_bytes += size;
+    *block_size = class->chunk_size;
+    return chunk;
+}
+
+/**
+ * @brief Returns the chunk size of the class serving a request.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param size Requested size.
+ * @return The usable size.
+ */
+size_t slab_block_size(SlabAllocator *slabs, size_t size)
+{
+    return size > SLAB_MAX_CHUNK ? size : class_for_size(slabs, size)->chunk_size;
+}
+
+/**
+ * @brief Pushes a chunk onto its class free list, or frees a large block.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param block The block.
+ * @param block_size Usable size of the block.
+ * @param size Bytes the block is accounted for.
+ */
+void slab_free(SlabAllocator *slabs, void *block, size_t block_size, size_t size)
+{
+    if (block_size > SLAB_MAX_CHUNK)
+    {
+        slabs->large_count--;
+        slabs->large_bytes -= block_size;
+        free(block);
+        return;
+    }
+
+    SlabClass *class = class_for_size(slabs, block_size);
+    memcpy(block, &class->free_list, sizeof(void *));
+    class->free_list = block;
+    class->used_chunks--;
+    class->requested_bytes -= size;
+}
+
+/**
+ * @brief Moves the requested byte count of a live chunk.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param block_size Usable size of the block.
+ * @param old_size Previous accounted size.
+ * @param new_size New accounted size.
+ */
+void slab_resize_in_place(SlabAllocator *slabs, size_t block_size, size_t old_size, size_t new_size)
+{
+    if (block_size > SLAB_MAX_CHUNK)
+        return;
+
+    SlabClass *class = class_for_size(slabs, block_size);
+    class->requested_bytes = class->requested_bytes - old_size + new_size;
+}
+
+/**
+ * @brief Fills in the accounting of a class.
+ * @param slabs Pointer to the SlabAllocator.
+ * @param index Class index; `class_count` selects large allocations.
+ * @param stats Receives the accounting.
+ */
+void slab_class_stats(const SlabAllocator *slabs, size_t index, SlabClassStats *stats)
+{
+    if (index >= slabs->class_count)
+    {
+        stats->chunk_size = 0;
+        stats->used_chunks = slabs->large_count;
+        stats->total_chunks = slabs->large_count;
+        stats->requested_bytes = slabs->large_bytes;
+        stats->allocated_bytes = slabs->large_bytes;
+        return;
+    }
+
+    const SlabClass *class = &slabs->classes[index];
+    stats->chunk_size = class->chunk_size;
+    stats->used_chunks = class->used_chunks;
+    stats->total_chunks = class->page_count * class->chunks_per_page;
+    stats->requested_bytes = class->requested_bytes;
+    stats->allocated_bytes = stats->total_chunks * class->chunk_size;
+}
+
+/**
+ * @brief Frees all pages.
+ * @param slabs Pointer to the SlabAllocator.
+ */
+void slab_destroy(SlabAllocator *slabs)
+{
+    for (size_t i = 0; i < slabs->class_count; i++)
+    {
+        for (size_t p = 0; p < slabs->classes[i].page_count; p++)
+            free(slabs->classes[i].pages[p]);
+
+        free(slabs->classes[i].pages);
+    }
+
+    memset(slabs, 0, sizeof(*slabs));
+}
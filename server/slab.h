@@ -0,0 +1,126 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SLAB_CLASS_COUNT 48 /** Maximum number of size classes */
+
+/**
+ * @brief Free list and accounting of one size class.
+ *
+ * Chunks are carved from pages of the same class and recycled through an
+ * intrusive free list; pages are kept for the lifetime of the allocator.
+ */
+typedef struct
+{
+    size_t chunk_size;      /** Size of every chunk in the class */
+    size_t chunks_per_page; /** Number of chunks carved from one page */
+    void *free_list;        /** Chunks ready for reuse, linked through their first word */
+    char *page_cursor;      /** Next uncarved chunk of the newest page */
+    size_t page_left;       /** Uncarved chunks left in the newest page */
+    void **pages;           /** Pages owned by the class */
+    size_t page_count;      /** Number of pages in use */
+    size_t page_cap;        /** Capacity of the `pages` array */
+    size_t used_chunks;     /** Chunks currently handed out */
+    size_t requested_bytes; /** Bytes actually needed by the live chunks */
+} SlabClass;
+
+/**
+ * @brief Size-class allocator for hashmap entries.
+ *
+ * Requests are rounded up to the nearest class. Classes are 8 bytes apart
+ * up to 128 bytes and grow by a factor of 1.25 from there. Anything larger than the biggest class goes straight to `malloc`
+ * and is only accounted for. The allocator is not thread-safe; each shard
+ * owns one and uses it under the shard lock.
+ */
+typedef struct
+{
+    SlabClass classes[SLAB_CLASS_COUNT]; /** Size classes, smallest first */
+    size_t class_count;                  /** Number of classes in use */
+    size_t large_count;                  /** Live allocations bigger than every class */
+    size_t large_bytes;                  /** Bytes held by those allocations */
+} SlabAllocator;
+
+/**
+ * @brief Memory accounting of one size class (or of large allocations).
+ */
+typedef struct
+{
+    size_t chunk_size;      /** Chunk size of the class, 0 for large allocations */
+    size_t used_chunks;     /** Chunks currently handed out */
+    size_t total_chunks;    /** Chunks carved or carvable from the allocated pages */
+    size_t requested_bytes; /** Bytes needed by the live chunks */
+    size_t allocated_bytes; /** Bytes of the pages owned by the class */
+} SlabClassStats;
+
+/**
+ * @brief Initializes an allocator with no pages.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ */
+void slab_init(SlabAllocator *slabs);
+
+/**
+ * @brief Allocates a block of at least `size` bytes.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ * @param size Number of bytes needed.
+ * @param block_size Receives the usable size of the block.
+ * @return Pointer to the block, or NULL if allocation fails.
+ */
+void *slab_alloc(SlabAllocator *slabs, size_t size, size_t *block_size);
+
+/**
+ * @brief Returns the usable size `slab_alloc` hands out for a request.
+ *
+ * Lets callers recompute the size of a block from what they stored in it
+ * instead of keeping it next to the data.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ * @param size Number of bytes needed.
+ * @return The usable size of a block for that request.
+ */
+size_t slab_block_size(SlabAllocator *slabs, size_t size);
+
+/**
+ * @brief Returns a block to its size class.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ * @param block Pointer returned by `slab_alloc`.
+ * @param block_size Usable size reported by `slab_alloc`.
+ * @param size Number of bytes the block was last accounted for.
+ */
+void slab_free(SlabAllocator *slabs, void *block, size_t block_size, size_t size);
+
+/**
+ * @brief Updates the accounting of a block that was rewritten in place.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ * @param block_size Usable size of the block.
+ * @param old_size Bytes the block was accounted for until now.
+ * @param new_size Bytes the block holds now.
+ */
+void slab_resize_in_place(SlabAllocator *slabs, size_t block_size, size_t old_size, size_t new_size);
+
+/**
+ * @brief Reports the accounting of one class.
+ *
+ * Index `class_count` reports allocations larger than every class.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ * @param index Class index, up to and including `class_count`.
+ * @param stats Receives the accounting.
+ */
+void slab_class_stats(const SlabAllocator *slabs, size_t index, SlabClassStats *stats);
+
+/**
+ * @brief Releases every page of the allocator.
+ *
+ * Large allocations must have been freed by the caller already.
+ *
+ * @param slabs Pointer to the SlabAllocator.
+ */
+void slab_destroy(SlabAllocator *slabs);
+
+#endif // SLAB_H
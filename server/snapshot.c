@@ -0,0 +1,599 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "store.h"
+#include "logger.h"
+#include "utils.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "CEPSNAP1"            /** First bytes of every snapshot */
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BLOCK_SIZE (256 * 1024)      /** Payload size at which a block is closed */
+#define SNAPSHOT_SCAN_BUCKETS 256             /** Buckets visited per shard lock while saving */
+#define SNAPSHOT_MAX_LOAD_THREADS 16          /** Upper bound for the threads loading a snapshot */
+
+/*
+ * A snapshot is a header followed by blocks of entries. All integers are
+ * stored in host byte order, which is little-endian on every target the
+ * server builds for.
+ *
+ *   header:  SnapshotHeader
+ *   block:   SnapshotBlock, then `payload_len` bytes of entries
+ *   entry:   SnapshotEntry, then the key bytes, then the value bytes
+ *
+ * Every block carries a CRC-32C of its payload, so blocks can be checked
+ * and loaded independently of each other.
+ */
+
+/**
+ * @brief Header at the start of a snapshot.
+ */
+typedef struct
+{
+    char magic[8];       /** SNAPSHOT_MAGIC */
+    uint64_t keys;       /** Entries in all blocks */
+    uint64_t blocks;     /** Number of blocks */
+    uint64_t created_ms; /** Unix time in milliseconds at which the snapshot was started */
+    uint32_t version;    /** SNAPSHOT_VERSION */
+    uint32_t crc;        /** CRC-32C of the preceding header bytes */
+} SnapshotHeader;
+
+/**
+ * @brief Header of a block of entries.
+ */
+typedef struct
+{
+    uint32_t payload_len; /** Bytes of entries following the header */
+    uint32_t entries;     /** Number of entries in the block */
+    uint32_t crc;         /** CRC-32C of the payload */
+    uint32_t reserved;    /** Zero */
+} SnapshotBlock;
+
+/**
+ * @brief Header of one key-value pair.
+ */
+typedef struct
+{
+    uint32_t key_len;   /** Length of the key */
+    uint32_t value_len; /** Length of the value */
+    uint64_t expire_at; /** Unix time in milliseconds at which the key expires, 0 for never */
+} SnapshotEntry;
+
+/**
+ * @brief Block being assembled by a save.
+ */
+typedef struct
+{
+    char *data;       /** Block header followed by the payload */
+    size_t len;       /** Bytes used, including the block header */
+    size_t cap;       /** Bytes allocated */
+    uint32_t entries; /** Entries in the block */
+    bool failed;      /** True if the buffer could not grow */
+} SnapshotWriter;
+
+/**
+ * @brief State shared by the threads loading a snapshot.
+ */
+typedef struct
+{
+    const char *data;         /** The mapped snapshot */
+    const size_t *offsets;    /** File offset of every block */
+    size_t blocks;            /** Number of blocks */
+    size_t next_block;        /** Next block to claim, advanced atomically */
+    uint64_t now;             /** Time against which expiry is checked */
+    size_t loaded;            /** Keys inserted, summed atomically */
+    size_t expired;           /** Keys skipped because they expired, summed atomically */
+    bool failed;              /** Set when a block is damaged */
+} SnapshotLoader;
+
+static char *snapshot_path = NULL;
+static unsigned int snapshot_interval = 0;
+
+// Guarded by `lock`
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static bool saving = false;
+static uint64_t save_count = 0;
+static uint64_t failure_count = 0;
+static uint64_t last_save_ms = 0;
+static uint64_t last_keys = 0;
+static uint64_t last_bytes = 0;
+static uint64_t last_duration_ms = 0;
+
+/**
+ * @brief Returns the milliseconds elapsed on the monotonic clock since a start time.
+ */
+static uint64_t elapsed_ms(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Checks one block and inserts its entries.
+ * @param loader The shared load state.
+ * @param offset File offset of the block.
+ * @return true on success, false if the block is damaged.
+ */
+static bool load_block(SnapshotLoader *loader, size_t offset)
+{
+    SnapshotBlock block;
+    memcpy(&block, loader->data + offset, sizeof(block));
+
+    const char *payload = loader->data + offset + sizeof(block);
+    if (crc32c(0, payload, block.payload_len) != block.crc)
+        return false;
+
+    const char *cursor = payload;
+    const char *end = payload + block.payload_len;
+    size_t loaded = 0;
+    size_t expired = 0;
+
+    for (uint32_t i = 0; i < block.entries; i++)
+    {
+        SnapshotEntry entry;
+        if ((size_t)(end - cursor) < sizeof(entry))
+            return false;
+
+        memcpy(&entry, cursor, sizeof(entry));
+        cursor += sizeof(entry);
+
+        if ((size_t)(end - cursor) < (size_t)entry.key_len + entry.value_len)
+            return false;
+
+        const char *key = cursor;
+        const char *value = cursor + entry.key_len;
+        cursor += (size_t)entry.key_len + entry.value_len;
+
+        if (entry.expire_at && entry.expire_at <= loader->now)
+        {
+            expired++;
+            continue;
+        }
+
+        StoreShard *shard = store_shard_for_key(key, entry.key_len);
+        pthread_mutex_lock(&shard->lock);
+        bool success = hash_map_set(shard->map, key, entry.key_len, value, entry.value_len, entry.expire_at);
+        pthread_mutex_unlock(&shard->lock);
+
+        if (success)
+            loaded++;
+        else
+            log_warn("Snapshot: could not load key '%.*s'", (int)entry.key_len, key);
+    }
+
+    __atomic_fetch_add(&loader->loaded, loaded, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&loader->expired, expired, __ATOMIC_RELAXED);
+    return cursor == end;
+}
+
+/**
+ * @brief Body of a loader thread: claims blocks until none are left.
+ */
+static void *load_main(void *arg)
+{
+    SnapshotLoader *loader = arg;
+
+    while (!__atomic_load_n(&loader->failed, __ATOMIC_RELAXED))
+    {
+        size_t index = __atomic_fetch_add(&loader->next_block, 1, __ATOMIC_RELAXED);
+        if (index >= loader->blocks)
+            break;
+
+        if (!load_block(loader, loader->offsets[index]))
+        {
+            log_error("Snapshot: block %zu at offset %zu is damaged", index, loader->offsets[index]);
+            __atomic_store_n(&loader->failed, true, __ATOMIC_RELAXED);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Checks the header and finds every block of a mapped snapshot.
+ * @param data The mapped file.
+ * @param size Size of the file.
+ * @param header Receives the header.
+ * @return The block offsets, or NULL if the file is damaged; the caller frees them.
+ */
+static size_t *index_blocks(const char *data, size_t size, SnapshotHeader *header)
+{
+    if (size < sizeof(*header))
+        return NULL;
+
+    memcpy(header, data, sizeof(*header));
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        crc32c(0, header, offsetof(SnapshotHeader, crc)) != header->crc)
+        return NULL;
+
+    // Every block takes at least its header, which bounds a corrupt count
+    if (header->blocks > (size - sizeof(*header)) / sizeof(SnapshotBlock))
+        return NULL;
+
+    size_t *offsets = malloc((header->blocks ? header->blocks : 1) * sizeof(size_t));
+    if (!offsets)
+        return NULL;
+
+    size_t offset = sizeof(*header);
+    uint64_t found = 0;
+    for (; found < header->blocks; found++)
+    {
+        SnapshotBlock block;
+        if (size - offset < sizeof(block))
+            break;
+
+        memcpy(&block, data + offset, sizeof(block));
+        if (size - offset - sizeof(block) < block.payload_len)
+            break;
+
+        offsets[found] = offset;
+        offset += sizeof(block) + block.payload_len;
+    }
+
+    if (found != header->blocks || offset != size)
+    {
+        free(offsets);
+        return NULL;
+    }
+
+    return offsets;
+}
+
+/**
+ * @brief Maps a snapshot and loads it with several threads.
+ * @param path Path of the snapshot.
+ * @return true if it was loaded or does not exist.
+ */
+bool snapshot_load(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno == ENOENT)
+            return true;
+
+        perror("open snapshot");
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("fstat snapshot");
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    char *data = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        log_error("Snapshot: could not map %s", path);
+        return false;
+    }
+    madvise(data, size, MADV_WILLNEED);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    SnapshotHeader header;
+    size_t *offsets = index_blocks(data, size, &header);
+    if (!offsets)
+    {
+        log_error("Snapshot: %s is damaged", path);
+        munmap(data, size);
+        return false;
+    }
+
+    // Keys spread evenly over the shards, so each table is sized for its share plus some slack
+    size_t shard_count = store_shard_count();
+    size_t per_shard = header.keys / shard_count;
+    for (size_t i = 0; i < shard_count; i++)
+        hash_map_reserve(store_shard_at(i)->map, per_shard + per_shard / 8 + 16);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t thread_count = cpus > 0 ? (size_t)cpus : 1;
+    if (thread_count > SNAPSHOT_MAX_LOAD_THREADS)
+        thread_count = SNAPSHOT_MAX_LOAD_THREADS;
+    if (thread_count > header.blocks)
+        thread_count = header.blocks ? header.blocks : 1;
+
+    SnapshotLoader loader = {data, offsets, header.blocks, 0, current_time_ms(), 0, 0, false};
+    pthread_t threads[SNAPSHOT_MAX_LOAD_THREADS];
+    size_t started = 0;
+
+    // The calling thread loads too, so a failed pthread_create only slows the load down
+    for (size_t i = 1; i < thread_count; i++)
+    {
+        if (pthread_create(&threads[started], NULL, load_main, &loader) == 0)
+            started++;
+    }
+
+    load_main(&loader);
+
+    for (size_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(offsets);
+    munmap(data, size);
+
+    if (loader.failed)
+        return false;
+
+    log_info("Snapshot: loaded %zu keys from %s in %llu ms with %zu threads (%zu expired)",
+             loader.loaded, path, (unsigned long long)elapsed_ms(&start), started + 1, loader.expired);
+    return true;
+}
+
+/**
+ * @brief Makes room in the block being assembled.
+ * @return true on success, false if the buffer could not grow.
+ */
+static bool writer_reserve(SnapshotWriter *writer, size_t extra)
+{
+    if (writer->len + extra <= writer->cap)
+        return true;
+
+    size_t cap = writer->cap ? writer->cap : SNAPSHOT_BLOCK_SIZE + sizeof(SnapshotBlock);
+    while (cap < writer->len + extra)
+        cap *= 2;
+
+    char *data = realloc(writer->data, cap);
+    if (!data)
+        return false;
+
+    writer->data = data;
+    writer->cap = cap;
+    return true;
+}
+
+/**
+ * @brief Appends one pair to the block being assembled.
+ * @return true while the buffer could grow.
+ */
+static bool save_pair(const char *key, size_t key_len, const char *value, size_t value_len, uint64_t expire_at, void *ctx)
+{
+    SnapshotWriter *writer = ctx;
+    SnapshotEntry entry = {(uint32_t)key_len, (uint32_t)value_len, expire_at};
+
+    if (!writer_reserve(writer, sizeof(entry) + key_len + value_len))
+    {
+        writer->failed = true;
+        errno = ENOMEM;
+        return false;
+    }
+
+    memcpy(writer->data + writer->len, &entry, sizeof(entry));
+    memcpy(writer->data + writer->len + sizeof(entry), key, key_len);
+    memcpy(writer->data + writer->len + sizeof(entry) + key_len, value, value_len);
+    writer->len += sizeof(entry) + key_len + value_len;
+    writer->entries++;
+    return true;
+}
+
+/**
+ * @brief Fills in the header of the block being assembled and writes it out.
+ * @param writer The block.
+ * @param fd The snapshot being written.
+ * @return true on success, false with `errno` set on failure.
+ */
+static bool flush_block(SnapshotWriter *writer, int fd)
+{
+    SnapshotBlock block = {0};
+    block.payload_len = (uint32_t)(writer->len - sizeof(block));
+    block.entries = writer->entries;
+    block.crc = crc32c(0, writer->data + sizeof(block), block.payload_len);
+    memcpy(writer->data, &block, sizeof(block));
+
+    bool success = write_all(fd, writer->data, writer->len);
+
+    writer->len = sizeof(block);
+    writer->entries = 0;
+    return success;
+}
+
+/**
+ * @brief Body of the save thread.
+ *
+ * Walks the keyspace into blocks, writes the header last and renames the
+ * finished file over the previous snapshot.
+ */
+static void *save_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "snapshot-save");
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    size_t path_len = strlen(snapshot_path) + sizeof(".tmp");
+    char *path = malloc(path_len);
+    if (path)
+        snprintf(path, path_len, "%s.tmp", snapshot_path);
+
+    int fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    SnapshotWriter writer = {0};
+    SnapshotHeader header = {0};
+    uint64_t bytes = sizeof(header);
+
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.created_ms = current_time_ms();
+
+    // The header is written last, once the counts are known
+    bool success = fd != -1 && writer_reserve(&writer, sizeof(SnapshotBlock)) &&
+                   lseek(fd, sizeof(header), SEEK_SET) == (off_t)sizeof(header);
+    writer.len = sizeof(SnapshotBlock);
+
+    size_t cursor = 0;
+    while (success)
+    {
+        cursor = store_scan(cursor, SNAPSHOT_SCAN_BUCKETS, save_pair, &writer);
+        if (writer.failed)
+        {
+            success = false;
+            break;
+        }
+
+        if (writer.entries > 0 && (writer.len >= SNAPSHOT_BLOCK_SIZE || cursor == 0))
+        {
+            header.keys += writer.entries;
+            header.blocks++;
+            bytes += writer.len;
+            success = flush_block(&writer, fd);
+        }
+
+        if (cursor == 0)
+            break;
+    }
+
+    header.crc = crc32c(0, &header, offsetof(SnapshotHeader, crc));
+
+    success = success && pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+              fdatasync(fd) == 0 && rename(path, snapshot_path) == 0;
+
+    if (success)
+        fsync_parent_directory(snapshot_path);
+    else
+        log_error("Snapshot: could not write %s: %s", snapshot_path, strerror(errno));
+
+    if (fd != -1)
+        close(fd);
+    if (!success && path)
+        unlink(path);
+
+    uint64_t duration = elapsed_ms(&start);
+
+    pthread_mutex_lock(&lock);
+    saving = false;
+    if (success)
+    {
+        save_count++;
+        last_save_ms = header.created_ms;
+        last_keys = header.keys;
+        last_bytes = bytes;
+        last_duration_ms = duration;
+    }
+    else
+    {
+        failure_count++;
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (success)
+        log_info("Snapshot: saved %llu keys (%llu bytes) to %s in %llu ms",
+                 (unsigned long long)header.keys, (unsigned long long)bytes, snapshot_path,
+                 (unsigned long long)duration);
+
+    free(writer.data);
+    free(path);
+    return NULL;
+}
+
+/**
+ * @brief Starts a save on a background thread.
+ * @return true if one was started.
+ */
+bool snapshot_save_async(void)
+{
+    if (!snapshot_path)
+        return false;
+
+    pthread_mutex_lock(&lock);
+    if (saving)
+    {
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    saving = true;
+    pthread_mutex_unlock(&lock);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, save_main, NULL) != 0)
+    {
+        perror("pthread_create snapshot");
+        pthread_mutex_lock(&lock);
+        saving = false;
+        pthread_mutex_unlock(&lock);
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+/**
+ * @brief Body of the scheduler thread taking the periodic snapshots.
+ */
+static void *schedule_main(void *arg)
+{
+    (void)arg;
+    pthread_setname_np(pthread_self(), "snapshot");
+
+    for (;;)
+    {
+        struct timespec interval = {snapshot_interval, 0};
+        while (nanosleep(&interval, &interval) == -1 && errno == EINTR)
+            ;
+
+        snapshot_save_async();
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Sets the snapshot path and starts the scheduler thread.
+ * @param path Path of the snapshot.
+ * @param interval Seconds between snapshots, 0 for none.
+ * @return true on success.
+ */
+bool initialize_snapshot(const char *path, unsigned int interval)
+{
+    snapshot_path = strdup(path);
+    if (!snapshot_path)
+        return false;
+
+    snapshot_interval = interval;
+    if (interval == 0)
+        return true;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, schedule_main, NULL) != 0)
+    {
+        perror("pthread_create snapshot scheduler");
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+/**
+ * @brief Reports the state of snapshots.
+ * @param stats Receives the figures.
+ */
+void snapshot_stats(SnapshotStats *stats)
+{
+    pthread_mutex_lock(&lock);
+    stats->enabled = snapshot_path != NULL;
+    stats->interval = snapshot_interval;
+    stats->in_progress = saving;
+    stats->saves = save_count;
+    stats->failures = failure_count;
+    stats->last_save_ms = last_save_ms;
+    stats->last_keys = last_keys;
+    stats->last_bytes = last_bytes;
+    stats->last_duration_ms = last_duration_ms;
+    pthread_mutex_unlock(&lock);
+}
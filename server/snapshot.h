@@ -0,0 +1,70 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Figures reported by INFO about snapshots.
+ */
+typedef struct
+{
+    bool enabled;               /** Whether a snapshot file is configured */
+    unsigned int interval;      /** Seconds between periodic snapshots, 0 if only BGSAVE takes them */
+    bool in_progress;           /** Whether a snapshot is being written */
+    uint64_t saves;             /** Snapshots written */
+    uint64_t failures;          /** Snapshots that could not be written */
+    uint64_t last_save_ms;      /** Unix time in milliseconds of the last written snapshot, 0 if none */
+    uint64_t last_keys;         /** Keys in the last written snapshot */
+    uint64_t last_bytes;        /** Size of the last written snapshot */
+    uint64_t last_duration_ms;  /** Time taken by the last written snapshot */
+} SnapshotStats;
+
+/**
+ * @brief Loads a snapshot into the store.
+ *
+ * The file is mapped into memory and checked block by block while loader
+ * threads insert the keys directly into their shards, whose tables are
+ * grown up front to the final key count so the load never resizes. Keys
+ * whose time to live ran out since the snapshot was taken are skipped.
+ *
+ * Must be called before any worker starts.
+ *
+ * @param path Path of the snapshot.
+ * @return True if the snapshot was loaded or does not exist, false if it is
+ *         damaged or could not be read.
+ */
+bool snapshot_load(const char *path);
+
+/**
+ * @brief Configures where snapshots are written and starts the periodic ones.
+ *
+ * @param path Path of the snapshot; new snapshots are written next to it and
+ *             renamed over it once complete.
+ * @param interval Seconds between periodic snapshots, 0 to only take them on BGSAVE.
+ * @return True on success, false if the path could not be stored or the
+ *         scheduler thread could not be started.
+ */
+bool initialize_snapshot(const char *path, unsigned int interval);
+
+/**
+ * @brief Starts writing a snapshot on a background thread.
+ *
+ * The keyspace is walked a few buckets per shard lock, so event loops keep
+ * serving requests. The snapshot is not a single point in time: every key
+ * is recorded as it was when its bucket was visited.
+ *
+ * @return True if a snapshot was started, false if snapshots are not
+ *         configured or one is already being written.
+ */
+bool snapshot_save_async(void);
+
+/**
+ * @brief Reports the state of snapshots.
+ *
+ * @param stats Receives the figures.
+ */
+void snapshot_stats(SnapshotStats *stats);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,375 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "stats.h"
+
+#define CALIBRATION_NS 20000000 /** Time spent measuring the tick rate at startup */
+
+/**
+ * @brief Log-linear latency histogram of one command type.
+ *
+ * Values below LATENCY_SUB_BUCKETS ticks get a bucket each; above that,
+ * every power of two is split into LATENCY_SUB_BUCKETS equal buckets, so
+ * the relative error stays bounded whatever the magnitude (HDR style).
+ */
+typedef struct
+{
+    _Atomic uint64_t counts[LATENCY_BUCKET_COUNT]; /** Samples per bucket */
+    _Atomic uint64_t max;                          /** Largest sample in ticks */
+} LatencyHistogram;
+
+/**
+ * @brief Counters owned by one worker thread.
+ *
+ * Only the owning worker writes them, with plain relaxed loads and stores,
+ * so INFO can read them from another thread without slowing the hot path
+ * down with locked instructions.
+ */
+typedef struct
+{
+    LatencyHistogram latency[CMD_TYPE_COUNT]; /** Per command type */
+    _Atomic uint64_t invalid_commands;        /** Commands that were not recognized */
+    _Atomic uint64_t bytes_in;                /** Bytes read from clients */
+    _Atomic uint64_t bytes_out;               /** Bytes written to clients */
+    _Atomic uint64_t syscalls;                /** System calls made by the event loop */
+    _Atomic uint64_t epoll_wakeups;           /** `epoll_wait` calls that returned events */
+    _Atomic uint64_t events;                  /** Events returned by those calls */
+    _Atomic uint64_t max_events;              /** Largest event batch */
+} WorkerStats;
+
+static WorkerStats *worker_stats = NULL;
+static size_t worker_stats_count = 0;
+static double ticks_per_us = 1000.0;
+static struct timespec start_time;
+
+static atomic_uint_fast64_t total_clients_connected = 0;
+static atomic_uint_fast64_t active_clients = 0;
+static atomic_uint_fast64_t timed_out_clients = 0;
+
+static __thread WorkerStats *local_stats = NULL; /** Counters of the worker running on the calling thread */
+
+/**
+ * @brief Adds to a counter owned by the calling thread.
+ */
+static inline void counter_add(_Atomic uint64_t *counter, uint64_t amount)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+/**
+ * @brief Raises a maximum owned by the calling thread.
+ */
+static inline void counter_max(_Atomic uint64_t *counter, uint64_t value)
+{
+    if (value > atomic_load_explicit(counter, memory_order_relaxed))
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+/**
+ * @brief Reads a counter written by another thread.
+ */
+static inline uint64_t counter_get(_Atomic uint64_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the nanoseconds elapsed since a point in time.
+ */
+static double elapsed_ns(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e9 + (now.tv_nsec - since->tv_nsec);
+}
+
+/**
+ * @brief Measures how many ticks of `stats_now()` make a microsecond.
+ *
+ * The TSC rate is not reported by the kernel, so it is compared against
+ * `CLOCK_MONOTONIC` over a short busy wait.
+ */
+static void calibrate_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    uint64_t first = stats_now();
+
+    double ns;
+    while ((ns = elapsed_ns(&begin)) < CALIBRATION_NS)
+        ;
+
+    ticks_per_us = (stats_now() - first) * 1000.0 / ns;
+#endif
+}
+
+/**
+ * @brief Allocates the counters of every worker.
+ * @param worker_count Number of worker threads.
+ * @return true on success, false on allocation failure.
+ */
+bool initialize_stats(size_t worker_count)
+{
+    worker_stats = calloc(worker_count, sizeof(WorkerStats));
+    if (!worker_stats)
+        return false;
+
+    worker_stats_count = worker_count;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    calibrate_ticks();
+    return true;
+}
+
+/**
+ * @brief Selects the counters the calling thread records into.
+ * @param worker_id Index of the worker.
+ */
+void stats_attach_worker(size_t worker_id)
+{
+    local_stats = &worker_stats[worker_id];
+}
+
+/**
+ * @brief Maps a latency in ticks to its histogram bucket.
+ * @param ticks The latency.
+ * @return The bucket index.
+ */
+static inline size_t latency_bucket(uint64_t ticks)
+{
+    if (ticks < LATENCY_SUB_BUCKETS)
+        return ticks;
+
+    size_t exponent = 63 - __builtin_clzll(ticks);
+    if (exponent >= LATENCY_MAX_EXPONENT)
+        return LATENCY_BUCKET_COUNT - 1;
+
+    size_t sub_bucket = (ticks >> (exponent - 4)) & (LATENCY_SUB_BUCKETS - 1);
+    return (exponent - 3) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+/**
+ * @brief Returns the largest latency that falls into a bucket.
+ * @param bucket The bucket index.
+ * @return The upper bound in ticks.
+ */
+static inline uint64_t bucket_upper_bound(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS)
+        return bucket;
+
+    size_t exponent = bucket / LATENCY_SUB_BUCKETS + 3;
+    size_t sub_bucket = bucket % LATENCY_SUB_BUCKETS;
+    uint64_t lower = (uint64_t)(LATENCY_SUB_BUCKETS + sub_bucket) << (exponent - 4);
+    return lower + ((uint64_t)1 << (exponent - 4)) - 1;
+}
+
+/**
+ * @brief Adds a command latency sample to the histogram of the calling worker.
+ * @param type The command type.
+ * @param start Tick count taken before the command ran.
+ */
+void stats_record_command(CommandType type, uint64_t start)
+{
+    if (type < 0 || type >= CMD_TYPE_COUNT)
+    {
+        counter_add(&local_stats->invalid_commands, 1);
+        return;
+    }
+
+    uint64_t ticks = stats_now() - start;
+    LatencyHistogram *histogram = &local_stats->latency[type];
+
+    counter_add(&histogram->counts[latency_bucket(ticks)], 1);
+    counter_max(&histogram->max, ticks);
+}
+
+/**
+ * @brief Counts a read and the bytes it returned.
+ * @param bytes Result of the read.
+ */
+void stats_count_read(ssize_t bytes)
+{
+    counter_add(&local_stats->syscalls, 1);
+    if (bytes > 0)
+        counter_add(&local_stats->bytes_in, bytes);
+}
+
+/**
+ * @brief Counts a write and the bytes it sent.
+ * @param bytes Result of the write.
+ */
+void stats_count_write(ssize_t bytes)
+{
+    counter_add(&local_stats->syscalls, 1);
+    if (bytes > 0)
+        counter_add(&local_stats->bytes_out, bytes);
+}
+
+/**
+ * @brief Counts received bytes.
+ * @param bytes Number of bytes.
+ */
+void stats_count_bytes_in(size_t bytes)
+{
+    counter_add(&local_stats->bytes_in, bytes);
+}
+
+/**
+ * @brief Counts sent bytes.
+ * @param bytes Number of bytes.
+ */
+void stats_count_bytes_out(size_t bytes)
+{
+    counter_add(&local_stats->bytes_out, bytes);
+}
+
+/**
+ * @brief Counts a system call.
+ */
+void stats_count_syscall(void)
+{
+    counter_add(&local_stats->syscalls, 1);
+}
+
+/**
+ * @brief Counts an `epoll_wait` call and its batch size.
+ * @param events Number of events returned.
+ */
+void stats_count_wakeup(int events)
+{
+    counter_add(&local_stats->syscalls, 1);
+
+    if (events > 0)
+    {
+        counter_add(&local_stats->epoll_wakeups, 1);
+        counter_add(&local_stats->events, events);
+        counter_max(&local_stats->max_events, events);
+    }
+}
+
+/**
+ * @brief Counts an accepted client.
+ */
+void stats_client_connected(void)
+{
+    atomic_fetch_add(&active_clients, 1);
+    atomic_fetch_add(&total_clients_connected, 1);
+}
+
+/**
+ * @brief Counts a closed client.
+ */
+void stats_client_disconnected(void)
+{
+    atomic_fetch_sub(&active_clients, 1);
+}
+
+/**
+ * @brief Counts a client closed for being idle.
+ */
+void stats_client_timed_out(void)
+{
+    atomic_fetch_add_explicit(&timed_out_clients, 1, memory_order_relaxed);
+}
+
+/**
+ * @brief Returns the number of open client connections.
+ * @return The connection count.
+ */
+uint64_t stats_active_clients(void)
+{
+    return atomic_load(&active_clients);
+}
+
+/**
+ * @brief Finds the smallest bucket bound covering a fraction of the samples.
+ * @param counts Merged bucket counts.
+ * @param total Number of samples.
+ * @param max The largest sample, which bounds the result.
+ * @param quantile The fraction, between 0 and 1.
+ * @return The latency in ticks.
+ */
+static uint64_t quantile_ticks(const uint64_t *counts, uint64_t total, uint64_t max, double quantile)
+{
+    uint64_t rank = (uint64_t)(quantile * total + 0.5);
+    uint64_t seen = 0;
+
+    if (rank == 0)
+        rank = 1;
+
+    size_t i;
+    for (i = 0; i < LATENCY_BUCKET_COUNT; i++)
+    {
+        seen += counts[i];
+        if (seen >= rank)
+            break;
+    }
+
+    uint64_t bound = bucket_upper_bound(i < LATENCY_BUCKET_COUNT ? i : LATENCY_BUCKET_COUNT - 1);
+    return bound < max ? bound : max;
+}
+
+/**
+ * @brief Merges the counters of all workers.
+ * @param snapshot Receives the totals.
+ */
+void stats_snapshot(StatsSnapshot *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->uptime_seconds = elapsed_ns(&start_time) / 1e9;
+    snapshot->workers = worker_stats_count;
+    snapshot->clients_connected = atomic_load(&active_clients);
+    snapshot->clients_total = atomic_load(&total_clients_connected);
+    snapshot->clients_timed_out = atomic_load(&timed_out_clients);
+
+    for (size_t w = 0; w < worker_stats_count; w++)
+    {
+        WorkerStats *stats = &worker_stats[w];
+        snapshot->commands += counter_get(&stats->invalid_commands);
+        snapshot->bytes_in += counter_get(&stats->bytes_in);
+        snapshot->bytes_out += counter_get(&stats->bytes_out);
+        snapshot->syscalls += counter_get(&stats->syscalls);
+        snapshot->epoll_wakeups += counter_get(&stats->epoll_wakeups);
+        snapshot->events += counter_get(&stats->events);
+
+        uint64_t max_events = counter_get(&stats->max_events);
+        if (max_events > snapshot->max_events_per_wakeup)
+            snapshot->max_events_per_wakeup = max_events;
+    }
+
+    uint64_t counts[LATENCY_BUCKET_COUNT];
+
+    for (int type = 0; type < CMD_TYPE_COUNT; type++)
+    {
+        CommandLatency *latency = &snapshot->latency[type];
+        uint64_t max = 0;
+
+        memset(counts, 0, sizeof(counts));
+
+        for (size_t w = 0; w < worker_stats_count; w++)
+        {
+            LatencyHistogram *histogram = &worker_stats[w].latency[type];
+
+            for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+                counts[i] += counter_get(&histogram->counts[i]);
+
+            uint64_t worker_max = counter_get(&histogram->max);
+            if (worker_max > max)
+                max = worker_max;
+        }
+
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT; i++)
+            latency->calls += counts[i];
+
+        snapshot->commands += latency->calls;
+
+        if (latency->calls == 0)
+            continue;
+
+        latency->p50_us = quantile_ticks(counts, latency->calls, max, 0.5) / ticks_per_us;
+        latency->p99_us = quantile_ticks(counts, latency->calls, max, 0.99) / ticks_per_us;
+        latency->p999_us = quantile_ticks(counts, latency->calls, max, 0.999) / ticks_per_us;
+        latency->max_us = max / ticks_per_us;
+    }
+}
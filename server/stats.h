@@ -0,0 +1,171 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "parser.h"
+
+#define LATENCY_SUB_BUCKETS 16   /** Histogram buckets per power of two (about 6% precision) */
+#define LATENCY_MAX_EXPONENT 44  /** Largest power of two tracked exactly; longer samples land in the last bucket */
+#define LATENCY_BUCKET_COUNT ((LATENCY_MAX_EXPONENT - 3) * LATENCY_SUB_BUCKETS)
+
+/**
+ * @brief Reads a cheap monotonic tick counter.
+ *
+ * On x86 this is the time stamp counter, elsewhere `CLOCK_MONOTONIC` in
+ * nanoseconds. Ticks are only converted to time when statistics are read.
+ *
+ * @return The current tick count.
+ */
+static inline uint64_t stats_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Latency summary of one command type, merged over all workers.
+ */
+typedef struct
+{
+    uint64_t calls; /** Number of executions */
+    double p50_us;  /** Median latency in microseconds */
+    double p99_us;  /** 99th percentile latency in microseconds */
+    double p999_us; /** 99.9th percentile latency in microseconds */
+    double max_us;  /** Largest latency in microseconds */
+} CommandLatency;
+
+/**
+ * @brief Point-in-time totals of the server counters, merged over all workers.
+ */
+typedef struct
+{
+    double uptime_seconds;          /** Time since `initialize_stats` */
+    size_t workers;                 /** Number of worker threads */
+    uint64_t clients_connected;     /** Currently open client connections */
+    uint64_t clients_total;         /** Connections accepted since startup */
+    uint64_t clients_timed_out;     /** Connections closed for exceeding the idle timeout */
+    uint64_t commands;              /** Commands executed */
+    uint64_t bytes_in;              /** Bytes read from clients */
+    uint64_t bytes_out;             /** Bytes written to clients */
+    uint64_t syscalls;              /** Socket and epoll system calls made by the event loops */
+    uint64_t epoll_wakeups;         /** `epoll_wait` calls that returned events */
+    uint64_t events;                /** Events returned by those calls */
+    uint64_t max_events_per_wakeup; /** Largest event batch */
+    CommandLatency latency[CMD_TYPE_COUNT]; /** Per command type, indexed by `CommandType` */
+} StatsSnapshot;
+
+/**
+ * @brief Allocates the per-worker counters and calibrates the tick counter.
+ *
+ * Must be called once, before any worker starts.
+ *
+ * @param worker_count Number of worker threads.
+ * @return True on success, false if allocation fails.
+ */
+bool initialize_stats(size_t worker_count);
+
+/**
+ * @brief Binds the calling thread to the counters of a worker.
+ *
+ * Counters are only ever written by their worker, so recording a sample
+ * needs no atomic read-modify-write.
+ *
+ * @param worker_id Index of the worker run by the calling thread.
+ */
+void stats_attach_worker(size_t worker_id);
+
+/**
+ * @brief Records the execution of a command.
+ *
+ * @param type The command type.
+ * @param start Tick count returned by `stats_now()` before the command ran.
+ */
+void stats_record_command(CommandType type, uint64_t start);
+
+/**
+ * @brief Counts a read system call and the bytes it returned.
+ *
+ * @param bytes Number of bytes read, or a negative value if the call failed.
+ */
+void stats_count_read(ssize_t bytes);
+
+/**
+ * @brief Counts a write system call and the bytes it sent.
+ *
+ * @param bytes Number of bytes written, or a negative value if the call failed.
+ */
+void stats_count_write(ssize_t bytes);
+
+/**
+ * @brief Counts bytes received without a read system call of their own (io_uring).
+ *
+ * @param bytes Number of bytes received.
+ */
+void stats_count_bytes_in(size_t bytes);
+
+/**
+ * @brief Counts bytes sent without a write system call of their own (io_uring).
+ *
+ * @param bytes Number of bytes sent.
+ */
+void stats_count_bytes_out(size_t bytes);
+
+/**
+ * @brief Counts a system call that moves no client data (`epoll_ctl`, `accept`, `close`).
+ */
+void stats_count_syscall(void);
+
+/**
+ * @brief Counts an `epoll_wait` call and the size of its event batch.
+ *
+ * @param events Number of events returned.
+ */
+void stats_count_wakeup(int events);
+
+/**
+ * @brief Counts a newly accepted client.
+ */
+void stats_client_connected(void);
+
+/**
+ * @brief Counts a closed client.
+ */
+void stats_client_disconnected(void);
+
+/**
+ * @brief Counts a client closed for exceeding the idle timeout.
+ *
+ * The close itself is still counted by `stats_client_disconnected`.
+ */
+void stats_client_timed_out(void);
+
+/**
+ * @brief Returns the number of open client connections.
+ *
+ * @return The connection count.
+ */
+uint64_t stats_active_clients(void);
+
+/**
+ * @brief Merges the counters and histograms of every worker.
+ *
+ * Safe to call from any thread while the workers keep running; the result
+ * may mix counter values from slightly different moments.
+ *
+ * @param snapshot Receives the totals.
+ */
+void stats_snapshot(StatsSnapshot *snapshot);
+
+#endif // STATS_H
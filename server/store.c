@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "hash.h"
+#include "utils.h"
+#include "store.h"
+
+#define EXPIRE_BATCH 64 /** Expired keys removed per shard lock */
+
+static StoreShard *shards = NULL;
+static size_t shard_mask = 0;
+static unsigned int shard_bits = 0;
+static size_t memory_limit = 0;
+static EvictionPolicy eviction_policy = EVICTION_LRU;
+
+/**
+ * @brief Allocates the shards and their hashmaps.
+ * @param shard_count Requested number of shards.
+ * @param capacity Initial bucket count of each shard.
+ * @return true on success, false on allocation failure.
+ */
+bool initialize_store(size_t shard_count, size_t capacity)
+{
+    initialize_hash_seed();
+
+    size_t count = 1;
+    while (count < shard_count)
+        count <<= 1;
+
+    shards = calloc(count, sizeof(StoreShard));
+    if (!shards)
+        return false;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        shards[i].map = create_hash_map(capacity);
+        if (!shards[i].map)
+            return false;
+
+        pthread_mutex_init(&shards[i].lock, NULL);
+    }
+
+    shard_mask = count - 1;
+    shard_bits = __builtin_ctzll(count);
+    return true;
+}
+
+/**
+ * @brief Maps a key to its shard.
+ *
+ * Uses the middle bits of the key hash; the hashmap uses the low bits for
+ * the slot index and the top bits for its control bytes.
+ *
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @return The shard owning the key.
+ */
+StoreShard *store_shard_for_key(const char *key, size_t key_len)
+{
+    return &shards[store_shard_index(hash_bytes(key, key_len))];
+}
+
+/**
+ * @brief Maps a key hash to a shard.
+ * @param hash Hash of the key.
+ * @return The shard index.
+ */
+size_t store_shard_index(uint64_t hash)
+{
+    return (hash >> 32) & shard_mask;
+}
+
+/**
+ * @brief Returns the number of shards.
+ * @return The shard count.
+ */
+size_t store_shard_count()
+{
+    return shard_mask + 1;
+}
+
+/**
+ * @brief Returns a shard by index.
+ * @param index The shard index.
+ * @return The shard.
+ */
+StoreShard *store_shard_at(size_t index)
+{
+    return &shards[index];
+}
+
+/**
+ * @brief Walks part of the keyspace.
+ *
+ * The shard index lives in the low bits of the cursor and the hashmap scan
+ * cursor of that shard in the remaining bits. Shards are walked one after
+ * the other, and a call never crosses into the next shard, so the shard
+ * lock is held for at most `max_buckets` buckets.
+ *
+ * @param cursor The keyspace cursor, 0 to start a walk.
+ * @param max_buckets Maximum number of buckets to visit.
+ * @param visitor Callback invoked for each pair.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return The next cursor, 0 once the whole keyspace was walked.
+ */
+size_t store_scan(size_t cursor, size_t max_buckets, HashMapVisitor visitor, void *ctx)
+{
+    size_t index = cursor & shard_mask;
+    size_t bucket = cursor >> shard_bits;
+    StoreShard *shard = &shards[index];
+    bool more;
+
+    pthread_mutex_lock(&shard->lock);
+    do
+    {
+        more = hash_map_scan(shard->map, &bucket, visitor, ctx);
+    } while (more && bucket != 0 && --max_buckets > 0);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (bucket != 0)
+        return (bucket << shard_bits) | index;
+
+    return index == shard_mask ? 0 : index + 1;
+}
+
+/**
+ * @brief Empties every shard, one shard lock at a time.
+ * @return true on success, false if a shard could not be emptied.
+ */
+bool store_clear(void)
+{
+    bool success = true;
+
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        success &= hash_map_clear(shards[i].map);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return success;
+}
+
+/**
+ * @brief Presizes every shard for its share of a key count.
+ * @param keys Keys expected in the whole keyspace.
+ * @return true on success, false if a table could not be allocated.
+ */
+bool store_reserve(size_t keys)
+{
+    size_t per_shard = keys / (shard_mask + 1);
+    bool success = true;
+
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        success &= hash_map_reserve(shards[i].map, per_shard + per_shard / 8 + 16);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return success;
+}
+
+/**
+ * @brief Splits a memory limit over the shards.
+ * @param max_memory Limit of the whole keyspace in bytes, 0 for none.
+ * @param policy Eviction policy of every shard.
+ */
+void store_set_memory_limit(size_t max_memory, EvictionPolicy policy)
+{
+    size_t shard_limit = max_memory / (shard_mask + 1);
+
+    // A tiny limit must still not read as "no limit"
+    if (max_memory > 0 && shard_limit == 0)
+        shard_limit = 1;
+
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        hash_map_set_memory_limit(shards[i].map, shard_limit, policy);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    memory_limit = max_memory;
+    eviction_policy = policy;
+}
+
+/**
+ * @brief Returns the configured memory limit.
+ * @param policy Receives the eviction policy.
+ * @return The limit in bytes, 0 for none.
+ */
+size_t store_memory_limit(EvictionPolicy *policy)
+{
+    *policy = eviction_policy;
+    return memory_limit;
+}
+
+/**
+ * @brief Lets GET read every shard without its lock.
+ */
+void store_enable_concurrent_reads(void)
+{
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        hash_map_enable_concurrent_reads(shards[i].map);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+}
+
+/**
+ * @brief Reads the monotonic clock.
+ * @return Microseconds since an arbitrary point.
+ */
+static uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @brief Runs one time-limited expiry sweep over the shards of a worker.
+ * @param worker_id Index of the calling worker.
+ * @param worker_count Number of workers.
+ * @param time_limit_us Time budget in microseconds.
+ * @return The number of keys removed.
+ */
+size_t store_expire_cycle(size_t worker_id, size_t worker_count, uint64_t time_limit_us)
+{
+    static __thread size_t next_shard = 0; /** Position among the worker's shards to resume from */
+
+    size_t shard_count = shard_mask + 1;
+    if (worker_id >= shard_count)
+        return 0;
+
+    size_t owned = (shard_count - worker_id + worker_count - 1) / worker_count;
+    uint64_t now = current_time_ms();
+    uint64_t deadline = monotonic_us() + time_limit_us;
+    size_t removed = 0;
+
+    for (size_t visited = 0; visited < owned; visited++)
+    {
+        size_t position = (next_shard + visited) % owned;
+        StoreShard *shard = &shards[worker_id + position * worker_count];
+        size_t batch;
+
+        do
+        {
+            pthread_mutex_lock(&shard->lock);
+            batch = hash_map_expire_due(shard->map, now, EXPIRE_BATCH);
+            hash_map_reclaim(shard->map);
+            pthread_mutex_unlock(&shard->lock);
+
+            removed += batch;
+
+            if (monotonic_us() >= deadline)
+            {
+                // Keys left in this shard are picked up first next time
+                next_shard = batch == EXPIRE_BATCH ? position : position + 1;
+                return removed;
+            }
+        } while (batch == EXPIRE_BATCH);
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Aggregates slab statistics over all shards.
+ * @param stats Receives one entry per class plus one for large allocations.
+ * @return The number of classes.
+ */
+size_t store_slab_stats(SlabClassStats *stats)
+{
+    memset(stats, 0, (SLAB_CLASS_COUNT + 1) * sizeof(SlabClassStats));
+    size_t class_count = 0;
+
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        SlabAllocator *slabs = &shards[i].map->slabs;
+        class_count = slabs->class_count;
+
+        for (size_t c = 0; c <= class_count; c++)
+        {
+            SlabClassStats class_stats;
+            slab_class_stats(slabs, c, &class_stats);
+
+            SlabClassStats *total = &stats[c < class_count ? c : SLAB_CLASS_COUNT];
+            total->chunk_size = class_stats.chunk_size;
+            total->used_chunks += class_stats.used_chunks;
+            total->total_chunks += class_stats.total_chunks;
+            total->requested_bytes += class_stats.requested_bytes;
+            total->allocated_bytes += class_stats.allocated_bytes;
+        }
+
+        pthread_mutex_unlock(&shards[i].lock);
+    }
+
+    return class_count;
+}
+
+/**
+ * @brief Aggregates hashmap occupancy over all shards.
+ * @param stats Receives the totals.
+ */
+void store_keyspace_stats(HashMapStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    for (size_t i = 0; i <= shard_mask; i++)
+    {
+        HashMapStats shard_stats;
+
+        pthread_mutex_lock(&shards[i].lock);
+        hash_map_stats(shards[i].map, &shard_stats);
+        pthread_mutex_unlock(&shards[i].lock);
+
+        stats->keys += shard_stats.keys;
+        stats->capacity += shard_stats.capacity;
+        stats->tombstones += shard_stats.tombstones;
+        stats->expires += shard_stats.expires;
+        stats->expired += shard_stats.expired;
+        stats->memory += shard_stats.memory;
+        stats->evicted += shard_stats.evicted;
+        if (shard_stats.longest_probe > stats->longest_probe)
+            stats->longest_probe = shard_stats.longest_probe;
+    }
+}
@@ -0,0 +1,175 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "hashmap.h"
+
+/**
+ * @brief A slice of the keyspace with its own hashmap and lock.
+ *
+ * Keys are spread over the shards by hash, so worker threads touching
+ * different keys rarely contend on the same lock.
+ */
+typedef struct
+{
+    pthread_mutex_t lock; /** Serializes access to the shard's hashmap */
+    HashMap *map;         /** Key-value pairs owned by this shard */
+} StoreShard;
+
+/**
+ * @brief Creates the sharded keyspace.
+ *
+ * Must be called once before any worker thread starts executing commands.
+ *
+ * @param shard_count Number of shards (rounded up to a power of two).
+ * @param capacity Initial capacity of each shard's hashmap.
+ * @return True on success, false if allocation fails.
+ */
+bool initialize_store(size_t shard_count, size_t capacity);
+
+/**
+ * @brief Returns the shard responsible for a key.
+ *
+ * @param key The key bytes.
+ * @param key_len Length of the key.
+ * @return Pointer to the owning shard.
+ */
+StoreShard *store_shard_for_key(const char *key, size_t key_len);
+
+/**
+ * @brief Returns the index of the shard responsible for a key.
+ *
+ * @param hash Hash of the key, as computed by `hash_bytes`.
+ * @return Index of the owning shard, for `store_shard_at`.
+ */
+size_t store_shard_index(uint64_t hash);
+
+/**
+ * @brief Returns the number of shards in the store.
+ *
+ * @return The shard count.
+ */
+size_t store_shard_count();
+
+/**
+ * @brief Returns the shard at a given index.
+ *
+ * Used to walk the whole keyspace shard by shard.
+ *
+ * @param index Shard index, less than `store_shard_count()`.
+ * @return Pointer to the shard.
+ */
+StoreShard *store_shard_at(size_t index);
+
+/**
+ * @brief Visits a bounded part of the keyspace and returns where to resume.
+ *
+ * Starting from 0 and passing the returned cursor back until it is 0 again
+ * visits every key that exists for the whole walk at least once; keys may
+ * be reported twice if a table grows in between calls. The owning shard is
+ * locked while its pairs are visited, so the visitor must not call back
+ * into the store.
+ *
+ * @param cursor The cursor returned by the previous call, or 0 to start.
+ * @param max_buckets Maximum number of hashmap buckets to visit (at least one).
+ * @param visitor Callback invoked for each pair; returning false ends the
+ *                call after the current bucket.
+ * @param ctx Opaque pointer passed to the visitor.
+ * @return The cursor to resume from, 0 once the whole keyspace was visited.
+ */
+size_t store_scan(size_t cursor, size_t max_buckets, HashMapVisitor visitor, void *ctx);
+
+/**
+ * @brief Grows the shards so that a number of keys fits without resizing.
+ *
+ * Keys spread evenly over the shards, so each table is sized for its share
+ * plus some slack. Shards are grown one after the other, each under its own
+ * lock; lookups without the lock keep working while a table is replaced.
+ * Tables that are already large enough are kept.
+ *
+ * @param keys Number of keys the whole keyspace should hold.
+ * @return True on success, false if a table could not be allocated.
+ */
+bool store_reserve(size_t keys);
+
+/**
+ * @brief Removes every key.
+ *
+ * Shards are emptied one after the other, each under its own lock, so the
+ * keyspace is not cleared atomically.
+ *
+ * @return True on success, false if a shard could not allocate its empty table.
+ */
+bool store_clear(void);
+
+/**
+ * @brief Removes expired keys from the shards owned by one worker, for a bounded time.
+ *
+ * Worker `worker_id` owns the shards whose index is congruent to it modulo
+ * `worker_count`, so workers never sweep the same shard. Keys are removed
+ * in small batches, each under its own shard lock, and the sweep stops once
+ * the time limit is used up; the next call resumes with the shard where it
+ * stopped. Memory retired by writers of a shard is freed along the way.
+ *
+ * @param worker_id Index of the calling worker.
+ * @param worker_count Number of workers sharing the sweep.
+ * @param time_limit_us Time the sweep may run for, in microseconds.
+ * @return The number of keys removed.
+ */
+size_t store_expire_cycle(size_t worker_id, size_t worker_count, uint64_t time_limit_us);
+
+/**
+ * @brief Switches every shard to lookups without the shard lock.
+ *
+ * Used when several workers share the keyspace. Writers still take the
+ * shard lock, but no longer update pairs in place, and memory they unlink
+ * is only freed once the readers that may see it are done. The expiry
+ * sweep frees it, so memory lingers for at most a sweep interval after
+ * the last reader left.
+ */
+void store_enable_concurrent_reads(void);
+
+/**
+ * @brief Limits the memory of the keyspace.
+ *
+ * The limit is split evenly over the shards and each shard evicts on its
+ * own, under its own lock, when a write would take it over its share.
+ * Keys are spread over the shards by hash, so the shares fill up evenly.
+ *
+ * @param max_memory Bytes the whole keyspace may hold, 0 for no limit.
+ * @param policy How eviction victims are chosen.
+ */
+void store_set_memory_limit(size_t max_memory, EvictionPolicy policy);
+
+/**
+ * @brief Returns the memory limit of the keyspace.
+ *
+ * @param policy Receives the eviction policy.
+ * @return The limit in bytes, 0 if there is none.
+ */
+size_t store_memory_limit(EvictionPolicy *policy);
+
+/**
+ * @brief Sums the slab accounting of every shard, class by class.
+ *
+ * Each shard is locked while its allocator is read.
+ *
+ * @param stats Array of `SLAB_CLASS_COUNT + 1` entries receiving the totals;
+ *              the entry at index `SLAB_CLASS_COUNT` holds the large allocations.
+ * @return The number of classes filled in, excluding the large entry.
+ */
+size_t store_slab_stats(SlabClassStats *stats);
+
+/**
+ * @brief Sums the occupancy of every shard's hashmap.
+ *
+ * Each shard is locked while its table is walked.
+ *
+ * @param stats Receives the totals; `longest_probe` is the maximum over all shards.
+ */
+void store_keyspace_stats(HashMapStats *stats);
+
+#endif // STORE_H
@@ -0,0 +1,209 @@
+#include <string.h>
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) /** Ticks covered by all levels */
+
+/**
+ * @brief Initializes an empty wheel starting at a given tick.
+ * @param wheel The wheel.
+ * @param now The current tick.
+ */
+void timer_wheel_init(TimerWheel *wheel, uint64_t now)
+{
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->current = now;
+}
+
+/**
+ * @brief Links a timer into the slot matching its distance to the current tick.
+ *
+ * Timers further away than the wheel spans are parked in the top level and
+ * re-placed every time that slot comes around.
+ *
+ * @param wheel The wheel.
+ * @param node The timer.
+ */
+static void place(TimerWheel *wheel, TimerNode *node)
+{
+    uint64_t expires = node->expires > wheel->current ? node->expires : wheel->current;
+    uint64_t delta = expires - wheel->current;
+    size_t level = 0;
+
+    if (delta >= WHEEL_SPAN)
+    {
+        expires = wheel->current + WHEEL_SPAN - 1;
+        level = TIMER_WHEEL_LEVELS - 1;
+    }
+    else
+    {
+        while (delta >= (uint64_t)1 << ((level + 1) * TIMER_WHEEL_BITS))
+            level++;
+    }
+
+    size_t slot = (expires >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK;
+    TimerNode **head = &wheel->slots[level][slot];
+
+    node->slot = (uint16_t)(level * TIMER_WHEEL_SLOTS + slot);
+    node->next = *head;
+    node->pprev = head;
+    if (*head)
+        (*head)->pprev = &node->next;
+    *head = node;
+
+    wheel->occupied[level] |= 1ull << slot;
+}
+
+/**
+ * @brief Unlinks a timer from its slot.
+ * @param wheel The wheel.
+ * @param node The timer.
+ */
+static void unlink_node(TimerWheel *wheel, TimerNode *node)
+{
+    *node->pprev = node->next;
+    if (node->next)
+        node->next->pprev = node->pprev;
+
+    size_t level = node->slot / TIMER_WHEEL_SLOTS;
+    size_t slot = node->slot % TIMER_WHEEL_SLOTS;
+    if (!wheel->slots[level][slot])
+        wheel->occupied[level] &= ~(1ull << slot);
+
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/**
+ * @brief Schedules a timer.
+ * @param wheel The wheel.
+ * @param node The timer, with `expires` set.
+ */
+void timer_wheel_add(TimerWheel *wheel, TimerNode *node)
+{
+    place(wheel, node);
+    wheel->count++;
+}
+
+/**
+ * @brief Cancels a timer.
+ * @param wheel The wheel.
+ * @param node The timer.
+ */
+void timer_wheel_remove(TimerWheel *wheel, TimerNode *node)
+{
+    unlink_node(wheel, node);
+    wheel->count--;
+}
+
+/**
+ * @brief Moves the timers of the higher level slots that start at the current tick one level down.
+ *
+ * Called whenever the current tick is a multiple of the level 0 size.
+ *
+ * @param wheel The wheel.
+ */
+static void cascade(TimerWheel *wheel)
+{
+    for (size_t level = 1; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        size_t slot = (wheel->current >> (level * TIMER_WHEEL_BITS)) & SLOT_MASK;
+        TimerNode *node = wheel->slots[level][slot];
+
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ull << slot);
+
+        while (node)
+        {
+            TimerNode *next = node->next;
+            place(wheel, node);
+            node = next;
+        }
+
+        // Only a wrap-around of this level starts a slot of the next one
+        if (slot != 0)
+            return;
+    }
+}
+
+/**
+ * @brief Finds the next tick at which the wheel has work to do.
+ *
+ * That is the next occupied level 0 slot, or the next tick at which an
+ * occupied slot of a higher level has to be cascaded.
+ *
+ * @param wheel The wheel.
+ * @return The tick, or UINT64_MAX if the wheel is empty.
+ */
+static uint64_t next_event(const TimerWheel *wheel)
+{
+    uint64_t current = wheel->current;
+
+    for (size_t level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        unsigned int shift = level * TIMER_WHEEL_BITS;
+        size_t slot = (current >> shift) & SLOT_MASK;
+
+        // The slot of the current tick is still due on level 0; higher levels already cascaded theirs
+        size_t first = level == 0 ? slot : slot + 1;
+        uint64_t ahead = first < TIMER_WHEEL_SLOTS ? wheel->occupied[level] >> first : 0;
+
+        if (ahead)
+        {
+            uint64_t base = current >> (shift + TIMER_WHEEL_BITS) << (shift + TIMER_WHEEL_BITS);
+            return base | ((uint64_t)(first + __builtin_ctzll(ahead)) << shift);
+        }
+
+        // Slots behind the current one belong to the next revolution of this level
+        if (wheel->occupied[level])
+            return ((current >> (shift + TIMER_WHEEL_BITS)) + 1) << (shift + TIMER_WHEEL_BITS);
+    }
+
+    return UINT64_MAX;
+}
+
+/**
+ * @brief Moves the wheel to a later tick, cascading if a higher level slot starts there.
+ * @param wheel The wheel.
+ * @param tick The new current tick.
+ */
+static void advance(TimerWheel *wheel, uint64_t tick)
+{
+    wheel->current = tick;
+
+    if ((tick & SLOT_MASK) == 0)
+        cascade(wheel);
+}
+
+/**
+ * @brief Pops a due timer, advancing the wheel over idle ticks.
+ * @param wheel The wheel.
+ * @param now The current tick.
+ * @return The timer, or NULL if none is due.
+ */
+TimerNode *timer_wheel_expire(TimerWheel *wheel, uint64_t now)
+{
+    while (wheel->current <= now)
+    {
+        size_t slot = wheel->current & SLOT_MASK;
+        TimerNode *node = wheel->slots[0][slot];
+
+        if (node)
+        {
+            timer_wheel_remove(wheel, node);
+            return node;
+        }
+
+        uint64_t next = next_event(wheel);
+        if (next > now)
+        {
+            // Nothing is due up to `now`, so every tick until then is done
+            advance(wheel, now + 1);
+            return NULL;
+        }
+
+        advance(wheel, next);
+    }
+
+    return NULL;
+}
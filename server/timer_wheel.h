@@ -0,0 +1,84 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMER_WHEEL_LEVELS 6                          /** Number of wheels; together they span 2^36 ticks */
+#define TIMER_WHEEL_BITS 6                            /** log2 of the slots per wheel */
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_BITS)    /** Slots per wheel */
+
+/**
+ * @brief A timer linked into one slot of a timer wheel.
+ *
+ * Timers are intrusive: the owner embeds or allocates the node and keeps it
+ * alive while it is in a wheel.
+ */
+typedef struct TimerNode
+{
+    struct TimerNode *next;   /** Next timer of the slot */
+    struct TimerNode **pprev; /** Link that points at this timer */
+    uint64_t expires;         /** Tick at which the timer is due */
+    uint16_t slot;            /** Level and slot the timer is linked into */
+    void *data;               /** Owner of the timer */
+} TimerNode;
+
+/**
+ * @brief Hierarchical timing wheel.
+ *
+ * Level 0 has one slot per tick; each level above has slots as wide as the
+ * whole level below it. A timer is placed on the lowest level that can
+ * represent its distance to the current tick and moves down a level
+ * whenever the wheel reaches its slot, so adding, removing and expiring a
+ * timer all cost O(1) however many timers are pending. A bitmap of the
+ * occupied slots per level lets the wheel skip idle stretches without
+ * visiting every tick.
+ */
+typedef struct
+{
+    TimerNode *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; /** Timer lists */
+    uint64_t occupied[TIMER_WHEEL_LEVELS];                   /** Bit `s` set while slot `s` of a level is not empty */
+    uint64_t current;                                        /** First tick not processed yet */
+    size_t count;                                            /** Number of pending timers */
+} TimerWheel;
+
+/**
+ * @brief Initializes an empty wheel.
+ *
+ * @param wheel The wheel.
+ * @param now The current tick.
+ */
+void timer_wheel_init(TimerWheel *wheel, uint64_t now);
+
+/**
+ * @brief Schedules a timer at `node->expires`.
+ *
+ * A timer that is already due fires at the next call to `timer_wheel_expire`.
+ *
+ * @param wheel The wheel.
+ * @param node A timer that is not in any wheel.
+ */
+void timer_wheel_add(TimerWheel *wheel, TimerNode *node);
+
+/**
+ * @brief Cancels a pending timer.
+ *
+ * @param wheel The wheel holding the timer.
+ * @param node The timer.
+ */
+void timer_wheel_remove(TimerWheel *wheel, TimerNode *node);
+
+/**
+ * @brief Removes and returns one timer due at or before `now`.
+ *
+ * Callers bound the work done per call by how many timers they pop; the
+ * wheel only advances as far as the timers it has handed out.
+ *
+ * @param wheel The wheel.
+ * @param now The current tick.
+ * @return A due timer, or NULL once no timer is due.
+ */
+TimerNode *timer_wheel_expire(TimerWheel *wheel, uint64_t now);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,353 @@
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/socket.h>
+
+#define MIN_KERNEL_MAJOR 6 /** First kernel with multishot receive */
+#define MIN_KERNEL_MINOR 0
+
+static int io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * @brief Checks that the running kernel is at least the given version.
+ * @return true if the kernel release is new enough.
+ */
+static bool kernel_at_least(int major, int minor)
+{
+    struct utsname name;
+    int kernel_major, kernel_minor;
+
+    if (uname(&name) == -1 || sscanf(name.release, "%d.%d", &kernel_major, &kernel_minor) != 2)
+        return false;
+
+    return kernel_major > major || (kernel_major == major && kernel_minor >= minor);
+}
+
+/**
+ * @brief Checks whether the io_uring backend can run on this kernel.
+ * @return true if a ring with a provided buffer ring can be created.
+ */
+bool uring_available(void)
+{
+    if (!kernel_at_least(MIN_KERNEL_MAJOR, MIN_KERNEL_MINOR))
+        return false;
+
+    Uring ring;
+    if (!uring_init(&ring, 8))
+        return false;
+
+    bool available = uring_setup_buffers(&ring, 8, 64, 0);
+    uring_free(&ring);
+    return available;
+}
+
+/**
+ * @brief Creates the ring, preferring the cheapest task work mode the kernel offers.
+ * @param entries Requested submission queue size.
+ * @param params Receives the ring parameters.
+ * @return The ring file descriptor, or -1 on failure.
+ */
+static int create_ring(unsigned int entries, struct io_uring_params *params)
+{
+    static const unsigned int flag_sets[] = {
+        IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+        0,
+    };
+
+    for (size_t i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]); i++)
+    {
+        memset(params, 0, sizeof(*params));
+        params->flags = flag_sets[i];
+
+        int fd = io_uring_setup(entries, params);
+        if (fd >= 0 || errno != EINVAL)
+            return fd;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Creates an io_uring instance and maps its submission and completion rings.
+ * @param ring The ring to initialize.
+ * @param entries Requested submission queue size.
+ * @return true on success, false on failure.
+ */
+bool uring_init(Uring *ring, unsigned int entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = create_ring(entries, &params);
+    if (ring->fd == -1)
+        return false;
+
+    ring->features = params.features;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (ring->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        ring->sq_ring = NULL;
+        uring_free(ring);
+        return false;
+    }
+
+    if (ring->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            ring->cq_ring = NULL;
+            uring_free(ring);
+            return false;
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        ring->sqes = NULL;
+        uring_free(ring);
+        return false;
+    }
+
+    char *sq = ring->sq_ring;
+    char *cq = ring->cq_ring;
+
+    ring->sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->sq_entries = *(unsigned int *)(sq + params.sq_off.ring_entries);
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Submission slots are always used in order, so the indirection array is the identity
+    unsigned int *sq_array = (unsigned int *)(sq + params.sq_off.array);
+    for (unsigned int i = 0; i < ring->sq_entries; i++)
+        sq_array[i] = i;
+
+    return true;
+}
+
+/**
+ * @brief Registers a provided buffer ring and fills it with buffers.
+ * @param ring The ring.
+ * @param count Number of buffers, a power of two.
+ * @param size Size of each buffer.
+ * @param group Buffer group id.
+ * @return true on success, false on failure.
+ */
+bool uring_setup_buffers(Uring *ring, unsigned int count, unsigned int size, unsigned short group)
+{
+    ring->buf_ring_size = count * sizeof(struct io_uring_buf);
+    ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->buf_ring == MAP_FAILED)
+    {
+        ring->buf_ring = NULL;
+        return false;
+    }
+
+    ring->buffers = malloc((size_t)count * size);
+    if (!ring->buffers)
+        return false;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)ring->buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+
+    if (io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        return false;
+
+    ring->buf_count = count;
+    ring->buf_size = size;
+    ring->buf_group = group;
+    ring->buf_tail = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+        uring_recycle_buffer(ring, (unsigned short)i);
+
+    return true;
+}
+
+/**
+ * @brief Releases every resource held by the ring.
+ * @param ring The ring.
+ */
+void uring_free(Uring *ring)
+{
+    if (ring->sqes)
+        munmap(ring->sqes, ring->sqes_size);
+
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+
+    if (ring->sq_ring)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+
+    if (ring->buf_ring)
+        munmap(ring->buf_ring, ring->buf_ring_size);
+
+    free(ring->buffers);
+
+    if (ring->fd != -1)
+        close(ring->fd);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+/**
+ * @brief Returns a cleared submission queue entry, submitting first if the queue is full.
+ * @param ring The ring.
+ * @return The entry, or NULL if the queue stays full.
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring)
+{
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+    {
+        if (uring_submit_and_wait(ring, 0) == -1 ||
+            ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+            return NULL;
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask];
+    ring->sq_local_tail++;
+
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+/**
+ * @brief Publishes the prepared entries and enters the kernel once.
+ * @param ring The ring.
+ * @param wait_nr Completions to wait for.
+ * @return Number of entries submitted, or -1 on failure.
+ */
+int uring_submit_and_wait(Uring *ring, unsigned int wait_nr)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    // Entries the kernel rejected last time are still between its head and our tail
+    unsigned int to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0)
+        return 0;
+
+    return io_uring_enter(ring->fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+}
+
+/**
+ * @brief Appends a buffer to the provided buffer ring.
+ * @param ring The ring.
+ * @param bid Buffer id.
+ */
+void uring_recycle_buffer(Uring *ring, unsigned short bid)
+{
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (ring->buf_count - 1)];
+
+    buf->addr = (uintptr_t)uring_buffer(ring, bid);
+    buf->len = ring->buf_size;
+    buf->bid = bid;
+
+    ring->buf_tail++;
+    __atomic_store_n(&ring->buf_ring->tail, ring->buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, unsigned short group, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = group;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, unsigned int count, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)iov;
+    sqe->len = count;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned int events, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = user_data;
+}
+
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+}
+
+#endif // HAVE_IO_URING
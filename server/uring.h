@@ -0,0 +1,229 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+// The io_uring backend is built whenever the kernel headers provide it, unless disabled with -DNO_IO_URING
+#if !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+/**
+ * @brief An io_uring instance driven through raw system calls.
+ *
+ * Holds the memory-mapped submission and completion rings and, once
+ * `uring_setup_buffers` has been called, a ring of provided buffers that
+ * multishot receives pick their destination from.
+ */
+typedef struct
+{
+    int fd;                              /** Ring file descriptor */
+    unsigned int features;               /** IORING_FEAT_* flags reported by the kernel */
+
+    unsigned int *sq_head;               /** Submission queue head, advanced by the kernel */
+    unsigned int *sq_tail;               /** Submission queue tail, published on submit */
+    unsigned int sq_mask;                /** Submission queue index mask */
+    unsigned int sq_entries;             /** Submission queue size */
+    unsigned int sq_local_tail;          /** Tail including prepared but unpublished entries */
+    struct io_uring_sqe *sqes;           /** Submission queue entries */
+
+    unsigned int *cq_head;               /** Completion queue head, advanced by `uring_cqe_seen` */
+    unsigned int *cq_tail;               /** Completion queue tail, advanced by the kernel */
+    unsigned int cq_mask;                /** Completion queue index mask */
+    struct io_uring_cqe *cqes;           /** Completion queue entries */
+
+    void *sq_ring;                       /** Mapping of the submission ring */
+    size_t sq_ring_size;                 /** Size of that mapping */
+    void *cq_ring;                       /** Mapping of the completion ring, may alias `sq_ring` */
+    size_t cq_ring_size;                 /** Size of that mapping */
+    size_t sqes_size;                    /** Size of the submission entry mapping */
+
+    struct io_uring_buf_ring *buf_ring;  /** Provided buffer ring shared with the kernel */
+    size_t buf_ring_size;                /** Size of the buffer ring mapping */
+    char *buffers;                       /** Memory backing the provided buffers */
+    unsigned int buf_count;              /** Number of provided buffers, a power of two */
+    unsigned int buf_size;               /** Size of each provided buffer */
+    unsigned short buf_group;            /** Buffer group id used by receives */
+    unsigned short buf_tail;             /** Local tail of the buffer ring */
+} Uring;
+
+/**
+ * @brief Checks whether the running kernel supports the io_uring backend.
+ *
+ * Multishot receives with provided buffer rings need Linux 6.0. A small ring
+ * is created and torn down to make sure io_uring is not disabled either.
+ *
+ * @return True if `uring_init` and `uring_setup_buffers` can be expected to work.
+ */
+bool uring_available(void);
+
+/**
+ * @brief Creates an io_uring instance and maps its rings.
+ *
+ * The ring is set up for a single issuer with deferred task work when the
+ * kernel supports it, so it must only be used from the calling thread.
+ *
+ * @param ring The ring to initialize.
+ * @param entries Requested submission queue size.
+ * @return True on success, false with `errno` set on failure.
+ */
+bool uring_init(Uring *ring, unsigned int entries);
+
+/**
+ * @brief Registers a ring of provided receive buffers.
+ *
+ * @param ring The ring.
+ * @param count Number of buffers, a power of two.
+ * @param size Size of each buffer.
+ * @param group Buffer group id passed to `uring_prep_recv_multishot`.
+ * @return True on success, false with `errno` set on failure.
+ */
+bool uring_setup_buffers(Uring *ring, unsigned int count, unsigned int size, unsigned short group);
+
+/**
+ * @brief Unmaps the rings, frees the provided buffers and closes the ring.
+ *
+ * @param ring The ring.
+ */
+void uring_free(Uring *ring);
+
+/**
+ * @brief Returns a cleared submission queue entry.
+ *
+ * When the submission queue is full, the prepared entries are submitted
+ * first to make room.
+ *
+ * @param ring The ring.
+ * @return The entry, or NULL if none could be freed up.
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+/**
+ * @brief Submits the prepared entries and optionally waits for completions.
+ *
+ * @param ring The ring.
+ * @param wait_nr Number of completions to wait for, 0 to return immediately.
+ * @return Number of entries submitted, or -1 with `errno` set on failure.
+ */
+int uring_submit_and_wait(Uring *ring, unsigned int wait_nr);
+
+/**
+ * @brief Returns the oldest unprocessed completion.
+ *
+ * @param ring The ring.
+ * @return The completion, or NULL if the completion queue is empty.
+ */
+static inline struct io_uring_cqe *uring_peek_cqe(Uring *ring)
+{
+    unsigned int head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * @brief Hands the completion returned by `uring_peek_cqe` back to the kernel.
+ *
+ * @param ring The ring.
+ */
+static inline void uring_cqe_seen(Uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns the memory of a provided buffer picked by a receive.
+ *
+ * @param ring The ring.
+ * @param bid Buffer id taken from the completion flags.
+ * @return Pointer to the buffer.
+ */
+static inline char *uring_buffer(Uring *ring, unsigned short bid)
+{
+    return ring->buffers + (size_t)bid * ring->buf_size;
+}
+
+/**
+ * @brief Gives a provided buffer back to the kernel once its data has been consumed.
+ *
+ * @param ring The ring.
+ * @param bid Buffer id taken from the completion flags.
+ */
+void uring_recycle_buffer(Uring *ring, unsigned short bid);
+
+/**
+ * @brief Prepares a multishot accept that posts a completion for every new connection.
+ *
+ * @param sqe The submission queue entry.
+ * @param fd The listening socket.
+ * @param user_data Value copied into every completion.
+ */
+void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int fd, uint64_t user_data);
+
+/**
+ * @brief Prepares a multishot receive that fills provided buffers as data arrives.
+ *
+ * @param sqe The submission queue entry.
+ * @param fd The socket.
+ * @param group Buffer group to pick buffers from.
+ * @param user_data Value copied into every completion.
+ */
+void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, unsigned short group, uint64_t user_data);
+
+/**
+ * @brief Prepares a gathered write.
+ *
+ * The I/O vector array may be modified once the entry has been submitted;
+ * the buffers it points to must stay valid until the write completes.
+ *
+ * @param sqe The submission queue entry.
+ * @param fd The socket.
+ * @param iov The segments to write.
+ * @param count Number of segments.
+ * @param user_data Value copied into the completion.
+ */
+void uring_prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iov, unsigned int count, uint64_t user_data);
+
+/**
+ * @brief Prepares a read into a buffer.
+ *
+ * @param sqe The submission queue entry.
+ * @param fd The file to read from.
+ * @param buf The buffer.
+ * @param len Size of the buffer.
+ * @param user_data Value copied into the completion.
+ */
+void uring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned int len, uint64_t user_data);
+
+/**
+ * @brief Prepares a one-shot wait until a file is ready, without reading it.
+ *
+ * @param sqe The submission queue entry.
+ * @param fd The file to wait for.
+ * @param events Poll events to wait for, e.g. `POLLIN`.
+ * @param user_data Value copied into the completion.
+ */
+void uring_prep_poll(struct io_uring_sqe *sqe, int fd, unsigned int events, uint64_t user_data);
+
+/**
+ * @brief Prepares the cancellation of an earlier request.
+ *
+ * @param sqe The submission queue entry.
+ * @param target `user_data` of the request to cancel.
+ * @param user_data Value copied into the completion of the cancellation itself.
+ */
+void uring_prep_cancel(struct io_uring_sqe *sqe, uint64_t target, uint64_t user_data);
+
+#endif // HAVE_IO_URING
+
+#endif // URING_H
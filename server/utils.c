@@ -1,5 +1,19 @@
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include "utils.h"
+
+#define CRC32C_POLY 0x82F63B78u /** Reflected Castagnoli polynomial */
+
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
 
 /**
  * @brief Removes a trailing newline from a string, if present.
@@ -22,3 +36,384 @@ void remove_trailing_newline(char *str)
         str[len - 1] = '\0';
     }
 }
+
+/**
+ * @brief Matches one character against the class starting after a `[`.
+ * @param pattern In: first byte after `[`, out: first byte after the closing `]`.
+ * @param end One past the last pattern byte.
+ * @param c The character to test.
+ * @return true if the class contains the character.
+ */
+static bool match_class(const char **pattern, const char *end, char c)
+{
+    const char *p = *pattern;
+    bool negate = p < end && *p == '^';
+    bool matched = false;
+
+    if (negate)
+        p++;
+
+    while (p < end && *p != ']')
+    {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+
+        if (p + 2 < end && p[1] == '-' && p[2] != ']')
+        {
+            char low = p[0] < p[2] ? p[0] : p[2];
+            char high = p[0] < p[2] ? p[2] : p[0];
+            matched |= c >= low && c <= high;
+            p += 3;
+        }
+        else
+        {
+            matched |= *p == c;
+            p++;
+        }
+    }
+
+    // An unterminated class runs to the end of the pattern
+    *pattern = p < end ? p + 1 : p;
+    return matched != negate;
+}
+
+/**
+ * @brief Matches a string against a glob-style pattern.
+ *
+ * Runs in O(pattern * string) time at worst: on a mismatch only the most
+ * recent `*` is retried, one character further along the string.
+ *
+ * @param pattern The pattern bytes.
+ * @param pattern_len Length of the pattern.
+ * @param str The string bytes.
+ * @param str_len Length of the string.
+ * @return true if the whole string matches the pattern.
+ */
+bool glob_match(const char *pattern, size_t pattern_len, const char *str, size_t str_len)
+{
+    const char *p = pattern, *p_end = pattern + pattern_len;
+    const char *s = str, *s_end = str + str_len;
+    const char *star_p = NULL, *star_s = NULL;
+
+    while (s < s_end)
+    {
+        if (p < p_end && *p == '*')
+        {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+
+        if (p < p_end)
+        {
+            const char *next = p + 1;
+            bool matched;
+
+            if (*p == '?')
+            {
+                matched = true;
+            }
+            else if (*p == '[')
+            {
+                matched = match_class(&next, p_end, *s);
+            }
+            else
+            {
+                if (*p == '\\' && next < p_end)
+                    next++;
+                matched = next[-1] == *s;
+            }
+
+            if (matched)
+            {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+
+        if (!star_p)
+            return false;
+
+        p = star_p;
+        s = ++star_s;
+    }
+
+    while (p < p_end && *p == '*')
+        p++;
+
+    return p == p_end;
+}
+
+/**
+ * @brief Parses a byte count with an optional k, m or g suffix.
+ * @param text The text.
+ * @param bytes Receives the byte count.
+ * @return true on success, false if the text is not a byte count.
+ */
+bool parse_memory_size(const char *text, size_t *bytes)
+{
+    static const struct
+    {
+        const char *suffix;
+        size_t multiplier;
+    } units[] = {
+        {"", 1},
+        {"b", 1},
+        {"k", 1024},
+        {"kb", 1024},
+        {"m", 1024 * 1024},
+        {"mb", 1024 * 1024},
+        {"g", 1024 * 1024 * 1024},
+        {"gb", 1024 * 1024 * 1024},
+    };
+
+    if (text[0] < '0' || text[0] > '9')
+        return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (errno == ERANGE)
+        return false;
+
+    for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++)
+    {
+        if (strcasecmp(end, units[i].suffix) == 0)
+        {
+            if (value > SIZE_MAX / units[i].multiplier)
+                return false;
+
+            *bytes = (size_t)value * units[i].multiplier;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Parses a canonical decimal integer.
+ * @param text The text bytes.
+ * @param len Length of the text.
+ * @param value Receives the integer.
+ * @return true on success.
+ */
+bool parse_int64(const char *text, size_t len, int64_t *value)
+{
+    bool negative = len > 0 && text[0] == '-';
+    size_t digits = len - negative;
+
+    if (digits == 0 || digits > 19 || text[negative] < '0' || text[negative] > '9')
+        return false;
+
+    // "0" is the only form with a leading zero, and has no negative twin
+    if (text[negative] == '0' && (digits > 1 || negative))
+        return false;
+
+    uint64_t magnitude = 0;
+    for (size_t i = negative; i < len; i++)
+    {
+        if (text[i] < '0' || text[i] > '9')
+            return false;
+
+        magnitude = magnitude * 10 + (uint64_t)(text[i] - '0');
+    }
+
+    if (magnitude > (uint64_t)INT64_MAX + negative)
+        return false;
+
+    *value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+    return true;
+}
+
+/**
+ * @brief Formats an integer in decimal.
+ * @param value The integer.
+ * @param text Receives the digits.
+ * @return The number of bytes written.
+ */
+size_t format_int64(int64_t value, char *text)
+{
+    char digits[INT64_TEXT_MAX];
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    size_t count = 0;
+
+    do
+    {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+
+    size_t len = 0;
+    if (value < 0)
+        text[len++] = '-';
+
+    while (count > 0)
+        text[len++] = digits[--count];
+
+    return len;
+}
+
+/**
+ * @brief Reads the realtime clock.
+ * @return Milliseconds since the Unix epoch.
+ */
+uint64_t current_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Returns the coarse monotonic time.
+ * @return Milliseconds since an arbitrary point in the past.
+ */
+uint64_t monotonic_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Writes a whole buffer, retrying short writes.
+ * @param fd The file descriptor.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return true on success, false with `errno` set on failure.
+ */
+bool write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0)
+    {
+        ssize_t written = write(fd, p, len);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        p += written;
+        len -= written;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Flushes the directory containing a file.
+ * @param path Path of the file.
+ */
+void fsync_parent_directory(const char *path)
+{
+    char *copy = strdup(path);
+    if (!copy)
+        return;
+
+    int dir_fd = open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd != -1)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    free(copy);
+}
+
+/**
+ * @brief Fills the slice-by-8 tables of the software CRC-32C.
+ */
+static void crc32c_init_tables(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (CRC32C_POLY & -(crc & 1));
+        crc32c_table[0][i] = crc;
+    }
+
+    for (int slice = 1; slice < 8; slice++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            uint32_t prev = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+}
+
+/**
+ * @brief Software CRC-32C over the inverted running checksum.
+ */
+static uint32_t crc32c_software(uint32_t crc, const unsigned char *p, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init_tables);
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xFF] ^ crc32c_table[6][(v >> 8) & 0xFF] ^
+              crc32c_table[5][(v >> 16) & 0xFF] ^ crc32c_table[4][(v >> 24) & 0xFF] ^
+              crc32c_table[3][(v >> 32) & 0xFF] ^ crc32c_table[2][(v >> 40) & 0xFF] ^
+              crc32c_table[1][(v >> 48) & 0xFF] ^ crc32c_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len--)
+        crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xFF];
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief CRC-32C with the SSE 4.2 instruction, over the inverted running checksum.
+ */
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hardware(uint32_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t crc64 = crc;
+
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t)crc64;
+    while (len--)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+
+    return crc;
+}
+#endif
+
+/**
+ * @brief Computes or extends a CRC-32C checksum.
+ * @param crc The checksum of the preceding bytes, 0 to start.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return The checksum.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len)
+{
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2"))
+        return ~crc32c_hardware(~crc, data, len);
+#endif
+
+    return ~crc32c_software(~crc, data, len);
+}
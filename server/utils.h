@@ -1,6 +1,10 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
 /**
  * @brief Removes a trailing newline from a string, if present.
  *
@@ -8,4 +12,110 @@
  */
 void remove_trailing_newline(char *str);
 
+/**
+ * @brief Matches a string against a glob-style pattern.
+ *
+ * Supports `*`, `?`, character classes such as `[abc]`, `[a-z]` and `[^a]`,
+ * and `\` to escape the next character. Both inputs are length-delimited.
+ *
+ * @param pattern The pattern bytes.
+ * @param pattern_len Length of the pattern.
+ * @param str The string bytes.
+ * @param str_len Length of the string.
+ * @return true if the whole string matches the pattern.
+ */
+bool glob_match(const char *pattern, size_t pattern_len, const char *str, size_t str_len);
+
+/**
+ * @brief Parses a byte count such as `512`, `64kb`, `100mb` or `2G`.
+ *
+ * Suffixes are case-insensitive powers of 1024, with or without the `b`.
+ *
+ * @param text The null-terminated text.
+ * @param bytes Receives the number of bytes.
+ * @return true if the text is a valid byte count that fits in a size_t.
+ */
+bool parse_memory_size(const char *text, size_t *bytes);
+
+/**
+ * @brief Longest decimal form of a 64-bit integer, sign included.
+ */
+#define INT64_TEXT_MAX 20
+
+/**
+ * @brief Parses the canonical decimal form of a signed 64-bit integer.
+ *
+ * Only text that `format_int64` would produce is accepted: an optional
+ * minus sign and digits without leading zeros, no `+`, no `-0` and no
+ * surrounding spaces.
+ *
+ * @param text The text bytes, not necessarily null-terminated.
+ * @param len Length of the text.
+ * @param value Receives the integer.
+ * @return true if the text is a canonical integer that fits in an int64_t.
+ */
+bool parse_int64(const char *text, size_t len, int64_t *value);
+
+/**
+ * @brief Writes the decimal form of a signed 64-bit integer.
+ *
+ * @param value The integer.
+ * @param text Buffer of at least `INT64_TEXT_MAX` bytes; no terminator is written.
+ * @return The number of bytes written.
+ */
+size_t format_int64(int64_t value, char *text);
+
+/**
+ * @brief Returns the wall clock time.
+ *
+ * Used for key expiry, whose deadlines are absolute so they keep their
+ * meaning across restarts.
+ *
+ * @return Milliseconds since the Unix epoch.
+ */
+uint64_t current_time_ms(void);
+
+/**
+ * @brief Returns a coarse monotonic clock.
+ *
+ * Read from the vDSO without a system call, at the resolution of the kernel
+ * tick, which is plenty for idle timeouts.
+ *
+ * @return Milliseconds since an arbitrary point in the past.
+ */
+uint64_t monotonic_time_ms(void);
+
+/**
+ * @brief Writes a whole buffer to a file, retrying short and interrupted writes.
+ *
+ * @param fd The file descriptor.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return true on success, false with `errno` set on failure.
+ */
+bool write_all(int fd, const void *data, size_t len);
+
+/**
+ * @brief Flushes the directory containing a file.
+ *
+ * Makes a file created or renamed in that directory survive a crash.
+ *
+ * @param path Path of the file.
+ */
+void fsync_parent_directory(const char *path);
+
+/**
+ * @brief Computes or extends a CRC-32C (Castagnoli) checksum.
+ *
+ * Uses the SSE 4.2 CRC32 instruction when the CPU has it, and a
+ * slice-by-8 table otherwise. Passing the result of a previous call as
+ * `crc` continues the checksum over more bytes.
+ *
+ * @param crc The checksum of the preceding bytes, 0 to start.
+ * @param data The bytes.
+ * @param len Number of bytes.
+ * @return The checksum.
+ */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+
 #endif // UTILS_H